@@ -22,6 +22,19 @@ check_symbol_exists("bcopy" "strings.h" HAVE_BCOPY)
 check_symbol_exists("memmove" "string.h" HAVE_MEMMOVE)
 check_symbol_exists("mmap" "sys/mman.h" HAVE_MMAP)
 check_symbol_exists("getrandom" "sys/random.h" HAVE_GETRANDOM)
+check_symbol_exists("fork" "unistd.h" HAVE_FORK)
+
+# only needed for xmlwf
+find_package(Threads)
+if(CMAKE_USE_PTHREADS_INIT)
+    set(HAVE_PTHREAD TRUE)
+endif()
+if(USE_zlib)
+    find_package(ZLIB)
+    if(ZLIB_FOUND)
+        set(HAVE_ZLIB TRUE)
+    endif()
+endif()
 
 if(USE_libbsd)
     set(CMAKE_REQUIRED_LIBRARIES "${LIB_BSD}")
@@ -18,6 +18,9 @@
 /* Define to 1 if you have the <fcntl.h> header file. */
 #cmakedefine HAVE_FCNTL_H
 
+/* Define to 1 if you have the `fork' function. */
+#cmakedefine HAVE_FORK
+
 /* Define to 1 if you have the `getpagesize' function. */
 #cmakedefine HAVE_GETPAGESIZE
 
@@ -39,6 +42,12 @@
 /* Define to 1 if you have a working `mmap' system call. */
 #cmakedefine HAVE_MMAP
 
+/* Define to 1 if you have POSIX threads, for the xmlwf reader thread. */
+#cmakedefine HAVE_PTHREAD
+
+/* Define if zlib is available, for gzip-compressed input to xmlwf. */
+#cmakedefine HAVE_ZLIB
+
 /* Define to 1 if you have the <stdint.h> header file. */
 #cmakedefine HAVE_STDINT_H
 
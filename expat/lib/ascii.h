@@ -118,3 +118,7 @@
 #define ASCII_HASH 0x23
 #define ASCII_PIPE 0x7C
 #define ASCII_COMMA 0x2C
+#define ASCII_AT 0x40
+#define ASCII_ASTERISK 0x2A
+#define ASCII_LBRACE 0x7B
+#define ASCII_RBRACE 0x7D
@@ -49,6 +49,7 @@
 #include <unistd.h>                     /* getpid() */
 #include <fcntl.h>                      /* O_RDONLY */
 #include <errno.h>
+#include <sys/uio.h>                    /* struct iovec */
 #endif
 
 #define XML_BUILDING_EXPAT 1
@@ -63,6 +64,19 @@
 #include "expat.h"
 #include "siphash.h"
 
+#ifdef _WIN32
+/* the layout XML_ParseV expects where the system has no struct iovec */
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+#endif
+
+#ifdef HAVE_MMAP
+# include <sys/mman.h>                  /* mmap(), madvise() */
+# include <sys/stat.h>                  /* fstat() */
+#endif
+
 #if defined(HAVE_GETRANDOM) || defined(HAVE_SYSCALL_GETRANDOM)
 # if defined(HAVE_GETRANDOM)
 #  include <sys/random.h>    /* getrandom */
@@ -180,14 +194,94 @@ typedef struct {
   KEY name;
 } NAMED;
 
+/* What a parser and its external entity parsers hold, and the limit
+   set by XML_SetMemoryLimit().  It is allocated on its own and freed
+   with the last of these parsers, as external entity parsers may be
+   freed after their parent. */
+typedef struct {
+  XML_MemoryStats stats;
+  size_t limit;
+  XML_Bool limitExceeded;
+  int refCount;
+} MEMORY_ACCOUNT;
+
+/* The allocator of a parser: either a classic suite or, if isSized is
+   set, an XML_Memory_Handling_Suite2.  Internally every block is freed
+   and reallocated together with its size, see memFree() and friends;
+   the classic suite just ignores it.
+*/
+typedef struct {
+  XML_Memory_Handling_Suite classic;
+  XML_Memory_Handling_Suite2 sized;
+  XML_Bool isSized;
+} MEMORY_FUNCTIONS;
+
+/* What the parser's memory is allocated through: the sizes are
+   charged to account under category.  A parser has one suite per
+   category, all sharing its MEMORY_FUNCTIONS and account.
+*/
+typedef struct {
+  const MEMORY_FUNCTIONS *fns;
+  MEMORY_ACCOUNT *account;
+  enum XML_MemoryCategory category;
+} MEMORY_SUITE;
+
+/* alignment requested from aligned_alloc_fcn: a cache line */
+#define MEM_ALIGNMENT 64
+
+/* Size header of blocks handed to the application by a sized suite,
+   since they come back through XML_MemFree() or
+   XML_FreeContentModel() without one. */
+typedef union {
+  size_t size;
+  void *p;
+  double d;
+  long l;
+} MEM_HEADER;
+
+/* An arena hands out memory that is only released as a whole; the DTD
+   of a parser created with XML_ParserCreate_Arena() keeps its named
+   entries, default attribute lists and content model scaffolding in
+   one.  Released chunks are kept for the next document, like the
+   free blocks of a STRING_POOL.
+*/
+typedef union {
+  void *p;
+  double d;
+  long l;
+} ARENA_ALIGN;
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  ARENA_ALIGN s[1];
+} ARENA_CHUNK;
+
+typedef struct {
+  ARENA_CHUNK *chunks;
+  ARENA_CHUNK *freeChunks;
+  char *ptr;
+  char *end;
+  size_t chunkSize;           /* 0 if the arena is not used */
+  const MEMORY_SUITE *mem;
+} ARENA;
+
 typedef struct {
   NAMED **v;
   unsigned char power;
   size_t size;
   size_t used;
-  const XML_Memory_Handling_Suite *mem;
+  const MEMORY_SUITE *mem;
+  ARENA *arena;               /* owner of the entries, or NULL */
+  /* entries kept by hashTableClear() for reuse, chained through their
+     name field; all entries of a table have the same size */
+  NAMED *spare;
+  size_t entrySize;
 } HASH_TABLE;
 
+static XML_Bool FASTCALL
+keyeq(KEY s1, KEY s2);
+
 static size_t
 keylen(KEY s);
 
@@ -212,12 +306,39 @@ typedef struct {
   NAMED **end;
 } HASH_TABLE_ITER;
 
-#define INIT_TAG_BUF_SIZE 32  /* must be a multiple of sizeof(XML_Char) */
+/* The file XML_ParseFile() has open, kept while parsing it is
+   suspended.  A regular file is mapped a window at a time, anything
+   else read with XML_ParseFromReader(). */
+typedef struct {
+  FILE *fp;
+  int flags;
+#ifdef HAVE_MMAP
+  XML_Bool mapped;
+  off_t offset;  /* of the next window */
+  off_t size;
+#endif
+} PARSE_FILE;
+
+#define INIT_TAGS_SIZE 16
+#define INIT_TAG_NAMES_SIZE 512  /* must be a multiple of sizeof(XML_Char) */
 #define INIT_DATA_BUF_SIZE 1024
 #define INIT_ATTS_SIZE 16
 #define INIT_ATTS_VERSION 0xFFFFFFFF
 #define INIT_BLOCK_SIZE 1024
+#define INIT_ARENA_CHUNK_SIZE 8192
 #define INIT_BUFFER_SIZE 1024
+/* percentage by which a full buffer grows */
+#define BUFFER_GROWTH 100
+/* input first added to a token left over from the previous XML_Parse() */
+#define INIT_JOIN_SIZE 256
+/* first and largest read asked of an XML_ParseFromReader() reader */
+#define INIT_READ_SIZE (16 * 1024)
+#define MAX_READ_SIZE (1024 * 1024)
+/* part of a file XML_ParseFile() maps at a time; a multiple of the
+   page size */
+#define FILE_WINDOW_SIZE (8 * 1024 * 1024)
+/* upper bound on the attributes of a start-tag checked on the raw input */
+#define LAZY_ATTS_LIMIT 32
 
 #define EXPAND_SPARE 24
 
@@ -246,33 +367,44 @@ typedef struct {
 } TAG_NAME;
 
 /* TAG represents an open element.
-   The name of the element is stored in both the document and API
-   encodings.  The memory buffer 'buf' is a separately-allocated
-   memory area which stores the name.  During the XML_Parse()/
-   XMLParseBuffer() when the element is open, the memory for the 'raw'
-   version of the name (in the document encoding) is shared with the
-   document buffer.  If the element is open across calls to
-   XML_Parse()/XML_ParseBuffer(), the buffer is re-allocated to
-   contain the 'raw' name as well.
-
-   A parser re-uses these structures, maintaining a list of allocated
-   TAG objects in a free list.
+   The open elements of a parser are kept in one array, the innermost
+   last, and their names in one arena next to it: the 'buf' of an
+   element is the part of the arena between its parent's and its
+   first child's.  'buf' holds the name in the API encoding, which is
+   also what the end tag is matched against (see tagNameMatches()), so
+   nothing of an open element refers to the document buffer.
+
+   Both the array and the arena grow as needed and are kept for the
+   elements that follow; growing the arena moves the names, see
+   tagNamesResize().
 */
-typedef struct tag {
-  struct tag *parent;           /* parent of this element */
-  const char *rawName;          /* tagName in the original encoding */
-  int rawNameLength;
+typedef struct {
   TAG_NAME name;                /* tagName in the API encoding */
-  char *buf;                    /* buffer for name components */
+  char *buf;                    /* name components, in m_tagNames */
   char *bufEnd;                 /* end of the buffer */
   BINDING *bindings;
 } TAG;
 
+/* One token of the replacement text of an internal general entity, as
+   recorded by tokenizeEntity(): the text from byte offset start up to
+   the next token is reported as is if len is 0, else as the len
+   characters in chars (a newline, predefined entity or character
+   reference).
+*/
+typedef struct {
+  int start;
+  int len;
+  XML_Char chars[XML_ENCODE_MAX];
+} ENTITY_TOKEN;
+
 typedef struct {
   const XML_Char *name;
   const XML_Char *textPtr;
   int textLen;                  /* length in XML_Chars */
   int processed;                /* # of processed bytes - when suspended */
+  ENTITY_TOKEN *tokens;         /* replacement text as character data */
+  int nTokens;                  /* 0 = not yet tokenized, -1 = not text */
+  int allocTokens;
   const XML_Char *systemId;
   const XML_Char *base;
   const XML_Char *publicId;
@@ -296,7 +428,7 @@ typedef struct {
 
 typedef struct block {
   struct block *next;
-  int size;
+  size_t size;
   XML_Char s[1];
 } BLOCK;
 
@@ -306,7 +438,7 @@ typedef struct {
   const XML_Char *end;
   XML_Char *ptr;
   XML_Char *start;
-  const XML_Memory_Handling_Suite *mem;
+  const MEMORY_SUITE *mem;
 } STRING_POOL;
 
 /* The XML_Char before the name is used to determine whether
@@ -324,6 +456,24 @@ typedef struct {
   const XML_Char *value;
 } DEFAULT_ATTRIBUTE;
 
+/* A default attribute array kept by a capacity-keeping reset, linked
+   through the space of its first entries. */
+typedef struct spare_default_atts {
+  struct spare_default_atts *next;
+  int count;
+} SPARE_DEFAULT_ATTS;
+
+/* The same for a token array of an entity, which is made large enough
+   to hold this. */
+typedef struct spare_entity_tokens {
+  struct spare_entity_tokens *next;
+  int count;
+} SPARE_ENTITY_TOKENS;
+
+#define MIN_ENTITY_TOKENS \
+  ((int)((sizeof(SPARE_ENTITY_TOKENS) + sizeof(ENTITY_TOKEN) - 1) \
+         / sizeof(ENTITY_TOKEN)))
+
 typedef struct {
   unsigned long version;
   unsigned long hash;
@@ -358,6 +508,9 @@ typedef struct {
   HASH_TABLE paramEntities;
 #endif /* XML_DTD */
   PREFIX defaultPrefix;
+  ARENA arena;
+  SPARE_DEFAULT_ATTS *spareDefaultAtts;
+  SPARE_ENTITY_TOKENS *spareEntityTokens;
   /* === scaffolding for building content model === */
   XML_Bool in_eldecl;
   CONTENT_SCAFFOLD *scaffold;
@@ -366,6 +519,7 @@ typedef struct {
   unsigned scaffCount;
   int scaffLevel;
   int *scaffIndex;
+  unsigned scaffIndexSize;
 } DTD;
 
 typedef struct open_internal_entity {
@@ -377,6 +531,76 @@ typedef struct open_internal_entity {
   XML_Bool betweenDecl; /* WFC: PE Between Declarations */
 } OPEN_INTERNAL_ENTITY;
 
+/* State of the markup declaration being parsed.  Only needed while
+   the prolog and the DTD are parsed, so it is allocated by doProlog()
+   and released when the document element starts.
+*/
+typedef struct {
+  ENTITY *declEntity;
+  const XML_Char *doctypeName;
+  const XML_Char *doctypeSysid;
+  const XML_Char *doctypePubid;
+  const XML_Char *declAttributeType;
+  const XML_Char *declNotationName;
+  const XML_Char *declNotationPublicId;
+  ELEMENT_TYPE *declElementType;
+  ATTRIBUTE_ID *declAttributeId;
+  XML_Bool declAttributeIsCdata;
+  XML_Bool declAttributeIsId;
+  char *groupConnector;
+  unsigned int groupSize;
+} DECL_STATE;
+
+/* Path subscriptions, see XML_AddPathPattern().  Each pattern is a
+   list of steps; the matcher keeps, for every open element, the set of
+   (pattern, step) states that its children can advance.
+*/
+typedef struct {
+  const XML_Char *name;       /* NULL matches any element */
+  ELEMENT_TYPE *type;         /* name in the symbol table, without NS */
+  XML_Bool descendant;        /* step introduced by "//" */
+} PATH_STEP;
+
+typedef struct {
+  int firstStep;
+  int nSteps;
+  const XML_Char *attName;    /* non-NULL for patterns ending in "/@name" */
+  XML_Bool text;              /* pattern ends in "/text()" */
+} PATH_PATTERN;
+
+typedef struct {
+  int pattern;
+  int step;                   /* next step to be matched */
+} PATH_STATE;
+
+typedef struct {
+  int firstState;             /* states active for the children */
+  int firstMatch;             /* element patterns matched by the element */
+} PATH_LEVEL;
+
+typedef struct {
+  PATH_PATTERN *patterns;
+  int nPatterns;
+  int patternsAlloc;
+  PATH_STEP *steps;
+  int nSteps;
+  int stepsAlloc;
+  PATH_STATE *states;
+  int nStates;
+  int statesAlloc;
+  int *matches;
+  int nMatches;
+  int matchesAlloc;
+  int *attMatches;
+  int nAttMatches;
+  int attMatchesAlloc;
+  /* levels[0] is the document, levels[depth - 1] the current element */
+  PATH_LEVEL *levels;
+  int depth;
+  int levelsAlloc;
+  STRING_POOL pool;
+} PATH_MATCHER;
+
 typedef enum XML_Error PTRCALL Processor(XML_Parser parser,
                                          const char *start,
                                          const char *end,
@@ -401,11 +625,122 @@ static Processor externalEntityInitProcessor3;
 static Processor externalEntityContentProcessor;
 static Processor internalEntityProcessor;
 
+/* A hibernated parser, see XML_Hibernate(), is a HIBERNATED record
+   with the scalar parse state followed by the strings, symbol tables,
+   open elements, unparsed input and path matcher state; it holds no
+   pointers into itself or into the freed parser.  Everything is read
+   through memcpy, so the blob may be moved around.
+*/
+#define HIBERNATE_MAGIC 0x48425850UL
+
+typedef struct {
+  unsigned long magic;
+  size_t size;                  /* of the whole blob */
+  MEMORY_FUNCTIONS memFunctions;
+  size_t arenaChunkSize;
+  size_t memoryLimit;
+  unsigned long hashSecretSalt;
+  Processor *processor;
+  XML_ParsingStatus parsingStatus;
+  PROLOG_STATE prologState;
+  /* static encoding in use, NULL if not yet known or unknownEncoding */
+  const ENCODING *encoding;
+  XML_Bool unknownEncoding;
+  void *unknownEncodingData;
+  void (XMLCALL *unknownEncodingRelease)(void *);
+  void *unknownEncodingHandlerData;
+  void *userData;
+  void *handlerArg;             /* unless handlerArgIsParser */
+  XML_Bool handlerArgIsParser;
+  XML_Parser externalEntityRefHandlerArg;
+  XML_Bool externalEntityRefHandlerArgIsParser;
+  XML_StartElementHandler startElementHandler;
+  XML_EndElementHandler endElementHandler;
+  XML_CharacterDataHandler characterDataHandler;
+  XML_ProcessingInstructionHandler processingInstructionHandler;
+  XML_CommentHandler commentHandler;
+  XML_StartCdataSectionHandler startCdataSectionHandler;
+  XML_EndCdataSectionHandler endCdataSectionHandler;
+  XML_DefaultHandler defaultHandler;
+  XML_StartDoctypeDeclHandler startDoctypeDeclHandler;
+  XML_EndDoctypeDeclHandler endDoctypeDeclHandler;
+  XML_UnparsedEntityDeclHandler unparsedEntityDeclHandler;
+  XML_NotationDeclHandler notationDeclHandler;
+  XML_StartNamespaceDeclHandler startNamespaceDeclHandler;
+  XML_EndNamespaceDeclHandler endNamespaceDeclHandler;
+  XML_NotStandaloneHandler notStandaloneHandler;
+  XML_ExternalEntityRefHandler externalEntityRefHandler;
+  XML_ExternalEntityPrefetchHandler externalEntityPrefetchHandler;
+  XML_SkippedEntityHandler skippedEntityHandler;
+  XML_UnknownEncodingHandler unknownEncodingHandler;
+  XML_ElementDeclHandler elementDeclHandler;
+  XML_AttlistDeclHandler attlistDeclHandler;
+  XML_EntityDeclHandler entityDeclHandler;
+  XML_XmlDeclHandler xmlDeclHandler;
+  XML_PathStartHandler pathStartHandler;
+  XML_PathEndHandler pathEndHandler;
+  XML_PathCharacterDataHandler pathCharacterDataHandler;
+  XML_PathAttributeHandler pathAttributeHandler;
+  XML_Bool ns;
+  XML_Bool ns_triplets;
+  XML_Char namespaceSeparator;
+  XML_Bool defaultExpandInternalEntities;
+  XML_Bool lazyAtts;
+  XML_Bool keepCapacity;
+  int bufferInitSize;
+  int bufferGrowth;
+  int bufferShrinkSize;
+  XML_Bool pathSkipAtts;
+  XML_Bool paths;
+  int tagLevel;
+  int skipTagLevel;
+  XML_Bool skipExpandsEntities;
+  int nTags;
+  int nBindings;
+  POSITION position;
+  XML_Index parseEndByteIndex;
+  /* the unparsed input and the pointers into it, as offsets; -1 for
+     NULL */
+  XML_Bool buffer;
+  size_t bufferLen;
+  size_t bufferPtr;
+  size_t parseEndPtr;
+  size_t positionPtr;
+  size_t eventPtr;
+  size_t eventEndPtr;
+  XML_Bool keepProcessing;
+  XML_Bool hasParamEntityRefs;
+  XML_Bool standalone;
+#ifdef XML_DTD
+  XML_Bool paramEntityRead;
+  XML_Bool useForeignDTD;
+  enum XML_ParamEntityParsing paramEntityParsing;
+#endif
+} HIBERNATED;
+
+typedef struct {
+  char *start;
+  size_t len;
+  size_t alloc;
+  MEMORY_SUITE mem;
+  XML_Bool failed;
+} BLOB_WRITER;
+
+typedef struct {
+  const char *ptr;
+  const char *end;
+  XML_Bool failed;
+} BLOB_READER;
+
 static enum XML_Error
 handleUnknownEncoding(XML_Parser parser, const XML_Char *encodingName);
 static enum XML_Error
 processXmlDecl(XML_Parser parser, int isGeneralTextEntity,
                const char *s, const char *next);
+static void parserStructFree(XML_Parser parser);
+static enum XML_Error
+runProcessor(XML_Parser parser, const char *s, const char *end,
+             const char **nextPtr);
 static enum XML_Error
 initializeEncoding(XML_Parser parser);
 static enum XML_Error
@@ -420,6 +755,40 @@ doContent(XML_Parser parser, int startTagLevel, const ENCODING *enc,
           const char *start, const char *end, const char **endPtr,
           XML_Bool haveMore);
 static enum XML_Error
+entityContent(XML_Parser parser, ENTITY *entity, int startTagLevel,
+              const char *s, const char **nextPtr);
+static void tokenizeEntity(XML_Parser parser, ENTITY *entity);
+static void
+releaseEntityTokens(DTD *p, const MEMORY_SUITE *ms, XML_Bool keep);
+static ENTITY_TOKEN *
+takeEntityTokens(DTD *p, int minCount, int *count);
+static void
+freeSpareEntityTokens(DTD *p, const MEMORY_SUITE *ms);
+static enum XML_Error
+skipContent(XML_Parser parser, const ENCODING *enc, int tok,
+            const char *s, const char *next, const char **eventPP);
+static void *
+pathReserve(XML_Parser parser, void *array, int *allocPtr, int needed,
+            size_t size);
+static enum XML_Error
+pathEnterElement(XML_Parser parser, const ELEMENT_TYPE *type,
+                 const XML_Char *name);
+static enum XML_Error
+storeStartTag(XML_Parser parser, const ENCODING *enc, const char *s,
+              TAG_NAME *tagNamePtr, BINDING **bindingsPtr);
+static void
+pathStartElement(XML_Parser parser, const XML_Char *name,
+                 const XML_Char **atts, XML_Bool isEmpty);
+static void
+pathEndElement(XML_Parser parser, const XML_Char *name);
+static void
+pathCharacters(XML_Parser parser, const XML_Char *s, int len);
+static void
+pathCharacterData(XML_Parser parser, const ENCODING *enc,
+                  const char *s, const char *end);
+static const XML_Char *
+getAttributeValue(XML_Parser parser, const XML_Char *name);
+static enum XML_Error
 doCdataSection(XML_Parser parser, const ENCODING *, const char **startPtr,
                const char *end, const char **nextPtr, XML_Bool haveMore);
 #ifdef XML_DTD
@@ -430,6 +799,14 @@ doIgnoreSection(XML_Parser parser, const ENCODING *, const char **startPtr,
 
 static void
 freeBindings(XML_Parser parser, BINDING *bindings);
+static void
+releaseSkippedBindings(XML_Parser parser, BINDING *bindings);
+static enum XML_Error
+checkSkippedAtts(XML_Parser parser, const ENCODING *enc, const char *attStr,
+                 const XML_Char *tagName, BINDING **bindingsPtr);
+static int
+getAttributes(XML_Parser parser, const ENCODING *enc, const char *attStr,
+              int nDefaultAtts);
 static enum XML_Error
 storeAtts(XML_Parser parser, const ENCODING *, const char *s,
           TAG_NAME *tagNamePtr, BINDING **bindingsPtr);
@@ -462,6 +839,13 @@ reportComment(XML_Parser parser, const ENCODING *enc, const char *start,
 static void
 reportDefault(XML_Parser parser, const ENCODING *enc, const char *start,
               const char *end);
+static void
+announceEntity(XML_Parser parser, const ENTITY *entity);
+static int
+charsPiece(const XML_Char *s, const XML_Char *end);
+static void
+reportCharacters(XML_Parser parser, XML_CharacterDataHandler handler,
+                 const XML_Char *s, const XML_Char *end);
 
 static const XML_Char * getContext(XML_Parser parser);
 static XML_Bool
@@ -469,31 +853,77 @@ setContext(XML_Parser parser, const XML_Char *context);
 
 static void FASTCALL normalizePublicId(XML_Char *s);
 
-static DTD * dtdCreate(const XML_Memory_Handling_Suite *ms);
+static void memSuiteInit(MEMORY_FUNCTIONS *fns, MEMORY_SUITE *ms,
+                         const XML_Memory_Handling_Suite *classic,
+                         const XML_Memory_Handling_Suite2 *sized);
+static XML_Bool memCharge(const MEMORY_SUITE *ms, size_t size);
+static void memUncharge(const MEMORY_SUITE *ms, size_t size);
+static void *memMalloc(const MEMORY_SUITE *ms, size_t size);
+static void *memRealloc(const MEMORY_SUITE *ms, void *ptr,
+                        size_t oldSize, size_t size);
+static void memFree(const MEMORY_SUITE *ms, void *ptr, size_t size);
+static size_t memAlignedSize(const MEMORY_SUITE *ms, size_t size);
+static void *memAllocAligned(const MEMORY_SUITE *ms, size_t size);
+static void memFreeAligned(const MEMORY_SUITE *ms, void *ptr, size_t size);
+static void *appMalloc(const MEMORY_SUITE *ms, size_t size);
+static void *appRealloc(const MEMORY_SUITE *ms, void *ptr, size_t size);
+static void appFree(const MEMORY_SUITE *ms, void *ptr);
+
+static DTD * dtdCreate(const MEMORY_SUITE *memFor,
+                       size_t arenaChunkSize);
+static void *
+dtdMalloc(DTD *p, const MEMORY_SUITE *ms, size_t size);
+static void *
+dtdRealloc(DTD *p, const MEMORY_SUITE *ms, void *ptr,
+           size_t oldSize, size_t size);
+static void
+dtdFree(DTD *p, const MEMORY_SUITE *ms, void *ptr, size_t size);
+static void
+putDefaultAtts(DTD *p, DEFAULT_ATTRIBUTE *atts, int count);
+static DEFAULT_ATTRIBUTE *
+takeDefaultAtts(DTD *p, int minCount, int *count);
+static void
+freeSpareDefaultAtts(DTD *p, const MEMORY_SUITE *ms);
 /* do not call if m_parentParser != NULL */
-static void dtdReset(DTD *p, const XML_Memory_Handling_Suite *ms);
+static void dtdReset(DTD *p, const MEMORY_SUITE *ms,
+                     XML_Bool keepCapacity);
 static void
-dtdDestroy(DTD *p, XML_Bool isDocEntity, const XML_Memory_Handling_Suite *ms);
+dtdDestroy(DTD *p, XML_Bool isDocEntity, const MEMORY_SUITE *ms);
 static int
 dtdCopy(XML_Parser oldParser,
-        DTD *newDtd, const DTD *oldDtd, const XML_Memory_Handling_Suite *ms);
+        DTD *newDtd, const DTD *oldDtd, const MEMORY_SUITE *ms);
 static int
 copyEntityTable(XML_Parser oldParser,
                 HASH_TABLE *, STRING_POOL *, const HASH_TABLE *);
 static NAMED *
 lookup(XML_Parser parser, HASH_TABLE *table, KEY name, size_t createSize);
 static void FASTCALL
-hashTableInit(HASH_TABLE *, const XML_Memory_Handling_Suite *ms);
-static void FASTCALL hashTableClear(HASH_TABLE *);
+hashTableInit(HASH_TABLE *, const MEMORY_SUITE *ms,
+              ARENA *arena);
+static void FASTCALL hashTableClear(HASH_TABLE *, XML_Bool keepEntries);
 static void FASTCALL hashTableDestroy(HASH_TABLE *);
+static void FASTCALL hashTableTrim(HASH_TABLE *);
 static void FASTCALL
 hashTableIterInit(HASH_TABLE_ITER *, const HASH_TABLE *);
 static NAMED * FASTCALL hashTableIterNext(HASH_TABLE_ITER *);
 
+static void
+arenaInit(ARENA *, const MEMORY_SUITE *ms, size_t chunkSize);
+static void *
+arenaAlloc(ARENA *, size_t size);
+static void
+arenaClear(ARENA *);
+static void
+arenaDestroy(ARENA *);
+static void
+arenaTrim(ARENA *);
+
 static void FASTCALL
-poolInit(STRING_POOL *, const XML_Memory_Handling_Suite *ms);
+poolInit(STRING_POOL *, const MEMORY_SUITE *ms);
 static void FASTCALL poolClear(STRING_POOL *);
 static void FASTCALL poolDestroy(STRING_POOL *);
+static void FASTCALL poolTrim(STRING_POOL *);
+static size_t poolBytesToAllocateFor(size_t blockSize);
 static XML_Char *
 poolAppend(STRING_POOL *pool, const ENCODING *enc,
            const char *ptr, const char *end);
@@ -515,19 +945,47 @@ getElementType(XML_Parser parser, const ENCODING *enc,
                const char *ptr, const char *end);
 
 static XML_Char *copyString(const XML_Char *s,
-                            const XML_Memory_Handling_Suite *memsuite);
+                            const MEMORY_SUITE *memsuite);
+static void freeString(const XML_Char *s, const MEMORY_SUITE *memsuite);
 
 static unsigned long generate_hash_secret_salt(XML_Parser parser);
 static XML_Bool startParsing(XML_Parser parser);
 
 static XML_Parser
 parserCreate(const XML_Char *encodingName,
-             const XML_Memory_Handling_Suite *memsuite,
+             const MEMORY_SUITE *memsuite,
              const XML_Char *nameSep,
-             DTD *dtd);
+             DTD *dtd,
+             size_t arenaChunkSize);
 
 static void
 parserInit(XML_Parser parser, const XML_Char *encodingName);
+static void trimBuffer(XML_Parser parser);
+static void *getBuffer(XML_Parser parser, size_t len, size_t maxSize);
+static size_t
+grownBufferSize(XML_Parser parser, size_t bufferSize, size_t neededSize);
+static XML_Bool
+bufferOversized(XML_Parser parser, size_t neededSize);
+static enum XML_Status
+parseInPlace(XML_Parser parser, const char *s, size_t len, XML_Bool isFinal);
+static XML_Bool
+keepInput(XML_Parser parser, const char *s, const char *from, const char *to);
+static void keepEventContext(XML_Parser parser, const char *s, size_t len);
+static XML_Bool
+appendInput(XML_Parser parser, const char *s, size_t len, XML_Bool isFinal);
+static int XMLCALL readFile(void *readerArg, char *buf, int len);
+#ifdef HAVE_MMAP
+static enum XML_Status parseFileMapped(XML_Parser parser, PARSE_FILE *file);
+#endif
+static void fileClose(XML_Parser parser);
+static TAG *pushTag(XML_Parser parser);
+static XML_Bool reserveTagBuf(XML_Parser parser, size_t size);
+static XML_Bool tagNamesResize(XML_Parser parser, size_t newSize);
+static void trimTags(XML_Parser parser);
+static XML_Bool allocDataBuf(XML_Parser parser);
+static void declStateInit(DECL_STATE *decl);
+static XML_Bool declStateReady(XML_Parser parser);
+static void declStateFree(XML_Parser parser);
 
 #define poolStart(pool) ((pool)->start)
 #define poolEnd(pool) ((pool)->ptr)
@@ -547,15 +1005,24 @@ struct XML_ParserStruct {
   void *m_userData;
   void *m_handlerArg;
   char *m_buffer;
-  const XML_Memory_Handling_Suite m_mem;
+  MEMORY_FUNCTIONS m_memFunctions;
+  const MEMORY_SUITE m_memFor[XML_MEMORY_CATEGORIES];
   /* first character to be parsed */
   const char *m_bufferPtr;
   /* past last character to be parsed */
   char *m_bufferEnd;
   /* allocated end of m_buffer */
   const char *m_bufferLim;
+  /* see XML_SetBufferPolicy() */
+  int m_bufferInitSize;
+  int m_bufferGrowth;
+  int m_bufferShrinkSize;
   XML_Index m_parseEndByteIndex;
   const char *m_parseEndPtr;
+  /* start of the caller's input while it is parsed in place */
+  const char *m_parseStartPtr;
+  /* NULL unless XML_ParseFile() is suspended, see PARSE_FILE */
+  PARSE_FILE *m_file;
   XML_Char *m_dataBuf;
   XML_Char *m_dataBufEnd;
   XML_StartElementHandler m_startElementHandler;
@@ -575,12 +1042,17 @@ struct XML_ParserStruct {
   XML_NotStandaloneHandler m_notStandaloneHandler;
   XML_ExternalEntityRefHandler m_externalEntityRefHandler;
   XML_Parser m_externalEntityRefHandlerArg;
+  XML_ExternalEntityPrefetchHandler m_externalEntityPrefetchHandler;
   XML_SkippedEntityHandler m_skippedEntityHandler;
   XML_UnknownEncodingHandler m_unknownEncodingHandler;
   XML_ElementDeclHandler m_elementDeclHandler;
   XML_AttlistDeclHandler m_attlistDeclHandler;
   XML_EntityDeclHandler m_entityDeclHandler;
   XML_XmlDeclHandler m_xmlDeclHandler;
+  XML_PathStartHandler m_pathStartHandler;
+  XML_PathEndHandler m_pathEndHandler;
+  XML_PathCharacterDataHandler m_pathCharacterDataHandler;
+  XML_PathAttributeHandler m_pathAttributeHandler;
   const ENCODING *m_encoding;
   INIT_ENCODING m_initEncoding;
   const ENCODING *m_internalEncoding;
@@ -601,41 +1073,55 @@ struct XML_ParserStruct {
   OPEN_INTERNAL_ENTITY *m_freeInternalEntities;
   XML_Bool m_defaultExpandInternalEntities;
   int m_tagLevel;
-  ENTITY *m_declEntity;
-  const XML_Char *m_doctypeName;
-  const XML_Char *m_doctypeSysid;
-  const XML_Char *m_doctypePubid;
-  const XML_Char *m_declAttributeType;
-  const XML_Char *m_declNotationName;
-  const XML_Char *m_declNotationPublicId;
-  ELEMENT_TYPE *m_declElementType;
-  ATTRIBUTE_ID *m_declAttributeId;
-  XML_Bool m_declAttributeIsCdata;
-  XML_Bool m_declAttributeIsId;
+  /* level of the element whose content is being skipped, or 0 */
+  int m_skipTagLevel;
+  /* whether the skipped content still expands internal entities, as
+     it does when the path matcher skips it on its own */
+  XML_Bool m_skipExpandsEntities;
+  /* NULL outside of the prolog, see declStateReady() */
+  DECL_STATE *m_decl;
   DTD *m_dtd;
   const XML_Char *m_curBase;
-  TAG *m_tagStack;
-  TAG *m_freeTagList;
+  /* the open elements, see TAG */
+  TAG *m_tags;
+  int m_nTags;
+  int m_tagsSize;
+  char *m_tagNames;
+  const char *m_tagNamesLim;
   BINDING *m_inheritedBindings;
   BINDING *m_freeBindingList;
   int m_attsSize;
   int m_nSpecifiedAtts;
   int m_idAttIndex;
   ATTRIBUTE *m_atts;
+  XML_Bool m_lazyAtts;
+  XML_Bool m_keepCapacity;
+  /* true while the handlers of a start-tag run: XML_GetAttributeValue()
+     can then fetch its attributes, and XML_SkipCurrentElement() knows
+     the element being started, even an empty root element, whose tag
+     level is still 0 */
+  XML_Bool m_inStartTag;
+  /* number of raw entries in m_atts, or -1 if m_atts holds appAtts */
+  int m_nRawAtts;
+  const ENCODING *m_rawAttsEnc;
+  PATH_MATCHER *m_paths;
+  /* set by the path matcher if nobody needs the current attributes */
+  XML_Bool m_pathSkipAtts;
   NS_ATT *m_nsAtts;
   unsigned long m_nsAttsVersion;
   unsigned char m_nsAttsPower;
 #ifdef XML_ATTR_INFO
   XML_AttrInfo *m_attInfo;
+  int m_attInfoSize;
 #endif
   POSITION m_position;
   STRING_POOL m_tempPool;
   STRING_POOL m_temp2Pool;
-  char *m_groupConnector;
-  unsigned int m_groupSize;
   XML_Char m_namespaceSeparator;
   XML_Parser m_parentParser;
   XML_ParsingStatus m_parsingStatus;
+  /* set while the processor runs, and so handlers may be called */
+  XML_Bool m_inProcessor;
 #ifdef XML_DTD
   XML_Bool m_isParamEntity;
   XML_Bool m_useForeignDTD;
@@ -644,9 +1130,27 @@ struct XML_ParserStruct {
   unsigned long m_hash_secret_salt;
 };
 
-#define MALLOC(parser, s)      (parser->m_mem.malloc_fcn((s)))
-#define REALLOC(parser, p, s)  (parser->m_mem.realloc_fcn((p),(s)))
-#define FREE(parser, p)        (parser->m_mem.free_fcn((p)))
+#define MEM(parser, c)  (&(parser)->m_memFor[XML_MEMORY_ ## c])
+#define MALLOC(parser, s)          (memMalloc(MEM(parser, OTHER), (s)))
+#define REALLOC(parser, p, os, s)  (memRealloc(MEM(parser, OTHER), (p), (os), (s)))
+#define FREE(parser, p, s)         (memFree(MEM(parser, OTHER), (p), (s)))
+#define MALLOC_IN(parser, c, s)    (memMalloc(MEM(parser, c), (s)))
+#define REALLOC_IN(parser, c, p, os, s) \
+        (memRealloc(MEM(parser, c), (p), (os), (s)))
+#define FREE_IN(parser, c, p, s)   (memFree(MEM(parser, c), (p), (s)))
+
+/* true if character data has to be passed to path subscriptions */
+#define PATH_TEXT_WANTED(parser) \
+  ((parser)->m_paths != NULL && (parser)->m_paths->nMatches != 0 \
+   && (parser)->m_pathCharacterDataHandler != NULL)
+
+/* true once the conversion buffer needed for input in encoding enc
+   is available; the buffer is only allocated when the input cannot
+   be reported without converting it
+*/
+#define DATA_BUF_READY(parser, enc, s) \
+  ((parser)->m_dataBuf != NULL || !MUST_CONVERT(enc, s) \
+   || allocDataBuf(parser))
 
 
 XML_Parser XMLCALL
@@ -910,91 +1414,113 @@ XML_ParserCreate_MM(const XML_Char *encodingName,
                     const XML_Memory_Handling_Suite *memsuite,
                     const XML_Char *nameSep)
 {
-  return parserCreate(encodingName, memsuite, nameSep, NULL);
+  MEMORY_FUNCTIONS fns;
+  MEMORY_SUITE ms;
+  memSuiteInit(&fns, &ms, memsuite, NULL);
+  return parserCreate(encodingName, &ms, nameSep, NULL, 0);
+}
+
+XML_Parser XMLCALL
+XML_ParserCreate_MM2(const XML_Char *encodingName,
+                     const XML_Memory_Handling_Suite2 *memsuite,
+                     const XML_Char *nameSep)
+{
+  MEMORY_FUNCTIONS fns;
+  MEMORY_SUITE ms;
+  if (memsuite == NULL || memsuite->malloc_fcn == NULL
+      || memsuite->realloc_fcn == NULL || memsuite->free_sized_fcn == NULL)
+    return NULL;
+  memSuiteInit(&fns, &ms, NULL, memsuite);
+  return parserCreate(encodingName, &ms, nameSep, NULL, 0);
+}
+
+XML_Parser XMLCALL
+XML_ParserCreate_Arena(const XML_Char *encodingName,
+                       const XML_Memory_Handling_Suite *memsuite,
+                       const XML_Char *nameSep,
+                       size_t chunkSize)
+{
+  MEMORY_FUNCTIONS fns;
+  MEMORY_SUITE ms;
+  memSuiteInit(&fns, &ms, memsuite, NULL);
+  return parserCreate(encodingName, &ms, nameSep, NULL,
+                      chunkSize ? chunkSize : INIT_ARENA_CHUNK_SIZE);
 }
 
 static XML_Parser
 parserCreate(const XML_Char *encodingName,
-             const XML_Memory_Handling_Suite *memsuite,
+             const MEMORY_SUITE *memsuite,
              const XML_Char *nameSep,
-             DTD *dtd)
+             DTD *dtd,
+             size_t arenaChunkSize)
 {
   XML_Parser parser;
 
-  if (memsuite) {
-    XML_Memory_Handling_Suite *mtemp;
-    parser = (XML_Parser)
-      memsuite->malloc_fcn(sizeof(struct XML_ParserStruct));
-    if (parser != NULL) {
-      mtemp = (XML_Memory_Handling_Suite *)&(parser->m_mem);
-      mtemp->malloc_fcn = memsuite->malloc_fcn;
-      mtemp->realloc_fcn = memsuite->realloc_fcn;
-      mtemp->free_fcn = memsuite->free_fcn;
+  parser = (XML_Parser)
+    memAllocAligned(memsuite, sizeof(struct XML_ParserStruct));
+  if (!parser)
+    return parser;
+  {
+    MEMORY_SUITE *memFor = (MEMORY_SUITE *)parser->m_memFor;
+    int i;
+    parser->m_memFunctions = *memsuite->fns;
+    for (i = 0; i < XML_MEMORY_CATEGORIES; i++) {
+      memFor[i].fns = &parser->m_memFunctions;
+      memFor[i].account = memsuite->account;
+      memFor[i].category = (enum XML_MemoryCategory)i;
     }
-  }
-  else {
-    XML_Memory_Handling_Suite *mtemp;
-    parser = (XML_Parser)malloc(sizeof(struct XML_ParserStruct));
-    if (parser != NULL) {
-      mtemp = (XML_Memory_Handling_Suite *)&(parser->m_mem);
-      mtemp->malloc_fcn = malloc;
-      mtemp->realloc_fcn = realloc;
-      mtemp->free_fcn = free;
+    /* external entity parsers charge the account of their parent */
+    if (memsuite->account == NULL) {
+      MEMORY_ACCOUNT *account = (MEMORY_ACCOUNT *)
+        memMalloc(memsuite, sizeof(MEMORY_ACCOUNT));
+      if (account == NULL) {
+        memFreeAligned(memsuite, parser, sizeof(struct XML_ParserStruct));
+        return NULL;
+      }
+      memset(account, 0, sizeof(MEMORY_ACCOUNT));
+      for (i = 0; i < XML_MEMORY_CATEGORIES; i++)
+        memFor[i].account = account;
+      memCharge(MEM(parser, OTHER),
+                memAlignedSize(memsuite, sizeof(struct XML_ParserStruct))
+                + sizeof(MEMORY_ACCOUNT));
     }
+    memFor[0].account->refCount++;
   }
 
-  if (!parser)
-    return parser;
-
   parser->m_buffer = NULL;
   parser->m_bufferLim = NULL;
 
-  parser->m_attsSize = INIT_ATTS_SIZE;
-  parser->m_atts = (ATTRIBUTE *)MALLOC(parser, parser->m_attsSize * sizeof(ATTRIBUTE));
-  if (parser->m_atts == NULL) {
-    FREE(parser, parser);
-    return NULL;
-  }
-#ifdef XML_ATTR_INFO
-  parser->m_attInfo = (XML_AttrInfo*)MALLOC(parser, parser->m_attsSize * sizeof(XML_AttrInfo));
-  if (parser->m_attInfo == NULL) {
-    FREE(parser, parser->m_atts);
-    FREE(parser, parser);
-    return NULL;
-  }
-#endif
-  parser->m_dataBuf = (XML_Char *)MALLOC(parser, INIT_DATA_BUF_SIZE * sizeof(XML_Char));
-  if (parser->m_dataBuf == NULL) {
-    FREE(parser, parser->m_atts);
+  /* allocated by the first start tag, see storeAtts() */
+  parser->m_attsSize = 0;
+  parser->m_atts = NULL;
 #ifdef XML_ATTR_INFO
-    FREE(parser, parser->m_attInfo);
+  parser->m_attInfoSize = 0;
+  parser->m_attInfo = NULL;
 #endif
-    FREE(parser, parser);
-    return NULL;
-  }
-  parser->m_dataBufEnd = parser->m_dataBuf + INIT_DATA_BUF_SIZE;
+  /* only needed for input that has to be converted, see DATA_BUF_READY */
+  parser->m_dataBuf = NULL;
+  parser->m_dataBufEnd = NULL;
+  parser->m_decl = NULL;
+  parser->m_file = NULL;
 
   if (dtd)
     parser->m_dtd = dtd;
   else {
-    parser->m_dtd = dtdCreate(&parser->m_mem);
+    parser->m_dtd = dtdCreate(parser->m_memFor, arenaChunkSize);
     if (parser->m_dtd == NULL) {
-      FREE(parser, parser->m_dataBuf);
-      FREE(parser, parser->m_atts);
-#ifdef XML_ATTR_INFO
-      FREE(parser, parser->m_attInfo);
-#endif
-      FREE(parser, parser);
+      parserStructFree(parser);
       return NULL;
     }
   }
 
   parser->m_freeBindingList = NULL;
-  parser->m_freeTagList = NULL;
   parser->m_freeInternalEntities = NULL;
 
-  parser->m_groupSize = 0;
-  parser->m_groupConnector = NULL;
+  /* allocated by the first start tag, see pushTag() */
+  parser->m_tags = NULL;
+  parser->m_tagsSize = 0;
+  parser->m_tagNames = NULL;
+  parser->m_tagNamesLim = NULL;
 
   parser->m_unknownEncodingHandler = NULL;
   parser->m_unknownEncodingHandlerData = NULL;
@@ -1002,15 +1528,23 @@ parserCreate(const XML_Char *encodingName,
   parser->m_namespaceSeparator = ASCII_EXCL;
   parser->m_ns = XML_FALSE;
   parser->m_ns_triplets = XML_FALSE;
+  parser->m_lazyAtts = XML_FALSE;
+  parser->m_keepCapacity = XML_FALSE;
+  parser->m_bufferInitSize = INIT_BUFFER_SIZE;
+  parser->m_bufferGrowth = BUFFER_GROWTH;
+  parser->m_bufferShrinkSize = 0;
 
   parser->m_nsAtts = NULL;
   parser->m_nsAttsVersion = 0;
   parser->m_nsAttsPower = 0;
 
   parser->m_protocolEncodingName = NULL;
+  parser->m_unknownEncodingMem = NULL;
+
+  parser->m_paths = NULL;
 
-  poolInit(&parser->m_tempPool, &(parser->m_mem));
-  poolInit(&parser->m_temp2Pool, &(parser->m_mem));
+  poolInit(&parser->m_tempPool, MEM(parser, POOLS));
+  poolInit(&parser->m_temp2Pool, MEM(parser, POOLS));
   parserInit(parser, encodingName);
 
   if (encodingName && !parser->m_protocolEncodingName) {
@@ -1036,7 +1570,7 @@ parserInit(XML_Parser parser, const XML_Char *encodingName)
   parser->m_processor = prologInitProcessor;
   XmlPrologStateInit(&parser->m_prologState);
   if (encodingName != NULL) {
-    parser->m_protocolEncodingName = copyString(encodingName, &(parser->m_mem));
+    parser->m_protocolEncodingName = copyString(encodingName, MEM(parser, OTHER));
   }
   parser->m_curBase = NULL;
   XmlInitEncoding(&parser->m_initEncoding, &parser->m_encoding, 0);
@@ -1059,26 +1593,31 @@ parserInit(XML_Parser parser, const XML_Char *encodingName)
   parser->m_notStandaloneHandler = NULL;
   parser->m_externalEntityRefHandler = NULL;
   parser->m_externalEntityRefHandlerArg = parser;
+  parser->m_externalEntityPrefetchHandler = NULL;
   parser->m_skippedEntityHandler = NULL;
   parser->m_elementDeclHandler = NULL;
   parser->m_attlistDeclHandler = NULL;
   parser->m_entityDeclHandler = NULL;
   parser->m_xmlDeclHandler = NULL;
+  parser->m_pathStartHandler = NULL;
+  parser->m_pathEndHandler = NULL;
+  parser->m_pathCharacterDataHandler = NULL;
+  parser->m_pathAttributeHandler = NULL;
+  if (parser->m_paths) {
+    /* the patterns themselves survive XML_ParserReset() */
+    parser->m_paths->nStates = 0;
+    parser->m_paths->nMatches = 0;
+    parser->m_paths->nAttMatches = 0;
+    parser->m_paths->depth = 0;
+  }
+  parser->m_pathSkipAtts = XML_FALSE;
   parser->m_bufferPtr = parser->m_buffer;
   parser->m_bufferEnd = parser->m_buffer;
   parser->m_parseEndByteIndex = 0;
   parser->m_parseEndPtr = NULL;
-  parser->m_declElementType = NULL;
-  parser->m_declAttributeId = NULL;
-  parser->m_declEntity = NULL;
-  parser->m_doctypeName = NULL;
-  parser->m_doctypeSysid = NULL;
-  parser->m_doctypePubid = NULL;
-  parser->m_declAttributeType = NULL;
-  parser->m_declNotationName = NULL;
-  parser->m_declNotationPublicId = NULL;
-  parser->m_declAttributeIsCdata = XML_FALSE;
-  parser->m_declAttributeIsId = XML_FALSE;
+  parser->m_parseStartPtr = NULL;
+  if (parser->m_decl != NULL)
+    declStateInit(parser->m_decl);
   memset(&parser->m_position, 0, sizeof(POSITION));
   parser->m_errorCode = XML_ERROR_NONE;
   parser->m_eventPtr = NULL;
@@ -1087,14 +1626,19 @@ parserInit(XML_Parser parser, const XML_Char *encodingName)
   parser->m_openInternalEntities = NULL;
   parser->m_defaultExpandInternalEntities = XML_TRUE;
   parser->m_tagLevel = 0;
-  parser->m_tagStack = NULL;
+  parser->m_skipTagLevel = 0;
+  parser->m_skipExpandsEntities = XML_FALSE;
+  parser->m_nTags = 0;
   parser->m_inheritedBindings = NULL;
   parser->m_nSpecifiedAtts = 0;
-  parser->m_unknownEncodingMem = NULL;
+  parser->m_inStartTag = XML_FALSE;
+  parser->m_nRawAtts = -1;
+  parser->m_rawAttsEnc = NULL;
   parser->m_unknownEncodingRelease = NULL;
   parser->m_unknownEncodingData = NULL;
   parser->m_parentParser = NULL;
   parser->m_parsingStatus.parsing = XML_INITIALIZED;
+  parser->m_inProcessor = XML_FALSE;
 #ifdef XML_DTD
   parser->m_isParamEntity = XML_FALSE;
   parser->m_useForeignDTD = XML_FALSE;
@@ -1103,6 +1647,59 @@ parserInit(XML_Parser parser, const XML_Char *encodingName)
   parser->m_hash_secret_salt = 0;
 }
 
+static void
+declStateInit(DECL_STATE *decl)
+{
+  decl->declElementType = NULL;
+  decl->declAttributeId = NULL;
+  decl->declEntity = NULL;
+  decl->doctypeName = NULL;
+  decl->doctypeSysid = NULL;
+  decl->doctypePubid = NULL;
+  decl->declAttributeType = NULL;
+  decl->declNotationName = NULL;
+  decl->declNotationPublicId = NULL;
+  decl->declAttributeIsCdata = XML_FALSE;
+  decl->declAttributeIsId = XML_FALSE;
+}
+
+static XML_Bool
+declStateReady(XML_Parser parser)
+{
+  DECL_STATE *decl;
+  if (parser->m_decl != NULL)
+    return XML_TRUE;
+  decl = (DECL_STATE *)MALLOC(parser, sizeof(DECL_STATE));
+  if (decl == NULL)
+    return XML_FALSE;
+  declStateInit(decl);
+  decl->groupConnector = NULL;
+  decl->groupSize = 0;
+  parser->m_decl = decl;
+  return XML_TRUE;
+}
+
+static void
+declStateFree(XML_Parser parser)
+{
+  DECL_STATE *decl = parser->m_decl;
+  if (decl == NULL)
+    return;
+  FREE(parser, decl->groupConnector, decl->groupSize);
+  FREE(parser, decl, sizeof(DECL_STATE));
+  parser->m_decl = NULL;
+}
+
+static XML_Bool
+allocDataBuf(XML_Parser parser)
+{
+  parser->m_dataBuf = (XML_Char *)MALLOC(parser, INIT_DATA_BUF_SIZE * sizeof(XML_Char));
+  if (parser->m_dataBuf == NULL)
+    return XML_FALSE;
+  parser->m_dataBufEnd = parser->m_dataBuf + INIT_DATA_BUF_SIZE;
+  return XML_TRUE;
+}
+
 /* moves list of bindings to m_freeBindingList */
 static void FASTCALL
 moveToFreeBindingList(XML_Parser parser, BINDING *bindings)
@@ -1118,23 +1715,18 @@ moveToFreeBindingList(XML_Parser parser, BINDING *bindings)
 XML_Bool XMLCALL
 XML_ParserReset(XML_Parser parser, const XML_Char *encodingName)
 {
-  TAG *tStk;
   OPEN_INTERNAL_ENTITY *openEntityList;
+  int i;
 
   if (parser == NULL)
       return XML_FALSE;
 
   if (parser->m_parentParser)
     return XML_FALSE;
-  /* move m_tagStack to m_freeTagList */
-  tStk = parser->m_tagStack;
-  while (tStk) {
-    TAG *tag = tStk;
-    tStk = tStk->parent;
-    tag->parent = parser->m_freeTagList;
-    moveToFreeBindingList(parser, tag->bindings);
-    tag->bindings = NULL;
-    parser->m_freeTagList = tag;
+  /* close the open elements, keeping m_tags for reuse */
+  for (i = 0; i < parser->m_nTags; i++) {
+    moveToFreeBindingList(parser, parser->m_tags[i].bindings);
+    parser->m_tags[i].bindings = NULL;
   }
   /* move m_openInternalEntities to m_freeInternalEntities */
   openEntityList = parser->m_openInternalEntities;
@@ -1145,15 +1737,37 @@ XML_ParserReset(XML_Parser parser, const XML_Char *encodingName)
     parser->m_freeInternalEntities = openEntity;
   }
   moveToFreeBindingList(parser, parser->m_inheritedBindings);
-  FREE(parser, parser->m_unknownEncodingMem);
+  fileClose(parser);
+  if (!parser->m_keepCapacity) {
+    declStateFree(parser);
+    FREE(parser, parser->m_unknownEncodingMem, XmlSizeOfUnknownEncoding());
+    parser->m_unknownEncodingMem = NULL;
+  }
   if (parser->m_unknownEncodingRelease)
     parser->m_unknownEncodingRelease(parser->m_unknownEncodingData);
   poolClear(&parser->m_tempPool);
   poolClear(&parser->m_temp2Pool);
-  FREE(parser, (void *)parser->m_protocolEncodingName);
-  parser->m_protocolEncodingName = NULL;
+  if (parser->m_keepCapacity && encodingName != NULL
+      && parser->m_protocolEncodingName != NULL
+      && keyeq(encodingName, parser->m_protocolEncodingName)) {
+    /* same protocol encoding as before: keep the copy */
+    encodingName = NULL;
+  }
+  else {
+    freeString(parser->m_protocolEncodingName, MEM(parser, OTHER));
+    parser->m_protocolEncodingName = NULL;
+  }
   parserInit(parser, encodingName);
-  dtdReset(parser->m_dtd, &parser->m_mem);
+  dtdReset(parser->m_dtd, MEM(parser, DTD), parser->m_keepCapacity);
+  {
+    MEMORY_ACCOUNT *account = MEM(parser, OTHER)->account;
+    XML_MemoryStats *stats = &account->stats;
+    int i;
+    stats->peak = stats->current;
+    for (i = 0; i < XML_MEMORY_CATEGORIES; i++)
+      stats->peakBy[i] = stats->currentBy[i];
+    account->limitExceeded = XML_FALSE;
+  }
   return XML_TRUE;
 }
 
@@ -1170,14 +1784,14 @@ XML_SetEncoding(XML_Parser parser, const XML_Char *encodingName)
     return XML_STATUS_ERROR;
 
   /* Get rid of any previous encoding name */
-  FREE(parser, (void *)parser->m_protocolEncodingName);
+  freeString(parser->m_protocolEncodingName, MEM(parser, OTHER));
 
   if (encodingName == NULL)
     /* No new encoding name */
     parser->m_protocolEncodingName = NULL;
   else {
     /* Copy the new encoding name into allocated memory */
-    parser->m_protocolEncodingName = copyString(encodingName, &(parser->m_mem));
+    parser->m_protocolEncodingName = copyString(encodingName, MEM(parser, OTHER));
     if (!parser->m_protocolEncodingName)
       return XML_STATUS_ERROR;
   }
@@ -1206,6 +1820,7 @@ XML_ExternalEntityParserCreate(XML_Parser oldParser,
   XML_EndNamespaceDeclHandler oldEndNamespaceDeclHandler;
   XML_NotStandaloneHandler oldNotStandaloneHandler;
   XML_ExternalEntityRefHandler oldExternalEntityRefHandler;
+  XML_ExternalEntityPrefetchHandler oldExternalEntityPrefetchHandler;
   XML_SkippedEntityHandler oldSkippedEntityHandler;
   XML_UnknownEncodingHandler oldUnknownEncodingHandler;
   XML_ElementDeclHandler oldElementDeclHandler;
@@ -1250,13 +1865,14 @@ XML_ExternalEntityParserCreate(XML_Parser oldParser,
   oldEndNamespaceDeclHandler = parser->m_endNamespaceDeclHandler;
   oldNotStandaloneHandler = parser->m_notStandaloneHandler;
   oldExternalEntityRefHandler = parser->m_externalEntityRefHandler;
+  oldExternalEntityPrefetchHandler = parser->m_externalEntityPrefetchHandler;
   oldSkippedEntityHandler = parser->m_skippedEntityHandler;
   oldUnknownEncodingHandler = parser->m_unknownEncodingHandler;
   oldElementDeclHandler = parser->m_elementDeclHandler;
   oldAttlistDeclHandler = parser->m_attlistDeclHandler;
   oldEntityDeclHandler = parser->m_entityDeclHandler;
   oldXmlDeclHandler = parser->m_xmlDeclHandler;
-  oldDeclElementType = parser->m_declElementType;
+  oldDeclElementType = parser->m_decl ? parser->m_decl->declElementType : NULL;
 
   oldUserData = parser->m_userData;
   oldHandlerArg = parser->m_handlerArg;
@@ -1287,10 +1903,12 @@ XML_ExternalEntityParserCreate(XML_Parser oldParser,
   if (parser->m_ns) {
     XML_Char tmp[2];
     *tmp = parser->m_namespaceSeparator;
-    parser = parserCreate(encodingName, &parser->m_mem, tmp, newDtd);
+    parser = parserCreate(encodingName, MEM(parser, OTHER), tmp, newDtd,
+                          oldDtd->arena.chunkSize);
   }
   else {
-    parser = parserCreate(encodingName, &parser->m_mem, NULL, newDtd);
+    parser = parserCreate(encodingName, MEM(parser, OTHER), NULL, newDtd,
+                          oldDtd->arena.chunkSize);
   }
 
   if (!parser)
@@ -1310,13 +1928,13 @@ XML_ExternalEntityParserCreate(XML_Parser oldParser,
   parser->m_endNamespaceDeclHandler = oldEndNamespaceDeclHandler;
   parser->m_notStandaloneHandler = oldNotStandaloneHandler;
   parser->m_externalEntityRefHandler = oldExternalEntityRefHandler;
+  parser->m_externalEntityPrefetchHandler = oldExternalEntityPrefetchHandler;
   parser->m_skippedEntityHandler = oldSkippedEntityHandler;
   parser->m_unknownEncodingHandler = oldUnknownEncodingHandler;
   parser->m_elementDeclHandler = oldElementDeclHandler;
   parser->m_attlistDeclHandler = oldAttlistDeclHandler;
   parser->m_entityDeclHandler = oldEntityDeclHandler;
   parser->m_xmlDeclHandler = oldXmlDeclHandler;
-  parser->m_declElementType = oldDeclElementType;
   parser->m_userData = oldUserData;
   if (oldUserData == oldHandlerArg)
     parser->m_handlerArg = parser->m_userData;
@@ -1333,7 +1951,7 @@ XML_ExternalEntityParserCreate(XML_Parser oldParser,
   parser->m_prologState.inEntityValue = oldInEntityValue;
   if (context) {
 #endif /* XML_DTD */
-    if (!dtdCopy(oldParser, parser->m_dtd, oldDtd, &parser->m_mem)
+    if (!dtdCopy(oldParser, parser->m_dtd, oldDtd, MEM(parser, DTD))
       || !setContext(parser, context)) {
       XML_ParserFree(parser);
       return NULL;
@@ -1354,6 +1972,13 @@ XML_ExternalEntityParserCreate(XML_Parser oldParser,
     parser->m_processor = externalParEntInitProcessor;
   }
 #endif /* XML_DTD */
+  if (oldDeclElementType != NULL) {
+    if (!declStateReady(parser)) {
+      XML_ParserFree(parser);
+      return NULL;
+    }
+    parser->m_decl->declElementType = oldDeclElementType;
+  }
   return parser;
 }
 
@@ -1365,34 +1990,24 @@ destroyBindings(BINDING *bindings, XML_Parser parser)
     if (!b)
       break;
     bindings = b->nextTagBinding;
-    FREE(parser, b->uri);
-    FREE(parser, b);
+    FREE_IN(parser, BINDINGS, b->uri, b->uriAlloc * sizeof(XML_Char));
+    FREE_IN(parser, BINDINGS, b, sizeof(BINDING));
   }
 }
 
 void XMLCALL
 XML_ParserFree(XML_Parser parser)
 {
-  TAG *tagList;
   OPEN_INTERNAL_ENTITY *entityList;
+  int i;
   if (parser == NULL)
     return;
-  /* free m_tagStack and m_freeTagList */
-  tagList = parser->m_tagStack;
-  for (;;) {
-    TAG *p;
-    if (tagList == NULL) {
-      if (parser->m_freeTagList == NULL)
-        break;
-      tagList = parser->m_freeTagList;
-      parser->m_freeTagList = NULL;
-    }
-    p = tagList;
-    tagList = tagList->parent;
-    FREE(parser, p->buf);
-    destroyBindings(p->bindings, parser);
-    FREE(parser, p);
-  }
+  fileClose(parser);
+  for (i = 0; i < parser->m_nTags; i++)
+    destroyBindings(parser->m_tags[i].bindings, parser);
+  FREE_IN(parser, TAGS, parser->m_tags, parser->m_tagsSize * sizeof(TAG));
+  FREE_IN(parser, TAGS, parser->m_tagNames,
+          parser->m_tagNamesLim - parser->m_tagNames);
   /* free m_openInternalEntities and m_freeInternalEntities */
   entityList = parser->m_openInternalEntities;
   for (;;) {
@@ -1405,14 +2020,14 @@ XML_ParserFree(XML_Parser parser)
     }
     openEntity = entityList;
     entityList = entityList->next;
-    FREE(parser, openEntity);
+    FREE(parser, openEntity, sizeof(OPEN_INTERNAL_ENTITY));
   }
 
   destroyBindings(parser->m_freeBindingList, parser);
   destroyBindings(parser->m_inheritedBindings, parser);
   poolDestroy(&parser->m_tempPool);
   poolDestroy(&parser->m_temp2Pool);
-  FREE(parser, (void *)parser->m_protocolEncodingName);
+  freeString(parser->m_protocolEncodingName, MEM(parser, OTHER));
 #ifdef XML_DTD
   /* external parameter entity parsers share the DTD structure
      parser->m_dtd with the root parser, so we must not destroy it
@@ -1421,19 +2036,51 @@ XML_ParserFree(XML_Parser parser)
 #else
   if (parser->m_dtd)
 #endif /* XML_DTD */
-    dtdDestroy(parser->m_dtd, (XML_Bool)!parser->m_parentParser, &parser->m_mem);
-  FREE(parser, (void *)parser->m_atts);
+    dtdDestroy(parser->m_dtd, (XML_Bool)!parser->m_parentParser, MEM(parser, DTD));
+  FREE(parser, (void *)parser->m_atts,
+       parser->m_attsSize * sizeof(ATTRIBUTE));
 #ifdef XML_ATTR_INFO
-  FREE(parser, (void *)parser->m_attInfo);
+  FREE(parser, (void *)parser->m_attInfo,
+       parser->m_attInfoSize * sizeof(XML_AttrInfo));
 #endif
-  FREE(parser, parser->m_groupConnector);
-  FREE(parser, parser->m_buffer);
-  FREE(parser, parser->m_dataBuf);
-  FREE(parser, parser->m_nsAtts);
-  FREE(parser, parser->m_unknownEncodingMem);
+  declStateFree(parser);
+  FREE_IN(parser, BUFFER, parser->m_buffer,
+          parser->m_bufferLim - parser->m_buffer);
+  FREE(parser, parser->m_dataBuf, INIT_DATA_BUF_SIZE * sizeof(XML_Char));
+  FREE(parser, parser->m_nsAtts,
+       ((size_t)1 << parser->m_nsAttsPower) * sizeof(NS_ATT));
+  FREE(parser, parser->m_unknownEncodingMem, XmlSizeOfUnknownEncoding());
   if (parser->m_unknownEncodingRelease)
     parser->m_unknownEncodingRelease(parser->m_unknownEncodingData);
-  FREE(parser, parser);
+  if (parser->m_paths) {
+    PATH_MATCHER *paths = parser->m_paths;
+    poolDestroy(&paths->pool);
+    FREE(parser, paths->patterns, paths->patternsAlloc * sizeof(PATH_PATTERN));
+    FREE(parser, paths->steps, paths->stepsAlloc * sizeof(PATH_STEP));
+    FREE(parser, paths->states, paths->statesAlloc * sizeof(PATH_STATE));
+    FREE(parser, paths->matches, paths->matchesAlloc * sizeof(int));
+    FREE(parser, paths->attMatches, paths->attMatchesAlloc * sizeof(int));
+    FREE(parser, paths->levels, paths->levelsAlloc * sizeof(PATH_LEVEL));
+    FREE(parser, paths, sizeof(PATH_MATCHER));
+  }
+  parserStructFree(parser);
+}
+
+/* Frees the parser structure, and its memory account if no other
+   parser charges it any more. */
+static void
+parserStructFree(XML_Parser parser)
+{
+  MEMORY_FUNCTIONS fns = parser->m_memFunctions;
+  MEMORY_ACCOUNT *account = MEM(parser, OTHER)->account;
+  memFreeAligned(MEM(parser, OTHER), parser, sizeof(struct XML_ParserStruct));
+  if (--account->refCount == 0) {
+    MEMORY_SUITE ms;
+    ms.fns = &fns;
+    ms.account = NULL;
+    ms.category = XML_MEMORY_OTHER;
+    memFree(&ms, account, sizeof(MEMORY_ACCOUNT));
+  }
 }
 
 void XMLCALL
@@ -1471,80 +2118,1360 @@ XML_SetReturnNSTriplet(XML_Parser parser, int do_nst)
 }
 
 void XMLCALL
-XML_SetUserData(XML_Parser parser, void *p)
+XML_SetLazyAttributes(XML_Parser parser, XML_Bool lazy)
 {
   if (parser == NULL)
     return;
-  if (parser->m_handlerArg == parser->m_userData)
-    parser->m_handlerArg = parser->m_userData = p;
-  else
-    parser->m_userData = p;
+  /* block after XML_Parse()/XML_ParseBuffer() has been called */
+  if (parser->m_parsingStatus.parsing == XML_PARSING || parser->m_parsingStatus.parsing == XML_SUSPENDED)
+    return;
+  parser->m_lazyAtts = lazy ? XML_TRUE : XML_FALSE;
 }
 
-enum XML_Status XMLCALL
-XML_SetBase(XML_Parser parser, const XML_Char *p)
+void XMLCALL
+XML_SetResetMode(XML_Parser parser, enum XML_ResetMode mode)
 {
-  if (parser == NULL)
-    return XML_STATUS_ERROR;
-  if (p) {
-    p = poolCopyString(&parser->m_dtd->pool, p);
-    if (!p)
-      return XML_STATUS_ERROR;
-    parser->m_curBase = p;
-  }
-  else
-    parser->m_curBase = NULL;
-  return XML_STATUS_OK;
+  if (parser != NULL)
+    parser->m_keepCapacity
+        = (mode == XML_RESET_KEEP_CAPACITY) ? XML_TRUE : XML_FALSE;
 }
 
-const XML_Char * XMLCALL
-XML_GetBase(XML_Parser parser)
+void XMLCALL
+XML_GetMemoryStats(XML_Parser parser, XML_MemoryStats *stats)
 {
-  if (parser == NULL)
-    return NULL;
-  return parser->m_curBase;
+  if (parser == NULL || stats == NULL)
+    return;
+  *stats = MEM(parser, OTHER)->account->stats;
 }
 
-int XMLCALL
-XML_GetSpecifiedAttributeCount(XML_Parser parser)
+XML_Bool XMLCALL
+XML_SetMemoryLimit(XML_Parser parser, size_t maxBytes)
 {
+  MEMORY_ACCOUNT *account;
   if (parser == NULL)
-    return -1;
-  return parser->m_nSpecifiedAtts;
+    return XML_FALSE;
+  account = MEM(parser, OTHER)->account;
+  if (maxBytes != 0 && maxBytes < account->stats.current)
+    return XML_FALSE;
+  account->limit = maxBytes;
+  return XML_TRUE;
 }
 
-int XMLCALL
-XML_GetIdAttributeIndex(XML_Parser parser)
+/* Memory is given back in stages, from what is merely kept for reuse
+   to what is in use but larger than needed, until the target is met.
+*/
+XML_Bool XMLCALL
+XML_TrimMemory(XML_Parser parser, size_t targetBytes)
 {
+  const XML_MemoryStats *stats;
+  DTD *dtd;
   if (parser == NULL)
-    return -1;
-  return parser->m_idAttIndex;
-}
+    return XML_FALSE;
+  stats = &MEM(parser, OTHER)->account->stats;
+  dtd = parser->m_dtd;
+  /* called from a handler, the parse still uses all of it */
+  if (parser->m_inProcessor)
+    return XML_FALSE;
+
+  trimTags(parser);
+  destroyBindings(parser->m_freeBindingList, parser);
+  parser->m_freeBindingList = NULL;
+  while (parser->m_freeInternalEntities != NULL) {
+    OPEN_INTERNAL_ENTITY *openEntity = parser->m_freeInternalEntities;
+    parser->m_freeInternalEntities = openEntity->next;
+    FREE(parser, openEntity, sizeof(OPEN_INTERNAL_ENTITY));
+  }
+  if (stats->current <= targetBytes)
+    return XML_TRUE;
+
+  poolTrim(&parser->m_tempPool);
+  poolTrim(&parser->m_temp2Pool);
+  poolTrim(&dtd->pool);
+  poolTrim(&dtd->entityValuePool);
+  /* recorded again as needed, but not while one is being replayed */
+  if (parser->m_openInternalEntities == NULL)
+    releaseEntityTokens(dtd, MEM(parser, DTD), XML_FALSE);
+  hashTableTrim(&dtd->generalEntities);
+#ifdef XML_DTD
+  hashTableTrim(&dtd->paramEntities);
+#endif /* XML_DTD */
+  hashTableTrim(&dtd->elementTypes);
+  hashTableTrim(&dtd->attributeIds);
+  hashTableTrim(&dtd->prefixes);
+  freeSpareDefaultAtts(dtd, MEM(parser, DTD));
+  freeSpareEntityTokens(dtd, MEM(parser, DTD));
+  arenaTrim(&dtd->arena);
+  if (stats->current <= targetBytes)
+    return XML_TRUE;
 
+  /* a suspended parse still needs its buffer and attributes */
+  if (parser->m_parsingStatus.parsing == XML_SUSPENDED)
+    return XML_FALSE;
+  FREE(parser, parser->m_nsAtts,
+       ((size_t)1 << parser->m_nsAttsPower) * sizeof(NS_ATT));
+  parser->m_nsAtts = NULL;
+  parser->m_nsAttsPower = 0;
+  parser->m_nsAttsVersion = 0;
+  /* allocated again by the next start tag, see storeAtts() */
+  FREE(parser, (void *)parser->m_atts,
+       parser->m_attsSize * sizeof(ATTRIBUTE));
+  parser->m_atts = NULL;
+  parser->m_attsSize = 0;
+  parser->m_nRawAtts = -1;
+  parser->m_inStartTag = XML_FALSE;
 #ifdef XML_ATTR_INFO
-const XML_AttrInfo * XMLCALL
-XML_GetAttributeInfo(XML_Parser parser)
-{
-  if (parser == NULL)
-    return NULL;
-  return parser->m_attInfo;
-}
+  FREE(parser, (void *)parser->m_attInfo,
+       parser->m_attInfoSize * sizeof(XML_AttrInfo));
+  parser->m_attInfo = NULL;
+  parser->m_attInfoSize = 0;
 #endif
+  if (stats->current <= targetBytes)
+    return XML_TRUE;
 
-void XMLCALL
-XML_SetElementHandler(XML_Parser parser,
-                      XML_StartElementHandler start,
-                      XML_EndElementHandler end)
-{
-  if (parser == NULL)
-    return;
-  parser->m_startElementHandler = start;
-  parser->m_endElementHandler = end;
+  FREE(parser, parser->m_dataBuf, INIT_DATA_BUF_SIZE * sizeof(XML_Char));
+  parser->m_dataBuf = NULL;
+  parser->m_dataBufEnd = NULL;
+  /* kept by a warm reset, but only used until the document element */
+  if (parser->m_parsingStatus.parsing != XML_PARSING || parser->m_tagLevel > 0)
+    declStateFree(parser);
+  if (stats->current <= targetBytes)
+    return XML_TRUE;
+
+  trimBuffer(parser);
+  return (stats->current <= targetBytes) ? XML_TRUE : XML_FALSE;
 }
 
-void XMLCALL
-XML_SetStartElementHandler(XML_Parser parser,
-                           XML_StartElementHandler start) {
+/* Moves the unparsed input, and the context kept before it, to a
+   buffer no larger than needed; an empty buffer is freed. */
+static void
+trimBuffer(XML_Parser parser)
+{
+  const size_t oldBufferSize
+      = (size_t)(parser->m_bufferLim - parser->m_buffer);
+  size_t keep = 0;
+  size_t live;
+  size_t bufferSize;
+  char *newBuf = NULL;
+
+  if (parser->m_buffer == NULL)
+    return;
+  live = (size_t)(parser->m_bufferEnd - parser->m_bufferPtr);
+#ifdef XML_CONTEXT_BYTES
+  keep = (size_t)(parser->m_bufferPtr - parser->m_buffer);
+  if (keep > XML_CONTEXT_BYTES)
+    keep = XML_CONTEXT_BYTES;
+#endif  /* defined XML_CONTEXT_BYTES */
+  bufferSize = live + keep;
+  if (bufferSize > 0) {
+    if (bufferSize < (size_t)parser->m_bufferInitSize)
+      bufferSize = (size_t)parser->m_bufferInitSize;
+    if (bufferSize >= oldBufferSize)
+      return;
+    newBuf = (char *)MALLOC_IN(parser, BUFFER, bufferSize);
+    if (newBuf == NULL)
+      return;
+    memcpy(newBuf, parser->m_bufferPtr - keep, live + keep);
+  }
+  FREE_IN(parser, BUFFER, parser->m_buffer, oldBufferSize);
+  parser->m_buffer = newBuf;
+  if (newBuf == NULL) {
+    parser->m_bufferPtr = NULL;
+    parser->m_bufferEnd = NULL;
+    parser->m_bufferLim = NULL;
+  }
+  else {
+    parser->m_bufferPtr = newBuf + keep;
+    parser->m_bufferEnd = newBuf + keep + live;
+    parser->m_bufferLim = newBuf + bufferSize;
+  }
+  parser->m_eventPtr = parser->m_eventEndPtr = NULL;
+  parser->m_positionPtr = NULL;
+}
+
+/* Hibernation, see XML_Hibernate() and HIBERNATED. */
+
+static void
+blobWrite(BLOB_WRITER *w, const void *p, size_t n)
+{
+  if (w->failed || n == 0)
+    return;
+  if (n > w->alloc - w->len) {
+    size_t newAlloc = w->alloc ? w->alloc : 1024;
+    char *temp;
+    while (n > newAlloc - w->len) {
+      if (newAlloc > (size_t)-1 / 2) {
+        w->failed = XML_TRUE;
+        return;
+      }
+      newAlloc *= 2;
+    }
+    temp = (char *)memRealloc(&w->mem, w->start, w->alloc, newAlloc);
+    if (temp == NULL) {
+      w->failed = XML_TRUE;
+      return;
+    }
+    w->start = temp;
+    w->alloc = newAlloc;
+  }
+  memcpy(w->start + w->len, p, n);
+  w->len += n;
+}
+
+static void
+blobWriteInt(BLOB_WRITER *w, int n)
+{
+  blobWrite(w, &n, sizeof(int));
+}
+
+/* n characters of s; a NULL s is kept as such */
+static void
+blobWriteChars(BLOB_WRITER *w, const XML_Char *s, int n)
+{
+  if (s == NULL) {
+    blobWriteInt(w, -1);
+    return;
+  }
+  blobWriteInt(w, n);
+  blobWrite(w, s, n * sizeof(XML_Char));
+}
+
+static void
+blobWriteString(BLOB_WRITER *w, const XML_Char *s)
+{
+  blobWriteChars(w, s, s ? (int)keylen(s) : 0);
+}
+
+/* a PREFIX by name; the default prefix has none */
+static void
+blobWritePrefix(BLOB_WRITER *w, const PREFIX *prefix)
+{
+  blobWriteInt(w, prefix != NULL);
+  if (prefix != NULL)
+    blobWriteString(w, prefix->name);
+}
+
+static void
+blobRead(BLOB_READER *r, void *p, size_t n)
+{
+  if (r->failed || n > (size_t)(r->end - r->ptr)) {
+    r->failed = XML_TRUE;
+    memset(p, 0, n);
+    return;
+  }
+  memcpy(p, r->ptr, n);
+  r->ptr += n;
+}
+
+static int
+blobReadInt(BLOB_READER *r)
+{
+  int n;
+  blobRead(r, &n, sizeof(int));
+  return n;
+}
+
+/* Appends a string written by blobWriteChars() to pool and returns
+   it; NULL for a NULL string or with r->failed set.  The length is
+   stored in *lenPtr unless that is NULL.
+*/
+static const XML_Char *
+blobReadString(BLOB_READER *r, STRING_POOL *pool, int *lenPtr)
+{
+  const XML_Char *s;
+  int n = blobReadInt(r);
+  int i;
+  if (r->failed || n == -1)
+    return NULL;
+  if (n < 0 || (size_t)n > (size_t)(r->end - r->ptr) / sizeof(XML_Char)) {
+    r->failed = XML_TRUE;
+    return NULL;
+  }
+  for (i = 0; i < n; i++) {
+    XML_Char c;
+    memcpy(&c, r->ptr, sizeof(XML_Char));
+    r->ptr += sizeof(XML_Char);
+    if (!poolAppendChar(pool, c)) {
+      r->failed = XML_TRUE;
+      return NULL;
+    }
+  }
+  if (!poolAppendChar(pool, XML_T('\0'))) {
+    r->failed = XML_TRUE;
+    return NULL;
+  }
+  s = poolStart(pool);
+  poolFinish(pool);
+  if (lenPtr != NULL)
+    *lenPtr = n;
+  return s;
+}
+
+/* Looks up a name written by blobWriteString() in table, where it
+   has to exist; NULL for a NULL name.
+*/
+static NAMED *
+blobReadLookup(XML_Parser parser, BLOB_READER *r, HASH_TABLE *table)
+{
+  NAMED *named;
+  const XML_Char *name = blobReadString(r, &parser->m_tempPool, NULL);
+  if (name == NULL)
+    return NULL;
+  named = lookup(parser, table, name, 0);
+  if (named == NULL)
+    r->failed = XML_TRUE;
+  return named;
+}
+
+static PREFIX *
+blobReadPrefix(XML_Parser parser, BLOB_READER *r)
+{
+  DTD * const dtd = parser->m_dtd;
+  PREFIX *prefix;
+  if (!blobReadInt(r))
+    return NULL;
+  prefix = (PREFIX *)blobReadLookup(parser, r, &dtd->prefixes);
+  if (prefix == NULL && !r->failed)
+    prefix = &dtd->defaultPrefix;
+  return prefix;
+}
+
+/* An offset into the unparsed input, see HIBERNATED. */
+static size_t
+hibernateOffset(XML_Parser parser, const char *base, const char *ptr)
+{
+  if (ptr == NULL || ptr < base || ptr > parser->m_bufferEnd)
+    return (size_t)-1;
+  return (size_t)(ptr - base);
+}
+
+static void
+hibernateEntities(BLOB_WRITER *w, const HASH_TABLE *table)
+{
+  HASH_TABLE_ITER iter;
+  blobWriteInt(w, (int)table->used);
+  hashTableIterInit(&iter, table);
+  for (;;) {
+    const ENTITY *e = (ENTITY *)hashTableIterNext(&iter);
+    if (!e)
+      break;
+    blobWriteString(w, e->name);
+    blobWriteChars(w, e->textPtr, e->textLen);
+    blobWriteString(w, e->systemId);
+    blobWriteString(w, e->base);
+    blobWriteString(w, e->publicId);
+    blobWriteString(w, e->notation);
+    blobWriteInt(w, e->is_param);
+    blobWriteInt(w, e->is_internal);
+  }
+}
+
+/* The symbol tables, in the order dtdCopy() rebuilds them. */
+static void
+hibernateDtd(BLOB_WRITER *w, const DTD *dtd)
+{
+  HASH_TABLE_ITER iter;
+
+  blobWriteInt(w, (int)dtd->prefixes.used);
+  hashTableIterInit(&iter, &dtd->prefixes);
+  for (;;) {
+    const PREFIX *p = (PREFIX *)hashTableIterNext(&iter);
+    if (!p)
+      break;
+    blobWriteString(w, p->name);
+  }
+
+  blobWriteInt(w, (int)dtd->attributeIds.used);
+  hashTableIterInit(&iter, &dtd->attributeIds);
+  for (;;) {
+    const ATTRIBUTE_ID *a = (ATTRIBUTE_ID *)hashTableIterNext(&iter);
+    if (!a)
+      break;
+    blobWriteString(w, a->name);
+    blobWriteInt(w, a->maybeTokenized);
+    blobWriteInt(w, a->xmlns);
+    blobWritePrefix(w, a->prefix);
+  }
+
+  blobWriteInt(w, (int)dtd->elementTypes.used);
+  hashTableIterInit(&iter, &dtd->elementTypes);
+  for (;;) {
+    int i;
+    const ELEMENT_TYPE *e = (ELEMENT_TYPE *)hashTableIterNext(&iter);
+    if (!e)
+      break;
+    blobWriteString(w, e->name);
+    blobWritePrefix(w, e->prefix);
+    blobWriteString(w, e->idAtt ? e->idAtt->name : NULL);
+    blobWriteInt(w, e->nDefaultAtts);
+    for (i = 0; i < e->nDefaultAtts; i++) {
+      blobWriteString(w, e->defaultAtts[i].id->name);
+      blobWriteInt(w, e->defaultAtts[i].isCdata);
+      blobWriteString(w, e->defaultAtts[i].value);
+    }
+  }
+
+  hibernateEntities(w, &dtd->generalEntities);
+#ifdef XML_DTD
+  hibernateEntities(w, &dtd->paramEntities);
+#endif /* XML_DTD */
+}
+
+static int
+hibernateIndex(BINDING **all, int n, const BINDING *b)
+{
+  int i;
+  for (i = 0; i < n; i++)
+    if (all[i] == b)
+      return i;
+  return -1;
+}
+
+static void
+hibernateBinding(BLOB_WRITER *w, BINDING **all, int n, const BINDING *b)
+{
+  blobWritePrefix(w, b->prefix);
+  blobWriteString(w, b->attId ? b->attId->name : NULL);
+  blobWriteInt(w, b->uriLen);
+  blobWriteInt(w, b->uriAlloc);
+  blobWrite(w, b->uri, b->uriLen * sizeof(XML_Char));
+  blobWriteInt(w, hibernateIndex(all, n, b->prevPrefixBinding));
+}
+
+/* The inherited bindings, then the open elements from the document
+   element down with the bindings each of them declared, and finally
+   the bindings in effect for each prefix.  Bindings are numbered in
+   the order they are written.
+*/
+static XML_Bool
+hibernateTags(XML_Parser parser, BLOB_WRITER *w, int nBindings)
+{
+  DTD * const dtd = parser->m_dtd;
+  HASH_TABLE_ITER iter;
+  BINDING **all = NULL;
+  const BINDING *b;
+  const TAG *tag;
+  int i, n;
+
+  if (nBindings > 0) {
+    all = (BINDING **)MALLOC(parser, nBindings * sizeof(BINDING *));
+    if (all == NULL)
+      return XML_FALSE;
+  }
+  n = 0;
+  for (b = parser->m_inheritedBindings; b; b = b->nextTagBinding)
+    all[n++] = (BINDING *)b;
+  for (i = 0; i < parser->m_nTags; i++)
+    for (b = parser->m_tags[i].bindings; b; b = b->nextTagBinding)
+      all[n++] = (BINDING *)b;
+
+  n = 0;
+  for (b = parser->m_inheritedBindings; b; b = b->nextTagBinding)
+    n++;
+  blobWriteInt(w, n);
+  for (b = parser->m_inheritedBindings; b; b = b->nextTagBinding)
+    hibernateBinding(w, all, nBindings, b);
+
+  for (i = 0; i < parser->m_nTags; i++) {
+    const int nameLen
+        = (parser->m_tags[i].name.strLen + 1) * sizeof(XML_Char);
+    tag = &parser->m_tags[i];
+    blobWriteInt(w, tag->name.strLen);
+    blobWrite(w, tag->buf, nameLen);
+    n = 0;
+    for (b = tag->bindings; b; b = b->nextTagBinding)
+      n++;
+    blobWriteInt(w, n);
+    for (b = tag->bindings; b; b = b->nextTagBinding)
+      hibernateBinding(w, all, nBindings, b);
+    blobWriteInt(w, tag->name.localPart
+                    ? (int)(tag->name.localPart - (XML_Char *)tag->buf)
+                    : -1);
+    if (tag->name.str == (XML_Char *)tag->buf)
+      blobWriteInt(w, -1);
+    else {
+      for (n = 0; n < nBindings; n++)
+        if (all[n]->uri == tag->name.str)
+          break;
+      if (n == nBindings)
+        w->failed = XML_TRUE;
+      blobWriteInt(w, n);
+    }
+    blobWriteInt(w, tag->name.uriLen);
+    blobWriteInt(w, tag->name.prefixLen);
+    blobWriteString(w, tag->name.prefix);
+  }
+
+  n = 0;
+  hashTableIterInit(&iter, &dtd->prefixes);
+  for (;;) {
+    const PREFIX *p = (PREFIX *)hashTableIterNext(&iter);
+    if (!p)
+      break;
+    if (p->binding)
+      n++;
+  }
+  blobWriteInt(w, n);
+  hashTableIterInit(&iter, &dtd->prefixes);
+  for (;;) {
+    const PREFIX *p = (PREFIX *)hashTableIterNext(&iter);
+    if (!p)
+      break;
+    if (p->binding) {
+      blobWritePrefix(w, p);
+      blobWriteInt(w, hibernateIndex(all, nBindings, p->binding));
+    }
+  }
+  blobWriteInt(w, hibernateIndex(all, nBindings, dtd->defaultPrefix.binding));
+
+  FREE(parser, all, nBindings * sizeof(BINDING *));
+  return XML_TRUE;
+}
+
+static void
+hibernatePaths(BLOB_WRITER *w, const PATH_MATCHER *paths)
+{
+  int i;
+  blobWriteInt(w, paths->nPatterns);
+  for (i = 0; i < paths->nPatterns; i++) {
+    blobWriteInt(w, paths->patterns[i].firstStep);
+    blobWriteInt(w, paths->patterns[i].nSteps);
+    blobWriteString(w, paths->patterns[i].attName);
+    blobWriteInt(w, paths->patterns[i].text);
+  }
+  blobWriteInt(w, paths->nSteps);
+  for (i = 0; i < paths->nSteps; i++) {
+    blobWriteString(w, paths->steps[i].name);
+    blobWriteInt(w, paths->steps[i].type != NULL);
+    blobWriteInt(w, paths->steps[i].descendant);
+  }
+  blobWriteInt(w, paths->nStates);
+  blobWrite(w, paths->states, paths->nStates * sizeof(PATH_STATE));
+  blobWriteInt(w, paths->nMatches);
+  blobWrite(w, paths->matches, paths->nMatches * sizeof(int));
+  blobWriteInt(w, paths->nAttMatches);
+  blobWrite(w, paths->attMatches, paths->nAttMatches * sizeof(int));
+  blobWriteInt(w, paths->depth);
+  blobWrite(w, paths->levels, paths->depth * sizeof(PATH_LEVEL));
+}
+
+/* Only a root parser between parsing calls, in content or the epilog
+   or not started yet, can be written down; in the prolog, inside an
+   internal entity or a content model declaration, there is more state
+   than is worth keeping.
+*/
+static XML_Bool
+canHibernate(XML_Parser parser)
+{
+  Processor *processor = parser->m_processor;
+  if (parser->m_parentParser != NULL
+      || parser->m_openInternalEntities != NULL
+      || parser->m_dtd->in_eldecl
+      || parser->m_file != NULL)
+    return XML_FALSE;
+  if (parser->m_parsingStatus.parsing == XML_INITIALIZED)
+    return (XML_Bool)(processor == prologInitProcessor);
+  if (processor != contentProcessor && processor != cdataSectionProcessor
+      && processor != epilogProcessor)
+    return XML_FALSE;
+  if (parser->m_encoding == &parser->m_initEncoding.initEnc)
+    return XML_FALSE;
+  if (parser->m_bufferPtr != NULL
+      && (parser->m_bufferPtr < parser->m_buffer
+          || parser->m_bufferPtr > parser->m_bufferEnd))
+    return XML_FALSE;
+  if (parser->m_positionPtr != NULL
+      && (parser->m_positionPtr < parser->m_buffer
+          || parser->m_positionPtr > parser->m_bufferEnd))
+    return XML_FALSE;
+  return XML_TRUE;
+}
+
+enum XML_Status XMLCALL
+XML_Hibernate(XML_Parser parser, void **blob, size_t *len)
+{
+  DTD *dtd;
+  HIBERNATED h;
+  BLOB_WRITER w;
+  const BINDING *b;
+  const char *base;
+  const char *eventPtr;
+  char *temp;
+  int i;
+
+  if (parser == NULL || blob == NULL || len == NULL)
+    return XML_STATUS_ERROR;
+  if (!canHibernate(parser))
+    return XML_STATUS_ERROR;
+  dtd = parser->m_dtd;
+
+  memset(&h, 0, sizeof(HIBERNATED));
+  h.magic = HIBERNATE_MAGIC;
+  h.memFunctions = parser->m_memFunctions;
+  h.arenaChunkSize = dtd->arena.chunkSize;
+  h.memoryLimit = MEM(parser, OTHER)->account->limit;
+  h.hashSecretSalt = parser->m_hash_secret_salt;
+  h.processor = parser->m_processor;
+  h.parsingStatus = parser->m_parsingStatus;
+  h.prologState = parser->m_prologState;
+  if (parser->m_parsingStatus.parsing != XML_INITIALIZED) {
+    if (parser->m_encoding == parser->m_unknownEncodingMem)
+      h.unknownEncoding = XML_TRUE;
+    else
+      h.encoding = parser->m_encoding;
+  }
+  h.unknownEncodingData = parser->m_unknownEncodingData;
+  h.unknownEncodingRelease = parser->m_unknownEncodingRelease;
+  h.unknownEncodingHandlerData = parser->m_unknownEncodingHandlerData;
+  h.userData = parser->m_userData;
+  if (parser->m_handlerArg == parser)
+    h.handlerArgIsParser = XML_TRUE;
+  else
+    h.handlerArg = parser->m_handlerArg;
+  if (parser->m_externalEntityRefHandlerArg == parser)
+    h.externalEntityRefHandlerArgIsParser = XML_TRUE;
+  else
+    h.externalEntityRefHandlerArg = parser->m_externalEntityRefHandlerArg;
+  h.startElementHandler = parser->m_startElementHandler;
+  h.endElementHandler = parser->m_endElementHandler;
+  h.characterDataHandler = parser->m_characterDataHandler;
+  h.processingInstructionHandler = parser->m_processingInstructionHandler;
+  h.commentHandler = parser->m_commentHandler;
+  h.startCdataSectionHandler = parser->m_startCdataSectionHandler;
+  h.endCdataSectionHandler = parser->m_endCdataSectionHandler;
+  h.defaultHandler = parser->m_defaultHandler;
+  h.startDoctypeDeclHandler = parser->m_startDoctypeDeclHandler;
+  h.endDoctypeDeclHandler = parser->m_endDoctypeDeclHandler;
+  h.unparsedEntityDeclHandler = parser->m_unparsedEntityDeclHandler;
+  h.notationDeclHandler = parser->m_notationDeclHandler;
+  h.startNamespaceDeclHandler = parser->m_startNamespaceDeclHandler;
+  h.endNamespaceDeclHandler = parser->m_endNamespaceDeclHandler;
+  h.notStandaloneHandler = parser->m_notStandaloneHandler;
+  h.externalEntityRefHandler = parser->m_externalEntityRefHandler;
+  h.externalEntityPrefetchHandler = parser->m_externalEntityPrefetchHandler;
+  h.skippedEntityHandler = parser->m_skippedEntityHandler;
+  h.unknownEncodingHandler = parser->m_unknownEncodingHandler;
+  h.elementDeclHandler = parser->m_elementDeclHandler;
+  h.attlistDeclHandler = parser->m_attlistDeclHandler;
+  h.entityDeclHandler = parser->m_entityDeclHandler;
+  h.xmlDeclHandler = parser->m_xmlDeclHandler;
+  h.pathStartHandler = parser->m_pathStartHandler;
+  h.pathEndHandler = parser->m_pathEndHandler;
+  h.pathCharacterDataHandler = parser->m_pathCharacterDataHandler;
+  h.pathAttributeHandler = parser->m_pathAttributeHandler;
+  h.ns = parser->m_ns;
+  h.ns_triplets = parser->m_ns_triplets;
+  h.namespaceSeparator = parser->m_namespaceSeparator;
+  h.defaultExpandInternalEntities = parser->m_defaultExpandInternalEntities;
+  h.lazyAtts = parser->m_lazyAtts;
+  h.keepCapacity = parser->m_keepCapacity;
+  h.bufferInitSize = parser->m_bufferInitSize;
+  h.bufferGrowth = parser->m_bufferGrowth;
+  h.bufferShrinkSize = parser->m_bufferShrinkSize;
+  h.pathSkipAtts = parser->m_pathSkipAtts;
+  h.paths = (XML_Bool)(parser->m_paths != NULL);
+  h.tagLevel = parser->m_tagLevel;
+  h.skipTagLevel = parser->m_skipTagLevel;
+  h.skipExpandsEntities = parser->m_skipExpandsEntities;
+  h.nTags = parser->m_nTags;
+  for (i = 0; i < parser->m_nTags; i++)
+    for (b = parser->m_tags[i].bindings; b; b = b->nextTagBinding)
+      h.nBindings++;
+  for (b = parser->m_inheritedBindings; b; b = b->nextTagBinding)
+    h.nBindings++;
+  h.position = parser->m_position;
+  h.parseEndByteIndex = parser->m_parseEndByteIndex;
+  h.keepProcessing = dtd->keepProcessing;
+  h.hasParamEntityRefs = dtd->hasParamEntityRefs;
+  h.standalone = dtd->standalone;
+#ifdef XML_DTD
+  h.paramEntityRead = dtd->paramEntityRead;
+  h.useForeignDTD = parser->m_useForeignDTD;
+  h.paramEntityParsing = parser->m_paramEntityParsing;
+#endif
+
+  /* Only the input from the earliest position still referred to is
+     kept.  The event pointers may be left pointing elsewhere, or be
+     stale after the buffer was moved (see trimBuffer()); they only
+     matter to XML_GetCurrentByteIndex() and friends.
+  */
+  eventPtr = parser->m_eventPtr;
+  if (eventPtr != NULL
+      && (eventPtr < parser->m_buffer || eventPtr > parser->m_bufferEnd))
+    eventPtr = NULL;
+  base = parser->m_bufferPtr;
+  if (parser->m_positionPtr != NULL && parser->m_positionPtr < base)
+    base = parser->m_positionPtr;
+  if (eventPtr != NULL && eventPtr < base)
+    base = eventPtr;
+  if (base != NULL) {
+    h.buffer = XML_TRUE;
+    h.bufferLen = (size_t)(parser->m_bufferEnd - base);
+  }
+  h.bufferPtr = hibernateOffset(parser, base, parser->m_bufferPtr);
+  h.positionPtr = hibernateOffset(parser, base, parser->m_positionPtr);
+  h.eventPtr = h.eventEndPtr = h.parseEndPtr = (size_t)-1;
+  if (eventPtr != NULL) {
+    h.eventPtr = hibernateOffset(parser, base, eventPtr);
+    h.eventEndPtr = hibernateOffset(parser, base, parser->m_eventEndPtr);
+    h.parseEndPtr = hibernateOffset(parser, base, parser->m_parseEndPtr);
+  }
+
+  /* the blob belongs to the application: it is not accounted */
+  w.start = NULL;
+  w.len = 0;
+  w.alloc = 0;
+  w.mem.fns = &parser->m_memFunctions;
+  w.mem.account = NULL;
+  w.mem.category = XML_MEMORY_OTHER;
+  w.failed = XML_FALSE;
+
+  blobWrite(&w, &h, sizeof(HIBERNATED));
+  blobWriteString(&w, parser->m_protocolEncodingName);
+  blobWriteString(&w, parser->m_curBase);
+  if (h.unknownEncoding)
+    blobWrite(&w, parser->m_unknownEncodingMem, XmlSizeOfUnknownEncoding());
+  hibernateDtd(&w, dtd);
+  if (!w.failed && !hibernateTags(parser, &w, h.nBindings))
+    w.failed = XML_TRUE;
+  blobWrite(&w, base, h.bufferLen);
+  if (parser->m_paths != NULL)
+    hibernatePaths(&w, parser->m_paths);
+  if (!w.failed && w.len < w.alloc) {
+    /* the application frees the blob with the size it is given */
+    temp = (char *)memRealloc(&w.mem, w.start, w.alloc, w.len);
+    if (temp == NULL)
+      w.failed = XML_TRUE;
+    else {
+      w.start = temp;
+      w.alloc = w.len;
+    }
+  }
+  if (w.failed) {
+    memFree(&w.mem, w.start, w.alloc);
+    return XML_STATUS_ERROR;
+  }
+  memcpy(w.start + offsetof(HIBERNATED, size), &w.len, sizeof(size_t));
+
+  /* the woken parser releases the unknown encoding */
+  parser->m_unknownEncodingRelease = NULL;
+  XML_ParserFree(parser);
+  *blob = w.start;
+  *len = w.len;
+  return XML_STATUS_OK;
+}
+
+static XML_Bool
+wakeEntities(XML_Parser parser, BLOB_READER *r, HASH_TABLE *table)
+{
+  DTD * const dtd = parser->m_dtd;
+  const XML_Char *cachedBase = NULL;
+  int n = blobReadInt(r);
+  for (; n > 0 && !r->failed; n--) {
+    ENTITY *e;
+    const XML_Char *base;
+    const XML_Char *name = blobReadString(r, &dtd->pool, NULL);
+    if (name == NULL)
+      return XML_FALSE;
+    e = (ENTITY *)lookup(parser, table, name, sizeof(ENTITY));
+    if (e == NULL)
+      return XML_FALSE;
+    e->textPtr = blobReadString(r, &dtd->pool, &e->textLen);
+    e->systemId = blobReadString(r, &dtd->pool, NULL);
+    base = blobReadString(r, &parser->m_tempPool, NULL);
+    if (base != NULL) {
+      /* most entities share the base of the document */
+      if (cachedBase == NULL || !keyeq(base, cachedBase))
+        cachedBase = poolCopyString(&dtd->pool, base);
+      if (cachedBase == NULL)
+        return XML_FALSE;
+      e->base = cachedBase;
+    }
+    e->publicId = blobReadString(r, &dtd->pool, NULL);
+    e->notation = blobReadString(r, &dtd->pool, NULL);
+    e->is_param = (XML_Bool)blobReadInt(r);
+    e->is_internal = (XML_Bool)blobReadInt(r);
+  }
+  return (XML_Bool)!r->failed;
+}
+
+static XML_Bool
+wakeDtd(XML_Parser parser, BLOB_READER *r)
+{
+  DTD * const dtd = parser->m_dtd;
+  int n;
+
+  for (n = blobReadInt(r); n > 0 && !r->failed; n--) {
+    const XML_Char *name = blobReadString(r, &dtd->pool, NULL);
+    if (name == NULL
+        || !lookup(parser, &dtd->prefixes, name, sizeof(PREFIX)))
+      return XML_FALSE;
+  }
+
+  for (n = blobReadInt(r); n > 0 && !r->failed; n--) {
+    ATTRIBUTE_ID *a;
+    const XML_Char *name;
+    /* the scratch byte before the name, see ATTRIBUTE_ID */
+    if (!poolAppendChar(&dtd->pool, XML_T('\0')))
+      return XML_FALSE;
+    name = blobReadString(r, &dtd->pool, NULL);
+    if (name == NULL)
+      return XML_FALSE;
+    ++name;
+    a = (ATTRIBUTE_ID *)lookup(parser, &dtd->attributeIds, name,
+                               sizeof(ATTRIBUTE_ID));
+    if (a == NULL)
+      return XML_FALSE;
+    a->maybeTokenized = (XML_Bool)blobReadInt(r);
+    a->xmlns = (XML_Bool)blobReadInt(r);
+    a->prefix = blobReadPrefix(parser, r);
+  }
+
+  for (n = blobReadInt(r); n > 0 && !r->failed; n--) {
+    ELEMENT_TYPE *e;
+    int i, nDefaultAtts;
+    const XML_Char *name = blobReadString(r, &dtd->pool, NULL);
+    if (name == NULL)
+      return XML_FALSE;
+    e = (ELEMENT_TYPE *)lookup(parser, &dtd->elementTypes, name,
+                               sizeof(ELEMENT_TYPE));
+    if (e == NULL)
+      return XML_FALSE;
+    e->prefix = blobReadPrefix(parser, r);
+    e->idAtt = (ATTRIBUTE_ID *)blobReadLookup(parser, r, &dtd->attributeIds);
+    nDefaultAtts = blobReadInt(r);
+    if (r->failed || nDefaultAtts < 0
+        || (size_t)nDefaultAtts > (size_t)(r->end - r->ptr))
+      return XML_FALSE;
+    if (nDefaultAtts > 0) {
+      e->defaultAtts = (DEFAULT_ATTRIBUTE *)
+          dtdMalloc(dtd, MEM(parser, DTD),
+                    nDefaultAtts * sizeof(DEFAULT_ATTRIBUTE));
+      if (e->defaultAtts == NULL)
+        return XML_FALSE;
+      e->allocDefaultAtts = nDefaultAtts;
+    }
+    for (i = 0; i < nDefaultAtts; i++) {
+      DEFAULT_ATTRIBUTE *att = e->defaultAtts + i;
+      att->id = (ATTRIBUTE_ID *)blobReadLookup(parser, r, &dtd->attributeIds);
+      att->isCdata = (XML_Bool)blobReadInt(r);
+      att->value = blobReadString(r, &dtd->pool, NULL);
+      if (att->id == NULL)
+        return XML_FALSE;
+      e->nDefaultAtts = i + 1;
+    }
+  }
+
+  if (!wakeEntities(parser, r, &dtd->generalEntities))
+    return XML_FALSE;
+#ifdef XML_DTD
+  if (!wakeEntities(parser, r, &dtd->paramEntities))
+    return XML_FALSE;
+#endif /* XML_DTD */
+  return (XML_Bool)!r->failed;
+}
+
+/* Reads the bindings written by hibernateBinding() and appends them
+   to the list at *tail; all holds those read so far.
+*/
+static XML_Bool
+wakeBindings(XML_Parser parser, BLOB_READER *r, BINDING **tail,
+             BINDING **all, int nAll, int *nRead)
+{
+  int n = blobReadInt(r);
+  for (; n > 0 && !r->failed; n--) {
+    BINDING *b;
+    PREFIX *prefix;
+    const ATTRIBUTE_ID *attId;
+    int uriLen, uriAlloc, prev;
+
+    if (*nRead == nAll)
+      return XML_FALSE;
+    prefix = blobReadPrefix(parser, r);
+    attId = (ATTRIBUTE_ID *)blobReadLookup(parser, r,
+                                           &parser->m_dtd->attributeIds);
+    uriLen = blobReadInt(r);
+    uriAlloc = blobReadInt(r);
+    if (r->failed || prefix == NULL || uriLen < 0 || uriAlloc <= uriLen
+        || (size_t)uriLen > (size_t)(r->end - r->ptr) / sizeof(XML_Char))
+      return XML_FALSE;
+    b = (BINDING *)MALLOC_IN(parser, BINDINGS, sizeof(BINDING));
+    if (b == NULL)
+      return XML_FALSE;
+    b->uri = (XML_Char *)MALLOC_IN(parser, BINDINGS,
+                                   uriAlloc * sizeof(XML_Char));
+    if (b->uri == NULL) {
+      FREE_IN(parser, BINDINGS, b, sizeof(BINDING));
+      return XML_FALSE;
+    }
+    b->prefix = prefix;
+    b->attId = attId;
+    b->uriLen = uriLen;
+    b->uriAlloc = uriAlloc;
+    b->nextTagBinding = NULL;
+    *tail = b;
+    tail = &b->nextTagBinding;
+    all[(*nRead)++] = b;
+    blobRead(r, b->uri, uriLen * sizeof(XML_Char));
+    prev = blobReadInt(r);
+    if (prev < -1 || prev >= *nRead - 1)
+      return XML_FALSE;
+    b->prevPrefixBinding = prev < 0 ? NULL : all[prev];
+  }
+  return (XML_Bool)!r->failed;
+}
+
+static XML_Bool
+wakeTags(XML_Parser parser, BLOB_READER *r, int nTags, int nBindings)
+{
+  DTD * const dtd = parser->m_dtd;
+  BINDING **all = NULL;
+  XML_Bool ok = XML_FALSE;
+  int nRead = 0;
+  int i, n;
+
+  if (nTags < 0 || nBindings < 0)
+    return XML_FALSE;
+  if (nBindings > 0) {
+    if ((size_t)nBindings > (size_t)(r->end - r->ptr))
+      return XML_FALSE;
+    all = (BINDING **)MALLOC(parser, nBindings * sizeof(BINDING *));
+    if (all == NULL)
+      return XML_FALSE;
+  }
+  if (!wakeBindings(parser, r, &parser->m_inheritedBindings,
+                    all, nBindings, &nRead))
+    goto done;
+
+  for (i = 0; i < nTags; i++) {
+    TAG *tag;
+    const PREFIX *prefix;
+    int strLen = blobReadInt(r);
+    int nameLen, localPart;
+    if (r->failed || strLen < 0
+        || (size_t)strLen >= (size_t)(r->end - r->ptr) / sizeof(XML_Char))
+      goto done;
+    nameLen = (strLen + 1) * sizeof(XML_Char);
+    tag = pushTag(parser);
+    if (tag == NULL || !reserveTagBuf(parser, nameLen))
+      goto done;
+    tag->bufEnd = tag->buf + nameLen;
+    blobRead(r, tag->buf, nameLen);
+    ((XML_Char *)tag->buf)[strLen] = XML_T('\0');
+    tag->name.strLen = strLen;
+    if (!wakeBindings(parser, r, &tag->bindings, all, nBindings, &nRead))
+      goto done;
+    localPart = blobReadInt(r);
+    if (localPart < -1 || localPart > strLen)
+      goto done;
+    tag->name.localPart
+        = localPart < 0 ? NULL : (XML_Char *)tag->buf + localPart;
+    n = blobReadInt(r);
+    if (n < -1 || n >= nRead)
+      goto done;
+    tag->name.str = n < 0 ? (XML_Char *)tag->buf : all[n]->uri;
+    tag->name.uriLen = blobReadInt(r);
+    tag->name.prefixLen = blobReadInt(r);
+    prefix = (PREFIX *)blobReadLookup(parser, r, &dtd->prefixes);
+    tag->name.prefix = prefix ? prefix->name : NULL;
+    if (r->failed)
+      goto done;
+  }
+
+  for (n = blobReadInt(r); n > 0 && !r->failed; n--) {
+    PREFIX *prefix = blobReadPrefix(parser, r);
+    i = blobReadInt(r);
+    if (prefix == NULL || i < 0 || i >= nRead)
+      goto done;
+    prefix->binding = all[i];
+  }
+  i = blobReadInt(r);
+  if (i < -1 || i >= nRead)
+    goto done;
+  dtd->defaultPrefix.binding = i < 0 ? NULL : all[i];
+  ok = (XML_Bool)(!r->failed && nRead == nBindings);
+done:
+  FREE(parser, all, nBindings * sizeof(BINDING *));
+  return ok;
+}
+
+/* One of the path matcher's arrays, allocated as large as needed. */
+static void *
+wakePathArray(XML_Parser parser, BLOB_READER *r, int *countPtr,
+              int *allocPtr, size_t size, XML_Bool read)
+{
+  void *array;
+  int n = blobReadInt(r);
+  *countPtr = *allocPtr = 0;
+  if (r->failed || n < 0 || (size_t)n > (size_t)(r->end - r->ptr)) {
+    r->failed = XML_TRUE;
+    return NULL;
+  }
+  if (n == 0)
+    return NULL;
+  array = MALLOC(parser, n * size);
+  if (array == NULL) {
+    r->failed = XML_TRUE;
+    return NULL;
+  }
+  *countPtr = *allocPtr = n;
+  if (read)
+    blobRead(r, array, n * size);
+  return array;
+}
+
+static XML_Bool
+wakePaths(XML_Parser parser, BLOB_READER *r)
+{
+  PATH_MATCHER *paths;
+  int i;
+  paths = (PATH_MATCHER *)MALLOC(parser, sizeof(PATH_MATCHER));
+  if (paths == NULL)
+    return XML_FALSE;
+  memset(paths, 0, sizeof(PATH_MATCHER));
+  poolInit(&paths->pool, MEM(parser, POOLS));
+  parser->m_paths = paths;
+
+  paths->patterns = (PATH_PATTERN *)
+      wakePathArray(parser, r, &paths->nPatterns, &paths->patternsAlloc,
+                    sizeof(PATH_PATTERN), XML_FALSE);
+  for (i = 0; i < paths->nPatterns && !r->failed; i++) {
+    PATH_PATTERN *pattern = paths->patterns + i;
+    pattern->firstStep = blobReadInt(r);
+    pattern->nSteps = blobReadInt(r);
+    pattern->attName = blobReadString(r, &paths->pool, NULL);
+    pattern->text = (XML_Bool)blobReadInt(r);
+  }
+  paths->steps = (PATH_STEP *)
+      wakePathArray(parser, r, &paths->nSteps, &paths->stepsAlloc,
+                    sizeof(PATH_STEP), XML_FALSE);
+  for (i = 0; i < paths->nSteps && !r->failed; i++) {
+    PATH_STEP *step = paths->steps + i;
+    step->name = blobReadString(r, &paths->pool, NULL);
+    step->type = NULL;
+    /* looked up in the DTD once the document has started */
+    if (blobReadInt(r) && step->name != NULL) {
+      step->type = (ELEMENT_TYPE *)lookup(parser,
+                                          &parser->m_dtd->elementTypes,
+                                          step->name, 0);
+      if (step->type == NULL)
+        r->failed = XML_TRUE;
+    }
+    step->descendant = (XML_Bool)blobReadInt(r);
+  }
+  paths->states = (PATH_STATE *)
+      wakePathArray(parser, r, &paths->nStates, &paths->statesAlloc,
+                    sizeof(PATH_STATE), XML_TRUE);
+  paths->matches = (int *)
+      wakePathArray(parser, r, &paths->nMatches, &paths->matchesAlloc,
+                    sizeof(int), XML_TRUE);
+  paths->attMatches = (int *)
+      wakePathArray(parser, r, &paths->nAttMatches, &paths->attMatchesAlloc,
+                    sizeof(int), XML_TRUE);
+  paths->levels = (PATH_LEVEL *)
+      wakePathArray(parser, r, &paths->depth, &paths->levelsAlloc,
+                    sizeof(PATH_LEVEL), XML_TRUE);
+  return (XML_Bool)!r->failed;
+}
+
+/* An offset written by hibernateOffset() */
+static const char *
+wakeOffset(XML_Parser parser, BLOB_READER *r, size_t offset)
+{
+  if (offset == (size_t)-1)
+    return NULL;
+  if (offset > (size_t)(parser->m_bufferEnd - parser->m_buffer)) {
+    r->failed = XML_TRUE;
+    return NULL;
+  }
+  return parser->m_buffer + offset;
+}
+
+static XML_Bool
+wakeParser(XML_Parser parser, const HIBERNATED *h, BLOB_READER *r)
+{
+  DTD * const dtd = parser->m_dtd;
+  const XML_Char *s;
+
+  /* needed by the symbol tables */
+  parser->m_hash_secret_salt = h->hashSecretSalt;
+  parser->m_processor = h->processor;
+  parser->m_parsingStatus = h->parsingStatus;
+  parser->m_prologState = h->prologState;
+  if (h->encoding != NULL)
+    parser->m_encoding = h->encoding;
+  parser->m_unknownEncodingHandlerData = h->unknownEncodingHandlerData;
+  parser->m_userData = h->userData;
+  parser->m_handlerArg = h->handlerArgIsParser ? parser : h->handlerArg;
+  parser->m_externalEntityRefHandlerArg
+      = h->externalEntityRefHandlerArgIsParser
+        ? parser : h->externalEntityRefHandlerArg;
+  parser->m_startElementHandler = h->startElementHandler;
+  parser->m_endElementHandler = h->endElementHandler;
+  parser->m_characterDataHandler = h->characterDataHandler;
+  parser->m_processingInstructionHandler = h->processingInstructionHandler;
+  parser->m_commentHandler = h->commentHandler;
+  parser->m_startCdataSectionHandler = h->startCdataSectionHandler;
+  parser->m_endCdataSectionHandler = h->endCdataSectionHandler;
+  parser->m_defaultHandler = h->defaultHandler;
+  parser->m_startDoctypeDeclHandler = h->startDoctypeDeclHandler;
+  parser->m_endDoctypeDeclHandler = h->endDoctypeDeclHandler;
+  parser->m_unparsedEntityDeclHandler = h->unparsedEntityDeclHandler;
+  parser->m_notationDeclHandler = h->notationDeclHandler;
+  parser->m_startNamespaceDeclHandler = h->startNamespaceDeclHandler;
+  parser->m_endNamespaceDeclHandler = h->endNamespaceDeclHandler;
+  parser->m_notStandaloneHandler = h->notStandaloneHandler;
+  parser->m_externalEntityRefHandler = h->externalEntityRefHandler;
+  parser->m_externalEntityPrefetchHandler = h->externalEntityPrefetchHandler;
+  parser->m_skippedEntityHandler = h->skippedEntityHandler;
+  parser->m_unknownEncodingHandler = h->unknownEncodingHandler;
+  parser->m_elementDeclHandler = h->elementDeclHandler;
+  parser->m_attlistDeclHandler = h->attlistDeclHandler;
+  parser->m_entityDeclHandler = h->entityDeclHandler;
+  parser->m_xmlDeclHandler = h->xmlDeclHandler;
+  parser->m_pathStartHandler = h->pathStartHandler;
+  parser->m_pathEndHandler = h->pathEndHandler;
+  parser->m_pathCharacterDataHandler = h->pathCharacterDataHandler;
+  parser->m_pathAttributeHandler = h->pathAttributeHandler;
+  parser->m_ns_triplets = h->ns_triplets;
+  parser->m_defaultExpandInternalEntities = h->defaultExpandInternalEntities;
+  parser->m_lazyAtts = h->lazyAtts;
+  parser->m_keepCapacity = h->keepCapacity;
+  if (!XML_SetBufferPolicy(parser, h->bufferInitSize, h->bufferGrowth,
+                           h->bufferShrinkSize))
+    return XML_FALSE;
+  parser->m_pathSkipAtts = h->pathSkipAtts;
+  parser->m_tagLevel = h->tagLevel;
+  parser->m_skipTagLevel = h->skipTagLevel;
+  parser->m_skipExpandsEntities = h->skipExpandsEntities;
+  parser->m_position = h->position;
+  parser->m_parseEndByteIndex = h->parseEndByteIndex;
+  dtd->keepProcessing = h->keepProcessing;
+  dtd->hasParamEntityRefs = h->hasParamEntityRefs;
+  dtd->standalone = h->standalone;
+#ifdef XML_DTD
+  dtd->paramEntityRead = h->paramEntityRead;
+  parser->m_useForeignDTD = h->useForeignDTD;
+  parser->m_paramEntityParsing = h->paramEntityParsing;
+#endif
+
+  s = blobReadString(r, &parser->m_tempPool, NULL);
+  if (s != NULL) {
+    parser->m_protocolEncodingName = copyString(s, MEM(parser, OTHER));
+    if (parser->m_protocolEncodingName == NULL)
+      return XML_FALSE;
+  }
+  parser->m_curBase = blobReadString(r, &dtd->pool, NULL);
+  if (h->unknownEncoding) {
+    parser->m_unknownEncodingMem = MALLOC(parser, XmlSizeOfUnknownEncoding());
+    if (parser->m_unknownEncodingMem == NULL)
+      return XML_FALSE;
+    blobRead(r, parser->m_unknownEncodingMem, XmlSizeOfUnknownEncoding());
+    parser->m_encoding = (const ENCODING *)parser->m_unknownEncodingMem;
+  }
+  if (r->failed || !wakeDtd(parser, r)
+      || !wakeTags(parser, r, h->nTags, h->nBindings))
+    return XML_FALSE;
+
+  if (h->buffer) {
+    /* room for the next input, as XML_GetBuffer() would make */
+    size_t bufferSize = h->bufferLen;
+    if (bufferSize > (size_t)(r->end - r->ptr))
+      return XML_FALSE;
+    if (bufferSize < (size_t)parser->m_bufferInitSize)
+      bufferSize = (size_t)parser->m_bufferInitSize;
+    parser->m_buffer = (char *)MALLOC_IN(parser, BUFFER, bufferSize);
+    if (parser->m_buffer == NULL)
+      return XML_FALSE;
+    parser->m_bufferLim = parser->m_buffer + bufferSize;
+    parser->m_bufferEnd = parser->m_buffer + h->bufferLen;
+    blobRead(r, parser->m_buffer, h->bufferLen);
+    parser->m_bufferPtr = wakeOffset(parser, r, h->bufferPtr);
+    parser->m_positionPtr = wakeOffset(parser, r, h->positionPtr);
+    parser->m_eventPtr = wakeOffset(parser, r, h->eventPtr);
+    parser->m_eventEndPtr = wakeOffset(parser, r, h->eventEndPtr);
+    parser->m_parseEndPtr = wakeOffset(parser, r, h->parseEndPtr);
+    if (parser->m_bufferPtr == NULL)
+      return XML_FALSE;
+  }
+  if (h->paths && !wakePaths(parser, r))
+    return XML_FALSE;
+  return (XML_Bool)!r->failed;
+}
+
+XML_Parser XMLCALL
+XML_Wake(void *blob, size_t len, const XML_Memory_Handling_Suite *memsuite)
+{
+  HIBERNATED h;
+  BLOB_READER r;
+  MEMORY_FUNCTIONS fns;
+  MEMORY_SUITE ms;
+  XML_Parser parser;
+
+  if (blob == NULL || len < sizeof(HIBERNATED))
+    return NULL;
+  memcpy(&h, blob, sizeof(HIBERNATED));
+  if (h.magic != HIBERNATE_MAGIC || h.size != len)
+    return NULL;
+  if (memsuite != NULL)
+    memSuiteInit(&fns, &ms, memsuite, NULL);
+  else {
+    fns = h.memFunctions;
+    ms.fns = &fns;
+    ms.account = NULL;
+    ms.category = XML_MEMORY_OTHER;
+  }
+  parser = parserCreate(NULL, &ms, h.ns ? &h.namespaceSeparator : NULL,
+                        NULL, h.arenaChunkSize);
+  if (parser == NULL)
+    return NULL;
+  r.ptr = (const char *)blob + sizeof(HIBERNATED);
+  r.end = (const char *)blob + len;
+  r.failed = XML_FALSE;
+  if (!wakeParser(parser, &h, &r) || r.ptr != r.end) {
+    XML_ParserFree(parser);
+    return NULL;
+  }
+  poolClear(&parser->m_tempPool);
+  MEM(parser, OTHER)->account->limit = h.memoryLimit;
+  /* released by the parser from now on */
+  parser->m_unknownEncodingData = h.unknownEncodingData;
+  parser->m_unknownEncodingRelease = h.unknownEncodingRelease;
+
+  /* the blob was allocated through the hibernated parser's suite */
+  ms.fns = &h.memFunctions;
+  ms.account = NULL;
+  memFree(&ms, blob, len);
+  return parser;
+}
+
+void XMLCALL
+XML_SetUserData(XML_Parser parser, void *p)
+{
+  if (parser == NULL)
+    return;
+  if (parser->m_handlerArg == parser->m_userData)
+    parser->m_handlerArg = parser->m_userData = p;
+  else
+    parser->m_userData = p;
+}
+
+enum XML_Status XMLCALL
+XML_SetBase(XML_Parser parser, const XML_Char *p)
+{
+  if (parser == NULL)
+    return XML_STATUS_ERROR;
+  if (p) {
+    p = poolCopyString(&parser->m_dtd->pool, p);
+    if (!p)
+      return XML_STATUS_ERROR;
+    parser->m_curBase = p;
+  }
+  else
+    parser->m_curBase = NULL;
+  return XML_STATUS_OK;
+}
+
+const XML_Char * XMLCALL
+XML_GetBase(XML_Parser parser)
+{
+  if (parser == NULL)
+    return NULL;
+  return parser->m_curBase;
+}
+
+int XMLCALL
+XML_GetSpecifiedAttributeCount(XML_Parser parser)
+{
+  if (parser == NULL)
+    return -1;
+  return parser->m_nSpecifiedAtts;
+}
+
+int XMLCALL
+XML_GetIdAttributeIndex(XML_Parser parser)
+{
+  if (parser == NULL)
+    return -1;
+  return parser->m_idAttIndex;
+}
+
+#ifdef XML_ATTR_INFO
+const XML_AttrInfo * XMLCALL
+XML_GetAttributeInfo(XML_Parser parser)
+{
+  if (parser == NULL)
+    return NULL;
+  return parser->m_attInfo;
+}
+#endif
+
+const XML_Char * XMLCALL
+XML_GetAttributeValue(XML_Parser parser, const XML_Char *name)
+{
+  if (parser == NULL || name == NULL)
+    return NULL;
+  if (!parser->m_inStartTag)
+    return NULL;
+  return getAttributeValue(parser, name);
+}
+
+static const XML_Char *
+getAttributeValue(XML_Parser parser, const XML_Char *name)
+{
+  const ENCODING *enc;
+  int i;
+
+  if (parser->m_nRawAtts < 0) {
+    const XML_Char **appAtts = (const XML_Char **)parser->m_atts;
+    for (i = 0; appAtts[i]; i += 2)
+      if (keyeq(appAtts[i], name))
+        return appAtts[i + 1];
+    return NULL;
+  }
+  enc = parser->m_rawAttsEnc;
+  for (i = 0; i < parser->m_nRawAtts; i++) {
+    const ATTRIBUTE *att = &parser->m_atts[i];
+    const char *nameEnd = att->name + XmlNameLength(enc, att->name);
+    XML_Bool found;
+    if (!MUST_CONVERT(enc, att->name)) {
+      const size_t len = keylen(name) * sizeof(XML_Char);
+      found = (len == (size_t)(nameEnd - att->name)
+               && memcmp(att->name, name, len) == 0);
+    }
+    else {
+      const XML_Char *attName = poolStoreString(&parser->m_tempPool, enc,
+                                                att->name, nameEnd);
+      if (!attName)
+        return NULL;
+      found = keyeq(attName, name);
+      poolDiscard(&parser->m_tempPool);
+    }
+    if (found) {
+      /* raw values were only admitted if they need no normalization */
+      const XML_Char *value = poolStoreString(&parser->m_tempPool, enc,
+                                              att->valuePtr, att->valueEnd);
+      if (value)
+        poolFinish(&parser->m_tempPool);
+      return value;
+    }
+  }
+  return NULL;
+}
+
+void XMLCALL
+XML_SetElementHandler(XML_Parser parser,
+                      XML_StartElementHandler start,
+                      XML_EndElementHandler end)
+{
+  if (parser == NULL)
+    return;
+  parser->m_startElementHandler = start;
+  parser->m_endElementHandler = end;
+}
+
+void XMLCALL
+XML_SetStartElementHandler(XML_Parser parser,
+                           XML_StartElementHandler start) {
   if (parser != NULL)
     parser->m_startElementHandler = start;
 }
@@ -1718,6 +3645,14 @@ XML_SetExternalEntityRefHandlerArg(XML_Parser parser, void *arg)
     parser->m_externalEntityRefHandlerArg = parser;
 }
 
+void XMLCALL
+XML_SetExternalEntityPrefetchHandler(XML_Parser parser,
+                                     XML_ExternalEntityPrefetchHandler handler)
+{
+  if (parser != NULL)
+    parser->m_externalEntityPrefetchHandler = handler;
+}
+
 void XMLCALL
 XML_SetSkippedEntityHandler(XML_Parser parser,
                             XML_SkippedEntityHandler handler)
@@ -1768,6 +3703,185 @@ XML_SetXmlDeclHandler(XML_Parser parser,
     parser->m_xmlDeclHandler = handler;
 }
 
+/* Parses one name test of a path pattern at *patternPtr into the
+   matcher's pool; *namePtr is set to NULL for "*".
+*/
+static XML_Bool
+pathParseName(XML_Parser parser, const XML_Char **patternPtr,
+              const XML_Char **namePtr)
+{
+  STRING_POOL * const pool = &parser->m_paths->pool;
+  const XML_Char *s = *patternPtr;
+  const XML_Char *start;
+
+  if (*s == XML_T(ASCII_ASTERISK)) {
+    if (s[1] != XML_T(ASCII_SLASH) && s[1] != XML_T('\0'))
+      return XML_FALSE;
+    *namePtr = NULL;
+    *patternPtr = s + 1;
+    return XML_TRUE;
+  }
+  if (*s == XML_T(ASCII_LBRACE)) {
+    if (!parser->m_ns)
+      return XML_FALSE;
+    for (s++; *s != XML_T(ASCII_RBRACE); s++) {
+      if (*s == XML_T('\0') || !poolAppendChar(pool, *s)) {
+        poolDiscard(pool);
+        return XML_FALSE;
+      }
+    }
+    s++;
+    if (parser->m_namespaceSeparator
+        && !poolAppendChar(pool, parser->m_namespaceSeparator)) {
+      poolDiscard(pool);
+      return XML_FALSE;
+    }
+  }
+  for (start = s; *s != XML_T('\0') && *s != XML_T(ASCII_SLASH); s++) {
+    if (*s == XML_T(ASCII_LBRACE) || *s == XML_T(ASCII_RBRACE)
+        || *s == XML_T(ASCII_AT) || *s == XML_T(ASCII_ASTERISK)
+        || *s == XML_T(ASCII_LPAREN) || *s == XML_T(ASCII_RPAREN)
+        || !poolAppendChar(pool, *s)) {
+      poolDiscard(pool);
+      return XML_FALSE;
+    }
+  }
+  if (s == start || !poolAppendChar(pool, XML_T('\0'))) {
+    poolDiscard(pool);
+    return XML_FALSE;
+  }
+  *namePtr = poolStart(pool);
+  poolFinish(pool);
+  *patternPtr = s;
+  return XML_TRUE;
+}
+
+static XML_Bool
+pathIsTextTest(const XML_Char *s)
+{
+  static const XML_Char textTest[] = {
+    ASCII_t, ASCII_e, ASCII_x, ASCII_t, ASCII_LPAREN, ASCII_RPAREN, '\0'
+  };
+  int i;
+  for (i = 0; textTest[i] != XML_T('\0'); i++) {
+    if (s[i] != textTest[i])
+      return XML_FALSE;
+  }
+  return (s[i] == XML_T('\0'));
+}
+
+static XML_Bool
+pathCompile(XML_Parser parser, const XML_Char *pattern, PATH_PATTERN *result)
+{
+  PATH_MATCHER * const paths = parser->m_paths;
+
+  result->firstStep = paths->nSteps;
+  result->nSteps = 0;
+  result->attName = NULL;
+  result->text = XML_FALSE;
+  if (*pattern != XML_T(ASCII_SLASH))
+    return XML_FALSE;
+  while (*pattern == XML_T(ASCII_SLASH)) {
+    PATH_STEP *steps;
+    XML_Bool descendant = XML_FALSE;
+    pattern++;
+    if (*pattern == XML_T(ASCII_SLASH)) {
+      descendant = XML_TRUE;
+      pattern++;
+    }
+    if (*pattern == XML_T(ASCII_AT)) {
+      /* an attribute step ends the pattern */
+      pattern++;
+      if (descendant || result->nSteps == 0
+          || *pattern == XML_T(ASCII_ASTERISK)
+          || !pathParseName(parser, &pattern, &result->attName))
+        return XML_FALSE;
+      break;
+    }
+    if (pathIsTextTest(pattern)) {
+      /* so does a text step */
+      if (descendant || result->nSteps == 0)
+        return XML_FALSE;
+      result->text = XML_TRUE;
+      pattern += 6;
+      break;
+    }
+    steps = (PATH_STEP *)pathReserve(parser, paths->steps, &paths->stepsAlloc,
+                                     paths->nSteps + 1, sizeof(PATH_STEP));
+    if (steps == NULL)
+      return XML_FALSE;
+    paths->steps = steps;
+    if (!pathParseName(parser, &pattern, &steps[paths->nSteps].name))
+      return XML_FALSE;
+    steps[paths->nSteps].type = NULL;
+    steps[paths->nSteps].descendant = descendant;
+    paths->nSteps++;
+    result->nSteps++;
+  }
+  return (*pattern == XML_T('\0'));
+}
+
+int XMLCALL
+XML_AddPathPattern(XML_Parser parser, const XML_Char *pattern)
+{
+  PATH_MATCHER *paths;
+  PATH_PATTERN *patterns;
+
+  if (parser == NULL || pattern == NULL)
+    return -1;
+  /* block after XML_Parse()/XML_ParseBuffer() has been called */
+  if (parser->m_parsingStatus.parsing == XML_PARSING || parser->m_parsingStatus.parsing == XML_SUSPENDED)
+    return -1;
+  if (parser->m_paths == NULL) {
+    paths = (PATH_MATCHER *)MALLOC(parser, sizeof(PATH_MATCHER));
+    if (paths == NULL)
+      return -1;
+    memset(paths, 0, sizeof(PATH_MATCHER));
+    poolInit(&paths->pool, MEM(parser, POOLS));
+    parser->m_paths = paths;
+  }
+  paths = parser->m_paths;
+  patterns = (PATH_PATTERN *)pathReserve(parser, paths->patterns,
+                                         &paths->patternsAlloc,
+                                         paths->nPatterns + 1,
+                                         sizeof(PATH_PATTERN));
+  if (patterns == NULL)
+    return -1;
+  paths->patterns = patterns;
+  if (!pathCompile(parser, pattern, &patterns[paths->nPatterns])) {
+    paths->nSteps = patterns[paths->nPatterns].firstStep;
+    return -1;
+  }
+  return paths->nPatterns++;
+}
+
+void XMLCALL
+XML_SetPathElementHandler(XML_Parser parser,
+                          XML_PathStartHandler start,
+                          XML_PathEndHandler end)
+{
+  if (parser == NULL)
+    return;
+  parser->m_pathStartHandler = start;
+  parser->m_pathEndHandler = end;
+}
+
+void XMLCALL
+XML_SetPathCharacterDataHandler(XML_Parser parser,
+                                XML_PathCharacterDataHandler handler)
+{
+  if (parser != NULL)
+    parser->m_pathCharacterDataHandler = handler;
+}
+
+void XMLCALL
+XML_SetPathAttributeHandler(XML_Parser parser,
+                            XML_PathAttributeHandler handler)
+{
+  if (parser != NULL)
+    parser->m_pathAttributeHandler = handler;
+}
+
 int XMLCALL
 XML_SetParamEntityParsing(XML_Parser parser,
                           enum XML_ParamEntityParsing peParsing)
@@ -1800,10 +3914,33 @@ XML_SetHashSalt(XML_Parser parser,
   return 1;
 }
 
+/* Calls the processor; see m_inProcessor. */
+static enum XML_Error
+runProcessor(XML_Parser parser, const char *s, const char *end,
+             const char **nextPtr)
+{
+  enum XML_Error result;
+  parser->m_inProcessor = XML_TRUE;
+  result = parser->m_processor(parser, s, end, nextPtr);
+  parser->m_inProcessor = XML_FALSE;
+  return result;
+}
+
 enum XML_Status XMLCALL
 XML_Parse(XML_Parser parser, const char *s, int len, int isFinal)
 {
-  if ((parser == NULL) || (len < 0) || ((s == NULL) && (len != 0))) {
+  if ((parser == NULL) || (len < 0)) {
+    if (parser != NULL)
+      parser->m_errorCode = XML_ERROR_INVALID_ARGUMENT;
+    return XML_STATUS_ERROR;
+  }
+  return XML_Parse64(parser, s, (size_t)len, isFinal);
+}
+
+enum XML_Status XMLCALL
+XML_Parse64(XML_Parser parser, const char *s, size_t len, int isFinal)
+{
+  if ((parser == NULL) || ((s == NULL) && (len != 0))) {
     if (parser != NULL)
       parser->m_errorCode = XML_ERROR_INVALID_ARGUMENT;
     return XML_STATUS_ERROR;
@@ -1836,7 +3973,7 @@ XML_Parse(XML_Parser parser, const char *s, int len, int isFinal)
        data are the final chunk of input, then we have to check them again
        to detect errors based on that fact.
     */
-    parser->m_errorCode = parser->m_processor(parser, parser->m_bufferPtr, parser->m_parseEndPtr, &parser->m_bufferPtr);
+    parser->m_errorCode = runProcessor(parser, parser->m_bufferPtr, parser->m_parseEndPtr, &parser->m_bufferPtr);
 
     if (parser->m_errorCode == XML_ERROR_NONE) {
       switch (parser->m_parsingStatus.parsing) {
@@ -1869,89 +4006,465 @@ XML_Parse(XML_Parser parser, const char *s, int len, int isFinal)
     parser->m_processor = errorProcessor;
     return XML_STATUS_ERROR;
   }
-#ifndef XML_CONTEXT_BYTES
-  else if (parser->m_bufferPtr == parser->m_bufferEnd) {
-    const char *end;
-    int nLeftOver;
+  else if (parser->m_bufferPtr == parser->m_bufferEnd)
+    return parseInPlace(parser, s, len, (XML_Bool)isFinal);
+  else {
+    /* Complete what was left over from the previous call with as
+       little of s as will do, then parse the rest of s in place. */
+    size_t done = 0;
+    for (;;) {
+      size_t n = (size_t)(parser->m_bufferEnd - parser->m_bufferPtr);
+      enum XML_Status result;
+      void *buff;
+      if (n < INIT_JOIN_SIZE)
+        n = INIT_JOIN_SIZE;
+      if (n >= len - done)
+        break;
+      buff = XML_GetBuffer64(parser, n);
+      if (buff == NULL)
+        return XML_STATUS_ERROR;
+      memcpy(buff, s + done, n);
+      done += n;
+      result = XML_ParseBuffer64(parser, n, XML_FALSE);
+      if (result == XML_STATUS_SUSPENDED) {
+        /* XML_ResumeParser() goes on from the buffer */
+        if (!appendInput(parser, s + done, len - done, (XML_Bool)isFinal))
+          return XML_STATUS_ERROR;
+        return result;
+      }
+      if (result != XML_STATUS_OK
+          || parser->m_parsingStatus.parsing != XML_PARSING)
+        return result;
+      n = (size_t)(parser->m_bufferEnd - parser->m_bufferPtr);
+      if (n <= done) {
+        /* only bytes of s are left: drop them from the buffer */
+        parser->m_bufferEnd -= n;
+        parser->m_parseEndByteIndex -= n;
+        return parseInPlace(parser, s + done - n, len - done + n,
+                            (XML_Bool)isFinal);
+      }
+    }
+    {
+      void *buff = XML_GetBuffer64(parser, len - done);
+      if (buff == NULL)
+        return XML_STATUS_ERROR;
+      memcpy(buff, s + done, len - done);
+      return XML_ParseBuffer64(parser, len - done, isFinal);
+    }
+  }
+}
+
+enum XML_Status XMLCALL
+XML_ParseV(XML_Parser parser, const struct iovec *iov, int iovcnt,
+           int isFinal)
+{
+  enum XML_Status result = XML_STATUS_OK;
+  int last;
+  int i;
+  if ((parser == NULL) || (iovcnt < 0) || ((iov == NULL) && (iovcnt != 0))) {
+    if (parser != NULL)
+      parser->m_errorCode = XML_ERROR_INVALID_ARGUMENT;
+    return XML_STATUS_ERROR;
+  }
+  /* isFinal goes with the last segment that is not empty */
+  for (last = iovcnt - 1; last >= 0; last--)
+    if (iov[last].iov_len != 0)
+      break;
+  if (last < 0)
+    return XML_Parse64(parser, NULL, 0, isFinal);
+  for (i = 0; i <= last; i++) {
+    const XML_Bool final = (XML_Bool)(isFinal && i == last);
+    if (iov[i].iov_len == 0)
+      continue;
+    /* each segment is parsed in place, and only a token left unfinished
+       at its end is joined with the start of the next one */
+    result = XML_Parse64(parser, (const char *)iov[i].iov_base,
+                         iov[i].iov_len, final);
+    if (result != XML_STATUS_OK
+        || parser->m_parsingStatus.parsing != XML_PARSING)
+      break;
+  }
+  if (result == XML_STATUS_SUSPENDED) {
+    /* XML_ResumeParser() goes on from the buffer */
+    for (i++; i <= last; i++) {
+      if (iov[i].iov_base == NULL && iov[i].iov_len != 0) {
+        parser->m_errorCode = XML_ERROR_INVALID_ARGUMENT;
+        return XML_STATUS_ERROR;
+      }
+      if (!appendInput(parser, (const char *)iov[i].iov_base,
+                       iov[i].iov_len, (XML_Bool)isFinal))
+        return XML_STATUS_ERROR;
+    }
+  }
+  return result;
+}
+
+enum XML_Status XMLCALL
+XML_ParseFromReader(XML_Parser parser, XML_Reader reader, void *readerArg)
+{
+  size_t readSize = INIT_READ_SIZE;
+  if (parser == NULL)
+    return XML_STATUS_ERROR;
+  if (reader == NULL) {
+    parser->m_errorCode = XML_ERROR_INVALID_ARGUMENT;
+    return XML_STATUS_ERROR;
+  }
+  if (parser->m_parsingStatus.parsing == XML_SUSPENDED) {
+    const enum XML_Status result = XML_ResumeParser(parser);
+    if (result != XML_STATUS_OK
+        || parser->m_parsingStatus.parsing == XML_FINISHED)
+      return result;
+  }
+  for (;;) {
+    /* Read at least as much as a token left unfinished already holds,
+       so that it is not scanned over and over again as it grows, and
+       fill whatever room the buffer has beyond that. */
+    const size_t pending = (size_t)(parser->m_bufferEnd - parser->m_bufferPtr);
+    size_t room;
+    int nread;
     enum XML_Status result;
-    /* Detect overflow (a+b > MAX <==> b > MAX-a) */
-    if (len > ((XML_Size)-1) / 2 - parser->m_parseEndByteIndex) {
-       parser->m_errorCode = XML_ERROR_NO_MEMORY;
-       parser->m_eventPtr = parser->m_eventEndPtr = NULL;
-       parser->m_processor = errorProcessor;
-       return XML_STATUS_ERROR;
-    }
-    parser->m_parseEndByteIndex += len;
-    parser->m_positionPtr = s;
-    parser->m_parsingStatus.finalBuffer = (XML_Bool)isFinal;
-
-    parser->m_errorCode = parser->m_processor(parser, s, parser->m_parseEndPtr = s + len, &end);
-
-    if (parser->m_errorCode != XML_ERROR_NONE) {
-      parser->m_eventEndPtr = parser->m_eventPtr;
+    char *buff = (char *)XML_GetBuffer64(parser,
+                                         pending > readSize ? pending
+                                                            : readSize);
+    if (buff == NULL)
+      return XML_STATUS_ERROR;
+    room = (size_t)(parser->m_bufferLim - buff);
+    if (room > INT_MAX)
+      room = INT_MAX;
+    nread = reader(readerArg, buff, (int)room);
+    if (nread < 0 || (size_t)nread > room) {
+      parser->m_errorCode = XML_ERROR_READ_FAILED;
+      parser->m_eventPtr = parser->m_eventEndPtr = NULL;
       parser->m_processor = errorProcessor;
       return XML_STATUS_ERROR;
     }
-    else {
-      switch (parser->m_parsingStatus.parsing) {
-      case XML_SUSPENDED:
-        result = XML_STATUS_SUSPENDED;
-        break;
-      case XML_INITIALIZED:
-      case XML_PARSING:
-        if (isFinal) {
-          parser->m_parsingStatus.parsing = XML_FINISHED;
-          return XML_STATUS_OK;
-        }
-      /* fall through */
-      default:
-        result = XML_STATUS_OK;
+    result = XML_ParseBuffer64(parser, (size_t)nread, nread == 0);
+    if (result != XML_STATUS_OK || nread == 0
+        || parser->m_parsingStatus.parsing == XML_FINISHED)
+      return result;
+    /* a reader that fills what it is given has more to come */
+    if ((size_t)nread == room && readSize < MAX_READ_SIZE)
+      readSize *= 2;
+  }
+}
+
+enum XML_Status XMLCALL
+XML_ParseFile(XML_Parser parser, const char *path, int flags)
+{
+  PARSE_FILE *file;
+  enum XML_Status result;
+  if (parser == NULL)
+    return XML_STATUS_ERROR;
+  if (parser->m_file == NULL) {
+    FILE *fp;
+    if (path == NULL) {
+      parser->m_errorCode = XML_ERROR_INVALID_ARGUMENT;
+      return XML_STATUS_ERROR;
+    }
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+      parser->m_errorCode = XML_ERROR_READ_FAILED;
+      return XML_STATUS_ERROR;
+    }
+    /* reads go straight to the parser's buffer */
+    setvbuf(fp, NULL, _IONBF, 0);
+    file = (PARSE_FILE *)MALLOC(parser, sizeof(PARSE_FILE));
+    if (file == NULL) {
+      fclose(fp);
+      parser->m_errorCode = XML_ERROR_NO_MEMORY;
+      return XML_STATUS_ERROR;
+    }
+    file->fp = fp;
+    file->flags = flags;
+#ifdef HAVE_MMAP
+    file->mapped = XML_FALSE;
+    file->offset = 0;
+    file->size = 0;
+    if (!(flags & XML_FILE_NO_MAP)) {
+      struct stat sb;
+      if (fstat(fileno(fp), &sb) == 0 && S_ISREG(sb.st_mode)
+          && sb.st_size > 0) {
+        file->mapped = XML_TRUE;
+        file->size = sb.st_size;
       }
     }
+#endif
+    parser->m_file = file;
+  }
+  file = parser->m_file;
+#ifdef HAVE_MMAP
+  if (file->mapped)
+    result = parseFileMapped(parser, file);
+  else
+#endif
+    result = XML_ParseFromReader(parser, readFile, file->fp);
+  if (result != XML_STATUS_SUSPENDED)
+    fileClose(parser);
+  return result;
+}
 
-    XmlUpdatePosition(parser->m_encoding, parser->m_positionPtr, end, &parser->m_position);
-    nLeftOver = s + len - end;
-    if (nLeftOver) {
-      if (parser->m_buffer == NULL || nLeftOver > parser->m_bufferLim - parser->m_buffer) {
-        /* avoid _signed_ integer overflow */
-        char *temp = NULL;
-        const int bytesToAllocate = (int)((unsigned)len * 2U);
-        if (bytesToAllocate > 0) {
-          temp = (char *)REALLOC(parser, parser->m_buffer, bytesToAllocate);
-        }
-        if (temp == NULL) {
-          parser->m_errorCode = XML_ERROR_NO_MEMORY;
-          parser->m_eventPtr = parser->m_eventEndPtr = NULL;
-          parser->m_processor = errorProcessor;
-          return XML_STATUS_ERROR;
-        }
-        parser->m_buffer = temp;
-        parser->m_bufferLim = parser->m_buffer + bytesToAllocate;
+static int XMLCALL
+readFile(void *readerArg, char *buf, int len)
+{
+  FILE *fp = (FILE *)readerArg;
+  const size_t nread = fread(buf, 1, (size_t)len, fp);
+  if (nread == 0 && ferror(fp))
+    return -1;
+  return (int)nread;
+}
+
+#ifdef HAVE_MMAP
+/* Parses the rest of a regular file a window at a time, each window
+   parsed in place by XML_Parse64(), which copies only a token left
+   unfinished at its end.  A window is unmapped once parsed, and its
+   pages dropped from the page cache with XML_FILE_DROP_PAGES; where
+   mapping fails, the rest is read instead. */
+static enum XML_Status
+parseFileMapped(XML_Parser parser, PARSE_FILE *file)
+{
+  enum XML_Status result = XML_STATUS_OK;
+  if (parser->m_parsingStatus.parsing == XML_SUSPENDED) {
+    result = XML_ResumeParser(parser);
+    if (result != XML_STATUS_OK
+        || parser->m_parsingStatus.parsing == XML_FINISHED)
+      return result;
+  }
+  while (file->offset < file->size) {
+    const off_t rest = file->size - file->offset;
+    const size_t len = rest > FILE_WINDOW_SIZE ? FILE_WINDOW_SIZE
+                                               : (size_t)rest;
+    int mapFlags = MAP_SHARED;
+    void *window;
+#ifdef MAP_POPULATE
+    if (file->flags & XML_FILE_POPULATE)
+      mapFlags |= MAP_POPULATE;
+#endif
+    window = mmap(NULL, len, PROT_READ, mapFlags, fileno(file->fp),
+                  file->offset);
+    if (window == MAP_FAILED) {
+      if (fseeko(file->fp, file->offset, SEEK_SET) != 0) {
+        parser->m_errorCode = XML_ERROR_READ_FAILED;
+        return XML_STATUS_ERROR;
       }
-      memcpy(parser->m_buffer, end, nLeftOver);
+      file->mapped = XML_FALSE;
+      return XML_ParseFromReader(parser, readFile, file->fp);
     }
-    parser->m_bufferPtr = parser->m_buffer;
-    parser->m_bufferEnd = parser->m_buffer + nLeftOver;
-    parser->m_positionPtr = parser->m_bufferPtr;
-    parser->m_parseEndPtr = parser->m_bufferEnd;
-    parser->m_eventPtr = parser->m_bufferPtr;
-    parser->m_eventEndPtr = parser->m_bufferPtr;
-    return result;
+#ifdef MADV_SEQUENTIAL
+    madvise(window, len, MADV_SEQUENTIAL);
+#endif
+    result = XML_Parse64(parser, (const char *)window, len,
+                         (XML_Bool)((off_t)len == rest));
+    munmap(window, len);
+#ifdef POSIX_FADV_DONTNEED
+    if (file->flags & XML_FILE_DROP_PAGES)
+      posix_fadvise(fileno(file->fp), file->offset, (off_t)len,
+                    POSIX_FADV_DONTNEED);
+#endif
+    file->offset += (off_t)len;
+    if (result != XML_STATUS_OK
+        || parser->m_parsingStatus.parsing == XML_FINISHED)
+      return result;
+  }
+  return result;
+}
+#endif /* HAVE_MMAP */
+
+static void
+fileClose(XML_Parser parser)
+{
+  if (parser->m_file == NULL)
+    return;
+  fclose(parser->m_file->fp);
+  FREE(parser, parser->m_file, sizeof(PARSE_FILE));
+  parser->m_file = NULL;
+}
+
+/* Appends len bytes at s to the input of a suspended parser, for
+   XML_ResumeParser() to parse, the last of them being final or not. */
+static XML_Bool
+appendInput(XML_Parser parser, const char *s, size_t len, XML_Bool isFinal)
+{
+  void *buff = getBuffer(parser, len, (size_t)-1);
+  if (buff == NULL)
+    return XML_FALSE;
+  if (len != 0)
+    memcpy(buff, s, len);
+  parser->m_bufferEnd += len;
+  parser->m_parseEndPtr = parser->m_bufferEnd;
+  parser->m_parseEndByteIndex += len;
+  parser->m_positionPtr = parser->m_bufferPtr;
+  parser->m_parsingStatus.finalBuffer = isFinal;
+  return XML_TRUE;
+}
+
+/* Parses len bytes at s in place, rather than copying them to the
+   buffer first; the buffer must hold no unparsed input.  Once parsing
+   stops, the unparsed rest of s and the context before it are copied,
+   see keepInput().
+*/
+static enum XML_Status
+parseInPlace(XML_Parser parser, const char *s, size_t len, XML_Bool isFinal)
+{
+  const char *end;
+  enum XML_Status result;
+  /* Detect overflow (a+b > MAX <==> b > MAX-a) */
+  if (len > ((XML_Size)-1) / 2 - parser->m_parseEndByteIndex) {
+     parser->m_errorCode = XML_ERROR_NO_MEMORY;
+     parser->m_eventPtr = parser->m_eventEndPtr = NULL;
+     parser->m_processor = errorProcessor;
+     return XML_STATUS_ERROR;
+  }
+  parser->m_parseEndByteIndex += len;
+  parser->m_positionPtr = s;
+  parser->m_parseStartPtr = s;
+  parser->m_parsingStatus.finalBuffer = isFinal;
+
+  parser->m_errorCode = runProcessor(parser, s, parser->m_parseEndPtr = s + len, &end);
+  parser->m_parseStartPtr = NULL;
+
+  if (parser->m_errorCode != XML_ERROR_NONE) {
+    parser->m_eventEndPtr = parser->m_eventPtr;
+    parser->m_processor = errorProcessor;
+    keepEventContext(parser, s, len);
+    return XML_STATUS_ERROR;
   }
-#endif  /* not defined XML_CONTEXT_BYTES */
   else {
-    void *buff = XML_GetBuffer(parser, len);
-    if (buff == NULL)
-      return XML_STATUS_ERROR;
-    else {
-      memcpy(buff, s, len);
-      return XML_ParseBuffer(parser, len, isFinal);
+    switch (parser->m_parsingStatus.parsing) {
+    case XML_SUSPENDED:
+      result = XML_STATUS_SUSPENDED;
+      break;
+    case XML_INITIALIZED:
+    case XML_PARSING:
+      if (isFinal) {
+        parser->m_parsingStatus.parsing = XML_FINISHED;
+        keepEventContext(parser, s, len);
+        return XML_STATUS_OK;
+      }
+    /* fall through */
+    default:
+      result = XML_STATUS_OK;
     }
   }
+
+  XmlUpdatePosition(parser->m_encoding, parser->m_positionPtr, end, &parser->m_position);
+  if (!keepInput(parser, s, end, s + len)) {
+    parser->m_errorCode = XML_ERROR_NO_MEMORY;
+    parser->m_eventPtr = parser->m_eventEndPtr = NULL;
+    parser->m_processor = errorProcessor;
+    return XML_STATUS_ERROR;
+  }
+  return result;
+}
+
+/* Copies the input from 'from' to 'to', within the caller's input at s
+   just parsed in place, to the buffer, together with up to
+   XML_CONTEXT_BYTES of context before it taken from s and, where s
+   has too little, from what the buffer held before.  The buffer then
+   continues at 'from' and ends at 'to'.
+*/
+static XML_Bool
+keepInput(XML_Parser parser, const char *s, const char *from, const char *to)
+{
+  size_t keep = 0;
+  size_t oldKeep = 0;
+  size_t size;
+  const char *base;
+  char *newBase;
+#ifdef XML_CONTEXT_BYTES
+  keep = (size_t)(from - s);
+  if (keep > XML_CONTEXT_BYTES)
+    keep = XML_CONTEXT_BYTES;
+  if (parser->m_bufferPtr != NULL) {
+    oldKeep = (size_t)(parser->m_bufferPtr - parser->m_buffer);
+    if (oldKeep > XML_CONTEXT_BYTES - keep)
+      oldKeep = XML_CONTEXT_BYTES - keep;
+  }
+#else
+  (void)s;
+#endif  /* defined XML_CONTEXT_BYTES */
+  size = oldKeep + keep + (size_t)(to - from);
+  /* a suspended parser needs a buffer for its event pointers to point
+     into even with no input to keep */
+  if (size > (size_t)(parser->m_bufferLim - parser->m_buffer)
+      || bufferOversized(parser, size)
+      || (parser->m_buffer == NULL
+          && parser->m_parsingStatus.parsing == XML_SUSPENDED)) {
+    const size_t bufferSize = grownBufferSize(parser, 0, size);
+    char *newBuf;
+    if (bufferSize == 0)
+      return XML_FALSE;
+    newBuf = (char *)MALLOC_IN(parser, BUFFER, bufferSize);
+    if (newBuf == NULL)
+      return XML_FALSE;
+    if (oldKeep)
+      memcpy(newBuf, parser->m_bufferPtr - oldKeep, oldKeep);
+    FREE_IN(parser, BUFFER, parser->m_buffer,
+            parser->m_bufferLim - parser->m_buffer);
+    parser->m_buffer = newBuf;
+    parser->m_bufferLim = newBuf + bufferSize;
+  }
+  else if (oldKeep)
+    memmove(parser->m_buffer, parser->m_bufferPtr - oldKeep, oldKeep);
+  base = from - keep;
+  newBase = parser->m_buffer + oldKeep;
+  if (size > oldKeep)
+    memcpy(newBase, base, size - oldKeep);
+  parser->m_bufferPtr = newBase + keep;
+  parser->m_bufferEnd = newBase + keep + (to - from);
+  parser->m_positionPtr = parser->m_bufferPtr;
+  parser->m_parseEndPtr = parser->m_bufferEnd;
+  if (parser->m_eventPtr >= base && parser->m_eventPtr <= to) {
+    parser->m_eventPtr = newBase + (parser->m_eventPtr - base);
+    if (parser->m_eventEndPtr >= base && parser->m_eventEndPtr <= to)
+      parser->m_eventEndPtr = newBase + (parser->m_eventEndPtr - base);
+    else
+      parser->m_eventEndPtr = parser->m_eventPtr;
+  }
+  else
+    parser->m_eventPtr = parser->m_eventEndPtr = parser->m_bufferPtr;
+  return XML_TRUE;
+}
+
+/* Once parsing in place ended, keeps the input around the last event
+   for XML_GetInputContext(), as parsing from the buffer would have.
+   Without XML_CONTEXT_BYTES the event pointers keep pointing into s.
+*/
+static void
+keepEventContext(XML_Parser parser, const char *s, size_t len)
+{
+#ifdef XML_CONTEXT_BYTES
+  const char *eventPtr = parser->m_eventPtr;
+  const char *to;
+  if (eventPtr == NULL || eventPtr < s || eventPtr > s + len)
+    return;
+  XmlUpdatePosition(parser->m_encoding, parser->m_positionPtr, eventPtr,
+                    &parser->m_position);
+  to = ((size_t)(s + len - eventPtr) > XML_CONTEXT_BYTES)
+       ? eventPtr + XML_CONTEXT_BYTES : s + len;
+  if (keepInput(parser, s, eventPtr, to))
+    parser->m_parseEndByteIndex -= (s + len) - to;
+  else
+    parser->m_eventPtr = parser->m_eventEndPtr = NULL;
+#else
+  (void)parser;
+  (void)s;
+  (void)len;
+#endif  /* defined XML_CONTEXT_BYTES */
 }
 
 enum XML_Status XMLCALL
 XML_ParseBuffer(XML_Parser parser, int len, int isFinal)
+{
+  if ((parser == NULL) || (len < 0)) {
+    if (parser != NULL)
+      parser->m_errorCode = XML_ERROR_INVALID_ARGUMENT;
+    return XML_STATUS_ERROR;
+  }
+  return XML_ParseBuffer64(parser, (size_t)len, isFinal);
+}
+
+enum XML_Status XMLCALL
+XML_ParseBuffer64(XML_Parser parser, size_t len, int isFinal)
 {
   const char *start;
   enum XML_Status result = XML_STATUS_OK;
@@ -1982,7 +4495,7 @@ XML_ParseBuffer(XML_Parser parser, int len, int isFinal)
   parser->m_parseEndByteIndex += len;
   parser->m_parsingStatus.finalBuffer = (XML_Bool)isFinal;
 
-  parser->m_errorCode = parser->m_processor(parser, start, parser->m_parseEndPtr, &parser->m_bufferPtr);
+  parser->m_errorCode = runProcessor(parser, start, parser->m_parseEndPtr, &parser->m_bufferPtr);
 
   if (parser->m_errorCode != XML_ERROR_NONE) {
     parser->m_eventEndPtr = parser->m_eventPtr;
@@ -2027,86 +4540,160 @@ XML_GetBuffer(XML_Parser parser, int len)
     return NULL;
   default: ;
   }
+  return getBuffer(parser, (size_t)len, INT_MAX);
+}
+
+void * XMLCALL
+XML_GetBuffer64(XML_Parser parser, size_t len)
+{
+  if (parser == NULL)
+    return NULL;
+  switch (parser->m_parsingStatus.parsing) {
+  case XML_SUSPENDED:
+    parser->m_errorCode = XML_ERROR_SUSPENDED;
+    return NULL;
+  case XML_FINISHED:
+    parser->m_errorCode = XML_ERROR_FINISHED;
+    return NULL;
+  default: ;
+  }
+  return getBuffer(parser, len, (size_t)-1);
+}
 
-  if (len > parser->m_bufferLim - parser->m_bufferEnd) {
+/* XML_GetBuffer() in any parsing state, for a buffer of at most
+   maxSize bytes */
+static void *
+getBuffer(XML_Parser parser, size_t len, size_t maxSize)
+{
+  const size_t oldBufferSize
+      = (size_t)(parser->m_bufferLim - parser->m_buffer);
+  const size_t live = (size_t)(parser->m_bufferEnd - parser->m_bufferPtr);
+  size_t keep = 0;
+  size_t neededSize;
+  XML_Bool shrink;
+  /* offsets of the event from the input kept, if it is kept */
+  XML_Bool keepEvent = XML_FALSE;
+  size_t eventOffset = 0;
+  size_t eventEndOffset = 0;
 #ifdef XML_CONTEXT_BYTES
-    int keep;
+  keep = (size_t)(parser->m_bufferPtr - parser->m_buffer);
+  if (keep > XML_CONTEXT_BYTES)
+    keep = XML_CONTEXT_BYTES;
 #endif  /* defined XML_CONTEXT_BYTES */
-    /* Do not invoke signed arithmetic overflow: */
-    int neededSize = (int) ((unsigned)len + (unsigned)(parser->m_bufferEnd - parser->m_bufferPtr));
-    if (neededSize < 0) {
+  /* A suspended parser given more input by appendInput() keeps the
+     current event, for XML_GetCurrentByteIndex() and
+     XML_GetInputContext() to go on reporting it. */
+  if (parser->m_parsingStatus.parsing == XML_SUSPENDED
+      && parser->m_buffer != NULL && parser->m_eventPtr != NULL
+      && parser->m_eventPtr >= parser->m_buffer
+      && parser->m_eventPtr <= parser->m_bufferEnd
+      && parser->m_eventEndPtr >= parser->m_eventPtr
+      && parser->m_eventEndPtr <= parser->m_bufferEnd) {
+    if (parser->m_eventPtr < parser->m_bufferPtr - keep)
+      keep = (size_t)(parser->m_bufferPtr - parser->m_eventPtr);
+    keepEvent = XML_TRUE;
+    eventOffset = (size_t)(parser->m_eventPtr - (parser->m_bufferPtr - keep));
+    eventEndOffset
+        = (size_t)(parser->m_eventEndPtr - (parser->m_bufferPtr - keep));
+  }
+  if (live + keep > maxSize || len > maxSize - live - keep) {
+    parser->m_errorCode = XML_ERROR_NO_MEMORY;
+    return NULL;
+  }
+  neededSize = len + live + keep;
+  shrink = bufferOversized(parser, neededSize);
+  if (len <= (size_t)(parser->m_bufferLim - parser->m_bufferEnd) && !shrink)
+    return parser->m_bufferEnd;
+
+  /* Moving the input kept to the front of the buffer only pays if
+     that frees at least as much room as it moves; otherwise a long
+     token would be moved again and again, and the buffer grows
+     instead. */
+  if (!shrink && neededSize <= oldBufferSize
+      && live + keep <= oldBufferSize - neededSize) {
+    const size_t offset
+        = (size_t)(parser->m_bufferPtr - parser->m_buffer) - keep;
+    memmove(parser->m_buffer, parser->m_bufferPtr - keep, live + keep);
+    parser->m_bufferEnd -= offset;
+    parser->m_bufferPtr -= offset;
+  }
+  else {
+    char *newBuf;
+    size_t bufferSize
+        = grownBufferSize(parser, shrink ? 0 : oldBufferSize, neededSize);
+    if (bufferSize == 0 || bufferSize > maxSize) {
       parser->m_errorCode = XML_ERROR_NO_MEMORY;
       return NULL;
     }
-#ifdef XML_CONTEXT_BYTES
-    keep = (int)(parser->m_bufferPtr - parser->m_buffer);
-    if (keep > XML_CONTEXT_BYTES)
-      keep = XML_CONTEXT_BYTES;
-    neededSize += keep;
-#endif  /* defined XML_CONTEXT_BYTES */
-    if (neededSize  <= parser->m_bufferLim - parser->m_buffer) {
-#ifdef XML_CONTEXT_BYTES
-      if (keep < parser->m_bufferPtr - parser->m_buffer) {
-        int offset = (int)(parser->m_bufferPtr - parser->m_buffer) - keep;
-        memmove(parser->m_buffer, &parser->m_buffer[offset], parser->m_bufferEnd - parser->m_bufferPtr + keep);
-        parser->m_bufferEnd -= offset;
-        parser->m_bufferPtr -= offset;
-      }
-#else
-      memmove(parser->m_buffer, parser->m_bufferPtr, parser->m_bufferEnd - parser->m_bufferPtr);
-      parser->m_bufferEnd = parser->m_buffer + (parser->m_bufferEnd - parser->m_bufferPtr);
-      parser->m_bufferPtr = parser->m_buffer;
-#endif  /* not defined XML_CONTEXT_BYTES */
+    newBuf = (char *)MALLOC_IN(parser, BUFFER, bufferSize);
+    if (newBuf == 0) {
+      parser->m_errorCode = XML_ERROR_NO_MEMORY;
+      return NULL;
     }
-    else {
-      char *newBuf;
-      int bufferSize = (int)(parser->m_bufferLim - parser->m_bufferPtr);
-      if (bufferSize == 0)
-        bufferSize = INIT_BUFFER_SIZE;
-      do {
-        /* Do not invoke signed arithmetic overflow: */
-        bufferSize = (int) (2U * (unsigned) bufferSize);
-      } while (bufferSize < neededSize && bufferSize > 0);
-      if (bufferSize <= 0) {
-        parser->m_errorCode = XML_ERROR_NO_MEMORY;
-        return NULL;
-      }
-      newBuf = (char *)MALLOC(parser, bufferSize);
-      if (newBuf == 0) {
-        parser->m_errorCode = XML_ERROR_NO_MEMORY;
-        return NULL;
-      }
-      parser->m_bufferLim = newBuf + bufferSize;
-#ifdef XML_CONTEXT_BYTES
-      if (parser->m_bufferPtr) {
-        int keep = (int)(parser->m_bufferPtr - parser->m_buffer);
-        if (keep > XML_CONTEXT_BYTES)
-          keep = XML_CONTEXT_BYTES;
-        memcpy(newBuf, &parser->m_bufferPtr[-keep], parser->m_bufferEnd - parser->m_bufferPtr + keep);
-        FREE(parser, parser->m_buffer);
-        parser->m_buffer = newBuf;
-        parser->m_bufferEnd = parser->m_buffer + (parser->m_bufferEnd - parser->m_bufferPtr) + keep;
-        parser->m_bufferPtr = parser->m_buffer + keep;
-      }
-      else {
-        parser->m_bufferEnd = newBuf + (parser->m_bufferEnd - parser->m_bufferPtr);
-        parser->m_bufferPtr = parser->m_buffer = newBuf;
-      }
-#else
-      if (parser->m_bufferPtr) {
-        memcpy(newBuf, parser->m_bufferPtr, parser->m_bufferEnd - parser->m_bufferPtr);
-        FREE(parser, parser->m_buffer);
-      }
-      parser->m_bufferEnd = newBuf + (parser->m_bufferEnd - parser->m_bufferPtr);
-      parser->m_bufferPtr = parser->m_buffer = newBuf;
-#endif  /* not defined XML_CONTEXT_BYTES */
+    if (parser->m_bufferPtr) {
+      memcpy(newBuf, parser->m_bufferPtr - keep, live + keep);
+      FREE_IN(parser, BUFFER, parser->m_buffer, oldBufferSize);
     }
-    parser->m_eventPtr = parser->m_eventEndPtr = NULL;
-    parser->m_positionPtr = NULL;
+    parser->m_buffer = newBuf;
+    parser->m_bufferLim = newBuf + bufferSize;
+    parser->m_bufferPtr = newBuf + keep;
+    parser->m_bufferEnd = newBuf + keep + live;
+  }
+  if (keepEvent) {
+    parser->m_eventPtr = parser->m_bufferPtr - keep + eventOffset;
+    parser->m_eventEndPtr = parser->m_bufferPtr - keep + eventEndOffset;
   }
+  else
+    parser->m_eventPtr = parser->m_eventEndPtr = NULL;
+  parser->m_positionPtr = NULL;
   return parser->m_bufferEnd;
 }
 
+/* The size a buffer of bufferSize bytes, or a new one if 0, grows to
+   for neededSize bytes; 0 if too large. */
+static size_t
+grownBufferSize(XML_Parser parser, size_t bufferSize, size_t neededSize)
+{
+  if (bufferSize == 0)
+    bufferSize = (size_t)parser->m_bufferInitSize;
+  while (bufferSize < neededSize) {
+    size_t step = bufferSize / 100 * parser->m_bufferGrowth
+                  + bufferSize % 100 * parser->m_bufferGrowth / 100;
+    if (step == 0)
+      step = 1;
+    if (bufferSize > (size_t)-1 - step)
+      return 0;
+    bufferSize += step;
+  }
+  return bufferSize;
+}
+
+/* Whether the buffer is to be replaced by a smaller one, holding
+   neededSize bytes, see XML_SetBufferPolicy(). */
+static XML_Bool
+bufferOversized(XML_Parser parser, size_t neededSize)
+{
+  const size_t bufferSize
+      = (size_t)(parser->m_bufferLim - parser->m_buffer);
+  return (XML_Bool)(parser->m_bufferShrinkSize != 0
+                    && bufferSize > (size_t)parser->m_bufferShrinkSize
+                    && neededSize <= bufferSize / 4
+                    && grownBufferSize(parser, 0, neededSize) < bufferSize);
+}
+
+XML_Bool XMLCALL
+XML_SetBufferPolicy(XML_Parser parser, int initialSize, int growthPercent,
+                    int shrinkSize)
+{
+  if (parser == NULL || initialSize < 0 || shrinkSize < 0
+      || (growthPercent != 0 && growthPercent < 10))
+    return XML_FALSE;
+  parser->m_bufferInitSize = initialSize ? initialSize : INIT_BUFFER_SIZE;
+  parser->m_bufferGrowth = growthPercent ? growthPercent : BUFFER_GROWTH;
+  parser->m_bufferShrinkSize = shrinkSize;
+  return XML_TRUE;
+}
+
 enum XML_Status XMLCALL
 XML_StopParser(XML_Parser parser, XML_Bool resumable)
 {
@@ -2152,7 +4739,7 @@ XML_ResumeParser(XML_Parser parser)
   }
   parser->m_parsingStatus.parsing = XML_PARSING;
 
-  parser->m_errorCode = parser->m_processor(parser, parser->m_bufferPtr, parser->m_parseEndPtr, &parser->m_bufferPtr);
+  parser->m_errorCode = runProcessor(parser, parser->m_bufferPtr, parser->m_parseEndPtr, &parser->m_bufferPtr);
 
   if (parser->m_errorCode != XML_ERROR_NONE) {
     parser->m_eventEndPtr = parser->m_eventPtr;
@@ -2179,6 +4766,22 @@ XML_ResumeParser(XML_Parser parser)
   return result;
 }
 
+enum XML_Status XMLCALL
+XML_SkipCurrentElement(XML_Parser parser)
+{
+  if (parser == NULL)
+    return XML_STATUS_ERROR;
+  if (parser->m_parsingStatus.parsing != XML_PARSING
+      && parser->m_parsingStatus.parsing != XML_SUSPENDED)
+    return XML_STATUS_ERROR;
+  /* an empty root element, being started, has no content either */
+  if (parser->m_tagLevel == 0)
+    return parser->m_inStartTag ? XML_STATUS_OK : XML_STATUS_ERROR;
+  parser->m_skipTagLevel = parser->m_tagLevel;
+  parser->m_skipExpandsEntities = XML_FALSE;
+  return XML_STATUS_OK;
+}
+
 void XMLCALL
 XML_GetParsingStatus(XML_Parser parser, XML_ParsingStatus *status)
 {
@@ -2193,6 +4796,10 @@ XML_GetErrorCode(XML_Parser parser)
 {
   if (parser == NULL)
     return XML_ERROR_INVALID_ARGUMENT;
+  /* allocations refused by the limit fail like any other */
+  if (parser->m_errorCode == XML_ERROR_NO_MEMORY
+      && MEM(parser, OTHER)->account->limitExceeded)
+    return XML_ERROR_MEMORY_LIMIT;
   return parser->m_errorCode;
 }
 
@@ -2211,24 +4818,51 @@ XML_GetCurrentByteCount(XML_Parser parser)
 {
   if (parser == NULL)
     return 0;
-  if (parser->m_eventEndPtr && parser->m_eventPtr)
-    return (int)(parser->m_eventEndPtr - parser->m_eventPtr);
+  if (parser->m_eventEndPtr && parser->m_eventPtr) {
+    const size_t count = (size_t)(parser->m_eventEndPtr - parser->m_eventPtr);
+    return count > INT_MAX ? INT_MAX : (int)count;
+  }
   return 0;
 }
 
+#ifdef XML_CONTEXT_BYTES
+/* Reports the part of [start, end) around event as the input context;
+   over INT_MAX bytes only a window of INT_MAX bytes is reported.
+*/
+static const char *
+inputContext(const char *start, const char *event, const char *end,
+             int *offset, int *size)
+{
+  if ((size_t)(end - start) > INT_MAX) {
+    if ((size_t)(event - start) > INT_MAX / 2)
+      start = event - INT_MAX / 2;
+    if ((size_t)(end - start) > INT_MAX)
+      end = start + INT_MAX;
+  }
+  if (offset != NULL)
+    *offset = (int)(event - start);
+  if (size != NULL)
+    *size   = (int)(end - start);
+  return start;
+}
+#endif /* defined XML_CONTEXT_BYTES */
+
 const char * XMLCALL
 XML_GetInputContext(XML_Parser parser, int *offset, int *size)
 {
 #ifdef XML_CONTEXT_BYTES
   if (parser == NULL)
     return NULL;
-  if (parser->m_eventPtr && parser->m_buffer) {
-    if (offset != NULL)
-      *offset = (int)(parser->m_eventPtr - parser->m_buffer);
-    if (size != NULL)
-      *size   = (int)(parser->m_bufferEnd - parser->m_buffer);
-    return parser->m_buffer;
-  }
+  if (parser->m_eventPtr && parser->m_parseStartPtr
+      && parser->m_eventPtr >= parser->m_parseStartPtr
+      && parser->m_eventPtr <= parser->m_parseEndPtr) {
+    /* only the context within the input parsed in place */
+    return inputContext(parser->m_parseStartPtr, parser->m_eventPtr,
+                        parser->m_parseEndPtr, offset, size);
+  }
+  if (parser->m_eventPtr && parser->m_buffer)
+    return inputContext(parser->m_buffer, parser->m_eventPtr,
+                        parser->m_bufferEnd, offset, size);
 #else
   (void)parser;
   (void)offset;
@@ -2265,7 +4899,7 @@ void XMLCALL
 XML_FreeContentModel(XML_Parser parser, XML_Content *model)
 {
   if (parser != NULL)
-    FREE(parser, model);
+    appFree(MEM(parser, OTHER), model);
 }
 
 void * XMLCALL
@@ -2273,7 +4907,7 @@ XML_MemMalloc(XML_Parser parser, size_t size)
 {
   if (parser == NULL)
     return NULL;
-  return MALLOC(parser, size);
+  return appMalloc(MEM(parser, OTHER), size);
 }
 
 void * XMLCALL
@@ -2281,14 +4915,14 @@ XML_MemRealloc(XML_Parser parser, void *ptr, size_t size)
 {
   if (parser == NULL)
     return NULL;
-  return REALLOC(parser, ptr, size);
+  return appRealloc(MEM(parser, OTHER), ptr, size);
 }
 
 void XMLCALL
 XML_MemFree(XML_Parser parser, void *ptr)
 {
   if (parser != NULL)
-    FREE(parser, ptr);
+    appFree(MEM(parser, OTHER), ptr);
 }
 
 void XMLCALL
@@ -2399,6 +5033,10 @@ XML_ErrorString(enum XML_Error code)
   /* Added in 2.2.5. */
   case XML_ERROR_INVALID_ARGUMENT:  /* Constant added in 2.2.1, already */
     return XML_L("invalid argument");
+  case XML_ERROR_MEMORY_LIMIT:
+    return XML_L("memory limit exceeded");
+  case XML_ERROR_READ_FAILED:
+    return XML_L("reading input failed");
   }
   return NULL;
 }
@@ -2474,54 +5112,188 @@ XML_GetFeatureList(void)
   return features;
 }
 
-/* Initially tag->rawName always points into the parse buffer;
-   for those TAG instances opened while the current parse buffer was
-   processed, and not yet closed, we need to store tag->rawName in a more
-   permanent location, since the parse buffer is about to be discarded.
+/* Whether the end tag name at rawName, in the document encoding,
+   is the name of the open element tag.  Names that must be converted
+   are compared a piece at a time, without storing them.
+*/
+static XML_Bool
+tagNameMatches(const ENCODING *enc, const char *rawName, const TAG *tag)
+{
+  const char *rawNameEnd = rawName + XmlNameLength(enc, rawName);
+  const XML_Char *name = (const XML_Char *)tag->buf;
+  const XML_Char *nameEnd = name + tag->name.strLen;
+  if (!MUST_CONVERT(enc, rawName))
+    return (XML_Bool)((size_t)(rawNameEnd - rawName)
+                      == tag->name.strLen * sizeof(XML_Char)
+                      && memcmp(name, rawName, rawNameEnd - rawName) == 0);
+  while (rawName < rawNameEnd) {
+    XML_Char buf[64];
+    XML_Char *toPtr = buf;
+    const enum XML_Convert_Result convert_res
+        = XmlConvert(enc, &rawName, rawNameEnd, (ICHAR **)&toPtr,
+                     (ICHAR *)(buf + sizeof(buf) / sizeof(XML_Char)));
+    if (toPtr - buf > nameEnd - name
+        || memcmp(buf, name, (toPtr - buf) * sizeof(XML_Char)) != 0)
+      return XML_FALSE;
+    name += toPtr - buf;
+    if (convert_res == XML_CONVERT_INPUT_INCOMPLETE)
+      break;
+  }
+  return (XML_Bool)(name == nameEnd);
+}
+
+/* Stores the name of the element just opened, converted from the
+   name at rawName in the document encoding, in its buf.
+*/
+static XML_Bool
+storeTagName(XML_Parser parser, const ENCODING *enc, const char *rawName)
+{
+  TAG *tag = &parser->m_tags[parser->m_nTags - 1];
+  const char *rawNameEnd = rawName + XmlNameLength(enc, rawName);
+  XML_Char *toPtr;
+  /* enough for the converted name in any encoding, usually */
+  size_t bufSize = 2 * ROUND_UP(rawNameEnd - rawName, sizeof(XML_Char))
+                   + sizeof(XML_Char);
+  for (;;) {
+    enum XML_Convert_Result convert_res;
+    if (!reserveTagBuf(parser, bufSize))
+      return XML_FALSE;
+    toPtr = (XML_Char *)tag->bufEnd;
+    convert_res = XmlConvert(enc, &rawName, rawNameEnd, (ICHAR **)&toPtr,
+                             (ICHAR *)parser->m_tagNamesLim - 1);
+    tag->bufEnd = (char *)toPtr;
+    if ((rawName >= rawNameEnd)
+        || (convert_res == XML_CONVERT_INPUT_INCOMPLETE))
+      break;
+    bufSize = (parser->m_tagNamesLim - tag->buf) * 2;
+  }
+  *toPtr = XML_T('\0');
+  tag->bufEnd = (char *)(toPtr + 1);
+  tag->name.str = (XML_Char *)tag->buf;
+  tag->name.strLen = (int)(toPtr - (XML_Char *)tag->buf);
+  return XML_TRUE;
+}
+
+/* Opens an element: returns a new entry at the end of m_tags, whose
+   buf starts, still empty, where its parent's ends.
+*/
+static TAG *
+pushTag(XML_Parser parser)
+{
+  TAG *tag;
+  if (parser->m_nTags == parser->m_tagsSize) {
+    int newSize = parser->m_tagsSize ? parser->m_tagsSize * 2 : INIT_TAGS_SIZE;
+    TAG *temp;
+    if (newSize < 0 || (size_t)newSize > (size_t)-1 / sizeof(TAG))
+      return NULL;
+    temp = (TAG *)REALLOC_IN(parser, TAGS, parser->m_tags,
+                             parser->m_tagsSize * sizeof(TAG),
+                             newSize * sizeof(TAG));
+    if (temp == NULL)
+      return NULL;
+    parser->m_tags = temp;
+    parser->m_tagsSize = newSize;
+  }
+  if (parser->m_tagNames == NULL && !tagNamesResize(parser, INIT_TAG_NAMES_SIZE))
+    return NULL;
+  tag = &parser->m_tags[parser->m_nTags];
+  tag->buf = parser->m_nTags ? tag[-1].bufEnd : parser->m_tagNames;
+  tag->bufEnd = tag->buf;
+  tag->name.str = NULL;
+  tag->name.strLen = 0;
+  tag->name.localPart = NULL;
+  tag->name.prefix = NULL;
+  tag->bindings = NULL;
+  parser->m_nTags++;
+  return tag;
+}
+
+/* Makes room for size bytes in the buf of the innermost element; the
+   names of all open elements may move.
+*/
+static XML_Bool
+reserveTagBuf(XML_Parser parser, size_t size)
+{
+  const TAG *tag = &parser->m_tags[parser->m_nTags - 1];
+  size_t used = tag->buf - parser->m_tagNames;
+  size_t newSize = parser->m_tagNamesLim - parser->m_tagNames;
+  if (size <= (size_t)(parser->m_tagNamesLim - tag->buf))
+    return XML_TRUE;
+  while (newSize - used < size) {
+    if (newSize > (size_t)-1 / 2)
+      return XML_FALSE;
+    newSize *= 2;
+  }
+  return tagNamesResize(parser, newSize);
+}
+
+/* Moves the names of the open elements to a new arena of newSize
+   bytes, a multiple of sizeof(XML_Char) large enough to hold them,
+   and updates the pointers into the old one.  A newSize of 0 frees the
+   arena of a parser without open elements.
 */
 static XML_Bool
-storeRawNames(XML_Parser parser)
-{
-  TAG *tag = parser->m_tagStack;
-  while (tag) {
-    int bufSize;
-    int nameLen = sizeof(XML_Char) * (tag->name.strLen + 1);
-    char *rawNameBuf = tag->buf + nameLen;
-    /* Stop if already stored.  Since m_tagStack is a stack, we can stop
-       at the first entry that has already been copied; everything
-       below it in the stack is already been accounted for in a
-       previous call to this function.
-    */
-    if (tag->rawName == rawNameBuf)
-      break;
-    /* For re-use purposes we need to ensure that the
-       size of tag->buf is a multiple of sizeof(XML_Char).
-    */
-    bufSize = nameLen + ROUND_UP(tag->rawNameLength, sizeof(XML_Char));
-    if (bufSize > tag->bufEnd - tag->buf) {
-      char *temp = (char *)REALLOC(parser, tag->buf, bufSize);
+tagNamesResize(XML_Parser parser, size_t newSize)
+{
+  char *oldNames = parser->m_tagNames;
+  char *newNames = NULL;
+  int i;
+  if (newSize != 0) {
+    newNames = (char *)MALLOC_IN(parser, TAGS, newSize);
+    if (newNames == NULL)
+      return XML_FALSE;
+    if (parser->m_nTags)
+      memcpy(newNames, oldNames,
+             parser->m_tags[parser->m_nTags - 1].bufEnd - oldNames);
+  }
+  for (i = 0; i < parser->m_nTags; i++) {
+    TAG *tag = &parser->m_tags[i];
+    char *buf = newNames + (tag->buf - oldNames);
+    /* tag->name.str points to tag->buf unless it has been expanded
+       with a namespace URI; tag->name.localPart always does */
+    if (tag->name.str == (XML_Char *)tag->buf)
+      tag->name.str = (XML_Char *)buf;
+    if (tag->name.localPart)
+      tag->name.localPart = (XML_Char *)buf + (tag->name.localPart -
+                                               (XML_Char *)tag->buf);
+    tag->bufEnd = buf + (tag->bufEnd - tag->buf);
+    tag->buf = buf;
+  }
+  FREE_IN(parser, TAGS, oldNames, parser->m_tagNamesLim - oldNames);
+  parser->m_tagNames = newNames;
+  parser->m_tagNamesLim = newNames ? newNames + newSize : NULL;
+  return XML_TRUE;
+}
+
+/* Shrinks m_tags and the name arena to what the open elements need,
+   see XML_TrimMemory(). */
+static void
+trimTags(XML_Parser parser)
+{
+  size_t namesSize = 0;
+  int tagsSize = 0;
+  if (parser->m_nTags) {
+    tagsSize = parser->m_nTags < INIT_TAGS_SIZE
+               ? INIT_TAGS_SIZE : parser->m_nTags;
+    namesSize = ROUND_UP(parser->m_tags[parser->m_nTags - 1].bufEnd
+                         - parser->m_tagNames, sizeof(XML_Char));
+    if (namesSize < INIT_TAG_NAMES_SIZE)
+      namesSize = INIT_TAG_NAMES_SIZE;
+  }
+  if (namesSize < (size_t)(parser->m_tagNamesLim - parser->m_tagNames))
+    tagNamesResize(parser, namesSize);
+  if (tagsSize < parser->m_tagsSize) {
+    TAG *temp = NULL;
+    if (tagsSize != 0) {
+      temp = (TAG *)MALLOC_IN(parser, TAGS, tagsSize * sizeof(TAG));
       if (temp == NULL)
-        return XML_FALSE;
-      /* if tag->name.str points to tag->buf (only when namespace
-         processing is off) then we have to update it
-      */
-      if (tag->name.str == (XML_Char *)tag->buf)
-        tag->name.str = (XML_Char *)temp;
-      /* if tag->name.localPart is set (when namespace processing is on)
-         then update it as well, since it will always point into tag->buf
-      */
-      if (tag->name.localPart)
-        tag->name.localPart = (XML_Char *)temp + (tag->name.localPart -
-                                                  (XML_Char *)tag->buf);
-      tag->buf = temp;
-      tag->bufEnd = temp + bufSize;
-      rawNameBuf = temp + nameLen;
+        return;
+      memcpy(temp, parser->m_tags, parser->m_nTags * sizeof(TAG));
     }
-    memcpy(rawNameBuf, tag->rawName, tag->rawNameLength);
-    tag->rawName = rawNameBuf;
-    tag = tag->parent;
+    FREE_IN(parser, TAGS, parser->m_tags, parser->m_tagsSize * sizeof(TAG));
+    parser->m_tags = temp;
+    parser->m_tagsSize = tagsSize;
   }
-  return XML_TRUE;
 }
 
 static enum XML_Error PTRCALL
@@ -2530,13 +5302,8 @@ contentProcessor(XML_Parser parser,
                  const char *end,
                  const char **endPtr)
 {
-  enum XML_Error result = doContent(parser, 0, parser->m_encoding, start, end,
-                                    endPtr, (XML_Bool)!parser->m_parsingStatus.finalBuffer);
-  if (result == XML_ERROR_NONE) {
-    if (!storeRawNames(parser))
-      return XML_ERROR_NO_MEMORY;
-  }
-  return result;
+  return doContent(parser, 0, parser->m_encoding, start, end,
+                   endPtr, (XML_Bool)!parser->m_parsingStatus.finalBuffer);
 }
 
 static enum XML_Error PTRCALL
@@ -2646,13 +5413,8 @@ externalEntityContentProcessor(XML_Parser parser,
                                const char *end,
                                const char **endPtr)
 {
-  enum XML_Error result = doContent(parser, 1, parser->m_encoding, start, end,
-                                    endPtr, (XML_Bool)!parser->m_parsingStatus.finalBuffer);
-  if (result == XML_ERROR_NONE) {
-    if (!storeRawNames(parser))
-      return XML_ERROR_NO_MEMORY;
-  }
-  return result;
+  return doContent(parser, 1, parser->m_encoding, start, end,
+                   endPtr, (XML_Bool)!parser->m_parsingStatus.finalBuffer);
 }
 
 static enum XML_Error
@@ -2666,6 +5428,9 @@ doContent(XML_Parser parser,
 {
   /* save one level of indirection */
   DTD * const dtd = parser->m_dtd;
+  /* attribute list reported for start-tags kept raw in lazy mode */
+  static const XML_Char *noAtts[] = { NULL };
+  const XML_Char **atts;
 
   const char **eventPP;
   const char **eventEndPP;
@@ -2678,11 +5443,35 @@ doContent(XML_Parser parser,
     eventEndPP = &(parser->m_openInternalEntities->internalEventEndPtr);
   }
   *eventPP = s;
+  if (!DATA_BUF_READY(parser, enc, s))
+    return XML_ERROR_NO_MEMORY;
 
   for (;;) {
     const char *next = s; /* XmlContentTok doesn't always set the last arg */
     int tok = XmlContentTok(enc, s, end, &next);
     *eventEndPP = next;
+    if (parser->m_skipTagLevel != 0 && tok > XML_TOK_INVALID
+        && (tok != XML_TOK_END_TAG
+            || parser->m_tagLevel > parser->m_skipTagLevel)
+        && (tok != XML_TOK_ENTITY_REF || !parser->m_skipExpandsEntities)) {
+      /* No handler is called for skipped content, so the parsing
+         status cannot change until the skipped element is closed.
+      */
+      enum XML_Error result = skipContent(parser, enc, tok, s, next, eventPP);
+      if (result != XML_ERROR_NONE)
+        return result;
+      if (tok == XML_TOK_CDATA_SECT_OPEN) {
+        result = doCdataSection(parser, enc, &next, end, nextPtr, haveMore);
+        if (result != XML_ERROR_NONE)
+          return result;
+        else if (!next) {
+          parser->m_processor = cdataSectionProcessor;
+          return result;
+        }
+      }
+      *eventPP = s = next;
+      continue;
+    }
     switch (tok) {
     case XML_TOK_TRAILING_CR:
       if (haveMore) {
@@ -2690,6 +5479,10 @@ doContent(XML_Parser parser,
         return XML_ERROR_NONE;
       }
       *eventEndPP = end;
+      if (PATH_TEXT_WANTED(parser)) {
+        XML_Char c = 0xA;
+        pathCharacters(parser, &c, 1);
+      }
       if (parser->m_characterDataHandler) {
         XML_Char c = 0xA;
         parser->m_characterDataHandler(parser->m_handlerArg, &c, 1);
@@ -2740,6 +5533,8 @@ doContent(XML_Parser parser,
                                               s + enc->minBytesPerChar,
                                               next - enc->minBytesPerChar);
         if (ch) {
+          if (PATH_TEXT_WANTED(parser))
+            pathCharacters(parser, &ch, 1);
           if (parser->m_characterDataHandler)
             parser->m_characterDataHandler(parser->m_handlerArg, &ch, 1);
           else if (parser->m_defaultHandler)
@@ -2812,64 +5607,23 @@ doContent(XML_Parser parser,
       {
         TAG *tag;
         enum XML_Error result;
-        XML_Char *toPtr;
-        if (parser->m_freeTagList) {
-          tag = parser->m_freeTagList;
-          parser->m_freeTagList = parser->m_freeTagList->parent;
-        }
-        else {
-          tag = (TAG *)MALLOC(parser, sizeof(TAG));
-          if (!tag)
-            return XML_ERROR_NO_MEMORY;
-          tag->buf = (char *)MALLOC(parser, INIT_TAG_BUF_SIZE);
-          if (!tag->buf) {
-            FREE(parser, tag);
-            return XML_ERROR_NO_MEMORY;
-          }
-          tag->bufEnd = tag->buf + INIT_TAG_BUF_SIZE;
-        }
-        tag->bindings = NULL;
-        tag->parent = parser->m_tagStack;
-        parser->m_tagStack = tag;
-        tag->name.localPart = NULL;
-        tag->name.prefix = NULL;
-        tag->rawName = s + enc->minBytesPerChar;
-        tag->rawNameLength = XmlNameLength(enc, tag->rawName);
+        tag = pushTag(parser);
+        if (!tag || !storeTagName(parser, enc, s + enc->minBytesPerChar))
+          return XML_ERROR_NO_MEMORY;
         ++parser->m_tagLevel;
-        {
-          const char *rawNameEnd = tag->rawName + tag->rawNameLength;
-          const char *fromPtr = tag->rawName;
-          toPtr = (XML_Char *)tag->buf;
-          for (;;) {
-            int bufSize;
-            int convLen;
-            const enum XML_Convert_Result convert_res = XmlConvert(enc,
-                       &fromPtr, rawNameEnd,
-                       (ICHAR **)&toPtr, (ICHAR *)tag->bufEnd - 1);
-            convLen = (int)(toPtr - (XML_Char *)tag->buf);
-            if ((fromPtr >= rawNameEnd) || (convert_res == XML_CONVERT_INPUT_INCOMPLETE)) {
-              tag->name.strLen = convLen;
-              break;
-            }
-            bufSize = (int)(tag->bufEnd - tag->buf) << 1;
-            {
-              char *temp = (char *)REALLOC(parser, tag->buf, bufSize);
-              if (temp == NULL)
-                return XML_ERROR_NO_MEMORY;
-              tag->buf = temp;
-              tag->bufEnd = temp + bufSize;
-              toPtr = (XML_Char *)temp + convLen;
-            }
-          }
-        }
-        tag->name.str = (XML_Char *)tag->buf;
-        *toPtr = XML_T('\0');
-        result = storeAtts(parser, enc, s, &(tag->name), &(tag->bindings));
+        result = storeStartTag(parser, enc, s, &(tag->name), &(tag->bindings));
         if (result)
           return result;
-        if (parser->m_startElementHandler)
+        atts = parser->m_nRawAtts < 0
+               ? (const XML_Char **)parser->m_atts : noAtts;
+        if (parser->m_paths != NULL)
+          pathStartElement(parser, tag->name.str, atts, XML_FALSE);
+        if (parser->m_startElementHandler) {
+          parser->m_inStartTag = XML_TRUE;
           parser->m_startElementHandler(parser->m_handlerArg, tag->name.str,
-                              (const XML_Char **)parser->m_atts);
+                                        atts);
+          parser->m_inStartTag = XML_FALSE;
+        }
         else if (parser->m_defaultHandler)
           reportDefault(parser, enc, s, next);
         poolClear(&parser->m_tempPool);
@@ -2889,16 +5643,26 @@ doContent(XML_Parser parser,
         if (!name.str)
           return XML_ERROR_NO_MEMORY;
         poolFinish(&parser->m_tempPool);
-        result = storeAtts(parser, enc, s, &name, &bindings);
+        result = storeStartTag(parser, enc, s, &name, &bindings);
         if (result != XML_ERROR_NONE) {
           freeBindings(parser, bindings);
           return result;
         }
         poolFinish(&parser->m_tempPool);
+        atts = parser->m_nRawAtts < 0
+               ? (const XML_Char **)parser->m_atts : noAtts;
+        if (parser->m_paths != NULL)
+          pathStartElement(parser, name.str, atts, XML_TRUE);
         if (parser->m_startElementHandler) {
-          parser->m_startElementHandler(parser->m_handlerArg, name.str, (const XML_Char **)parser->m_atts);
+          parser->m_inStartTag = XML_TRUE;
+          parser->m_startElementHandler(parser->m_handlerArg, name.str, atts);
+          parser->m_inStartTag = XML_FALSE;
           noElmHandlers = XML_FALSE;
         }
+        /* an empty element has no content to skip */
+        parser->m_skipTagLevel = 0;
+        if (parser->m_paths != NULL)
+          pathEndElement(parser, name.str);
         if (parser->m_endElementHandler) {
           if (parser->m_startElementHandler)
             *eventPP = *eventEndPP;
@@ -2919,21 +5683,17 @@ doContent(XML_Parser parser,
       if (parser->m_tagLevel == startTagLevel)
         return XML_ERROR_ASYNC_ENTITY;
       else {
-        int len;
-        const char *rawName;
-        TAG *tag = parser->m_tagStack;
-        parser->m_tagStack = tag->parent;
-        tag->parent = parser->m_freeTagList;
-        parser->m_freeTagList = tag;
-        rawName = s + enc->minBytesPerChar*2;
-        len = XmlNameLength(enc, rawName);
-        if (len != tag->rawNameLength
-            || memcmp(tag->rawName, rawName, len) != 0) {
+        const char *rawName = s + enc->minBytesPerChar*2;
+        /* stays in place until the next element is opened */
+        TAG *tag = &parser->m_tags[--parser->m_nTags];
+        /* the end-tag of a skipped element itself is reported as usual */
+        parser->m_skipTagLevel = 0;
+        if (!tagNameMatches(enc, rawName, tag)) {
           *eventPP = rawName;
           return XML_ERROR_TAG_MISMATCH;
         }
         --parser->m_tagLevel;
-        if (parser->m_endElementHandler) {
+        if (parser->m_endElementHandler || parser->m_paths != NULL) {
           const XML_Char *localPart;
           const XML_Char *prefix;
           XML_Char *uri;
@@ -2953,8 +5713,11 @@ doContent(XML_Parser parser,
              }
             *uri = XML_T('\0');
           }
-          parser->m_endElementHandler(parser->m_handlerArg, tag->name.str);
         }
+        if (parser->m_paths != NULL)
+          pathEndElement(parser, tag->name.str);
+        if (parser->m_endElementHandler)
+          parser->m_endElementHandler(parser->m_handlerArg, tag->name.str);
         else if (parser->m_defaultHandler)
           reportDefault(parser, enc, s, next);
         while (tag->bindings) {
@@ -2975,6 +5738,10 @@ doContent(XML_Parser parser,
         int n = XmlCharRefNumber(enc, s);
         if (n < 0)
           return XML_ERROR_BAD_CHAR_REF;
+        if (PATH_TEXT_WANTED(parser)) {
+          XML_Char buf[XML_ENCODE_MAX];
+          pathCharacters(parser, buf, XmlEncode(n, (ICHAR *)buf));
+        }
         if (parser->m_characterDataHandler) {
           XML_Char buf[XML_ENCODE_MAX];
           parser->m_characterDataHandler(parser->m_handlerArg, buf, XmlEncode(n, (ICHAR *)buf));
@@ -2986,6 +5753,10 @@ doContent(XML_Parser parser,
     case XML_TOK_XML_DECL:
       return XML_ERROR_MISPLACED_XML_PI;
     case XML_TOK_DATA_NEWLINE:
+      if (PATH_TEXT_WANTED(parser)) {
+        XML_Char c = 0xA;
+        pathCharacters(parser, &c, 1);
+      }
       if (parser->m_characterDataHandler) {
         XML_Char c = 0xA;
         parser->m_characterDataHandler(parser->m_handlerArg, &c, 1);
@@ -3030,6 +5801,8 @@ doContent(XML_Parser parser,
         *nextPtr = s;
         return XML_ERROR_NONE;
       }
+      if (PATH_TEXT_WANTED(parser))
+        pathCharacterData(parser, enc, s, end);
       if (parser->m_characterDataHandler) {
         if (MUST_CONVERT(enc, s)) {
           ICHAR *dataPtr = (ICHAR *)parser->m_dataBuf;
@@ -3038,9 +5811,8 @@ doContent(XML_Parser parser,
                                (int)(dataPtr - (ICHAR *)parser->m_dataBuf));
         }
         else
-          parser->m_characterDataHandler(parser->m_handlerArg,
-                               (XML_Char *)s,
-                               (int)((XML_Char *)end - (XML_Char *)s));
+          reportCharacters(parser, parser->m_characterDataHandler,
+                           (XML_Char *)s, (XML_Char *)end);
       }
       else if (parser->m_defaultHandler)
         reportDefault(parser, enc, s, end);
@@ -3060,6 +5832,8 @@ doContent(XML_Parser parser,
     case XML_TOK_DATA_CHARS:
       {
         XML_CharacterDataHandler charDataHandler = parser->m_characterDataHandler;
+        if (PATH_TEXT_WANTED(parser))
+          pathCharacterData(parser, enc, s, next);
         if (charDataHandler) {
           if (MUST_CONVERT(enc, s)) {
             for (;;) {
@@ -3074,9 +5848,8 @@ doContent(XML_Parser parser,
             }
           }
           else
-            charDataHandler(parser->m_handlerArg,
-                            (XML_Char *)s,
-                            (int)((XML_Char *)next - (XML_Char *)s));
+            reportCharacters(parser, charDataHandler,
+                             (XML_Char *)s, (XML_Char *)next);
         }
         else if (parser->m_defaultHandler)
           reportDefault(parser, enc, s, next);
@@ -3085,58 +5858,671 @@ doContent(XML_Parser parser,
     case XML_TOK_PI:
       if (!reportProcessingInstruction(parser, enc, s, next))
         return XML_ERROR_NO_MEMORY;
-      break;
-    case XML_TOK_COMMENT:
-      if (!reportComment(parser, enc, s, next))
+      break;
+    case XML_TOK_COMMENT:
+      if (!reportComment(parser, enc, s, next))
+        return XML_ERROR_NO_MEMORY;
+      break;
+    default:
+      /* All of the tokens produced by XmlContentTok() have their own
+       * explicit cases, so this default is not strictly necessary.
+       * However it is a useful safety net, so we retain the code and
+       * simply exclude it from the coverage tests.
+       *
+       * LCOV_EXCL_START
+       */
+      if (parser->m_defaultHandler)
+        reportDefault(parser, enc, s, next);
+      break;
+      /* LCOV_EXCL_STOP */
+    }
+    *eventPP = s = next;
+    switch (parser->m_parsingStatus.parsing) {
+    case XML_SUSPENDED:
+      *nextPtr = next;
+      return XML_ERROR_NONE;
+    case XML_FINISHED:
+      return XML_ERROR_ABORTED;
+    default: ;
+    }
+  }
+  /* not reached */
+}
+
+/* This function does not call free() on the allocated memory, merely
+ * moving it to the parser's m_freeBindingList where it can be freed or
+ * reused as appropriate.
+ */
+static void
+freeBindings(XML_Parser parser, BINDING *bindings)
+{
+  while (bindings) {
+    BINDING *b = bindings;
+
+    /* m_startNamespaceDeclHandler will have been called for this
+     * binding in addBindings(), so call the end handler now.
+     */
+    if (parser->m_endNamespaceDeclHandler)
+        parser->m_endNamespaceDeclHandler(parser->m_handlerArg, b->prefix->name);
+
+    bindings = bindings->nextTagBinding;
+    b->nextTagBinding = parser->m_freeBindingList;
+    parser->m_freeBindingList = b;
+    b->prefix->binding = b->prevPrefixBinding;
+  }
+}
+
+/* Like freeBindings(), but for the namespace declarations of skipped
+   tags, which were never reported.
+*/
+static void
+releaseSkippedBindings(XML_Parser parser, BINDING *bindings)
+{
+  while (bindings) {
+    BINDING *b = bindings;
+    bindings = bindings->nextTagBinding;
+    b->nextTagBinding = parser->m_freeBindingList;
+    parser->m_freeBindingList = b;
+    b->prefix->binding = b->prevPrefixBinding;
+  }
+}
+
+/* Checks the attributes of a skipped start-tag as storeAtts() would:
+   duplicate names, references in values, namespace declarations and,
+   with namespace processing, bound prefixes and unique expanded names.
+   Nothing is reported and no attribute list is built; the namespace
+   declarations are added to *bindingsPtr, so that they stay in scope
+   for the content.
+*/
+static enum XML_Error
+checkSkippedAtts(XML_Parser parser, const ENCODING *enc, const char *attStr,
+                 const XML_Char *tagName, BINDING **bindingsPtr)
+{
+  DTD * const dtd = parser->m_dtd;  /* save one level of indirection */
+  ELEMENT_TYPE *elementType;
+  const ATTRIBUTE_ID **ids;  /* the attributes seen so far, in m_atts */
+  int nIds = 0;
+  int nDefaultAtts;
+  int n;
+  int i;
+  enum XML_Error result = XML_ERROR_NONE;
+
+  elementType = (ELEMENT_TYPE *)lookup(parser, &dtd->elementTypes, tagName, 0);
+  if (!elementType) {
+    const XML_Char *name = poolCopyString(&dtd->pool, tagName);
+    if (!name)
+      return XML_ERROR_NO_MEMORY;
+    elementType = (ELEMENT_TYPE *)lookup(parser, &dtd->elementTypes, name,
+                                         sizeof(ELEMENT_TYPE));
+    if (!elementType)
+      return XML_ERROR_NO_MEMORY;
+    if (parser->m_ns && !setElementTypePrefix(parser, elementType))
+      return XML_ERROR_NO_MEMORY;
+  }
+  nDefaultAtts = elementType->nDefaultAtts;
+
+  n = getAttributes(parser, enc, attStr, nDefaultAtts);
+  if (n < 0)
+    return XML_ERROR_NO_MEMORY;
+
+  /* ids[i] never overtakes m_atts[i], which is read first */
+  ids = (const ATTRIBUTE_ID **)parser->m_atts;
+  for (i = 0; i < n; i++) {
+    const char *name = parser->m_atts[i].name;
+    const char *valuePtr = parser->m_atts[i].valuePtr;
+    const char *valueEnd = parser->m_atts[i].valueEnd;
+    const char normalized = parser->m_atts[i].normalized;
+    ATTRIBUTE_ID *attId = getAttributeId(parser, enc, name,
+                                         name + XmlNameLength(enc, name));
+    if (!attId) {
+      result = XML_ERROR_NO_MEMORY;
+      break;
+    }
+    if ((attId->name)[-1]) {
+      if (enc == parser->m_encoding)
+        parser->m_eventPtr = name;
+      result = XML_ERROR_DUPLICATE_ATTRIBUTE;
+      break;
+    }
+    (attId->name)[-1] = 1;
+    ids[nIds++] = attId;
+    if (!normalized || attId->xmlns) {
+      result = storeAttributeValue(parser, enc, XML_TRUE, valuePtr, valueEnd,
+                                   &parser->m_tempPool);
+      /* without attId, addBinding() does not report the declaration */
+      if (result == XML_ERROR_NONE && attId->xmlns)
+        result = addBinding(parser, attId->prefix, NULL,
+                            poolStart(&parser->m_tempPool), bindingsPtr);
+      poolDiscard(&parser->m_tempPool);
+      if (result != XML_ERROR_NONE)
+        break;
+    }
+  }
+
+  for (i = 0; i < nDefaultAtts && result == XML_ERROR_NONE; i++) {
+    const DEFAULT_ATTRIBUTE *da = elementType->defaultAtts + i;
+    if (!(da->id->name)[-1] && da->value && da->id->prefix) {
+      if (da->id->xmlns)
+        result = addBinding(parser, da->id->prefix, NULL, da->value,
+                            bindingsPtr);
+      else {
+        (da->id->name)[-1] = 1;
+        ids[nIds++] = da->id;
+      }
+    }
+  }
+
+  if (parser->m_ns && result == XML_ERROR_NONE) {
+    for (i = 0; i < nIds && result == XML_ERROR_NONE; i++) {
+      const BINDING *b;
+      const XML_Char *localPart;
+      int j;
+      if (!ids[i]->prefix || ids[i]->xmlns)
+        continue;
+      b = ids[i]->prefix->binding;
+      if (!b) {
+        result = XML_ERROR_UNBOUND_PREFIX;
+        break;
+      }
+      localPart = ids[i]->name;
+      while (*localPart++ != XML_T(ASCII_COLON))
+        ;
+      /* prefixed attributes are few, so a hash table does not pay */
+      for (j = 0; j < i; j++) {
+        const BINDING *b2;
+        const XML_Char *localPart2;
+        if (!ids[j]->prefix || ids[j]->xmlns)
+          continue;
+        b2 = ids[j]->prefix->binding;
+        if (b2->uriLen != b->uriLen
+            || memcmp(b2->uri, b->uri, b->uriLen * sizeof(XML_Char)) != 0)
+          continue;
+        localPart2 = ids[j]->name;
+        while (*localPart2++ != XML_T(ASCII_COLON))
+          ;
+        if (keyeq(localPart, localPart2)) {
+          result = XML_ERROR_DUPLICATE_ATTRIBUTE;
+          break;
+        }
+      }
+    }
+    if (result == XML_ERROR_NONE && elementType->prefix
+        && !elementType->prefix->binding)
+      result = XML_ERROR_UNBOUND_PREFIX;
+  }
+
+  /* clear flags that say whether attributes were specified */
+  for (i = 0; i < nIds; i++)
+    (ids[i]->name)[-1] = 0;
+  return result;
+}
+
+/* Processes a content token while the rest of an element is skipped
+   by XML_SkipCurrentElement(): tags only maintain the tag stack so that
+   nesting can be checked, and their attributes are checked by
+   checkSkippedAtts(); everything else is checked as far as it needs no
+   conversion, and no handler is called.  References to internal
+   entities are not expanded, unless m_skipExpandsEntities is set; then
+   doContent() handles them as usual.
+*/
+static enum XML_Error
+skipContent(XML_Parser parser, const ENCODING *enc, int tok,
+            const char *s, const char *next, const char **eventPP)
+{
+  DTD * const dtd = parser->m_dtd;  /* save one level of indirection */
+
+  switch (tok) {
+  case XML_TOK_START_TAG_NO_ATTS:
+  case XML_TOK_START_TAG_WITH_ATTS:
+    {
+      TAG *tag;
+      if (!pushTag(parser) || !storeTagName(parser, enc, s + enc->minBytesPerChar))
+        return XML_ERROR_NO_MEMORY;
+      ++parser->m_tagLevel;
+      tag = &parser->m_tags[parser->m_nTags - 1];
+      return checkSkippedAtts(parser, enc, s, tag->name.str, &tag->bindings);
+    }
+  case XML_TOK_EMPTY_ELEMENT_NO_ATTS:
+  case XML_TOK_EMPTY_ELEMENT_WITH_ATTS:
+    {
+      const char *rawName = s + enc->minBytesPerChar;
+      enum XML_Error result;
+      BINDING *bindings = NULL;
+      const XML_Char *name = poolStoreString(&parser->m_tempPool, enc, rawName,
+                                 rawName + XmlNameLength(enc, rawName));
+      if (!name)
+        return XML_ERROR_NO_MEMORY;
+      poolFinish(&parser->m_tempPool);
+      result = checkSkippedAtts(parser, enc, s, name, &bindings);
+      poolClear(&parser->m_tempPool);
+      releaseSkippedBindings(parser, bindings);
+      return result;
+    }
+  case XML_TOK_END_TAG:
+    {
+      TAG *tag = &parser->m_tags[--parser->m_nTags];
+      const char *rawName = s + enc->minBytesPerChar*2;
+      releaseSkippedBindings(parser, tag->bindings);
+      tag->bindings = NULL;
+      if (!tagNameMatches(enc, rawName, tag)) {
+        *eventPP = rawName;
+        return XML_ERROR_TAG_MISMATCH;
+      }
+      --parser->m_tagLevel;
+    }
+    break;
+  case XML_TOK_ENTITY_REF:
+    {
+      const XML_Char *name;
+      ENTITY *entity;
+      if (XmlPredefinedEntityName(enc, s + enc->minBytesPerChar,
+                                  next - enc->minBytesPerChar))
+        break;
+      name = poolStoreString(&dtd->pool, enc, s + enc->minBytesPerChar,
+                             next - enc->minBytesPerChar);
+      if (!name)
+        return XML_ERROR_NO_MEMORY;
+      entity = (ENTITY *)lookup(parser, &dtd->generalEntities, name, 0);
+      poolDiscard(&dtd->pool);
+      if (!dtd->hasParamEntityRefs || dtd->standalone) {
+        if (!entity)
+          return XML_ERROR_UNDEFINED_ENTITY;
+        else if (!entity->is_internal)
+          return XML_ERROR_ENTITY_DECLARED_IN_PE;
+      }
+      else if (!entity)
+        break;
+      if (entity->open)
+        return XML_ERROR_RECURSIVE_ENTITY_REF;
+      if (entity->notation)
+        return XML_ERROR_BINARY_ENTITY_REF;
+    }
+    break;
+  case XML_TOK_CHAR_REF:
+    if (XmlCharRefNumber(enc, s) < 0)
+      return XML_ERROR_BAD_CHAR_REF;
+    break;
+  case XML_TOK_XML_DECL:
+    return XML_ERROR_MISPLACED_XML_PI;
+  default:
+    /* character data, CDATA sections, processing instructions and
+       comments are well-formed once tokenized */
+    break;
+  }
+  return XML_ERROR_NONE;
+}
+
+/* Grows one of the path matcher's arrays so that it holds at least
+   'needed' elements of 'size' bytes; returns the (possibly moved) array
+   or NULL when out of memory.
+*/
+static void *
+pathReserve(XML_Parser parser, void *array, int *allocPtr, int needed,
+            size_t size)
+{
+  int newAlloc;
+  void *temp;
+  if (needed <= *allocPtr)
+    return array;
+  newAlloc = *allocPtr ? *allocPtr * 2 : 8;
+  while (newAlloc < needed)
+    newAlloc *= 2;
+  temp = REALLOC(parser, array, *allocPtr * size, newAlloc * size);
+  if (temp == NULL)
+    return NULL;
+  *allocPtr = newAlloc;
+  return temp;
+}
+
+/* Compares a step name with an element or attribute name as reported
+   to the handlers; with namespace triplets, the prefix is ignored.
+*/
+static XML_Bool
+pathNameMatches(XML_Parser parser, const XML_Char *stepName,
+                const XML_Char *name)
+{
+  for (; *stepName == *name; stepName++, name++) {
+    if (*stepName == 0)
+      return XML_TRUE;
+  }
+  return (*stepName == 0 && parser->m_ns_triplets
+          && *name == parser->m_namespaceSeparator);
+}
+
+static XML_Bool
+pathAddState(XML_Parser parser, int firstState, int pattern, int step)
+{
+  PATH_MATCHER * const paths = parser->m_paths;
+  PATH_STATE *temp;
+  int i;
+  for (i = firstState; i < paths->nStates; i++) {
+    if (paths->states[i].pattern == pattern && paths->states[i].step == step)
+      return XML_TRUE;
+  }
+  temp = (PATH_STATE *)pathReserve(parser, paths->states,
+                                   &paths->statesAlloc, paths->nStates + 1,
+                                   sizeof(PATH_STATE));
+  if (temp == NULL)
+    return XML_FALSE;
+  paths->states = temp;
+  paths->states[paths->nStates].pattern = pattern;
+  paths->states[paths->nStates].step = step;
+  paths->nStates++;
+  return XML_TRUE;
+}
+
+static XML_Bool
+pathAddMatch(XML_Parser parser, int **arrayPtr, int *countPtr, int *allocPtr,
+             int first, int pattern)
+{
+  int *temp;
+  int i;
+  for (i = first; i < *countPtr; i++) {
+    if ((*arrayPtr)[i] == pattern)
+      return XML_TRUE;
+  }
+  temp = (int *)pathReserve(parser, *arrayPtr, allocPtr, *countPtr + 1,
+                            sizeof(int));
+  if (temp == NULL)
+    return XML_FALSE;
+  *arrayPtr = temp;
+  temp[(*countPtr)++] = pattern;
+  return XML_TRUE;
+}
+
+/* Pushes a new level for the element 'name', advancing the states of
+   the parent level; patterns whose last step matched are recorded in
+   the matches of the new level, or in attMatches for attribute patterns.
+   Without namespace processing, names are tested by comparing 'type'
+   with the element types the steps resolve to; otherwise 'type' is
+   NULL and the expanded names are compared.
+*/
+static enum XML_Error
+pathEnterElement(XML_Parser parser, const ELEMENT_TYPE *type,
+                 const XML_Char *name)
+{
+  PATH_MATCHER * const paths = parser->m_paths;
+  PATH_LEVEL *level;
+  int i, first, end;
+
+  if (paths->depth == 0) {
+    PATH_LEVEL *levels;
+    PATH_STATE *states;
+    if (type != NULL) {
+      /* the symbol table is rebuilt for every document */
+      DTD * const dtd = parser->m_dtd;
+      for (i = 0; i < paths->nSteps; i++) {
+        if (paths->steps[i].name == NULL)
+          continue;
+        paths->steps[i].type
+            = (ELEMENT_TYPE *)lookup(parser, &dtd->elementTypes,
+                                     paths->steps[i].name,
+                                     sizeof(ELEMENT_TYPE));
+        if (paths->steps[i].type == NULL)
+          return XML_ERROR_NO_MEMORY;
+      }
+    }
+    levels = (PATH_LEVEL *)pathReserve(parser, paths->levels,
+                                       &paths->levelsAlloc, 1,
+                                       sizeof(PATH_LEVEL));
+    if (levels == NULL)
+      return XML_ERROR_NO_MEMORY;
+    paths->levels = levels;
+    states = (PATH_STATE *)pathReserve(parser, paths->states,
+                                       &paths->statesAlloc, paths->nPatterns,
+                                       sizeof(PATH_STATE));
+    if (states == NULL)
+      return XML_ERROR_NO_MEMORY;
+    paths->states = states;
+    for (i = 0; i < paths->nPatterns; i++) {
+      states[i].pattern = i;
+      states[i].step = 0;
+    }
+    paths->nStates = paths->nPatterns;
+    paths->nMatches = 0;
+    levels[0].firstState = 0;
+    levels[0].firstMatch = 0;
+    paths->depth = 1;
+  }
+  level = (PATH_LEVEL *)pathReserve(parser, paths->levels,
+                                    &paths->levelsAlloc, paths->depth + 1,
+                                    sizeof(PATH_LEVEL));
+  if (level == NULL)
+    return XML_ERROR_NO_MEMORY;
+  paths->levels = level;
+  first = level[paths->depth - 1].firstState;
+  end = paths->nStates;
+  level += paths->depth++;
+  level->firstState = end;
+  level->firstMatch = paths->nMatches;
+  paths->nAttMatches = 0;
+
+  for (i = first; i < end; i++) {
+    /* copied, as adding states may move the array */
+    const PATH_STATE state = paths->states[i];
+    const PATH_PATTERN *pattern = &paths->patterns[state.pattern];
+    const PATH_STEP *step = &paths->steps[pattern->firstStep + state.step];
+    if (step->descendant
+        && !pathAddState(parser, end, state.pattern, state.step))
+      return XML_ERROR_NO_MEMORY;
+    if (step->name != NULL
+        && (type != NULL ? step->type != type
+                         : !pathNameMatches(parser, step->name, name)))
+      continue;
+    if (state.step + 1 < pattern->nSteps) {
+      if (!pathAddState(parser, end, state.pattern, state.step + 1))
+        return XML_ERROR_NO_MEMORY;
+    }
+    else if (pattern->attName != NULL) {
+      if (!pathAddMatch(parser, &paths->attMatches, &paths->nAttMatches,
+                        &paths->attMatchesAlloc, 0, state.pattern))
         return XML_ERROR_NO_MEMORY;
-      break;
-    default:
-      /* All of the tokens produced by XmlContentTok() have their own
-       * explicit cases, so this default is not strictly necessary.
-       * However it is a useful safety net, so we retain the code and
-       * simply exclude it from the coverage tests.
-       *
-       * LCOV_EXCL_START
-       */
-      if (parser->m_defaultHandler)
-        reportDefault(parser, enc, s, next);
-      break;
-      /* LCOV_EXCL_STOP */
     }
-    *eventPP = s = next;
-    switch (parser->m_parsingStatus.parsing) {
-    case XML_SUSPENDED:
-      *nextPtr = next;
-      return XML_ERROR_NONE;
-    case XML_FINISHED:
-      return XML_ERROR_ABORTED;
-    default: ;
+    else if (!pathAddMatch(parser, &paths->matches, &paths->nMatches,
+                           &paths->matchesAlloc, level->firstMatch,
+                           state.pattern))
+      return XML_ERROR_NO_MEMORY;
+  }
+  /* nobody looks at the attribute list unless it is reported */
+  parser->m_pathSkipAtts = (!parser->m_startElementHandler
+                            && (paths->nMatches == level->firstMatch
+                                || !parser->m_pathStartHandler));
+  return XML_ERROR_NONE;
+}
+
+/* Without namespace processing, storeAtts() runs the matcher as soon
+   as the element type is known, so that attributes nobody asked for
+   are left unconverted; otherwise it has to wait for the expanded
+   element name.
+*/
+static enum XML_Error
+storeStartTag(XML_Parser parser, const ENCODING *enc, const char *s,
+              TAG_NAME *tagNamePtr, BINDING **bindingsPtr)
+{
+  enum XML_Error result = storeAtts(parser, enc, s, tagNamePtr, bindingsPtr);
+  if (result != XML_ERROR_NONE || parser->m_paths == NULL || !parser->m_ns)
+    return result;
+  return pathEnterElement(parser, NULL, tagNamePtr->str);
+}
+
+/* True if skipping element content could not be observed by any of
+   the regular content handlers.
+*/
+static XML_Bool
+pathContentUnobserved(XML_Parser parser)
+{
+  return (!parser->m_startElementHandler
+          && !parser->m_endElementHandler
+          && !parser->m_characterDataHandler
+          && !parser->m_processingInstructionHandler
+          && !parser->m_commentHandler
+          && !parser->m_startCdataSectionHandler
+          && !parser->m_endCdataSectionHandler
+          && !parser->m_defaultHandler
+          && !parser->m_skippedEntityHandler
+          && !parser->m_startNamespaceDeclHandler
+          && !parser->m_endNamespaceDeclHandler
+          && !parser->m_externalEntityRefHandler);
+}
+
+static void
+pathStartElement(XML_Parser parser, const XML_Char *name,
+                 const XML_Char **atts, XML_Bool isEmpty)
+{
+  PATH_MATCHER * const paths = parser->m_paths;
+  const PATH_LEVEL *level = &paths->levels[paths->depth - 1];
+  int i;
+
+  parser->m_inStartTag = XML_TRUE;
+  if (parser->m_pathStartHandler) {
+    for (i = level->firstMatch; i < paths->nMatches; i++)
+      parser->m_pathStartHandler(parser->m_handlerArg, paths->matches[i],
+                                 name, atts);
+  }
+  if (parser->m_pathAttributeHandler) {
+    for (i = 0; i < paths->nAttMatches; i++) {
+      const int id = paths->attMatches[i];
+      const XML_Char *value
+          = getAttributeValue(parser, paths->patterns[id].attName);
+      if (value != NULL)
+        parser->m_pathAttributeHandler(parser->m_handlerArg, id, name, value);
     }
   }
-  /* not reached */
+  parser->m_inStartTag = XML_FALSE;
+  /* a subtree no pattern can match and no handler would see is
+     skipped; its entity references are still expanded, so that the
+     document is checked as without the skip */
+  if (!isEmpty && parser->m_skipTagLevel == 0
+      && paths->nStates == level->firstState && paths->nMatches == 0
+      && pathContentUnobserved(parser)) {
+    parser->m_skipTagLevel = parser->m_tagLevel;
+    parser->m_skipExpandsEntities = XML_TRUE;
+  }
 }
 
-/* This function does not call free() on the allocated memory, merely
- * moving it to the parser's m_freeBindingList where it can be freed or
- * reused as appropriate.
- */
 static void
-freeBindings(XML_Parser parser, BINDING *bindings)
+pathEndElement(XML_Parser parser, const XML_Char *name)
 {
-  while (bindings) {
-    BINDING *b = bindings;
+  PATH_MATCHER * const paths = parser->m_paths;
+  const PATH_LEVEL *level;
+  int i;
 
-    /* m_startNamespaceDeclHandler will have been called for this
-     * binding in addBindings(), so call the end handler now.
-     */
-    if (parser->m_endNamespaceDeclHandler)
-        parser->m_endNamespaceDeclHandler(parser->m_handlerArg, b->prefix->name);
+  if (paths->depth < 2)
+    return;
+  level = &paths->levels[paths->depth - 1];
+  if (parser->m_pathEndHandler) {
+    for (i = paths->nMatches; i-- > level->firstMatch;)
+      parser->m_pathEndHandler(parser->m_handlerArg, paths->matches[i], name);
+  }
+  paths->nMatches = level->firstMatch;
+  paths->nStates = level->firstState;
+  paths->depth--;
+}
 
-    bindings = bindings->nextTagBinding;
-    b->nextTagBinding = parser->m_freeBindingList;
-    parser->m_freeBindingList = b;
-    b->prefix->binding = b->prevPrefixBinding;
+/* Reports text once to every pattern matched by an open element;
+   "text()" patterns only see the text of the current element.
+*/
+static void
+pathCharacters(XML_Parser parser, const XML_Char *s, int len)
+{
+  PATH_MATCHER * const paths = parser->m_paths;
+  const int firstMatch = paths->levels[paths->depth - 1].firstMatch;
+  int i, j;
+  for (i = 0; i < paths->nMatches; i++) {
+    const int id = paths->matches[i];
+    const int first = paths->patterns[id].text ? firstMatch : 0;
+    if (i < first)
+      continue;
+    for (j = first; j < i && paths->matches[j] != id; j++)
+      ;
+    if (j < i)
+      continue;
+    parser->m_pathCharacterDataHandler(parser->m_handlerArg, id, s, len);
+  }
+}
+
+static void
+pathCharacterData(XML_Parser parser, const ENCODING *enc,
+                  const char *s, const char *end)
+{
+  if (MUST_CONVERT(enc, s)) {
+    for (;;) {
+      ICHAR *dataPtr = (ICHAR *)parser->m_dataBuf;
+      const enum XML_Convert_Result convert_res = XmlConvert(enc, &s, end, &dataPtr, (ICHAR *)parser->m_dataBufEnd);
+      pathCharacters(parser, parser->m_dataBuf,
+                     (int)(dataPtr - (ICHAR *)parser->m_dataBuf));
+      if ((convert_res == XML_CONVERT_COMPLETED) || (convert_res == XML_CONVERT_INPUT_INCOMPLETE))
+        break;
+    }
+  }
+  else {
+    const XML_Char *data = (const XML_Char *)s;
+    do {
+      const int n = charsPiece(data, (const XML_Char *)end);
+      pathCharacters(parser, data, n);
+      data += n;
+    } while (data < (const XML_Char *)end);
+  }
+}
+
+/* Gets the attributes of a start-tag from the tokenizer into m_atts,
+   leaving room for nDefaultAtts more; returns their number, or -1 when
+   out of memory.
+*/
+static int
+getAttributes(XML_Parser parser, const ENCODING *enc, const char *attStr,
+              int nDefaultAtts)
+{
+  int n;
+
+  /* the first start tag allocates the attribute array */
+  if (parser->m_atts == NULL) {
+    parser->m_atts = (ATTRIBUTE *)MALLOC(parser,
+                                         INIT_ATTS_SIZE * sizeof(ATTRIBUTE));
+    if (parser->m_atts == NULL)
+      return -1;
+    parser->m_attsSize = INIT_ATTS_SIZE;
+  }
+#ifdef XML_ATTR_INFO
+  if (parser->m_attInfo == NULL) {
+    parser->m_attInfo = (XML_AttrInfo *)MALLOC(parser,
+                            INIT_ATTS_SIZE * sizeof(XML_AttrInfo));
+    if (parser->m_attInfo == NULL)
+      return -1;
+    parser->m_attInfoSize = INIT_ATTS_SIZE;
+  }
+#endif
+
+  n = XmlGetAttributes(enc, attStr, parser->m_attsSize, parser->m_atts);
+  if (n + nDefaultAtts > parser->m_attsSize) {
+    int oldAttsSize = parser->m_attsSize;
+    ATTRIBUTE *temp;
+    parser->m_attsSize = n + nDefaultAtts + INIT_ATTS_SIZE;
+    temp = (ATTRIBUTE *)REALLOC(parser, (void *)parser->m_atts,
+                                oldAttsSize * sizeof(ATTRIBUTE),
+                                parser->m_attsSize * sizeof(ATTRIBUTE));
+    if (temp == NULL) {
+      parser->m_attsSize = oldAttsSize;
+      return -1;
+    }
+    parser->m_atts = temp;
+    if (n > oldAttsSize)
+      XmlGetAttributes(enc, attStr, n, parser->m_atts);
+  }
+#ifdef XML_ATTR_INFO
+  /* grown separately, so that its size stays known if this fails */
+  if (parser->m_attInfoSize < parser->m_attsSize) {
+    XML_AttrInfo *temp2 = (XML_AttrInfo *)
+      REALLOC(parser, (void *)parser->m_attInfo,
+              parser->m_attInfoSize * sizeof(XML_AttrInfo),
+              parser->m_attsSize * sizeof(XML_AttrInfo));
+    if (temp2 == NULL)
+      return -1;
+    parser->m_attInfo = temp2;
+    parser->m_attInfoSize = parser->m_attsSize;
   }
+#endif
+  return n;
 }
 
 /* Precondition: all arguments must be non-NULL;
@@ -3181,33 +6567,56 @@ storeAtts(XML_Parser parser, const ENCODING *enc,
       return XML_ERROR_NO_MEMORY;
   }
   nDefaultAtts = elementType->nDefaultAtts;
+  if (parser->m_paths != NULL && !parser->m_ns) {
+    enum XML_Error result = pathEnterElement(parser, elementType,
+                                             tagNamePtr->str);
+    if (result != XML_ERROR_NONE)
+      return result;
+  }
 
   /* get the attributes from the tokenizer */
-  n = XmlGetAttributes(enc, attStr, parser->m_attsSize, parser->m_atts);
-  if (n + nDefaultAtts > parser->m_attsSize) {
-    int oldAttsSize = parser->m_attsSize;
-    ATTRIBUTE *temp;
-#ifdef XML_ATTR_INFO
-    XML_AttrInfo *temp2;
-#endif
-    parser->m_attsSize = n + nDefaultAtts + INIT_ATTS_SIZE;
-    temp = (ATTRIBUTE *)REALLOC(parser, (void *)parser->m_atts, parser->m_attsSize * sizeof(ATTRIBUTE));
-    if (temp == NULL) {
-      parser->m_attsSize = oldAttsSize;
-      return XML_ERROR_NO_MEMORY;
-    }
-    parser->m_atts = temp;
-#ifdef XML_ATTR_INFO
-    temp2 = (XML_AttrInfo *)REALLOC(parser, (void *)parser->m_attInfo, parser->m_attsSize * sizeof(XML_AttrInfo));
-    if (temp2 == NULL) {
-      parser->m_attsSize = oldAttsSize;
-      return XML_ERROR_NO_MEMORY;
+  n = getAttributes(parser, enc, attStr, nDefaultAtts);
+  if (n < 0)
+    return XML_ERROR_NO_MEMORY;
+
+  /* In lazy mode, start-tags without declared attributes whose values
+     need no normalization are only checked for duplicates; the values
+     are converted on demand by XML_GetAttributeValue().  The same is
+     done for elements that only the path matcher looks at.  Duplicates
+     are found by comparing the names as they are in the input, which
+     only works for the built-in encodings: an unknown encoding may map
+     several byte sequences to the same character.
+  */
+  if ((parser->m_lazyAtts || parser->m_pathSkipAtts)
+      && !parser->m_ns && nDefaultAtts == 0
+      && n <= LAZY_ATTS_LIMIT
+      && (const void *)enc != parser->m_unknownEncodingMem) {
+    int nameLen[LAZY_ATTS_LIMIT];
+    for (i = 0; i < n && parser->m_atts[i].normalized; i++)
+      ;
+    if (i == n) {
+      for (i = 0; i < n; i++) {
+        const ATTRIBUTE *currAtt = &parser->m_atts[i];
+        int j;
+        nameLen[i] = XmlNameLength(enc, currAtt->name);
+        /* within a built-in encoding, equal names have equal bytes */
+        for (j = 0; j < i; j++) {
+          if (nameLen[j] == nameLen[i]
+              && memcmp(parser->m_atts[j].name, currAtt->name, nameLen[i]) == 0) {
+            if (enc == parser->m_encoding)
+              parser->m_eventPtr = currAtt->name;
+            return XML_ERROR_DUPLICATE_ATTRIBUTE;
+          }
+        }
+      }
+      parser->m_nRawAtts = n;
+      parser->m_rawAttsEnc = enc;
+      parser->m_nSpecifiedAtts = 0;
+      parser->m_idAttIndex = -1;
+      return XML_ERROR_NONE;
     }
-    parser->m_attInfo = temp2;
-#endif
-    if (n > oldAttsSize)
-      XmlGetAttributes(enc, attStr, n, parser->m_atts);
   }
+  parser->m_nRawAtts = -1;
 
   appAtts = (const XML_Char **)parser->m_atts;
   for (i = 0; i < n; i++) {
@@ -3348,7 +6757,11 @@ storeAtts(XML_Parser parser, const ENCODING *enc,
       if (parser->m_nsAttsPower < 3)
         parser->m_nsAttsPower = 3;
       nsAttsSize = (int)1 << parser->m_nsAttsPower;
-      temp = (NS_ATT *)REALLOC(parser, parser->m_nsAtts, nsAttsSize * sizeof(NS_ATT));
+      temp = (NS_ATT *)REALLOC(parser, parser->m_nsAtts,
+                               parser->m_nsAtts != NULL
+                                   ? ((size_t)1 << oldNsAttsPower) * sizeof(NS_ATT)
+                                   : 0,
+                               nsAttsSize * sizeof(NS_ATT));
       if (!temp) {
         /* Restore actual size of memory in m_nsAtts */
         parser->m_nsAttsPower = oldNsAttsPower;
@@ -3508,17 +6921,19 @@ storeAtts(XML_Parser parser, const ENCODING *enc,
     ;  /* i includes null terminator */
   n = i + binding->uriLen + prefixLen;
   if (n > binding->uriAlloc) {
-    TAG *p;
-    uri = (XML_Char *)MALLOC(parser, (n + EXPAND_SPARE) * sizeof(XML_Char));
+    int t;
+    uri = (XML_Char *)MALLOC_IN(parser, BINDINGS,
+                                (n + EXPAND_SPARE) * sizeof(XML_Char));
     if (!uri)
       return XML_ERROR_NO_MEMORY;
-    binding->uriAlloc = n + EXPAND_SPARE;
     memcpy(uri, binding->uri, binding->uriLen * sizeof(XML_Char));
-    for (p = parser->m_tagStack; p; p = p->parent)
-      if (p->name.str == binding->uri)
-        p->name.str = uri;
-    FREE(parser, binding->uri);
+    for (t = 0; t < parser->m_nTags; t++)
+      if (parser->m_tags[t].name.str == binding->uri)
+        parser->m_tags[t].name.str = uri;
+    FREE_IN(parser, BINDINGS, binding->uri,
+            binding->uriAlloc * sizeof(XML_Char));
     binding->uri = uri;
+    binding->uriAlloc = n + EXPAND_SPARE;
   }
   /* if m_namespaceSeparator != '\0' then uri includes it already */
   uri = binding->uri + binding->uriLen;
@@ -3609,8 +7024,9 @@ addBinding(XML_Parser parser, PREFIX *prefix, const ATTRIBUTE_ID *attId,
   if (parser->m_freeBindingList) {
     b = parser->m_freeBindingList;
     if (len > b->uriAlloc) {
-      XML_Char *temp = (XML_Char *)REALLOC(parser, b->uri,
-                          sizeof(XML_Char) * (len + EXPAND_SPARE));
+      XML_Char *temp = (XML_Char *)REALLOC_IN(parser, BINDINGS, b->uri,
+                             sizeof(XML_Char) * b->uriAlloc,
+                             sizeof(XML_Char) * (len + EXPAND_SPARE));
       if (temp == NULL)
         return XML_ERROR_NO_MEMORY;
       b->uri = temp;
@@ -3619,12 +7035,13 @@ addBinding(XML_Parser parser, PREFIX *prefix, const ATTRIBUTE_ID *attId,
     parser->m_freeBindingList = b->nextTagBinding;
   }
   else {
-    b = (BINDING *)MALLOC(parser, sizeof(BINDING));
+    b = (BINDING *)MALLOC_IN(parser, BINDINGS, sizeof(BINDING));
     if (!b)
       return XML_ERROR_NO_MEMORY;
-    b->uri = (XML_Char *)MALLOC(parser, sizeof(XML_Char) * (len + EXPAND_SPARE));
+    b->uri = (XML_Char *)MALLOC_IN(parser, BINDINGS,
+                                   sizeof(XML_Char) * (len + EXPAND_SPARE));
     if (!b->uri) {
-      FREE(parser, b);
+      FREE_IN(parser, BINDINGS, b, sizeof(BINDING));
       return XML_ERROR_NO_MEMORY;
     }
     b->uriAlloc = len + EXPAND_SPARE;
@@ -3701,6 +7118,8 @@ doCdataSection(XML_Parser parser,
   }
   *eventPP = s;
   *startPtr = NULL;
+  if (!DATA_BUF_READY(parser, enc, s))
+    return XML_ERROR_NO_MEMORY;
 
   for (;;) {
     const char *next;
@@ -3708,7 +7127,9 @@ doCdataSection(XML_Parser parser,
     *eventEndPP = next;
     switch (tok) {
     case XML_TOK_CDATA_SECT_CLOSE:
-      if (parser->m_endCdataSectionHandler)
+      if (parser->m_skipTagLevel != 0)
+        ;  /* skipped by XML_SkipCurrentElement() */
+      else if (parser->m_endCdataSectionHandler)
         parser->m_endCdataSectionHandler(parser->m_handlerArg);
 #if 0
       /* see comment under XML_TOK_CDATA_SECT_OPEN */
@@ -3724,6 +7145,12 @@ doCdataSection(XML_Parser parser,
       else
         return XML_ERROR_NONE;
     case XML_TOK_DATA_NEWLINE:
+      if (parser->m_skipTagLevel != 0)
+        break;
+      if (PATH_TEXT_WANTED(parser)) {
+        XML_Char c = 0xA;
+        pathCharacters(parser, &c, 1);
+      }
       if (parser->m_characterDataHandler) {
         XML_Char c = 0xA;
         parser->m_characterDataHandler(parser->m_handlerArg, &c, 1);
@@ -3734,6 +7161,10 @@ doCdataSection(XML_Parser parser,
     case XML_TOK_DATA_CHARS:
       {
         XML_CharacterDataHandler charDataHandler = parser->m_characterDataHandler;
+        if (parser->m_skipTagLevel != 0)
+          break;
+        if (PATH_TEXT_WANTED(parser))
+          pathCharacterData(parser, enc, s, next);
         if (charDataHandler) {
           if (MUST_CONVERT(enc, s)) {
             for (;;) {
@@ -3748,9 +7179,8 @@ doCdataSection(XML_Parser parser,
             }
           }
           else
-            charDataHandler(parser->m_handlerArg,
-                            (XML_Char *)s,
-                            (int)((XML_Char *)next - (XML_Char *)s));
+            reportCharacters(parser, charDataHandler,
+                             (XML_Char *)s, (XML_Char *)next);
         }
         else if (parser->m_defaultHandler)
           reportDefault(parser, enc, s, next);
@@ -3859,6 +7289,8 @@ doIgnoreSection(XML_Parser parser,
   }
   *eventPP = s;
   *startPtr = NULL;
+  if (!DATA_BUF_READY(parser, enc, s))
+    return XML_ERROR_NO_MEMORY;
   tok = XmlIgnoreSectionTok(enc, s, end, &next);
   *eventEndPP = next;
   switch (tok) {
@@ -3990,8 +7422,11 @@ processXmlDecl(XML_Parser parser, int isGeneralTextEntity,
     }
     parser->m_xmlDeclHandler(parser->m_handlerArg, storedversion, storedEncName, standalone);
   }
-  else if (parser->m_defaultHandler)
+  else if (parser->m_defaultHandler) {
+    if (!DATA_BUF_READY(parser, parser->m_encoding, s))
+      return XML_ERROR_NO_MEMORY;
     reportDefault(parser, parser->m_encoding, s, next);
+  }
   if (parser->m_protocolEncodingName == NULL) {
     if (newEncoding) {
       /* Check that the specified encoding does not conflict with what
@@ -4044,7 +7479,9 @@ handleUnknownEncoding(XML_Parser parser, const XML_Char *encodingName)
     if (parser->m_unknownEncodingHandler(parser->m_unknownEncodingHandlerData, encodingName,
                                &info)) {
       ENCODING *enc;
-      parser->m_unknownEncodingMem = MALLOC(parser, XmlSizeOfUnknownEncoding());
+      /* may be left over from before a capacity-keeping reset */
+      if (!parser->m_unknownEncodingMem)
+        parser->m_unknownEncodingMem = MALLOC(parser, XmlSizeOfUnknownEncoding());
       if (!parser->m_unknownEncodingMem) {
         if (info.release)
           info.release(info.data);
@@ -4321,6 +7758,8 @@ doProlog(XML_Parser parser,
     eventPP = &(parser->m_openInternalEntities->internalEventPtr);
     eventEndPP = &(parser->m_openInternalEntities->internalEventEndPtr);
   }
+  if (!DATA_BUF_READY(parser, enc, s))
+    return XML_ERROR_NO_MEMORY;
 
   for (;;) {
     int role;
@@ -4370,6 +7809,9 @@ doProlog(XML_Parser parser,
       }
     }
     role = XmlTokenRole(&parser->m_prologState, tok, s, next, enc);
+    if (role > XML_ROLE_INSTANCE_START && role != XML_ROLE_PI
+        && role != XML_ROLE_COMMENT && !declStateReady(parser))
+      return XML_ERROR_NO_MEMORY;
     switch (role) {
     case XML_ROLE_XML_DECL:
       {
@@ -4377,25 +7819,27 @@ doProlog(XML_Parser parser,
         if (result != XML_ERROR_NONE)
           return result;
         enc = parser->m_encoding;
+        if (!DATA_BUF_READY(parser, enc, next))
+          return XML_ERROR_NO_MEMORY;
         handleDefault = XML_FALSE;
       }
       break;
     case XML_ROLE_DOCTYPE_NAME:
       if (parser->m_startDoctypeDeclHandler) {
-        parser->m_doctypeName = poolStoreString(&parser->m_tempPool, enc, s, next);
-        if (!parser->m_doctypeName)
+        parser->m_decl->doctypeName = poolStoreString(&parser->m_tempPool, enc, s, next);
+        if (!parser->m_decl->doctypeName)
           return XML_ERROR_NO_MEMORY;
         poolFinish(&parser->m_tempPool);
-        parser->m_doctypePubid = NULL;
+        parser->m_decl->doctypePubid = NULL;
         handleDefault = XML_FALSE;
       }
-      parser->m_doctypeSysid = NULL; /* always initialize to NULL */
+      parser->m_decl->doctypeSysid = NULL; /* always initialize to NULL */
       break;
     case XML_ROLE_DOCTYPE_INTERNAL_SUBSET:
       if (parser->m_startDoctypeDeclHandler) {
-        parser->m_startDoctypeDeclHandler(parser->m_handlerArg, parser->m_doctypeName, parser->m_doctypeSysid,
-                                parser->m_doctypePubid, 1);
-        parser->m_doctypeName = NULL;
+        parser->m_startDoctypeDeclHandler(parser->m_handlerArg, parser->m_decl->doctypeName, parser->m_decl->doctypeSysid,
+                                parser->m_decl->doctypePubid, 1);
+        parser->m_decl->doctypeName = NULL;
         poolClear(&parser->m_tempPool);
         handleDefault = XML_FALSE;
       }
@@ -4407,6 +7851,8 @@ doProlog(XML_Parser parser,
         if (result != XML_ERROR_NONE)
           return result;
         enc = parser->m_encoding;
+        if (!DATA_BUF_READY(parser, enc, next))
+          return XML_ERROR_NO_MEMORY;
         handleDefault = XML_FALSE;
       }
       break;
@@ -4414,11 +7860,11 @@ doProlog(XML_Parser parser,
     case XML_ROLE_DOCTYPE_PUBLIC_ID:
 #ifdef XML_DTD
       parser->m_useForeignDTD = XML_FALSE;
-      parser->m_declEntity = (ENTITY *)lookup(parser,
+      parser->m_decl->declEntity = (ENTITY *)lookup(parser,
                                     &dtd->paramEntities,
                                     externalSubsetName,
                                     sizeof(ENTITY));
-      if (!parser->m_declEntity)
+      if (!parser->m_decl->declEntity)
         return XML_ERROR_NO_MEMORY;
 #endif /* XML_DTD */
       dtd->hasParamEntityRefs = XML_TRUE;
@@ -4433,7 +7879,7 @@ doProlog(XML_Parser parser,
           return XML_ERROR_NO_MEMORY;
         normalizePublicId(pubId);
         poolFinish(&parser->m_tempPool);
-        parser->m_doctypePubid = pubId;
+        parser->m_decl->doctypePubid = pubId;
         handleDefault = XML_FALSE;
         goto alreadyChecked;
       }
@@ -4442,7 +7888,7 @@ doProlog(XML_Parser parser,
       if (!XmlIsPublicId(enc, s, next, eventPP))
         return XML_ERROR_PUBLICID;
     alreadyChecked:
-      if (dtd->keepProcessing && parser->m_declEntity) {
+      if (dtd->keepProcessing && parser->m_decl->declEntity) {
         XML_Char *tem = poolStoreString(&dtd->pool,
                                         enc,
                                         s + enc->minBytesPerChar,
@@ -4450,7 +7896,7 @@ doProlog(XML_Parser parser,
         if (!tem)
           return XML_ERROR_NO_MEMORY;
         normalizePublicId(tem);
-        parser->m_declEntity->publicId = tem;
+        parser->m_decl->declEntity->publicId = tem;
         poolFinish(&dtd->pool);
         /* Don't suppress the default handler if we fell through from
          * the XML_ROLE_DOCTYPE_PUBLIC_ID case.
@@ -4460,18 +7906,18 @@ doProlog(XML_Parser parser,
       }
       break;
     case XML_ROLE_DOCTYPE_CLOSE:
-      if (parser->m_doctypeName) {
-        parser->m_startDoctypeDeclHandler(parser->m_handlerArg, parser->m_doctypeName,
-                                parser->m_doctypeSysid, parser->m_doctypePubid, 0);
+      if (parser->m_decl->doctypeName) {
+        parser->m_startDoctypeDeclHandler(parser->m_handlerArg, parser->m_decl->doctypeName,
+                                parser->m_decl->doctypeSysid, parser->m_decl->doctypePubid, 0);
         poolClear(&parser->m_tempPool);
         handleDefault = XML_FALSE;
       }
-      /* parser->m_doctypeSysid will be non-NULL in the case of a previous
+      /* parser->m_decl->doctypeSysid will be non-NULL in the case of a previous
          XML_ROLE_DOCTYPE_SYSTEM_ID, even if parser->m_startDoctypeDeclHandler
          was not set, indicating an external subset
       */
 #ifdef XML_DTD
-      if (parser->m_doctypeSysid || parser->m_useForeignDTD) {
+      if (parser->m_decl->doctypeSysid || parser->m_useForeignDTD) {
         XML_Bool hadParamEntityRefs = dtd->hasParamEntityRefs;
         dtd->hasParamEntityRefs = XML_TRUE;
         if (parser->m_paramEntityParsing && parser->m_externalEntityRefHandler) {
@@ -4505,7 +7951,7 @@ doProlog(XML_Parser parser,
           /* if we didn't read the foreign DTD then this means that there
              is no external subset and we must reset dtd->hasParamEntityRefs
           */
-          else if (!parser->m_doctypeSysid)
+          else if (!parser->m_decl->doctypeSysid)
             dtd->hasParamEntityRefs = hadParamEntityRefs;
           /* end of DTD - no need to update dtd->keepProcessing */
         }
@@ -4554,46 +8000,48 @@ doProlog(XML_Parser parser,
         }
       }
 #endif /* XML_DTD */
+      if (!parser->m_keepCapacity)
+        declStateFree(parser);
       parser->m_processor = contentProcessor;
       return contentProcessor(parser, s, end, nextPtr);
     case XML_ROLE_ATTLIST_ELEMENT_NAME:
-      parser->m_declElementType = getElementType(parser, enc, s, next);
-      if (!parser->m_declElementType)
+      parser->m_decl->declElementType = getElementType(parser, enc, s, next);
+      if (!parser->m_decl->declElementType)
         return XML_ERROR_NO_MEMORY;
       goto checkAttListDeclHandler;
     case XML_ROLE_ATTRIBUTE_NAME:
-      parser->m_declAttributeId = getAttributeId(parser, enc, s, next);
-      if (!parser->m_declAttributeId)
+      parser->m_decl->declAttributeId = getAttributeId(parser, enc, s, next);
+      if (!parser->m_decl->declAttributeId)
         return XML_ERROR_NO_MEMORY;
-      parser->m_declAttributeIsCdata = XML_FALSE;
-      parser->m_declAttributeType = NULL;
-      parser->m_declAttributeIsId = XML_FALSE;
+      parser->m_decl->declAttributeIsCdata = XML_FALSE;
+      parser->m_decl->declAttributeType = NULL;
+      parser->m_decl->declAttributeIsId = XML_FALSE;
       goto checkAttListDeclHandler;
     case XML_ROLE_ATTRIBUTE_TYPE_CDATA:
-      parser->m_declAttributeIsCdata = XML_TRUE;
-      parser->m_declAttributeType = atypeCDATA;
+      parser->m_decl->declAttributeIsCdata = XML_TRUE;
+      parser->m_decl->declAttributeType = atypeCDATA;
       goto checkAttListDeclHandler;
     case XML_ROLE_ATTRIBUTE_TYPE_ID:
-      parser->m_declAttributeIsId = XML_TRUE;
-      parser->m_declAttributeType = atypeID;
+      parser->m_decl->declAttributeIsId = XML_TRUE;
+      parser->m_decl->declAttributeType = atypeID;
       goto checkAttListDeclHandler;
     case XML_ROLE_ATTRIBUTE_TYPE_IDREF:
-      parser->m_declAttributeType = atypeIDREF;
+      parser->m_decl->declAttributeType = atypeIDREF;
       goto checkAttListDeclHandler;
     case XML_ROLE_ATTRIBUTE_TYPE_IDREFS:
-      parser->m_declAttributeType = atypeIDREFS;
+      parser->m_decl->declAttributeType = atypeIDREFS;
       goto checkAttListDeclHandler;
     case XML_ROLE_ATTRIBUTE_TYPE_ENTITY:
-      parser->m_declAttributeType = atypeENTITY;
+      parser->m_decl->declAttributeType = atypeENTITY;
       goto checkAttListDeclHandler;
     case XML_ROLE_ATTRIBUTE_TYPE_ENTITIES:
-      parser->m_declAttributeType = atypeENTITIES;
+      parser->m_decl->declAttributeType = atypeENTITIES;
       goto checkAttListDeclHandler;
     case XML_ROLE_ATTRIBUTE_TYPE_NMTOKEN:
-      parser->m_declAttributeType = atypeNMTOKEN;
+      parser->m_decl->declAttributeType = atypeNMTOKEN;
       goto checkAttListDeclHandler;
     case XML_ROLE_ATTRIBUTE_TYPE_NMTOKENS:
-      parser->m_declAttributeType = atypeNMTOKENS;
+      parser->m_decl->declAttributeType = atypeNMTOKENS;
     checkAttListDeclHandler:
       if (dtd->keepProcessing && parser->m_attlistDeclHandler)
         handleDefault = XML_FALSE;
@@ -4602,7 +8050,7 @@ doProlog(XML_Parser parser,
     case XML_ROLE_ATTRIBUTE_NOTATION_VALUE:
       if (dtd->keepProcessing && parser->m_attlistDeclHandler) {
         const XML_Char *prefix;
-        if (parser->m_declAttributeType) {
+        if (parser->m_decl->declAttributeType) {
           prefix = enumValueSep;
         }
         else {
@@ -4614,31 +8062,31 @@ doProlog(XML_Parser parser,
           return XML_ERROR_NO_MEMORY;
         if (!poolAppend(&parser->m_tempPool, enc, s, next))
           return XML_ERROR_NO_MEMORY;
-        parser->m_declAttributeType = parser->m_tempPool.start;
+        parser->m_decl->declAttributeType = parser->m_tempPool.start;
         handleDefault = XML_FALSE;
       }
       break;
     case XML_ROLE_IMPLIED_ATTRIBUTE_VALUE:
     case XML_ROLE_REQUIRED_ATTRIBUTE_VALUE:
       if (dtd->keepProcessing) {
-        if (!defineAttribute(parser->m_declElementType, parser->m_declAttributeId,
-                             parser->m_declAttributeIsCdata, parser->m_declAttributeIsId,
+        if (!defineAttribute(parser->m_decl->declElementType, parser->m_decl->declAttributeId,
+                             parser->m_decl->declAttributeIsCdata, parser->m_decl->declAttributeIsId,
                              0, parser))
           return XML_ERROR_NO_MEMORY;
-        if (parser->m_attlistDeclHandler && parser->m_declAttributeType) {
-          if (*parser->m_declAttributeType == XML_T(ASCII_LPAREN)
-              || (*parser->m_declAttributeType == XML_T(ASCII_N)
-                  && parser->m_declAttributeType[1] == XML_T(ASCII_O))) {
+        if (parser->m_attlistDeclHandler && parser->m_decl->declAttributeType) {
+          if (*parser->m_decl->declAttributeType == XML_T(ASCII_LPAREN)
+              || (*parser->m_decl->declAttributeType == XML_T(ASCII_N)
+                  && parser->m_decl->declAttributeType[1] == XML_T(ASCII_O))) {
             /* Enumerated or Notation type */
             if (!poolAppendChar(&parser->m_tempPool, XML_T(ASCII_RPAREN))
                 || !poolAppendChar(&parser->m_tempPool, XML_T('\0')))
               return XML_ERROR_NO_MEMORY;
-            parser->m_declAttributeType = parser->m_tempPool.start;
+            parser->m_decl->declAttributeType = parser->m_tempPool.start;
             poolFinish(&parser->m_tempPool);
           }
           *eventEndPP = s;
-          parser->m_attlistDeclHandler(parser->m_handlerArg, parser->m_declElementType->name,
-                             parser->m_declAttributeId->name, parser->m_declAttributeType,
+          parser->m_attlistDeclHandler(parser->m_handlerArg, parser->m_decl->declElementType->name,
+                             parser->m_decl->declAttributeId->name, parser->m_decl->declAttributeType,
                              0, role == XML_ROLE_REQUIRED_ATTRIBUTE_VALUE);
           poolClear(&parser->m_tempPool);
           handleDefault = XML_FALSE;
@@ -4650,7 +8098,7 @@ doProlog(XML_Parser parser,
       if (dtd->keepProcessing) {
         const XML_Char *attVal;
         enum XML_Error result =
-          storeAttributeValue(parser, enc, parser->m_declAttributeIsCdata,
+          storeAttributeValue(parser, enc, parser->m_decl->declAttributeIsCdata,
                               s + enc->minBytesPerChar,
                               next - enc->minBytesPerChar,
                               &dtd->pool);
@@ -4659,23 +8107,23 @@ doProlog(XML_Parser parser,
         attVal = poolStart(&dtd->pool);
         poolFinish(&dtd->pool);
         /* ID attributes aren't allowed to have a default */
-        if (!defineAttribute(parser->m_declElementType, parser->m_declAttributeId,
-                             parser->m_declAttributeIsCdata, XML_FALSE, attVal, parser))
+        if (!defineAttribute(parser->m_decl->declElementType, parser->m_decl->declAttributeId,
+                             parser->m_decl->declAttributeIsCdata, XML_FALSE, attVal, parser))
           return XML_ERROR_NO_MEMORY;
-        if (parser->m_attlistDeclHandler && parser->m_declAttributeType) {
-          if (*parser->m_declAttributeType == XML_T(ASCII_LPAREN)
-              || (*parser->m_declAttributeType == XML_T(ASCII_N)
-                  && parser->m_declAttributeType[1] == XML_T(ASCII_O))) {
+        if (parser->m_attlistDeclHandler && parser->m_decl->declAttributeType) {
+          if (*parser->m_decl->declAttributeType == XML_T(ASCII_LPAREN)
+              || (*parser->m_decl->declAttributeType == XML_T(ASCII_N)
+                  && parser->m_decl->declAttributeType[1] == XML_T(ASCII_O))) {
             /* Enumerated or Notation type */
             if (!poolAppendChar(&parser->m_tempPool, XML_T(ASCII_RPAREN))
                 || !poolAppendChar(&parser->m_tempPool, XML_T('\0')))
               return XML_ERROR_NO_MEMORY;
-            parser->m_declAttributeType = parser->m_tempPool.start;
+            parser->m_decl->declAttributeType = parser->m_tempPool.start;
             poolFinish(&parser->m_tempPool);
           }
           *eventEndPP = s;
-          parser->m_attlistDeclHandler(parser->m_handlerArg, parser->m_declElementType->name,
-                             parser->m_declAttributeId->name, parser->m_declAttributeType,
+          parser->m_attlistDeclHandler(parser->m_handlerArg, parser->m_decl->declElementType->name,
+                             parser->m_decl->declAttributeId->name, parser->m_decl->declAttributeType,
                              attVal,
                              role == XML_ROLE_FIXED_ATTRIBUTE_VALUE);
           poolClear(&parser->m_tempPool);
@@ -4688,17 +8136,22 @@ doProlog(XML_Parser parser,
         enum XML_Error result = storeEntityValue(parser, enc,
                                             s + enc->minBytesPerChar,
                                             next - enc->minBytesPerChar);
-        if (parser->m_declEntity) {
-          parser->m_declEntity->textPtr = poolStart(&dtd->entityValuePool);
-          parser->m_declEntity->textLen = (int)(poolLength(&dtd->entityValuePool));
+        if (poolLength(&dtd->entityValuePool) > INT_MAX) {
+          /* entity text lengths are int */
+          poolDiscard(&dtd->entityValuePool);
+          return XML_ERROR_NO_MEMORY;
+        }
+        if (parser->m_decl->declEntity) {
+          parser->m_decl->declEntity->textPtr = poolStart(&dtd->entityValuePool);
+          parser->m_decl->declEntity->textLen = (int)(poolLength(&dtd->entityValuePool));
           poolFinish(&dtd->entityValuePool);
           if (parser->m_entityDeclHandler) {
             *eventEndPP = s;
             parser->m_entityDeclHandler(parser->m_handlerArg,
-                              parser->m_declEntity->name,
-                              parser->m_declEntity->is_param,
-                              parser->m_declEntity->textPtr,
-                              parser->m_declEntity->textLen,
+                              parser->m_decl->declEntity->name,
+                              parser->m_decl->declEntity->is_param,
+                              parser->m_decl->declEntity->textPtr,
+                              parser->m_decl->declEntity->textLen,
                               parser->m_curBase, 0, 0, 0);
             handleDefault = XML_FALSE;
           }
@@ -4715,19 +8168,19 @@ doProlog(XML_Parser parser,
 #endif /* XML_DTD */
       dtd->hasParamEntityRefs = XML_TRUE;
       if (parser->m_startDoctypeDeclHandler) {
-        parser->m_doctypeSysid = poolStoreString(&parser->m_tempPool, enc,
+        parser->m_decl->doctypeSysid = poolStoreString(&parser->m_tempPool, enc,
                                        s + enc->minBytesPerChar,
                                        next - enc->minBytesPerChar);
-        if (parser->m_doctypeSysid == NULL)
+        if (parser->m_decl->doctypeSysid == NULL)
           return XML_ERROR_NO_MEMORY;
         poolFinish(&parser->m_tempPool);
         handleDefault = XML_FALSE;
       }
 #ifdef XML_DTD
       else
-        /* use externalSubsetName to make parser->m_doctypeSysid non-NULL
+        /* use externalSubsetName to make parser->m_decl->doctypeSysid non-NULL
            for the case where no parser->m_startDoctypeDeclHandler is set */
-        parser->m_doctypeSysid = externalSubsetName;
+        parser->m_decl->doctypeSysid = externalSubsetName;
 #endif /* XML_DTD */
       if (!dtd->standalone
 #ifdef XML_DTD
@@ -4739,26 +8192,31 @@ doProlog(XML_Parser parser,
 #ifndef XML_DTD
       break;
 #else /* XML_DTD */
-      if (!parser->m_declEntity) {
-        parser->m_declEntity = (ENTITY *)lookup(parser,
+      if (!parser->m_decl->declEntity) {
+        parser->m_decl->declEntity = (ENTITY *)lookup(parser,
                                       &dtd->paramEntities,
                                       externalSubsetName,
                                       sizeof(ENTITY));
-        if (!parser->m_declEntity)
+        if (!parser->m_decl->declEntity)
           return XML_ERROR_NO_MEMORY;
-        parser->m_declEntity->publicId = NULL;
+        parser->m_decl->declEntity->publicId = NULL;
       }
 #endif /* XML_DTD */
       /* fall through */
     case XML_ROLE_ENTITY_SYSTEM_ID:
-      if (dtd->keepProcessing && parser->m_declEntity) {
-        parser->m_declEntity->systemId = poolStoreString(&dtd->pool, enc,
+      if (dtd->keepProcessing && parser->m_decl->declEntity) {
+        parser->m_decl->declEntity->systemId = poolStoreString(&dtd->pool, enc,
                                                s + enc->minBytesPerChar,
                                                next - enc->minBytesPerChar);
-        if (!parser->m_declEntity->systemId)
+        if (!parser->m_decl->declEntity->systemId)
           return XML_ERROR_NO_MEMORY;
-        parser->m_declEntity->base = parser->m_curBase;
+        parser->m_decl->declEntity->base = parser->m_curBase;
         poolFinish(&dtd->pool);
+#ifdef XML_DTD
+        /* the external subset is read at the end of the DOCTYPE */
+        if (role == XML_ROLE_DOCTYPE_SYSTEM_ID && parser->m_paramEntityParsing)
+          announceEntity(parser, parser->m_decl->declEntity);
+#endif /* XML_DTD */
         /* Don't suppress the default handler if we fell through from
          * the XML_ROLE_DOCTYPE_SYSTEM_ID case.
          */
@@ -4767,44 +8225,51 @@ doProlog(XML_Parser parser,
       }
       break;
     case XML_ROLE_ENTITY_COMPLETE:
-      if (dtd->keepProcessing && parser->m_declEntity && parser->m_entityDeclHandler) {
+      if (dtd->keepProcessing && parser->m_decl->declEntity
+#ifdef XML_DTD
+          && (!parser->m_decl->declEntity->is_param
+              || parser->m_paramEntityParsing)
+#endif /* XML_DTD */
+          )
+        announceEntity(parser, parser->m_decl->declEntity);
+      if (dtd->keepProcessing && parser->m_decl->declEntity && parser->m_entityDeclHandler) {
         *eventEndPP = s;
         parser->m_entityDeclHandler(parser->m_handlerArg,
-                          parser->m_declEntity->name,
-                          parser->m_declEntity->is_param,
+                          parser->m_decl->declEntity->name,
+                          parser->m_decl->declEntity->is_param,
                           0,0,
-                          parser->m_declEntity->base,
-                          parser->m_declEntity->systemId,
-                          parser->m_declEntity->publicId,
+                          parser->m_decl->declEntity->base,
+                          parser->m_decl->declEntity->systemId,
+                          parser->m_decl->declEntity->publicId,
                           0);
         handleDefault = XML_FALSE;
       }
       break;
     case XML_ROLE_ENTITY_NOTATION_NAME:
-      if (dtd->keepProcessing && parser->m_declEntity) {
-        parser->m_declEntity->notation = poolStoreString(&dtd->pool, enc, s, next);
-        if (!parser->m_declEntity->notation)
+      if (dtd->keepProcessing && parser->m_decl->declEntity) {
+        parser->m_decl->declEntity->notation = poolStoreString(&dtd->pool, enc, s, next);
+        if (!parser->m_decl->declEntity->notation)
           return XML_ERROR_NO_MEMORY;
         poolFinish(&dtd->pool);
         if (parser->m_unparsedEntityDeclHandler) {
           *eventEndPP = s;
           parser->m_unparsedEntityDeclHandler(parser->m_handlerArg,
-                                    parser->m_declEntity->name,
-                                    parser->m_declEntity->base,
-                                    parser->m_declEntity->systemId,
-                                    parser->m_declEntity->publicId,
-                                    parser->m_declEntity->notation);
+                                    parser->m_decl->declEntity->name,
+                                    parser->m_decl->declEntity->base,
+                                    parser->m_decl->declEntity->systemId,
+                                    parser->m_decl->declEntity->publicId,
+                                    parser->m_decl->declEntity->notation);
           handleDefault = XML_FALSE;
         }
         else if (parser->m_entityDeclHandler) {
           *eventEndPP = s;
           parser->m_entityDeclHandler(parser->m_handlerArg,
-                            parser->m_declEntity->name,
+                            parser->m_decl->declEntity->name,
                             0,0,0,
-                            parser->m_declEntity->base,
-                            parser->m_declEntity->systemId,
-                            parser->m_declEntity->publicId,
-                            parser->m_declEntity->notation);
+                            parser->m_decl->declEntity->base,
+                            parser->m_decl->declEntity->systemId,
+                            parser->m_decl->declEntity->publicId,
+                            parser->m_decl->declEntity->notation);
           handleDefault = XML_FALSE;
         }
       }
@@ -4812,36 +8277,36 @@ doProlog(XML_Parser parser,
     case XML_ROLE_GENERAL_ENTITY_NAME:
       {
         if (XmlPredefinedEntityName(enc, s, next)) {
-          parser->m_declEntity = NULL;
+          parser->m_decl->declEntity = NULL;
           break;
         }
         if (dtd->keepProcessing) {
           const XML_Char *name = poolStoreString(&dtd->pool, enc, s, next);
           if (!name)
             return XML_ERROR_NO_MEMORY;
-          parser->m_declEntity = (ENTITY *)lookup(parser, &dtd->generalEntities, name,
+          parser->m_decl->declEntity = (ENTITY *)lookup(parser, &dtd->generalEntities, name,
                                         sizeof(ENTITY));
-          if (!parser->m_declEntity)
+          if (!parser->m_decl->declEntity)
             return XML_ERROR_NO_MEMORY;
-          if (parser->m_declEntity->name != name) {
+          if (parser->m_decl->declEntity->name != name) {
             poolDiscard(&dtd->pool);
-            parser->m_declEntity = NULL;
+            parser->m_decl->declEntity = NULL;
           }
           else {
             poolFinish(&dtd->pool);
-            parser->m_declEntity->publicId = NULL;
-            parser->m_declEntity->is_param = XML_FALSE;
+            parser->m_decl->declEntity->publicId = NULL;
+            parser->m_decl->declEntity->is_param = XML_FALSE;
             /* if we have a parent parser or are reading an internal parameter
                entity, then the entity declaration is not considered "internal"
             */
-            parser->m_declEntity->is_internal = !(parser->m_parentParser || parser->m_openInternalEntities);
+            parser->m_decl->declEntity->is_internal = !(parser->m_parentParser || parser->m_openInternalEntities);
             if (parser->m_entityDeclHandler)
               handleDefault = XML_FALSE;
           }
         }
         else {
           poolDiscard(&dtd->pool);
-          parser->m_declEntity = NULL;
+          parser->m_decl->declEntity = NULL;
         }
       }
       break;
@@ -4851,40 +8316,40 @@ doProlog(XML_Parser parser,
         const XML_Char *name = poolStoreString(&dtd->pool, enc, s, next);
         if (!name)
           return XML_ERROR_NO_MEMORY;
-        parser->m_declEntity = (ENTITY *)lookup(parser, &dtd->paramEntities,
+        parser->m_decl->declEntity = (ENTITY *)lookup(parser, &dtd->paramEntities,
                                            name, sizeof(ENTITY));
-        if (!parser->m_declEntity)
+        if (!parser->m_decl->declEntity)
           return XML_ERROR_NO_MEMORY;
-        if (parser->m_declEntity->name != name) {
+        if (parser->m_decl->declEntity->name != name) {
           poolDiscard(&dtd->pool);
-          parser->m_declEntity = NULL;
+          parser->m_decl->declEntity = NULL;
         }
         else {
           poolFinish(&dtd->pool);
-          parser->m_declEntity->publicId = NULL;
-          parser->m_declEntity->is_param = XML_TRUE;
+          parser->m_decl->declEntity->publicId = NULL;
+          parser->m_decl->declEntity->is_param = XML_TRUE;
           /* if we have a parent parser or are reading an internal parameter
              entity, then the entity declaration is not considered "internal"
           */
-          parser->m_declEntity->is_internal = !(parser->m_parentParser || parser->m_openInternalEntities);
+          parser->m_decl->declEntity->is_internal = !(parser->m_parentParser || parser->m_openInternalEntities);
           if (parser->m_entityDeclHandler)
             handleDefault = XML_FALSE;
         }
       }
       else {
         poolDiscard(&dtd->pool);
-        parser->m_declEntity = NULL;
+        parser->m_decl->declEntity = NULL;
       }
 #else /* not XML_DTD */
-      parser->m_declEntity = NULL;
+      parser->m_decl->declEntity = NULL;
 #endif /* XML_DTD */
       break;
     case XML_ROLE_NOTATION_NAME:
-      parser->m_declNotationPublicId = NULL;
-      parser->m_declNotationName = NULL;
+      parser->m_decl->declNotationPublicId = NULL;
+      parser->m_decl->declNotationName = NULL;
       if (parser->m_notationDeclHandler) {
-        parser->m_declNotationName = poolStoreString(&parser->m_tempPool, enc, s, next);
-        if (!parser->m_declNotationName)
+        parser->m_decl->declNotationName = poolStoreString(&parser->m_tempPool, enc, s, next);
+        if (!parser->m_decl->declNotationName)
           return XML_ERROR_NO_MEMORY;
         poolFinish(&parser->m_tempPool);
         handleDefault = XML_FALSE;
@@ -4893,7 +8358,7 @@ doProlog(XML_Parser parser,
     case XML_ROLE_NOTATION_PUBLIC_ID:
       if (!XmlIsPublicId(enc, s, next, eventPP))
         return XML_ERROR_PUBLICID;
-      if (parser->m_declNotationName) {  /* means m_notationDeclHandler != NULL */
+      if (parser->m_decl->declNotationName) {  /* means m_notationDeclHandler != NULL */
         XML_Char *tem = poolStoreString(&parser->m_tempPool,
                                         enc,
                                         s + enc->minBytesPerChar,
@@ -4901,13 +8366,13 @@ doProlog(XML_Parser parser,
         if (!tem)
           return XML_ERROR_NO_MEMORY;
         normalizePublicId(tem);
-        parser->m_declNotationPublicId = tem;
+        parser->m_decl->declNotationPublicId = tem;
         poolFinish(&parser->m_tempPool);
         handleDefault = XML_FALSE;
       }
       break;
     case XML_ROLE_NOTATION_SYSTEM_ID:
-      if (parser->m_declNotationName && parser->m_notationDeclHandler) {
+      if (parser->m_decl->declNotationName && parser->m_notationDeclHandler) {
         const XML_Char *systemId
           = poolStoreString(&parser->m_tempPool, enc,
                             s + enc->minBytesPerChar,
@@ -4916,22 +8381,22 @@ doProlog(XML_Parser parser,
           return XML_ERROR_NO_MEMORY;
         *eventEndPP = s;
         parser->m_notationDeclHandler(parser->m_handlerArg,
-                            parser->m_declNotationName,
+                            parser->m_decl->declNotationName,
                             parser->m_curBase,
                             systemId,
-                            parser->m_declNotationPublicId);
+                            parser->m_decl->declNotationPublicId);
         handleDefault = XML_FALSE;
       }
       poolClear(&parser->m_tempPool);
       break;
     case XML_ROLE_NOTATION_NO_SYSTEM_ID:
-      if (parser->m_declNotationPublicId && parser->m_notationDeclHandler) {
+      if (parser->m_decl->declNotationPublicId && parser->m_notationDeclHandler) {
         *eventEndPP = s;
         parser->m_notationDeclHandler(parser->m_handlerArg,
-                            parser->m_declNotationName,
+                            parser->m_decl->declNotationName,
                             parser->m_curBase,
                             0,
-                            parser->m_declNotationPublicId);
+                            parser->m_decl->declNotationPublicId);
         handleDefault = XML_FALSE;
       }
       poolClear(&parser->m_tempPool);
@@ -4965,31 +8430,35 @@ doProlog(XML_Parser parser,
       break;
 #endif /* XML_DTD */
     case XML_ROLE_GROUP_OPEN:
-      if (parser->m_prologState.level >= parser->m_groupSize) {
-        if (parser->m_groupSize) {
-          char *temp = (char *)REALLOC(parser, parser->m_groupConnector, parser->m_groupSize *= 2);
-          if (temp == NULL) {
-            parser->m_groupSize /= 2;
+      if (parser->m_prologState.level >= parser->m_decl->groupSize) {
+        if (parser->m_decl->groupSize) {
+          char *temp = (char *)REALLOC(parser, parser->m_decl->groupConnector,
+                                       parser->m_decl->groupSize,
+                                       parser->m_decl->groupSize * 2);
+          if (temp == NULL)
             return XML_ERROR_NO_MEMORY;
-          }
-          parser->m_groupConnector = temp;
+          parser->m_decl->groupSize *= 2;
+          parser->m_decl->groupConnector = temp;
           if (dtd->scaffIndex) {
-            int *temp = (int *)REALLOC(parser, dtd->scaffIndex,
-                          parser->m_groupSize * sizeof(int));
+            int *temp = (int *)dtdRealloc(dtd, MEM(parser, DTD),
+                          dtd->scaffIndex,
+                          dtd->scaffIndexSize * sizeof(int),
+                          parser->m_decl->groupSize * sizeof(int));
             if (temp == NULL)
               return XML_ERROR_NO_MEMORY;
             dtd->scaffIndex = temp;
+            dtd->scaffIndexSize = parser->m_decl->groupSize;
           }
         }
         else {
-          parser->m_groupConnector = (char *)MALLOC(parser, parser->m_groupSize = 32);
-          if (!parser->m_groupConnector) {
-            parser->m_groupSize = 0;
+          parser->m_decl->groupConnector = (char *)MALLOC(parser, parser->m_decl->groupSize = 32);
+          if (!parser->m_decl->groupConnector) {
+            parser->m_decl->groupSize = 0;
             return XML_ERROR_NO_MEMORY;
           }
         }
       }
-      parser->m_groupConnector[parser->m_prologState.level] = 0;
+      parser->m_decl->groupConnector[parser->m_prologState.level] = 0;
       if (dtd->in_eldecl) {
         int myindex = nextScaffoldPart(parser);
         if (myindex < 0)
@@ -5002,17 +8471,17 @@ doProlog(XML_Parser parser,
       }
       break;
     case XML_ROLE_GROUP_SEQUENCE:
-      if (parser->m_groupConnector[parser->m_prologState.level] == ASCII_PIPE)
+      if (parser->m_decl->groupConnector[parser->m_prologState.level] == ASCII_PIPE)
         return XML_ERROR_SYNTAX;
-      parser->m_groupConnector[parser->m_prologState.level] = ASCII_COMMA;
+      parser->m_decl->groupConnector[parser->m_prologState.level] = ASCII_COMMA;
       if (dtd->in_eldecl && parser->m_elementDeclHandler)
         handleDefault = XML_FALSE;
       break;
     case XML_ROLE_GROUP_CHOICE:
-      if (parser->m_groupConnector[parser->m_prologState.level] == ASCII_COMMA)
+      if (parser->m_decl->groupConnector[parser->m_prologState.level] == ASCII_COMMA)
         return XML_ERROR_SYNTAX;
       if (dtd->in_eldecl
-          && !parser->m_groupConnector[parser->m_prologState.level]
+          && !parser->m_decl->groupConnector[parser->m_prologState.level]
           && (dtd->scaffold[dtd->scaffIndex[dtd->scaffLevel - 1]].type
               != XML_CTYPE_MIXED)
           ) {
@@ -5021,7 +8490,7 @@ doProlog(XML_Parser parser,
         if (parser->m_elementDeclHandler)
           handleDefault = XML_FALSE;
       }
-      parser->m_groupConnector[parser->m_prologState.level] = ASCII_PIPE;
+      parser->m_decl->groupConnector[parser->m_prologState.level] = ASCII_PIPE;
       break;
     case XML_ROLE_PARAM_ENTITY_REF:
 #ifdef XML_DTD
@@ -5128,8 +8597,8 @@ doProlog(XML_Parser parser,
 
     case XML_ROLE_ELEMENT_NAME:
       if (parser->m_elementDeclHandler) {
-        parser->m_declElementType = getElementType(parser, enc, s, next);
-        if (!parser->m_declElementType)
+        parser->m_decl->declElementType = getElementType(parser, enc, s, next);
+        if (!parser->m_decl->declElementType)
           return XML_ERROR_NO_MEMORY;
         dtd->scaffLevel = 0;
         dtd->scaffCount = 0;
@@ -5142,7 +8611,8 @@ doProlog(XML_Parser parser,
     case XML_ROLE_CONTENT_EMPTY:
       if (dtd->in_eldecl) {
         if (parser->m_elementDeclHandler) {
-          XML_Content * content = (XML_Content *) MALLOC(parser, sizeof(XML_Content));
+          XML_Content * content = (XML_Content *)
+            appMalloc(MEM(parser, OTHER), sizeof(XML_Content));
           if (!content)
             return XML_ERROR_NO_MEMORY;
           content->quant = XML_CQUANT_NONE;
@@ -5153,7 +8623,7 @@ doProlog(XML_Parser parser,
                            XML_CTYPE_ANY :
                            XML_CTYPE_EMPTY);
           *eventEndPP = s;
-          parser->m_elementDeclHandler(parser->m_handlerArg, parser->m_declElementType->name, content);
+          parser->m_elementDeclHandler(parser->m_handlerArg, parser->m_decl->declElementType->name, content);
           handleDefault = XML_FALSE;
         }
         dtd->in_eldecl = XML_FALSE;
@@ -5229,7 +8699,7 @@ doProlog(XML_Parser parser,
             if (!model)
               return XML_ERROR_NO_MEMORY;
             *eventEndPP = s;
-            parser->m_elementDeclHandler(parser->m_handlerArg, parser->m_declElementType->name, model);
+            parser->m_elementDeclHandler(parser->m_handlerArg, parser->m_decl->declElementType->name, model);
           }
           dtd->in_eldecl = XML_FALSE;
           dtd->contentStringLen = 0;
@@ -5302,6 +8772,8 @@ epilogProcessor(XML_Parser parser,
 {
   parser->m_processor = epilogProcessor;
   parser->m_eventPtr = s;
+  if (!DATA_BUF_READY(parser, parser->m_encoding, s))
+    return XML_ERROR_NO_MEMORY;
   for (;;) {
     const char *next = NULL;
     int tok = XmlPrologTok(parser->m_encoding, s, end, &next);
@@ -5401,8 +8873,7 @@ processInternalEntity(XML_Parser parser, ENTITY *entity,
   }
   else
 #endif /* XML_DTD */
-    result = doContent(parser, parser->m_tagLevel, parser->m_internalEncoding, textStart,
-                       textEnd, &next, XML_FALSE);
+    result = entityContent(parser, entity, parser->m_tagLevel, textStart, &next);
 
   if (result == XML_ERROR_NONE) {
     if (textEnd != next && parser->m_parsingStatus.parsing == XML_SUSPENDED) {
@@ -5446,40 +8917,254 @@ internalEntityProcessor(XML_Parser parser,
     result = doProlog(parser, parser->m_internalEncoding, textStart, textEnd, tok,
                       next, &next, XML_FALSE);
   }
-  else
-#endif /* XML_DTD */
-    result = doContent(parser, openEntity->startTagLevel, parser->m_internalEncoding,
-                       textStart, textEnd, &next, XML_FALSE);
+  else
+#endif /* XML_DTD */
+    result = entityContent(parser, entity, openEntity->startTagLevel,
+                           textStart, &next);
+
+  if (result != XML_ERROR_NONE)
+    return result;
+  else if (textEnd != next && parser->m_parsingStatus.parsing == XML_SUSPENDED) {
+    entity->processed = (int)(next - (char *)entity->textPtr);
+    return result;
+  }
+  else {
+    entity->open = XML_FALSE;
+    parser->m_openInternalEntities = openEntity->next;
+    /* put openEntity back in list of free instances */
+    openEntity->next = parser->m_freeInternalEntities;
+    parser->m_freeInternalEntities = openEntity;
+  }
+
+#ifdef XML_DTD
+  if (entity->is_param) {
+    int tok;
+    parser->m_processor = prologProcessor;
+    tok = XmlPrologTok(parser->m_encoding, s, end, &next);
+    return doProlog(parser, parser->m_encoding, s, end, tok, next, nextPtr,
+                    (XML_Bool)!parser->m_parsingStatus.finalBuffer);
+  }
+  else
+#endif /* XML_DTD */
+  {
+    parser->m_processor = contentProcessor;
+    /* see externalEntityContentProcessor vs contentProcessor */
+    return doContent(parser, parser->m_parentParser ? 1 : 0, parser->m_encoding, s, end,
+                     nextPtr, (XML_Bool)!parser->m_parsingStatus.finalBuffer);
+  }
+}
+
+/* Processes the replacement text of a general entity from s on, like
+   doContent() does; text that tokenizeEntity() could record is then
+   replayed from its tokens instead of being tokenized again for every
+   reference to the entity.
+*/
+static enum XML_Error
+entityContent(XML_Parser parser, ENTITY *entity, int startTagLevel,
+              const char *s, const char **nextPtr)
+{
+  const ENCODING * const enc = parser->m_internalEncoding;
+  const char * const textStart = (const char *)entity->textPtr;
+  const char * const textEnd = (const char *)(entity->textPtr + entity->textLen);
+  const char **eventPP = &(parser->m_openInternalEntities->internalEventPtr);
+  const char **eventEndPP = &(parser->m_openInternalEntities->internalEventEndPtr);
+  int i, lo, hi;
+
+  if (entity->nTokens == 0 && entity->textLen > 0)
+    tokenizeEntity(parser, entity);
+  if (entity->nTokens < 0)
+    return doContent(parser, startTagLevel, enc, s, textEnd, nextPtr,
+                     XML_FALSE);
+
+  /* find the token at s, where a suspended parse left off */
+  lo = 0;
+  hi = entity->nTokens;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (entity->tokens[mid].start < (int)(s - textStart))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  *eventPP = s;
+  for (i = lo; i < entity->nTokens; i++) {
+    const ENTITY_TOKEN *token = entity->tokens + i;
+    const char *next = (i + 1 < entity->nTokens)
+                       ? textStart + token[1].start : textEnd;
+    if (parser->m_skipTagLevel != 0)
+      return doContent(parser, startTagLevel, enc, s, textEnd, nextPtr,
+                       XML_FALSE);
+    *eventEndPP = next;
+    if (token->len == 0) {
+      if (PATH_TEXT_WANTED(parser))
+        pathCharacterData(parser, enc, s, next);
+      if (parser->m_characterDataHandler)
+        reportCharacters(parser, parser->m_characterDataHandler,
+                         (XML_Char *)s, (XML_Char *)next);
+      else if (parser->m_defaultHandler)
+        reportDefault(parser, enc, s, next);
+    }
+    else {
+      if (PATH_TEXT_WANTED(parser))
+        pathCharacters(parser, token->chars, token->len);
+      if (parser->m_characterDataHandler)
+        parser->m_characterDataHandler(parser->m_handlerArg, token->chars,
+                                       token->len);
+      else if (parser->m_defaultHandler)
+        reportDefault(parser, enc, s, next);
+    }
+    *eventPP = s = next;
+    switch (parser->m_parsingStatus.parsing) {
+    case XML_SUSPENDED:
+      *nextPtr = next;
+      return XML_ERROR_NONE;
+    case XML_FINISHED:
+      return XML_ERROR_ABORTED;
+    default: ;
+    }
+  }
+  if (startTagLevel == 0)
+    return XML_ERROR_NO_ELEMENTS;
+  *nextPtr = s;
+  return XML_ERROR_NONE;
+}
+
+/* Scans the replacement text of a general entity, filling in tokens
+   if not NULL.  Returns the number of tokens, or -1 if the text has
+   anything but character data and references to characters or
+   predefined entities.
+*/
+static int
+scanEntityTokens(XML_Parser parser, const ENTITY *entity,
+                 ENTITY_TOKEN *tokens)
+{
+  const ENCODING * const enc = parser->m_internalEncoding;
+  const char * const textStart = (const char *)entity->textPtr;
+  const char * const textEnd = (const char *)(entity->textPtr + entity->textLen);
+  const char *s = textStart;
+  int nTokens = 0;
+  for (;;) {
+    const char *next = s;
+    ENTITY_TOKEN token;
+    int n;
+    token.start = (int)(s - textStart);
+    token.len = 0;
+    switch (XmlContentTok(enc, s, textEnd, &next)) {
+    case XML_TOK_NONE:
+      return nTokens;
+    case XML_TOK_DATA_CHARS:
+      break;
+    case XML_TOK_DATA_NEWLINE:
+      token.chars[0] = 0xA;
+      token.len = 1;
+      break;
+    case XML_TOK_ENTITY_REF:
+      token.chars[0] = (XML_Char)XmlPredefinedEntityName(enc,
+                                              s + enc->minBytesPerChar,
+                                              next - enc->minBytesPerChar);
+      if (!token.chars[0])
+        return -1;
+      token.len = 1;
+      break;
+    case XML_TOK_CHAR_REF:
+      n = XmlCharRefNumber(enc, s);
+      if (n < 0)
+        return -1;
+      token.len = XmlEncode(n, (ICHAR *)token.chars);
+      break;
+    default:
+      return -1;
+    }
+    if (tokens != NULL)
+      tokens[nTokens] = token;
+    nTokens++;
+    s = next;
+  }
+}
 
-  if (result != XML_ERROR_NONE)
-    return result;
-  else if (textEnd != next && parser->m_parsingStatus.parsing == XML_SUSPENDED) {
-    entity->processed = (int)(next - (char *)entity->textPtr);
-    return result;
-  }
-  else {
-    entity->open = XML_FALSE;
-    parser->m_openInternalEntities = openEntity->next;
-    /* put openEntity back in list of free instances */
-    openEntity->next = parser->m_freeInternalEntities;
-    parser->m_freeInternalEntities = openEntity;
+/* Records the tokens of a general entity for entityContent(), once;
+   an entity that cannot be recorded, for want of memory or because
+   its text has markup, is marked so that it is not scanned again.
+*/
+static void
+tokenizeEntity(XML_Parser parser, ENTITY *entity)
+{
+  DTD * const dtd = parser->m_dtd;
+  int nTokens = scanEntityTokens(parser, entity, NULL);
+  int count = nTokens < MIN_ENTITY_TOKENS ? MIN_ENTITY_TOKENS : nTokens;
+  entity->nTokens = -1;
+  if (nTokens <= 0
+      || (size_t)count > (size_t)-1 / sizeof(ENTITY_TOKEN))
+    return;
+  if (dtd->spareEntityTokens != NULL)
+    entity->tokens = takeEntityTokens(dtd, count, &count);
+  if (entity->tokens == NULL)
+    entity->tokens = (ENTITY_TOKEN *)dtdMalloc(dtd, MEM(parser, DTD),
+                                               count * sizeof(ENTITY_TOKEN));
+  if (entity->tokens == NULL)
+    return;
+  entity->allocTokens = count;
+  entity->nTokens = scanEntityTokens(parser, entity, entity->tokens);
+}
+
+/* Takes the tokens recorded by tokenizeEntity() from all general
+   entities, to be kept for reuse by takeEntityTokens() or freed.
+*/
+static void
+releaseEntityTokens(DTD *p, const MEMORY_SUITE *ms, XML_Bool keep)
+{
+  HASH_TABLE_ITER iter;
+  hashTableIterInit(&iter, &(p->generalEntities));
+  /* with an arena, the tokens go away with the arena */
+  while (!p->arena.chunkSize) {
+    ENTITY *e = (ENTITY *)hashTableIterNext(&iter);
+    if (!e)
+      break;
+    if (e->allocTokens != 0) {
+      if (keep) {
+        SPARE_ENTITY_TOKENS *spare = (SPARE_ENTITY_TOKENS *)(void *)e->tokens;
+        spare->count = e->allocTokens;
+        spare->next = p->spareEntityTokens;
+        p->spareEntityTokens = spare;
+      }
+      else
+        memFree(ms, e->tokens, e->allocTokens * sizeof(ENTITY_TOKEN));
+    }
+    e->tokens = NULL;
+    e->nTokens = 0;
+    e->allocTokens = 0;
   }
+}
 
-#ifdef XML_DTD
-  if (entity->is_param) {
-    int tok;
-    parser->m_processor = prologProcessor;
-    tok = XmlPrologTok(parser->m_encoding, s, end, &next);
-    return doProlog(parser, parser->m_encoding, s, end, tok, next, nextPtr,
-                    (XML_Bool)!parser->m_parsingStatus.finalBuffer);
+/* Like takeDefaultAtts(), for token arrays. */
+static ENTITY_TOKEN *
+takeEntityTokens(DTD *p, int minCount, int *count)
+{
+  SPARE_ENTITY_TOKENS **best = NULL;
+  SPARE_ENTITY_TOKENS **sp;
+  for (sp = &(p->spareEntityTokens); *sp; sp = &((*sp)->next)) {
+    if ((*sp)->count >= minCount
+        && (best == NULL || (*sp)->count < (*best)->count))
+      best = sp;
   }
-  else
-#endif /* XML_DTD */
+  if (best == NULL)
+    return NULL;
   {
-    parser->m_processor = contentProcessor;
-    /* see externalEntityContentProcessor vs contentProcessor */
-    return doContent(parser, parser->m_parentParser ? 1 : 0, parser->m_encoding, s, end,
-                     nextPtr, (XML_Bool)!parser->m_parsingStatus.finalBuffer);
+    SPARE_ENTITY_TOKENS *spare = *best;
+    *best = spare->next;
+    *count = spare->count;
+    return (ENTITY_TOKEN *)(void *)spare;
+  }
+}
+
+static void
+freeSpareEntityTokens(DTD *p, const MEMORY_SUITE *ms)
+{
+  while (p->spareEntityTokens != NULL) {
+    SPARE_ENTITY_TOKENS *spare = p->spareEntityTokens;
+    p->spareEntityTokens = spare->next;
+    memFree(ms, spare, spare->count * sizeof(ENTITY_TOKEN));
   }
 }
 
@@ -5943,6 +9628,41 @@ reportComment(XML_Parser parser, const ENCODING *enc,
   return 1;
 }
 
+/* Returns the length of the first piece of [s, end) that a handler
+   can be given: all of it, or at most INT_MAX characters ending on a
+   character boundary.
+*/
+static int
+charsPiece(const XML_Char *s, const XML_Char *end)
+{
+  size_t n = (size_t)(end - s);
+  if (n <= INT_MAX)
+    return (int)n;
+  n = INT_MAX;
+#ifdef XML_UNICODE
+  if ((s[n - 1] & 0xFC00) == 0xD800)
+    n--;
+#else
+  while ((s[n] & 0xC0) == 0x80)
+    n--;
+#endif
+  return (int)n;
+}
+
+/* Reports [s, end) to handler, in more than one call if it is longer
+   than INT_MAX characters.
+*/
+static void
+reportCharacters(XML_Parser parser, XML_CharacterDataHandler handler,
+                 const XML_Char *s, const XML_Char *end)
+{
+  do {
+    const int n = charsPiece(s, end);
+    handler(parser->m_handlerArg, s, n);
+    s += n;
+  } while (s < end);
+}
+
 static void
 reportDefault(XML_Parser parser, const ENCODING *enc,
               const char *s, const char *end)
@@ -5951,6 +9671,15 @@ reportDefault(XML_Parser parser, const ENCODING *enc,
     enum XML_Convert_Result convert_res;
     const char **eventPP;
     const char **eventEndPP;
+    /* reported through a small buffer on the stack if the conversion
+       buffer, allocated on demand, cannot be had */
+    XML_Char spareBuf[64];
+    XML_Char *dataBuf = spareBuf;
+    XML_Char *dataBufEnd = spareBuf + sizeof(spareBuf) / sizeof(XML_Char);
+    if (DATA_BUF_READY(parser, enc, s)) {
+      dataBuf = parser->m_dataBuf;
+      dataBufEnd = parser->m_dataBufEnd;
+    }
     if (enc == parser->m_encoding) {
       eventPP = &parser->m_eventPtr;
       eventEndPP = &parser->m_eventEndPtr;
@@ -5977,15 +9706,28 @@ reportDefault(XML_Parser parser, const ENCODING *enc,
       /* LCOV_EXCL_STOP */
     }
     do {
-      ICHAR *dataPtr = (ICHAR *)parser->m_dataBuf;
-      convert_res = XmlConvert(enc, &s, end, &dataPtr, (ICHAR *)parser->m_dataBufEnd);
+      ICHAR *dataPtr = (ICHAR *)dataBuf;
+      convert_res = XmlConvert(enc, &s, end, &dataPtr, (ICHAR *)dataBufEnd);
       *eventEndPP = s;
-      parser->m_defaultHandler(parser->m_handlerArg, parser->m_dataBuf, (int)(dataPtr - (ICHAR *)parser->m_dataBuf));
+      parser->m_defaultHandler(parser->m_handlerArg, dataBuf, (int)(dataPtr - (ICHAR *)dataBuf));
       *eventPP = s;
     } while ((convert_res != XML_CONVERT_COMPLETED) && (convert_res != XML_CONVERT_INPUT_INCOMPLETE));
   }
   else
-    parser->m_defaultHandler(parser->m_handlerArg, (XML_Char *)s, (int)((XML_Char *)end - (XML_Char *)s));
+    reportCharacters(parser, parser->m_defaultHandler,
+                     (XML_Char *)s, (XML_Char *)end);
+}
+
+/* Tells the prefetch handler about an external entity, or subset, that
+   may be read later, while a resolver is there to read it. */
+static void
+announceEntity(XML_Parser parser, const ENTITY *entity)
+{
+  if (parser->m_externalEntityPrefetchHandler
+      && parser->m_externalEntityRefHandler)
+    parser->m_externalEntityPrefetchHandler(
+        parser->m_externalEntityRefHandlerArg, entity->base,
+        entity->systemId, entity->publicId);
 }
 
 
@@ -6005,10 +9747,25 @@ defineAttribute(ELEMENT_TYPE *type, ATTRIBUTE_ID *attId, XML_Bool isCdata,
       type->idAtt = attId;
   }
   if (type->nDefaultAtts == type->allocDefaultAtts) {
-    if (type->allocDefaultAtts == 0) {
+    int count;
+    DEFAULT_ATTRIBUTE *spare = NULL;
+    if (parser->m_dtd->spareDefaultAtts != NULL)
+      spare = takeDefaultAtts(parser->m_dtd, type->nDefaultAtts + 1, &count);
+    if (spare != NULL) {
+      if (type->allocDefaultAtts != 0) {
+        memcpy(spare, type->defaultAtts,
+               type->nDefaultAtts * sizeof(DEFAULT_ATTRIBUTE));
+        putDefaultAtts(parser->m_dtd, type->defaultAtts,
+                       type->allocDefaultAtts);
+      }
+      type->defaultAtts = spare;
+      type->allocDefaultAtts = count;
+    }
+    else if (type->allocDefaultAtts == 0) {
       type->allocDefaultAtts = 8;
-      type->defaultAtts = (DEFAULT_ATTRIBUTE *)MALLOC(parser, type->allocDefaultAtts
-                            * sizeof(DEFAULT_ATTRIBUTE));
+      type->defaultAtts = (DEFAULT_ATTRIBUTE *)
+        dtdMalloc(parser->m_dtd, MEM(parser, DTD),
+                  type->allocDefaultAtts * sizeof(DEFAULT_ATTRIBUTE));
       if (!type->defaultAtts) {
         type->allocDefaultAtts = 0;
         return 0;
@@ -6018,7 +9775,9 @@ defineAttribute(ELEMENT_TYPE *type, ATTRIBUTE_ID *attId, XML_Bool isCdata,
       DEFAULT_ATTRIBUTE *temp;
       int count = type->allocDefaultAtts * 2;
       temp = (DEFAULT_ATTRIBUTE *)
-        REALLOC(parser, type->defaultAtts, (count * sizeof(DEFAULT_ATTRIBUTE)));
+        dtdRealloc(parser->m_dtd, MEM(parser, DTD), type->defaultAtts,
+                   type->allocDefaultAtts * sizeof(DEFAULT_ATTRIBUTE),
+                   count * sizeof(DEFAULT_ATTRIBUTE));
       if (temp == NULL)
         return 0;
       type->allocDefaultAtts = count;
@@ -6310,27 +10069,37 @@ normalizePublicId(XML_Char *publicId)
   *p = XML_T('\0');
 }
 
+/* memFor holds a suite for each XML_MemoryCategory */
 static DTD *
-dtdCreate(const XML_Memory_Handling_Suite *ms)
+dtdCreate(const MEMORY_SUITE *memFor, size_t arenaChunkSize)
 {
-  DTD *p = (DTD *)ms->malloc_fcn(sizeof(DTD));
+  const MEMORY_SUITE *ms = &memFor[XML_MEMORY_DTD];
+  const MEMORY_SUITE *poolMem = &memFor[XML_MEMORY_POOLS];
+  const MEMORY_SUITE *tableMem = &memFor[XML_MEMORY_TABLES];
+  DTD *p = (DTD *)memAllocAligned(ms, sizeof(DTD));
+  ARENA *arena;
   if (p == NULL)
     return p;
-  poolInit(&(p->pool), ms);
-  poolInit(&(p->entityValuePool), ms);
-  hashTableInit(&(p->generalEntities), ms);
-  hashTableInit(&(p->elementTypes), ms);
-  hashTableInit(&(p->attributeIds), ms);
-  hashTableInit(&(p->prefixes), ms);
+  arenaInit(&(p->arena), ms, arenaChunkSize);
+  arena = arenaChunkSize ? &(p->arena) : NULL;
+  poolInit(&(p->pool), poolMem);
+  poolInit(&(p->entityValuePool), poolMem);
+  hashTableInit(&(p->generalEntities), tableMem, arena);
+  hashTableInit(&(p->elementTypes), tableMem, arena);
+  hashTableInit(&(p->attributeIds), tableMem, arena);
+  hashTableInit(&(p->prefixes), tableMem, arena);
 #ifdef XML_DTD
   p->paramEntityRead = XML_FALSE;
-  hashTableInit(&(p->paramEntities), ms);
+  hashTableInit(&(p->paramEntities), tableMem, arena);
 #endif /* XML_DTD */
   p->defaultPrefix.name = NULL;
   p->defaultPrefix.binding = NULL;
+  p->spareDefaultAtts = NULL;
+  p->spareEntityTokens = NULL;
 
   p->in_eldecl = XML_FALSE;
   p->scaffIndex = NULL;
+  p->scaffIndexSize = 0;
   p->scaffold = NULL;
   p->scaffLevel = 0;
   p->scaffSize = 0;
@@ -6344,25 +10113,36 @@ dtdCreate(const XML_Memory_Handling_Suite *ms)
 }
 
 static void
-dtdReset(DTD *p, const XML_Memory_Handling_Suite *ms)
+dtdReset(DTD *p, const MEMORY_SUITE *ms, XML_Bool keepCapacity)
 {
   HASH_TABLE_ITER iter;
   hashTableIterInit(&iter, &(p->elementTypes));
-  for (;;) {
+  /* with an arena, default attributes go away with the arena */
+  while (!p->arena.chunkSize) {
     ELEMENT_TYPE *e = (ELEMENT_TYPE *)hashTableIterNext(&iter);
     if (!e)
       break;
-    if (e->allocDefaultAtts != 0)
-      ms->free_fcn(e->defaultAtts);
-  }
-  hashTableClear(&(p->generalEntities));
+    if (e->allocDefaultAtts == 0)
+      continue;
+    if (keepCapacity)
+      putDefaultAtts(p, e->defaultAtts, e->allocDefaultAtts);
+    else
+      memFree(ms, e->defaultAtts,
+              e->allocDefaultAtts * sizeof(DEFAULT_ATTRIBUTE));
+  }
+  if (!keepCapacity)
+    freeSpareDefaultAtts(p, ms);
+  releaseEntityTokens(p, ms, keepCapacity);
+  if (!keepCapacity)
+    freeSpareEntityTokens(p, ms);
+  hashTableClear(&(p->generalEntities), keepCapacity);
 #ifdef XML_DTD
   p->paramEntityRead = XML_FALSE;
-  hashTableClear(&(p->paramEntities));
+  hashTableClear(&(p->paramEntities), keepCapacity);
 #endif /* XML_DTD */
-  hashTableClear(&(p->elementTypes));
-  hashTableClear(&(p->attributeIds));
-  hashTableClear(&(p->prefixes));
+  hashTableClear(&(p->elementTypes), keepCapacity);
+  hashTableClear(&(p->attributeIds), keepCapacity);
+  hashTableClear(&(p->prefixes), keepCapacity);
   poolClear(&(p->pool));
   poolClear(&(p->entityValuePool));
   p->defaultPrefix.name = NULL;
@@ -6370,13 +10150,18 @@ dtdReset(DTD *p, const XML_Memory_Handling_Suite *ms)
 
   p->in_eldecl = XML_FALSE;
 
-  ms->free_fcn(p->scaffIndex);
-  p->scaffIndex = NULL;
-  ms->free_fcn(p->scaffold);
-  p->scaffold = NULL;
+  /* arena memory cannot outlive the reset */
+  if (!keepCapacity || p->arena.chunkSize) {
+    dtdFree(p, ms, p->scaffIndex, p->scaffIndexSize * sizeof(int));
+    p->scaffIndex = NULL;
+    p->scaffIndexSize = 0;
+    dtdFree(p, ms, p->scaffold, p->scaffSize * sizeof(CONTENT_SCAFFOLD));
+    p->scaffold = NULL;
+    p->scaffSize = 0;
+  }
+  arenaClear(&(p->arena));
 
   p->scaffLevel = 0;
-  p->scaffSize = 0;
   p->scaffCount = 0;
   p->contentStringLen = 0;
 
@@ -6386,17 +10171,21 @@ dtdReset(DTD *p, const XML_Memory_Handling_Suite *ms)
 }
 
 static void
-dtdDestroy(DTD *p, XML_Bool isDocEntity, const XML_Memory_Handling_Suite *ms)
+dtdDestroy(DTD *p, XML_Bool isDocEntity, const MEMORY_SUITE *ms)
 {
   HASH_TABLE_ITER iter;
   hashTableIterInit(&iter, &(p->elementTypes));
-  for (;;) {
+  while (!p->arena.chunkSize) {
     ELEMENT_TYPE *e = (ELEMENT_TYPE *)hashTableIterNext(&iter);
     if (!e)
       break;
     if (e->allocDefaultAtts != 0)
-      ms->free_fcn(e->defaultAtts);
+      memFree(ms, e->defaultAtts,
+              e->allocDefaultAtts * sizeof(DEFAULT_ATTRIBUTE));
   }
+  freeSpareDefaultAtts(p, ms);
+  releaseEntityTokens(p, ms, XML_FALSE);
+  freeSpareEntityTokens(p, ms);
   hashTableDestroy(&(p->generalEntities));
 #ifdef XML_DTD
   hashTableDestroy(&(p->paramEntities));
@@ -6407,17 +10196,90 @@ dtdDestroy(DTD *p, XML_Bool isDocEntity, const XML_Memory_Handling_Suite *ms)
   poolDestroy(&(p->pool));
   poolDestroy(&(p->entityValuePool));
   if (isDocEntity) {
-    ms->free_fcn(p->scaffIndex);
-    ms->free_fcn(p->scaffold);
+    dtdFree(p, ms, p->scaffIndex, p->scaffIndexSize * sizeof(int));
+    dtdFree(p, ms, p->scaffold, p->scaffSize * sizeof(CONTENT_SCAFFOLD));
+  }
+  arenaDestroy(&(p->arena));
+  memFreeAligned(ms, p, sizeof(DTD));
+}
+
+/* Allocation of objects that live as long as the DTD's contents. */
+static void *
+dtdMalloc(DTD *p, const MEMORY_SUITE *ms, size_t size)
+{
+  if (p->arena.chunkSize)
+    return arenaAlloc(&(p->arena), size);
+  return memMalloc(ms, size);
+}
+
+static void *
+dtdRealloc(DTD *p, const MEMORY_SUITE *ms, void *ptr,
+           size_t oldSize, size_t size)
+{
+  void *result;
+  if (!p->arena.chunkSize)
+    return memRealloc(ms, ptr, oldSize, size);
+  result = arenaAlloc(&(p->arena), size);
+  if (result != NULL && ptr != NULL)
+    memcpy(result, ptr, oldSize < size ? oldSize : size);
+  return result;
+}
+
+static void
+dtdFree(DTD *p, const MEMORY_SUITE *ms, void *ptr, size_t size)
+{
+  if (!p->arena.chunkSize)
+    memFree(ms, ptr, size);
+}
+
+/* Default attribute arrays given up by dtdReset() are handed to the
+   next document's element types; takeDefaultAtts() picks the smallest
+   array holding at least minCount entries, so that a similar document
+   finds the same sizes again. */
+static void
+putDefaultAtts(DTD *p, DEFAULT_ATTRIBUTE *atts, int count)
+{
+  SPARE_DEFAULT_ATTS *spare = (SPARE_DEFAULT_ATTS *)(void *)atts;
+  spare->count = count;
+  spare->next = p->spareDefaultAtts;
+  p->spareDefaultAtts = spare;
+}
+
+static DEFAULT_ATTRIBUTE *
+takeDefaultAtts(DTD *p, int minCount, int *count)
+{
+  SPARE_DEFAULT_ATTS **best = NULL;
+  SPARE_DEFAULT_ATTS **sp;
+  for (sp = &(p->spareDefaultAtts); *sp; sp = &((*sp)->next)) {
+    if ((*sp)->count >= minCount
+        && (best == NULL || (*sp)->count < (*best)->count))
+      best = sp;
+  }
+  if (best == NULL)
+    return NULL;
+  {
+    SPARE_DEFAULT_ATTS *spare = *best;
+    *best = spare->next;
+    *count = spare->count;
+    return (DEFAULT_ATTRIBUTE *)(void *)spare;
+  }
+}
+
+static void
+freeSpareDefaultAtts(DTD *p, const MEMORY_SUITE *ms)
+{
+  while (p->spareDefaultAtts != NULL) {
+    SPARE_DEFAULT_ATTS *spare = p->spareDefaultAtts;
+    p->spareDefaultAtts = spare->next;
+    memFree(ms, spare, spare->count * sizeof(DEFAULT_ATTRIBUTE));
   }
-  ms->free_fcn(p);
 }
 
 /* Do a deep copy of the DTD. Return 0 for out of memory, non-zero otherwise.
    The new DTD has already been initialized.
 */
 static int
-dtdCopy(XML_Parser oldParser, DTD *newDtd, const DTD *oldDtd, const XML_Memory_Handling_Suite *ms)
+dtdCopy(XML_Parser oldParser, DTD *newDtd, const DTD *oldDtd, const MEMORY_SUITE *ms)
 {
   HASH_TABLE_ITER iter;
 
@@ -6489,7 +10351,7 @@ dtdCopy(XML_Parser oldParser, DTD *newDtd, const DTD *oldDtd, const XML_Memory_H
       return 0;
     if (oldE->nDefaultAtts) {
       newE->defaultAtts = (DEFAULT_ATTRIBUTE *)
-          ms->malloc_fcn(oldE->nDefaultAtts * sizeof(DEFAULT_ATTRIBUTE));
+          dtdMalloc(newDtd, ms, oldE->nDefaultAtts * sizeof(DEFAULT_ATTRIBUTE));
       if (!newE->defaultAtts) {
         return 0;
       }
@@ -6543,6 +10405,7 @@ dtdCopy(XML_Parser oldParser, DTD *newDtd, const DTD *oldDtd, const XML_Memory_H
   newDtd->scaffSize = oldDtd->scaffSize;
   newDtd->scaffLevel = oldDtd->scaffLevel;
   newDtd->scaffIndex = oldDtd->scaffIndex;
+  newDtd->scaffIndexSize = oldDtd->scaffIndexSize;
 
   return 1;
 }  /* End dtdCopy */
@@ -6664,7 +10527,7 @@ lookup(XML_Parser parser, HASH_TABLE *table, KEY name, size_t createSize)
     /* table->size is a power of 2 */
     table->size = (size_t)1 << INIT_POWER;
     tsize = table->size * sizeof(NAMED *);
-    table->v = (NAMED **)table->mem->malloc_fcn(tsize);
+    table->v = (NAMED **)memMalloc(table->mem, tsize);
     if (!table->v) {
       table->size = 0;
       return NULL;
@@ -6693,7 +10556,7 @@ lookup(XML_Parser parser, HASH_TABLE *table, KEY name, size_t createSize)
       size_t newSize = (size_t)1 << newPower;
       unsigned long newMask = (unsigned long)newSize - 1;
       size_t tsize = newSize * sizeof(NAMED *);
-      NAMED **newV = (NAMED **)table->mem->malloc_fcn(tsize);
+      NAMED **newV = (NAMED **)memMalloc(table->mem, tsize);
       if (!newV)
         return NULL;
       memset(newV, 0, tsize);
@@ -6709,7 +10572,7 @@ lookup(XML_Parser parser, HASH_TABLE *table, KEY name, size_t createSize)
           }
           newV[j] = table->v[i];
         }
-      table->mem->free_fcn(table->v);
+      memFree(table->mem, table->v, table->size * sizeof(NAMED *));
       table->v = newV;
       table->power = newPower;
       table->size = newSize;
@@ -6722,9 +10585,17 @@ lookup(XML_Parser parser, HASH_TABLE *table, KEY name, size_t createSize)
       }
     }
   }
-  table->v[i] = (NAMED *)table->mem->malloc_fcn(createSize);
+  if (table->spare != NULL && createSize == table->entrySize) {
+    table->v[i] = table->spare;
+    table->spare = (NAMED *)(void *)table->spare->name;
+  }
+  else if (table->arena != NULL)
+    table->v[i] = (NAMED *)arenaAlloc(table->arena, createSize);
+  else
+    table->v[i] = (NAMED *)memMalloc(table->mem, createSize);
   if (!table->v[i])
     return NULL;
+  table->entrySize = createSize;
   memset(table->v[i], 0, createSize);
   table->v[i]->name = name;
   (table->used)++;
@@ -6732,11 +10603,19 @@ lookup(XML_Parser parser, HASH_TABLE *table, KEY name, size_t createSize)
 }
 
 static void FASTCALL
-hashTableClear(HASH_TABLE *table)
+hashTableClear(HASH_TABLE *table, XML_Bool keepEntries)
 {
   size_t i;
   for (i = 0; i < table->size; i++) {
-    table->mem->free_fcn(table->v[i]);
+    NAMED *entry = table->v[i];
+    if (entry == NULL || table->arena != NULL)
+      ;
+    else if (keepEntries) {
+      entry->name = (KEY)(void *)table->spare;
+      table->spare = entry;
+    }
+    else
+      memFree(table->mem, entry, table->entrySize);
     table->v[i] = NULL;
   }
   table->used = 0;
@@ -6746,19 +10625,44 @@ static void FASTCALL
 hashTableDestroy(HASH_TABLE *table)
 {
   size_t i;
-  for (i = 0; i < table->size; i++)
-    table->mem->free_fcn(table->v[i]);
-  table->mem->free_fcn(table->v);
+  if (table->arena == NULL) {
+    for (i = 0; i < table->size; i++)
+      memFree(table->mem, table->v[i], table->entrySize);
+  }
+  hashTableTrim(table);
+  memFree(table->mem, table->v, table->size * sizeof(NAMED *));
+}
+
+/* Frees the entries kept by hashTableClear() for reuse, and the
+   bucket array of an empty table. */
+static void FASTCALL
+hashTableTrim(HASH_TABLE *table)
+{
+  while (table->spare != NULL) {
+    NAMED *entry = table->spare;
+    table->spare = (NAMED *)(void *)entry->name;
+    memFree(table->mem, entry, table->entrySize);
+  }
+  if (table->used == 0 && table->v != NULL) {
+    memFree(table->mem, table->v, table->size * sizeof(NAMED *));
+    table->v = NULL;
+    table->size = 0;
+    table->power = 0;
+  }
 }
 
 static void FASTCALL
-hashTableInit(HASH_TABLE *p, const XML_Memory_Handling_Suite *ms)
+hashTableInit(HASH_TABLE *p, const MEMORY_SUITE *ms,
+              ARENA *arena)
 {
   p->power = 0;
   p->size = 0;
   p->used = 0;
   p->v = NULL;
   p->mem = ms;
+  p->arena = arena;
+  p->spare = NULL;
+  p->entrySize = 0;
 }
 
 static void FASTCALL
@@ -6779,8 +10683,101 @@ hashTableIterNext(HASH_TABLE_ITER *iter)
   return NULL;
 }
 
+static void
+arenaInit(ARENA *arena, const MEMORY_SUITE *ms, size_t chunkSize)
+{
+  arena->chunks = NULL;
+  arena->freeChunks = NULL;
+  arena->ptr = NULL;
+  arena->end = NULL;
+  arena->chunkSize = chunkSize;
+  arena->mem = ms;
+}
+
+static void *
+arenaAlloc(ARENA *arena, size_t size)
+{
+  ARENA_CHUNK *chunk;
+  ARENA_CHUNK **prev;
+  void *result;
+
+  /* keep every allocation aligned */
+  if (size > (size_t)-1 - sizeof(ARENA_ALIGN))
+    return NULL;
+  size = (size + sizeof(ARENA_ALIGN) - 1)
+         / sizeof(ARENA_ALIGN) * sizeof(ARENA_ALIGN);
+  if (size <= (size_t)(arena->end - arena->ptr)) {
+    result = arena->ptr;
+    arena->ptr += size;
+    return result;
+  }
+  for (prev = &arena->freeChunks; *prev != NULL; prev = &(*prev)->next) {
+    if ((*prev)->size >= size)
+      break;
+  }
+  chunk = *prev;
+  if (chunk != NULL)
+    *prev = chunk->next;
+  else {
+    size_t chunkSize = size > arena->chunkSize ? size : arena->chunkSize;
+    if (chunkSize > (size_t)-1 - offsetof(ARENA_CHUNK, s))
+      return NULL;
+    chunk = (ARENA_CHUNK *)memAllocAligned(arena->mem,
+                                           offsetof(ARENA_CHUNK, s)
+                                           + chunkSize);
+    if (chunk == NULL)
+      return NULL;
+    chunk->size = chunkSize;
+  }
+  result = chunk->s;
+  if (arena->chunks != NULL
+      && chunk->size - size < (size_t)(arena->end - arena->ptr)) {
+    /* the current chunk has more room left, keep allocating from it */
+    chunk->next = arena->chunks->next;
+    arena->chunks->next = chunk;
+    return result;
+  }
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  arena->ptr = (char *)chunk->s + size;
+  arena->end = (char *)chunk->s + chunk->size;
+  return result;
+}
+
+/* Releases everything allocated from the arena, keeping the chunks. */
+static void
+arenaClear(ARENA *arena)
+{
+  while (arena->chunks != NULL) {
+    ARENA_CHUNK *chunk = arena->chunks;
+    arena->chunks = chunk->next;
+    chunk->next = arena->freeChunks;
+    arena->freeChunks = chunk;
+  }
+  arena->ptr = NULL;
+  arena->end = NULL;
+}
+
+static void
+arenaDestroy(ARENA *arena)
+{
+  arenaClear(arena);
+  arenaTrim(arena);
+}
+
+/* Frees the chunks kept by arenaClear() for reuse. */
+static void
+arenaTrim(ARENA *arena)
+{
+  while (arena->freeChunks != NULL) {
+    ARENA_CHUNK *chunk = arena->freeChunks;
+    arena->freeChunks = chunk->next;
+    memFreeAligned(arena->mem, chunk, offsetof(ARENA_CHUNK, s) + chunk->size);
+  }
+}
+
 static void FASTCALL
-poolInit(STRING_POOL *pool, const XML_Memory_Handling_Suite *ms)
+poolInit(STRING_POOL *pool, const MEMORY_SUITE *ms)
 {
   pool->blocks = NULL;
   pool->freeBlocks = NULL;
@@ -6816,15 +10813,23 @@ poolDestroy(STRING_POOL *pool)
   BLOCK *p = pool->blocks;
   while (p) {
     BLOCK *tem = p->next;
-    pool->mem->free_fcn(p);
+    memFree(pool->mem, p, poolBytesToAllocateFor(p->size));
     p = tem;
   }
-  p = pool->freeBlocks;
+  poolTrim(pool);
+}
+
+/* Frees the blocks kept by poolClear() for reuse. */
+static void FASTCALL
+poolTrim(STRING_POOL *pool)
+{
+  BLOCK *p = pool->freeBlocks;
   while (p) {
     BLOCK *tem = p->next;
-    pool->mem->free_fcn(p);
+    memFree(pool->mem, p, poolBytesToAllocateFor(p->size));
     p = tem;
   }
+  pool->freeBlocks = NULL;
 }
 
 static XML_Char *
@@ -6905,32 +10910,23 @@ poolStoreString(STRING_POOL *pool, const ENCODING *enc,
 }
 
 static size_t
-poolBytesToAllocateFor(int blockSize)
+poolBytesToAllocateFor(size_t blockSize)
 {
   /* Unprotected math would be:
   ** return offsetof(BLOCK, s) + blockSize * sizeof(XML_Char);
   **
-  ** Detect overflow, avoiding _signed_ overflow undefined behavior
-  ** For a + b * c we check b * c in isolation first, so that addition of a
-  ** on top has no chance of making us accept a small non-negative number
+  ** Detect overflow; for a + b * c we check b * c in isolation first,
+  ** so that addition of a on top has no chance of wrapping around.
   */
   const size_t stretch = sizeof(XML_Char);  /* can be 4 bytes */
 
-  if (blockSize <= 0)
+  if (blockSize == 0)
     return 0;
 
-  if (blockSize > (int)(INT_MAX / stretch))
+  if (blockSize > ((size_t)-1 - offsetof(BLOCK, s)) / stretch)
     return 0;
 
-  {
-    const int stretchedBlockSize = blockSize * (int)stretch;
-    const int bytesToAllocate = (int)(
-        offsetof(BLOCK, s) + (unsigned)stretchedBlockSize);
-    if (bytesToAllocate < 0)
-      return 0;
-
-    return (size_t)bytesToAllocate;
-  }
+  return offsetof(BLOCK, s) + blockSize * stretch;
 }
 
 static XML_Bool FASTCALL
@@ -6946,44 +10942,58 @@ poolGrow(STRING_POOL *pool)
       pool->ptr = pool->start;
       return XML_TRUE;
     }
-    if (pool->end - pool->start < pool->freeBlocks->size) {
-      BLOCK *tem = pool->freeBlocks->next;
-      pool->freeBlocks->next = pool->blocks;
-      pool->blocks = pool->freeBlocks;
-      pool->freeBlocks = tem;
-      memcpy(pool->blocks->s, pool->start,
-             (pool->end - pool->start) * sizeof(XML_Char));
-      pool->ptr = pool->blocks->s + (pool->ptr - pool->start);
-      pool->start = pool->blocks->s;
-      pool->end = pool->start + pool->blocks->size;
-      return XML_TRUE;
+    else {
+      /* Take the smallest free block that is larger than the current
+         one, so that blocks kept over XML_ParserReset() are reused in
+         whatever order they were released. */
+      BLOCK **best = NULL;
+      BLOCK **bp;
+      for (bp = &(pool->freeBlocks); *bp; bp = &((*bp)->next)) {
+        if ((size_t)(pool->end - pool->start) < (*bp)->size
+            && (best == NULL || (*bp)->size < (*best)->size))
+          best = bp;
+      }
+      if (best != NULL) {
+        BLOCK *tem = *best;
+        *best = tem->next;
+        tem->next = pool->blocks;
+        pool->blocks = tem;
+        memcpy(pool->blocks->s, pool->start,
+               (pool->end - pool->start) * sizeof(XML_Char));
+        pool->ptr = pool->blocks->s + (pool->ptr - pool->start);
+        pool->start = pool->blocks->s;
+        pool->end = pool->start + pool->blocks->size;
+        return XML_TRUE;
+      }
     }
   }
   if (pool->blocks && pool->start == pool->blocks->s) {
     BLOCK *temp;
-    int blockSize = (int)((unsigned)(pool->end - pool->start)*2U);
+    size_t blockSize = (size_t)(pool->end - pool->start);
     size_t bytesToAllocate;
 
     /* NOTE: Needs to be calculated prior to calling `realloc`
              to avoid dangling pointers: */
     const ptrdiff_t offsetInsideBlock = pool->ptr - pool->start;
 
-    if (blockSize < 0) {
-      /* This condition traps a situation where either more than
-       * INT_MAX/2 bytes have already been allocated.  This isn't
-       * readily testable, since it is unlikely that an average
-       * machine will have that much memory, so we exclude it from the
-       * coverage statistics.
+    if (blockSize > (size_t)-1 / 4) {
+      /* This condition traps a situation where more than half the
+       * address space has already been allocated.  This isn't
+       * readily testable, so we exclude it from the coverage
+       * statistics.
        */
       return XML_FALSE; /* LCOV_EXCL_LINE */
     }
+    blockSize *= 2;
 
     bytesToAllocate = poolBytesToAllocateFor(blockSize);
     if (bytesToAllocate == 0)
       return XML_FALSE;
 
     temp = (BLOCK *)
-      pool->mem->realloc_fcn(pool->blocks, (unsigned)bytesToAllocate);
+      memRealloc(pool->mem, pool->blocks,
+                 poolBytesToAllocateFor(pool->blocks->size),
+                 bytesToAllocate);
     if (temp == NULL)
       return XML_FALSE;
     pool->blocks = temp;
@@ -6994,28 +11004,15 @@ poolGrow(STRING_POOL *pool)
   }
   else {
     BLOCK *tem;
-    int blockSize = (int)(pool->end - pool->start);
+    size_t blockSize = (size_t)(pool->end - pool->start);
     size_t bytesToAllocate;
 
-    if (blockSize < 0) {
-      /* This condition traps a situation where either more than
-       * INT_MAX bytes have already been allocated (which is prevented
-       * by various pieces of program logic, not least this one, never
-       * mind the unlikelihood of actually having that much memory) or
-       * the pool control fields have been corrupted (which could
-       * conceivably happen in an extremely buggy user handler
-       * function).  Either way it isn't readily testable, so we
-       * exclude it from the coverage statistics.
-       */
-      return XML_FALSE;  /* LCOV_EXCL_LINE */
-    }
-
     if (blockSize < INIT_BLOCK_SIZE)
       blockSize = INIT_BLOCK_SIZE;
     else {
-      /* Detect overflow, avoiding _signed_ overflow undefined behavior */
-      if ((int)((unsigned)blockSize * 2U) < 0) {
-        return XML_FALSE;
+      /* Detect overflow */
+      if (blockSize > (size_t)-1 / 4) {
+        return XML_FALSE;  /* LCOV_EXCL_LINE */
       }
       blockSize *= 2;
     }
@@ -7024,7 +11021,7 @@ poolGrow(STRING_POOL *pool)
     if (bytesToAllocate == 0)
       return XML_FALSE;
 
-    tem = (BLOCK *)pool->mem->malloc_fcn(bytesToAllocate);
+    tem = (BLOCK *)memMalloc(pool->mem, bytesToAllocate);
     if (!tem)
       return XML_FALSE;
     tem->size = blockSize;
@@ -7048,9 +11045,11 @@ nextScaffoldPart(XML_Parser parser)
   int next;
 
   if (!dtd->scaffIndex) {
-    dtd->scaffIndex = (int *)MALLOC(parser, parser->m_groupSize * sizeof(int));
+    dtd->scaffIndex = (int *)dtdMalloc(dtd, MEM(parser, DTD),
+                                       parser->m_decl->groupSize * sizeof(int));
     if (!dtd->scaffIndex)
       return -1;
+    dtd->scaffIndexSize = parser->m_decl->groupSize;
     dtd->scaffIndex[0] = 0;
   }
 
@@ -7058,14 +11057,17 @@ nextScaffoldPart(XML_Parser parser)
     CONTENT_SCAFFOLD *temp;
     if (dtd->scaffold) {
       temp = (CONTENT_SCAFFOLD *)
-        REALLOC(parser, dtd->scaffold, dtd->scaffSize * 2 * sizeof(CONTENT_SCAFFOLD));
+        dtdRealloc(dtd, MEM(parser, DTD), dtd->scaffold,
+                   dtd->scaffSize * sizeof(CONTENT_SCAFFOLD),
+                   dtd->scaffSize * 2 * sizeof(CONTENT_SCAFFOLD));
       if (temp == NULL)
         return -1;
       dtd->scaffSize *= 2;
     }
     else {
-      temp = (CONTENT_SCAFFOLD *)MALLOC(parser, INIT_SCAFFOLD_ELEMENTS
-                                        * sizeof(CONTENT_SCAFFOLD));
+      temp = (CONTENT_SCAFFOLD *)dtdMalloc(dtd, MEM(parser, DTD),
+                                           INIT_SCAFFOLD_ELEMENTS
+                                           * sizeof(CONTENT_SCAFFOLD));
       if (temp == NULL)
         return -1;
       dtd->scaffSize = INIT_SCAFFOLD_ELEMENTS;
@@ -7136,7 +11138,7 @@ build_model (XML_Parser parser)
   int allocsize = (dtd->scaffCount * sizeof(XML_Content)
                    + (dtd->contentStringLen * sizeof(XML_Char)));
 
-  ret = (XML_Content *)MALLOC(parser, allocsize);
+  ret = (XML_Content *)appMalloc(MEM(parser, OTHER), allocsize);
   if (!ret)
     return NULL;
 
@@ -7172,9 +11174,205 @@ getElementType(XML_Parser parser,
   return ret;
 }
 
+static void
+memSuiteInit(MEMORY_FUNCTIONS *fns, MEMORY_SUITE *ms,
+             const XML_Memory_Handling_Suite *classic,
+             const XML_Memory_Handling_Suite2 *sized)
+{
+  memset(fns, 0, sizeof(MEMORY_FUNCTIONS));
+  if (sized != NULL) {
+    fns->sized = *sized;
+    fns->isSized = XML_TRUE;
+  }
+  else if (classic != NULL)
+    fns->classic = *classic;
+  else {
+    fns->classic.malloc_fcn = malloc;
+    fns->classic.realloc_fcn = realloc;
+    fns->classic.free_fcn = free;
+  }
+  ms->fns = fns;
+  ms->account = NULL;
+  ms->category = XML_MEMORY_OTHER;
+}
+
+/* Adds size bytes to the account of ms; fails if that would exceed
+   the limit. */
+static XML_Bool
+memCharge(const MEMORY_SUITE *ms, size_t size)
+{
+  MEMORY_ACCOUNT *account = ms->account;
+  XML_MemoryStats *stats;
+  if (account == NULL)
+    return XML_TRUE;
+  stats = &account->stats;
+  if (account->limit != 0
+      && (size > account->limit || stats->current > account->limit - size)) {
+    account->limitExceeded = XML_TRUE;
+    return XML_FALSE;
+  }
+  stats->current += size;
+  if (stats->current > stats->peak)
+    stats->peak = stats->current;
+  stats->currentBy[ms->category] += size;
+  if (stats->currentBy[ms->category] > stats->peakBy[ms->category])
+    stats->peakBy[ms->category] = stats->currentBy[ms->category];
+  return XML_TRUE;
+}
+
+static void
+memUncharge(const MEMORY_SUITE *ms, size_t size)
+{
+  if (ms->account == NULL)
+    return;
+  ms->account->stats.current -= size;
+  ms->account->stats.currentBy[ms->category] -= size;
+}
+
+static void *
+memMalloc(const MEMORY_SUITE *ms, size_t size)
+{
+  const MEMORY_FUNCTIONS *fns = ms->fns;
+  void *result;
+  if (!memCharge(ms, size))
+    return NULL;
+  if (fns->isSized)
+    result = fns->sized.malloc_fcn(fns->sized.ctx, size);
+  else
+    result = fns->classic.malloc_fcn(size);
+  if (result == NULL)
+    memUncharge(ms, size);
+  return result;
+}
+
+/* oldSize is the size ptr was allocated with, 0 if ptr is NULL */
+static void *
+memRealloc(const MEMORY_SUITE *ms, void *ptr, size_t oldSize, size_t size)
+{
+  const MEMORY_FUNCTIONS *fns = ms->fns;
+  void *result;
+  if (size > oldSize && !memCharge(ms, size - oldSize))
+    return NULL;
+  if (!fns->isSized)
+    result = fns->classic.realloc_fcn(ptr, size);
+  else if (ptr == NULL)
+    result = fns->sized.malloc_fcn(fns->sized.ctx, size);
+  else
+    result = fns->sized.realloc_fcn(fns->sized.ctx, ptr, oldSize, size);
+  if (result == NULL) {
+    if (size > oldSize)
+      memUncharge(ms, size - oldSize);
+  }
+  else if (size < oldSize)
+    memUncharge(ms, oldSize - size);
+  return result;
+}
+
+static void
+memFree(const MEMORY_SUITE *ms, void *ptr, size_t size)
+{
+  const MEMORY_FUNCTIONS *fns = ms->fns;
+  if (ptr == NULL)
+    return;
+  memUncharge(ms, size);
+  if (fns->isSized)
+    fns->sized.free_sized_fcn(fns->sized.ctx, ptr, size);
+  else
+    fns->classic.free_fcn(ptr);
+}
+
+/* The size memAllocAligned() actually allocates for size bytes */
+static size_t
+memAlignedSize(const MEMORY_SUITE *ms, size_t size)
+{
+  if (ms->fns->isSized && ms->fns->sized.aligned_alloc_fcn != NULL)
+    return ROUND_UP(size, MEM_ALIGNMENT);
+  return size;
+}
+
+/* For blocks that are never reallocated; the size is rounded up to a
+   multiple of the alignment, as aligned_alloc() requires, so
+   memFreeAligned() has to be given the same size. */
+static void *
+memAllocAligned(const MEMORY_SUITE *ms, size_t size)
+{
+  const MEMORY_FUNCTIONS *fns = ms->fns;
+  void *result;
+  if (!fns->isSized || fns->sized.aligned_alloc_fcn == NULL)
+    return memMalloc(ms, size);
+  if (size > (size_t)-1 - MEM_ALIGNMENT)
+    return NULL;
+  size = memAlignedSize(ms, size);
+  if (!memCharge(ms, size))
+    return NULL;
+  result = fns->sized.aligned_alloc_fcn(fns->sized.ctx, MEM_ALIGNMENT, size);
+  if (result == NULL)
+    memUncharge(ms, size);
+  return result;
+}
+
+static void
+memFreeAligned(const MEMORY_SUITE *ms, void *ptr, size_t size)
+{
+  memFree(ms, ptr, memAlignedSize(ms, size));
+}
+
+/* Memory owned by the application is not charged to the parser's
+   account: a classic suite cannot tell the size it is freed with. */
+static void *
+appMalloc(const MEMORY_SUITE *ms, size_t size)
+{
+  const MEMORY_FUNCTIONS *fns = ms->fns;
+  MEM_HEADER *header;
+  if (!fns->isSized)
+    return fns->classic.malloc_fcn(size);
+  if (size > (size_t)-1 - sizeof(MEM_HEADER))
+    return NULL;
+  header = (MEM_HEADER *)fns->sized.malloc_fcn(fns->sized.ctx,
+                                               sizeof(MEM_HEADER) + size);
+  if (header == NULL)
+    return NULL;
+  header->size = size;
+  return header + 1;
+}
+
+static void *
+appRealloc(const MEMORY_SUITE *ms, void *ptr, size_t size)
+{
+  const MEMORY_FUNCTIONS *fns = ms->fns;
+  MEM_HEADER *header;
+  if (!fns->isSized)
+    return fns->classic.realloc_fcn(ptr, size);
+  if (ptr == NULL)
+    return appMalloc(ms, size);
+  if (size > (size_t)-1 - sizeof(MEM_HEADER))
+    return NULL;
+  header = (MEM_HEADER *)ptr - 1;
+  header = (MEM_HEADER *)fns->sized.realloc_fcn(fns->sized.ctx, header,
+                                                sizeof(MEM_HEADER) + header->size,
+                                                sizeof(MEM_HEADER) + size);
+  if (header == NULL)
+    return NULL;
+  header->size = size;
+  return header + 1;
+}
+
+static void
+appFree(const MEMORY_SUITE *ms, void *ptr)
+{
+  const MEMORY_FUNCTIONS *fns = ms->fns;
+  if (!fns->isSized)
+    fns->classic.free_fcn(ptr);
+  else if (ptr != NULL) {
+    MEM_HEADER *header = (MEM_HEADER *)ptr - 1;
+    fns->sized.free_sized_fcn(fns->sized.ctx, header,
+                              sizeof(MEM_HEADER) + header->size);
+  }
+}
+
 static XML_Char *
 copyString(const XML_Char *s,
-           const XML_Memory_Handling_Suite *memsuite)
+           const MEMORY_SUITE *memsuite)
 {
     int charsRequired = 0;
     XML_Char *result;
@@ -7187,10 +11385,17 @@ copyString(const XML_Char *s,
     charsRequired++;
 
     /* Now allocate space for the copy */
-    result = memsuite->malloc_fcn(charsRequired * sizeof(XML_Char));
+    result = memMalloc(memsuite, charsRequired * sizeof(XML_Char));
     if (result == NULL)
         return NULL;
     /* Copy the original into place */
     memcpy(result, s, charsRequired * sizeof(XML_Char));
     return result;
 }
+
+static void
+freeString(const XML_Char *s, const MEMORY_SUITE *memsuite)
+{
+  if (s != NULL)
+    memFree(memsuite, (void *)s, (keylen(s) + 1) * sizeof(XML_Char));
+}
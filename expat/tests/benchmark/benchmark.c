@@ -44,15 +44,33 @@
 
 #ifdef XML_UNICODE_WCHAR_T
 # define XML_FMT_STR "ls"
+# define XCS(s) L ## s
 #else
 # define XML_FMT_STR "s"
+# define XCS(s) s
 #endif
 
+static unsigned long nrOfMallocs = 0;
+
+static void *
+counting_malloc(size_t size)
+{
+  nrOfMallocs++;
+  return malloc(size);
+}
+
+static void *
+counting_realloc(void *ptr, size_t size)
+{
+  nrOfMallocs++;
+  return realloc(ptr, size);
+}
+
 static void
 usage(const char *prog, int rc)
 {
   fprintf(stderr,
-          "usage: %s [-n] filename bufferSize nr_of_loops\n", prog);
+          "usage: %s [-n] [-k] [-m] filename bufferSize nr_of_loops\n", prog);
   exit(rc);
 }
 
@@ -63,19 +81,32 @@ int main (int argc, char *argv[])
   FILE        *fd;
   struct stat fileAttr;
   int         nrOfLoops, bufferSize, fileSize, i, isFinal;
-  int         j = 0, ns = 0;
+  int         j = 0, ns = 0, keep = 0, countMallocs = 0;
+  unsigned long firstMallocs = 0;
   clock_t     tstart, tend;
   double      cpuTime = 0.0;
+  XML_Memory_Handling_Suite memsuite = {
+    counting_malloc, counting_realloc, free
+  };
 
-  if (argc > 1) {
-    if (argv[1][0] == '-') {
-      if (argv[1][1] == 'n' && argv[1][2] == '\0') {
-        ns = 1;
-        j = 1;
-      }
-      else
-        usage(argv[0], 1);
+  while (j + 1 < argc && argv[j + 1][0] == '-') {
+    const char *opt = argv[j + 1];
+    if (opt[1] == '\0' || opt[2] != '\0')
+      usage(argv[0], 1);
+    switch (opt[1]) {
+    case 'n':
+      ns = 1;
+      break;
+    case 'k':
+      keep = 1;
+      break;
+    case 'm':
+      countMallocs = 1;
+      break;
+    default:
+      usage(argv[0], 1);
     }
+    j++;
   }
 
   if (argc != j + 4)
@@ -105,9 +136,11 @@ int main (int argc, char *argv[])
   fclose (fd);
   
   if (ns)
-    parser = XML_ParserCreateNS(NULL, '!');
+    parser = XML_ParserCreate_MM(NULL, &memsuite, XCS("!"));
   else
-    parser = XML_ParserCreate(NULL);
+    parser = XML_ParserCreate_MM(NULL, &memsuite, NULL);
+  if (keep)
+    XML_SetResetMode(parser, XML_RESET_KEEP_CAPACITY);
 
   i = 0;
   XMLBufEnd = XMLBuf + fileSize;
@@ -137,6 +170,8 @@ int main (int argc, char *argv[])
     tend = clock();
     cpuTime += ((double) (tend - tstart)) / CLOCKS_PER_SEC;
     XML_ParserReset(parser, NULL);
+    if (i == 0)
+      firstMallocs = nrOfMallocs;
     i++;
   }
 
@@ -145,5 +180,13 @@ int main (int argc, char *argv[])
       
   printf ("%d loops, with buffer size %d. Average time per loop: %f\n", 
           nrOfLoops, bufferSize, cpuTime / (double) nrOfLoops);
+  if (countMallocs) {
+    printf ("%lu allocations for the first document", firstMallocs);
+    if (nrOfLoops > 1)
+      printf (", %f per later document",
+              (double) (nrOfMallocs - firstMallocs)
+                  / (double) (nrOfLoops - 1));
+    printf ("\n");
+  }
   return 0;
 }
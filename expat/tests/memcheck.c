@@ -49,6 +49,7 @@ typedef struct allocation_entry {
 
 static AllocationEntry *alloc_head = NULL;
 static AllocationEntry *alloc_tail = NULL;
+static unsigned long alloc_count = 0;
 
 static AllocationEntry *find_allocation(void *ptr);
 
@@ -59,6 +60,7 @@ tracking_malloc(size_t size)
 {
     AllocationEntry *entry = malloc(sizeof(AllocationEntry));
 
+    alloc_count++;
     if (entry == NULL) {
         printf("Allocator failure\n");
         return NULL;
@@ -118,7 +120,7 @@ tracking_free(void *ptr)
         if (entry->next != NULL)
             entry->next->prev = entry->prev;
         else
-            alloc_tail = entry->next;
+            alloc_tail = entry->prev;
         free(entry);
     } else {
         printf("Attempting to free unallocated memory at %p\n", ptr);
@@ -142,6 +144,7 @@ tracking_realloc(void *ptr, size_t size)
         return NULL;
     }
 
+    alloc_count++;
     /* Find the allocation entry for this memory */
     entry = find_allocation(ptr);
     if (entry == NULL) {
@@ -180,6 +183,12 @@ tracking_realloc(void *ptr, size_t size)
     return entry->allocation;
 }
 
+unsigned long
+tracking_allocation_count(void)
+{
+    return alloc_count;
+}
+
 int
 tracking_report(void)
 {
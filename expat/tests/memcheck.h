@@ -50,6 +50,11 @@ void *tracking_realloc(void *ptr, size_t size);
  */
 int tracking_report(void);
 
+/* Number of calls to tracking_malloc() and tracking_realloc() so far,
+ * for checking that a stretch of work did not allocate.
+ */
+unsigned long tracking_allocation_count(void);
+
 #endif /* XML_MEMCHECK_H */
 
 #ifdef __cplusplus
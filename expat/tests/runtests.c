@@ -78,6 +78,21 @@
 #include "internal.h"  /* for UNUSED_P only */
 #include "minicheck.h"
 #include "memcheck.h"
+
+#ifdef _WIN32
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#else
+# include <sys/uio.h>  /* struct iovec */
+#endif
+
+#if defined(__linux__) && defined(XML_CONTEXT_BYTES)
+# include <sys/mman.h>  /* mmap */
+# include <unistd.h>  /* fileno */
+# define LARGE_INPUT_TESTS
+#endif
 #include "siphash.h"
 #include "ascii.h" /* for ASCII_xxx */
 
@@ -2843,6 +2858,70 @@ START_TEST(test_default_current)
 }
 END_TEST
 
+/* Test XML_DefaultCurrent() from the XML declaration handler of a
+   UTF-16 external entity, before any content needed converting */
+static XML_Parser default_current_parser;
+
+static void XMLCALL
+default_current_xml_decl(void *UNUSED_P(userData),
+                         const XML_Char *UNUSED_P(version),
+                         const XML_Char *UNUSED_P(encoding),
+                         int UNUSED_P(standalone))
+{
+    XML_DefaultCurrent(default_current_parser);
+}
+
+static int XMLCALL
+external_entity_utf16_decl(XML_Parser parser,
+                           const XML_Char *context,
+                           const XML_Char *UNUSED_P(base),
+                           const XML_Char *UNUSED_P(systemId),
+                           const XML_Char *UNUSED_P(publicId))
+{
+    const char *ascii = "<?xml version='1.0' encoding='utf-16'?><e/>";
+    char text[2 + 2 * 64];
+    int len = 2;
+    XML_Parser extparser;
+
+    text[0] = '\xff';
+    text[1] = '\xfe';
+    for (; *ascii != '\0'; ascii++) {
+        text[len++] = *ascii;
+        text[len++] = '\0';
+    }
+    extparser = XML_ExternalEntityParserCreate(parser, context, NULL);
+    if (extparser == NULL)
+        fail("Could not create external entity parser");
+    default_current_parser = extparser;
+    XML_SetXmlDeclHandler(extparser, default_current_xml_decl);
+    XML_SetDefaultHandler(extparser, accumulate_characters);
+    if (_XML_Parse_SINGLE_BYTES(extparser, text, len,
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(extparser);
+    XML_ParserFree(extparser);
+    return XML_STATUS_OK;
+}
+
+START_TEST(test_default_current_utf16_text_decl)
+{
+    const char *text =
+        "<!DOCTYPE doc [\n"
+        "<!ENTITY en SYSTEM 'http://example.org/dummy.ent'>\n"
+        "]>\n"
+        "<doc>&en;</doc>";
+    CharData storage;
+
+    CharData_Init(&storage);
+    XML_SetUserData(parser, &storage);
+    XML_SetExternalEntityRefHandler(parser, external_entity_utf16_decl);
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage,
+                           XCS("<?xml version='1.0' encoding='utf-16'?><e/>"));
+}
+END_TEST
+
 /* Test DTD element parsing code paths */
 START_TEST(test_dtd_elements)
 {
@@ -7083,186 +7162,2163 @@ START_TEST(test_empty_element_abort)
 }
 END_TEST
 
-/*
- * Namespaces tests.
- */
+/* Record the values of attributes "a" and "b" as fetched on demand */
+static void XMLCALL
+lazy_attribute_handler(void *userData, const XML_Char *name,
+                       const XML_Char **atts)
+{
+    CharData *storage = (CharData *)userData;
+    const XML_Char *value;
 
-static void
-namespace_setup(void)
+    CharData_AppendXMLChars(storage, name, -1);
+    /* "(" for an empty atts array, "[" if values were materialised */
+    CharData_AppendXMLChars(storage, (atts[0] == NULL) ? XCS("(") : XCS("["), 1);
+    value = XML_GetAttributeValue(parser, XCS("a"));
+    CharData_AppendXMLChars(storage, (value != NULL) ? value : XCS("-"), -1);
+    CharData_AppendXMLChars(storage, XCS(","), 1);
+    value = XML_GetAttributeValue(parser, XCS("b"));
+    CharData_AppendXMLChars(storage, (value != NULL) ? value : XCS("-"), -1);
+    CharData_AppendXMLChars(storage, XCS(")"), 1);
+}
+
+/* Test attribute values can be fetched lazily */
+START_TEST(test_lazy_attributes)
 {
-    parser = XML_ParserCreateNS(NULL, XCS(' '));
-    if (parser == NULL)
-        fail("Parser not created.");
+    const char *text =
+        "<doc a='1' b='two'><e b='x' c='3'/><f/><g a=\"&#x41;\"/></doc>";
+    const XML_Char *expected = XCS("doc(1,two)e(-,x)f(-,-)g[A,-)");
+    CharData storage;
+
+    CharData_Init(&storage);
+    XML_SetLazyAttributes(parser, XML_TRUE);
+    XML_SetUserData(parser, &storage);
+    XML_SetStartElementHandler(parser, lazy_attribute_handler);
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, expected);
+    if (XML_GetAttributeValue(parser, XCS("a")) != NULL)
+        fail("Attribute value available outside start handler");
 }
+END_TEST
 
-static void
-namespace_teardown(void)
+/* Test lazy attributes are converted from UTF-16 on demand */
+START_TEST(test_lazy_attributes_utf16)
 {
-    basic_teardown();
+    /* <doc a='v'/> in UTF-16BE */
+    const char text[] =
+        "\0<\0d\0o\0c\0 \0a\0=\0'\0v\0'\0/\0>";
+    const XML_Char *expected = XCS("doc(v,-)");
+    CharData storage;
+
+    CharData_Init(&storage);
+    XML_SetLazyAttributes(parser, XML_TRUE);
+    XML_SetUserData(parser, &storage);
+    XML_SetStartElementHandler(parser, lazy_attribute_handler);
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)sizeof(text) - 1,
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, expected);
 }
+END_TEST
 
-/* Check that an element name and attribute name match the expected values.
-   The expected values are passed as an array reference of string pointers
-   provided as the userData argument; the first is the expected
-   element name, and the second is the expected attribute name.
-*/
-static int triplet_start_flag = XML_FALSE;
-static int triplet_end_flag = XML_FALSE;
+/* Test duplicate attributes are still detected in lazy mode */
+START_TEST(test_lazy_attributes_duplicate)
+{
+    const char *text = "<doc><e x='1' a='1' x='2'/></doc>";
 
-static void XMLCALL
-triplet_start_checker(void *userData, const XML_Char *name,
-                      const XML_Char **atts)
+    XML_SetLazyAttributes(parser, XML_TRUE);
+    expect_failure(text, XML_ERROR_DUPLICATE_ATTRIBUTE,
+                   "Duplicate attribute not detected in lazy mode");
+}
+END_TEST
+
+/* Latin-1, except that bytes 0x80 and 0x81 both stand for U+00E9 */
+static int XMLCALL
+twice_e_acute_encoding_handler(void *UNUSED_P(data),
+                               const XML_Char *encoding,
+                               XML_Encoding *info)
 {
-    XML_Char **elemstr = (XML_Char **)userData;
-    char buffer[1024];
-    if (xcstrcmp(elemstr[0], name) != 0) {
-        sprintf(buffer, "unexpected start string: '%" XML_FMT_STR "'", name);
-        fail(buffer);
-    }
-    if (xcstrcmp(elemstr[1], atts[0]) != 0) {
-        sprintf(buffer, "unexpected attribute string: '%" XML_FMT_STR "'",
-                atts[0]);
-        fail(buffer);
-    }
-    triplet_start_flag = XML_TRUE;
+    int i;
+    if (xcstrcmp(encoding, XCS("twice-e-acute")) != 0)
+        return XML_STATUS_ERROR;
+    for (i = 0; i < 256; i++)
+        info->map[i] = i;
+    info->map[0x80] = 0xE9;
+    info->map[0x81] = 0xE9;
+    info->data = NULL;
+    info->convert = NULL;
+    info->release = NULL;
+    return XML_STATUS_OK;
 }
 
-/* Check that the element name passed to the end-element handler matches
-   the expected value.  The expected value is passed as the first element
-   in an array of strings passed as the userData argument.
-*/
-static void XMLCALL
-triplet_end_checker(void *userData, const XML_Char *name)
+/* Test attribute names that differ in the input but not once decoded
+   are duplicates, both in lazy mode and when only paths look at them */
+START_TEST(test_lazy_attributes_unknown_encoding)
 {
-    XML_Char **elemstr = (XML_Char **)userData;
-    if (xcstrcmp(elemstr[0], name) != 0) {
-        char buffer[1024];
-        sprintf(buffer, "unexpected end string: '%" XML_FMT_STR "'", name);
-        fail(buffer);
-    }
-    triplet_end_flag = XML_TRUE;
+    const char *text =
+        "<?xml version='1.0' encoding='twice-e-acute'?>"
+        "<doc><e \x80='1' \x81='2'/></doc>";
+
+    XML_SetLazyAttributes(parser, XML_TRUE);
+    XML_SetUnknownEncodingHandler(parser, twice_e_acute_encoding_handler,
+                                  NULL);
+    expect_failure(text, XML_ERROR_DUPLICATE_ATTRIBUTE,
+                   "Duplicate attribute not detected in lazy mode");
+
+    XML_ParserFree(parser);
+    parser = XML_ParserCreate(NULL);
+    if (parser == NULL)
+        fail("Parser not created");
+    if (XML_AddPathPattern(parser, XCS("/doc/x")) != 0)
+        fail("Valid path pattern rejected");
+    XML_SetUnknownEncodingHandler(parser, twice_e_acute_encoding_handler,
+                                  NULL);
+    expect_failure(text, XML_ERROR_DUPLICATE_ATTRIBUTE,
+                   "Duplicate attribute not detected for paths");
 }
+END_TEST
 
-START_TEST(test_return_ns_triplet)
+/* Test declared attributes bypass the lazy path */
+START_TEST(test_lazy_attributes_declared)
 {
     const char *text =
-        "<foo:e xmlns:foo='http://example.org/' bar:a='12'\n"
-        "       xmlns:bar='http://example.org/'>";
-    const char *epilog = "</foo:e>";
-    const XML_Char *elemstr[] = {
-        XCS("http://example.org/ e foo"),
-        XCS("http://example.org/ a bar")
-    };
-    XML_SetReturnNSTriplet(parser, XML_TRUE);
-    XML_SetUserData(parser, (void *)elemstr);
-    XML_SetElementHandler(parser, triplet_start_checker,
-                          triplet_end_checker);
-    XML_SetNamespaceDeclHandler(parser,
-                                dummy_start_namespace_decl_handler,
-                                dummy_end_namespace_decl_handler);
-    triplet_start_flag = XML_FALSE;
-    triplet_end_flag = XML_FALSE;
-    dummy_handler_flags = 0;
+        "<!DOCTYPE doc [\n"
+        "<!ATTLIST doc b CDATA 'dflt'>\n"
+        "]>\n"
+        "<doc a='1'/>";
+    const XML_Char *expected = XCS("doc[1,dflt)");
+    CharData storage;
+
+    CharData_Init(&storage);
+    XML_SetLazyAttributes(parser, XML_TRUE);
+    XML_SetUserData(parser, &storage);
+    XML_SetStartElementHandler(parser, lazy_attribute_handler);
     if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
-                                XML_FALSE) == XML_STATUS_ERROR)
+                                XML_TRUE) == XML_STATUS_ERROR)
         xml_failure(parser);
-    if (!triplet_start_flag)
-        fail("triplet_start_checker not invoked");
-    /* Check that unsetting "return triplets" fails while still parsing */
-    XML_SetReturnNSTriplet(parser, XML_FALSE);
-    if (_XML_Parse_SINGLE_BYTES(parser, epilog, (int)strlen(epilog),
+    CharData_CheckXMLChars(&storage, expected);
+}
+END_TEST
+
+/* Test XML_GetAttributeValue also works without lazy attributes */
+START_TEST(test_get_attribute_value_eager)
+{
+    const char *text = "<doc b='2' a=' x '/>";
+    const XML_Char *expected = XCS("doc[ x ,2)");
+    CharData storage;
+
+    CharData_Init(&storage);
+    XML_SetUserData(parser, &storage);
+    XML_SetStartElementHandler(parser, lazy_attribute_handler);
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
                                 XML_TRUE) == XML_STATUS_ERROR)
         xml_failure(parser);
-    if (!triplet_end_flag)
-        fail("triplet_end_checker not invoked");
-    if (dummy_handler_flags != (DUMMY_START_NS_DECL_HANDLER_FLAG |
-                                DUMMY_END_NS_DECL_HANDLER_FLAG))
-        fail("Namespace handlers not called");
+    CharData_CheckXMLChars(&storage, expected);
 }
 END_TEST
 
+/* Record elements and text, skipping the content of elements named
+ * "skip" and of the element enclosing an element named "rest".
+ */
 static void XMLCALL
-overwrite_start_checker(void *userData, const XML_Char *name,
-                        const XML_Char **atts)
+skipping_start_handler(void *userData, const XML_Char *name,
+                       const XML_Char **UNUSED_P(atts))
 {
-    CharData *storage = (CharData *) userData;
-    CharData_AppendXMLChars(storage, XCS("start "), 6);
+    CharData *storage = (CharData *)userData;
+
+    CharData_AppendXMLChars(storage, XCS("<"), 1);
     CharData_AppendXMLChars(storage, name, -1);
-    while (*atts != NULL) {
-        CharData_AppendXMLChars(storage, XCS("\nattribute "), 11);
-        CharData_AppendXMLChars(storage, *atts, -1);
-        atts += 2;
-    }
-    CharData_AppendXMLChars(storage, XCS("\n"), 1);
+    CharData_AppendXMLChars(storage, XCS(">"), 1);
+    if (!xcstrcmp(name, XCS("skip"))
+        && XML_SkipCurrentElement(parser) != XML_STATUS_OK)
+        fail("Failed to skip element");
 }
 
 static void XMLCALL
-overwrite_end_checker(void *userData, const XML_Char *name)
+skipping_end_handler(void *userData, const XML_Char *name)
 {
-    CharData *storage = (CharData *) userData;
-    CharData_AppendXMLChars(storage, XCS("end "), 4);
+    CharData *storage = (CharData *)userData;
+
+    CharData_AppendXMLChars(storage, XCS("</"), 2);
     CharData_AppendXMLChars(storage, name, -1);
-    CharData_AppendXMLChars(storage, XCS("\n"), 1);
+    CharData_AppendXMLChars(storage, XCS(">"), 1);
+    if (!xcstrcmp(name, XCS("rest"))
+        && XML_SkipCurrentElement(parser) != XML_STATUS_OK)
+        fail("Failed to skip rest of element");
 }
 
 static void
-run_ns_tagname_overwrite_test(const char *text, const XML_Char *result)
+run_skipping_parse(const char *text, const XML_Char *expected)
 {
     CharData storage;
+
     CharData_Init(&storage);
     XML_SetUserData(parser, &storage);
-    XML_SetElementHandler(parser,
-                          overwrite_start_checker, overwrite_end_checker);
-    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text), XML_TRUE) == XML_STATUS_ERROR)
+    XML_SetElementHandler(parser, skipping_start_handler,
+                          skipping_end_handler);
+    XML_SetCharacterDataHandler(parser, accumulate_characters);
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                XML_TRUE) == XML_STATUS_ERROR)
         xml_failure(parser);
-    CharData_CheckXMLChars(&storage, result);
+    CharData_CheckXMLChars(&storage, expected);
 }
 
-/* Regression test for SF bug #566334. */
-START_TEST(test_ns_tagname_overwrite)
+/* Test the content of an element can be skipped from its start handler */
+START_TEST(test_skip_current_element)
 {
     const char *text =
-        "<n:e xmlns:n='http://example.org/'>\n"
-        "  <n:f n:attr='foo'/>\n"
-        "  <n:g n:attr2='bar'/>\n"
-        "</n:e>";
-    const XML_Char *result =
-        XCS("start http://example.org/ e\n")
-        XCS("start http://example.org/ f\n")
-        XCS("attribute http://example.org/ attr\n")
-        XCS("end http://example.org/ f\n")
-        XCS("start http://example.org/ g\n")
-        XCS("attribute http://example.org/ attr2\n")
-        XCS("end http://example.org/ g\n")
-        XCS("end http://example.org/ e\n");
-    run_ns_tagname_overwrite_test(text, result);
+        "<!DOCTYPE doc [<!ENTITY e 'entity'>]>\n"
+        "<doc>a<skip x='1'><b>text<c/></b>&amp;&e;&#65;\n"
+        "<![CDATA[cdata]]><?pi data?><!--comment--></skip>"
+        "b<skip/>c<skip><skip></skip></skip>d</doc>";
+    const XML_Char *expected =
+        XCS("<doc>a<skip></skip>b<skip></skip>c<skip></skip>d</doc>");
+
+    run_skipping_parse(text, expected);
 }
 END_TEST
 
-/* Regression test for SF bug #566334. */
-START_TEST(test_ns_tagname_overwrite_triplet)
+/* Test skipping an empty root element succeeds like any other */
+START_TEST(test_skip_empty_root_element)
 {
-    const char *text =
-        "<n:e xmlns:n='http://example.org/'>\n"
-        "  <n:f n:attr='foo'/>\n"
-        "  <n:g n:attr2='bar'/>\n"
-        "</n:e>";
-    const XML_Char *result =
-        XCS("start http://example.org/ e n\n")
-        XCS("start http://example.org/ f n\n")
-        XCS("attribute http://example.org/ attr n\n")
-        XCS("end http://example.org/ f n\n")
-        XCS("start http://example.org/ g n\n")
-        XCS("attribute http://example.org/ attr2 n\n")
-        XCS("end http://example.org/ g n\n")
-        XCS("end http://example.org/ e n\n");
-    XML_SetReturnNSTriplet(parser, XML_TRUE);
-    run_ns_tagname_overwrite_test(text, result);
+    run_skipping_parse("<skip/>", XCS("<skip></skip>"));
 }
 END_TEST
 
+/* Test the rest of an element can be skipped from other handlers */
+START_TEST(test_skip_rest_of_element)
+{
+    const char *text =
+        "<doc><a>x<rest/>y<b/></a>z</doc>";
+    const XML_Char *expected =
+        XCS("<doc><a>x<rest></rest></a>z</doc>");
 
-/* Regression test for SF bug #620343. */
+    run_skipping_parse(text, expected);
+}
+END_TEST
+
+/* Test skipped content is still checked for well-formedness */
+START_TEST(test_skip_current_element_errors)
+{
+    const char *mismatch = "<doc><skip><a></b></skip></doc>";
+    const char *undefined = "<doc><skip>&undefined;</skip></doc>";
+    const char *charref = "<doc><skip>&#0;</skip></doc>";
+    CharData storage;
+
+    CharData_Init(&storage);
+    XML_SetUserData(parser, &storage);
+    XML_SetStartElementHandler(parser, skipping_start_handler);
+    expect_failure(mismatch, XML_ERROR_TAG_MISMATCH,
+                   "Mismatched tag in skipped content not detected");
+    XML_ParserReset(parser, NULL);
+    XML_SetUserData(parser, &storage);
+    XML_SetStartElementHandler(parser, skipping_start_handler);
+    expect_failure(undefined, XML_ERROR_UNDEFINED_ENTITY,
+                   "Undefined entity in skipped content not detected");
+    XML_ParserReset(parser, NULL);
+    XML_SetUserData(parser, &storage);
+    XML_SetStartElementHandler(parser, skipping_start_handler);
+    expect_failure(charref, XML_ERROR_BAD_CHAR_REF,
+                   "Bad character reference in skipped content not detected");
+}
+END_TEST
+
+/* Test the attributes of skipped tags are checked like any others */
+START_TEST(test_skip_current_element_attributes)
+{
+    struct {
+        const char *text;
+        enum XML_Error error;
+    } cases[] = {
+        { "<doc><skip><b><c x='1' x='2'/></b></skip></doc>",
+          XML_ERROR_DUPLICATE_ATTRIBUTE },
+        { "<doc><skip><b x='1' x='2'></b></skip></doc>",
+          XML_ERROR_DUPLICATE_ATTRIBUTE },
+        { "<doc><skip><c x='&undefined;'/></skip></doc>",
+          XML_ERROR_UNDEFINED_ENTITY },
+        { "<doc><skip><b x='&#0;'></b></skip></doc>",
+          XML_ERROR_BAD_CHAR_REF }
+    };
+    CharData storage;
+    size_t i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        CharData_Init(&storage);
+        XML_SetUserData(parser, &storage);
+        XML_SetStartElementHandler(parser, skipping_start_handler);
+        expect_failure(cases[i].text, cases[i].error,
+                       "Bad attribute in skipped content not detected");
+        XML_ParserReset(parser, NULL);
+    }
+}
+END_TEST
+
+/* Test XML_SkipCurrentElement fails outside of content */
+START_TEST(test_skip_current_element_not_parsing)
+{
+    if (XML_SkipCurrentElement(NULL) != XML_STATUS_ERROR)
+        fail("Skipping succeeded on NULL parser");
+    if (XML_SkipCurrentElement(parser) != XML_STATUS_ERROR)
+        fail("Skipping succeeded before parsing");
+}
+END_TEST
+
+/* Path subscription handlers log their events as "[id", "]id",
+   "id:text" and "@id=value".
+ */
+static void
+record_path_id(CharData *storage, XML_Char prefix, int pathId)
+{
+    XML_Char buf[2];
+
+    buf[0] = prefix;
+    buf[1] = XCS('0') + pathId;
+    CharData_AppendXMLChars(storage, buf, 2);
+}
+
+static void XMLCALL
+path_start_handler(void *userData, int pathId,
+                   const XML_Char *UNUSED_P(name),
+                   const XML_Char **UNUSED_P(atts))
+{
+    record_path_id((CharData *)userData, XCS('['), pathId);
+}
+
+static void XMLCALL
+path_end_handler(void *userData, int pathId, const XML_Char *UNUSED_P(name))
+{
+    record_path_id((CharData *)userData, XCS(']'), pathId);
+}
+
+static void XMLCALL
+path_character_handler(void *userData, int pathId,
+                       const XML_Char *s, int len)
+{
+    CharData *storage = (CharData *)userData;
+    XML_Char buf[2];
+
+    buf[0] = XCS('0') + pathId;
+    buf[1] = XCS(':');
+    CharData_AppendXMLChars(storage, buf, 2);
+    CharData_AppendXMLChars(storage, s, len);
+}
+
+static void XMLCALL
+path_attribute_handler(void *userData, int pathId,
+                       const XML_Char *UNUSED_P(name), const XML_Char *value)
+{
+    CharData *storage = (CharData *)userData;
+
+    record_path_id(storage, XCS('@'), pathId);
+    CharData_AppendXMLChars(storage, XCS("="), 1);
+    CharData_AppendXMLChars(storage, value, -1);
+}
+
+static void
+set_path_handlers(CharData *storage)
+{
+    XML_SetUserData(parser, storage);
+    XML_SetPathElementHandler(parser, path_start_handler, path_end_handler);
+    XML_SetPathCharacterDataHandler(parser, path_character_handler);
+    XML_SetPathAttributeHandler(parser, path_attribute_handler);
+}
+
+START_TEST(test_path_subscriptions)
+{
+    const char *text =
+        "<feed><title>Feed</title>"
+        "<entry id='1'><title>A</title><x/></entry>"
+        "<other><entry><title>no</title></entry></other>"
+        "<entry id='2'><title>B<b>&amp;</b></title></entry>"
+        "</feed>";
+    const XML_Char *expected =
+        XCS("@1=1[0[20:A2:A]2]0[2]2")
+        XCS("@1=2[0[20:B2:B0:&2:&]2]0");
+    CharData storage;
+
+    if (XML_AddPathPattern(parser, XCS("/feed/entry/title")) != 0
+        || XML_AddPathPattern(parser, XCS("//entry/@id")) != 1
+        || XML_AddPathPattern(parser, XCS("/feed/entry/*")) != 2)
+        fail("Valid path pattern rejected");
+    CharData_Init(&storage);
+    set_path_handlers(&storage);
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, expected);
+}
+END_TEST
+
+/* Subtrees without matches are skipped when only path handlers are
+   set; they must still be checked for well-formedness. */
+START_TEST(test_path_skips_unmatched_subtrees)
+{
+    const char *text =
+        "<a><c><b>no</b><c x='1'>&lt;<b/></c></c><b>yes</b></a>";
+    const char *bad_text = "<a><c><x></y></c></a>";
+    const char *bad_atts = "<a><c><x y='1' y='2'/></c><b/></a>";
+    /* entity references in skipped subtrees are still expanded */
+    const struct {
+        const char *text;
+        enum XML_Error error;
+    } bad_entities[] = {
+        { "<!DOCTYPE a [<!ENTITY e '<x>'>]><a><c>&e;</c><b/></a>",
+          XML_ERROR_ASYNC_ENTITY },
+        { "<!DOCTYPE a [<!ENTITY e '&e;'>]><a><c>&e;</c><b/></a>",
+          XML_ERROR_RECURSIVE_ENTITY_REF },
+        { "<!DOCTYPE a [<!ENTITY e 'a&#38;#0;'>]><a><c>&e;</c><b/></a>",
+          XML_ERROR_BAD_CHAR_REF },
+        { "<!DOCTYPE a [<!ENTITY e '<x a=\"1\" a=\"2\"/>'>]>"
+          "<a><c>&e;</c><b/></a>",
+          XML_ERROR_DUPLICATE_ATTRIBUTE }
+    };
+    CharData storage;
+    size_t i;
+
+    if (XML_AddPathPattern(parser, XCS("/a/b")) != 0)
+        fail("Valid path pattern rejected");
+    CharData_Init(&storage);
+    XML_SetUserData(parser, &storage);
+    XML_SetPathCharacterDataHandler(parser, path_character_handler);
+    if (XML_Parse(parser, text, (int)strlen(text),
+                  XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, XCS("0:yes"));
+
+    /* patterns survive a reset, handlers do not */
+    XML_ParserReset(parser, NULL);
+    XML_SetUserData(parser, &storage);
+    XML_SetPathCharacterDataHandler(parser, path_character_handler);
+    expect_failure(bad_text, XML_ERROR_TAG_MISMATCH,
+                   "Mismatched tag in skipped subtree not detected");
+
+    /* skipping must not make the parser accept more documents */
+    XML_ParserReset(parser, NULL);
+    set_path_handlers(&storage);
+    expect_failure(bad_atts, XML_ERROR_DUPLICATE_ATTRIBUTE,
+                   "Duplicate attribute in skipped subtree not detected");
+    for (i = 0; i < sizeof(bad_entities) / sizeof(bad_entities[0]); i++) {
+        XML_ParserReset(parser, NULL);
+        set_path_handlers(&storage);
+        expect_failure(bad_entities[i].text, bad_entities[i].error,
+                       "Bad entity in skipped subtree not detected");
+    }
+}
+END_TEST
+
+START_TEST(test_path_invalid_patterns)
+{
+    const XML_Char *invalid[] = {
+        XCS(""), XCS("a"), XCS("/"), XCS("/a/"), XCS("/a///b"),
+        XCS("/@id"), XCS("//@id"), XCS("/a//@id"), XCS("/a/@*"),
+        XCS("/a/@id/b"), XCS("/a*"), XCS("/{urn:x}a")
+    };
+    const char *text = "<a>";
+    size_t i;
+
+    for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        if (XML_AddPathPattern(parser, invalid[i]) != -1)
+            fail("Invalid path pattern accepted");
+    }
+    if (XML_AddPathPattern(NULL, XCS("/a")) != -1
+        || XML_AddPathPattern(parser, NULL) != -1)
+        fail("NULL argument accepted");
+    if (XML_AddPathPattern(parser, XCS("//*/@id")) != 0)
+        fail("Valid path pattern rejected");
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                XML_FALSE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    if (XML_AddPathPattern(parser, XCS("/a")) != -1)
+        fail("Path pattern added after parsing started");
+}
+END_TEST
+
+/* Test "text()" patterns, nested matches of one pattern and name tests
+   against element types declared in the DTD. */
+START_TEST(test_path_text_and_nesting)
+{
+    const char *text =
+        "<!DOCTYPE d [<!ATTLIST p id CDATA 'def'>]>\n"
+        "<d><p>a<p>b</p>c</p><p id='x'/></d>";
+    const XML_Char *expected =
+        XCS("[0[1@2=def0:a1:a[0[1@2=def0:b1:b]1]0")
+        XCS("0:c1:c]1]0[0[1@2=x]1]0");
+    CharData storage;
+
+    if (XML_AddPathPattern(parser, XCS("//p")) != 0
+        || XML_AddPathPattern(parser, XCS("/d//p/text()")) != 1
+        || XML_AddPathPattern(parser, XCS("//p/@id")) != 2)
+        fail("Valid path pattern rejected");
+    if (XML_AddPathPattern(parser, XCS("/d/text()/p")) != -1
+        || XML_AddPathPattern(parser, XCS("/text()")) != -1)
+        fail("Invalid text() pattern accepted");
+    CharData_Init(&storage);
+    set_path_handlers(&storage);
+    if (XML_Parse(parser, text, (int)strlen(text),
+                  XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, expected);
+}
+END_TEST
+
+/* Allocation counting for the arena tests. */
+static unsigned long counted_mallocs = 0;
+
+static void *
+counting_malloc(size_t size)
+{
+    counted_mallocs++;
+    return malloc(size);
+}
+
+static void *
+counting_realloc(void *ptr, size_t size)
+{
+    counted_mallocs++;
+    return realloc(ptr, size);
+}
+
+static void XMLCALL
+record_attribute_values(void *userData, const XML_Char *UNUSED_P(name),
+                        const XML_Char **atts)
+{
+    for (; atts[0] != NULL; atts += 2)
+        CharData_AppendXMLChars((CharData *)userData, atts[1], -1);
+}
+
+/* Parses a document with a DTD twice and returns the number of
+   allocations made by the second parse. */
+static unsigned long
+count_reparse_allocations(void)
+{
+    const char *text =
+        "<!DOCTYPE doc [\n"
+        "<!ELEMENT doc (a|(b,c))*>\n"
+        "<!ATTLIST a x CDATA 'def' y CDATA 'y' z CDATA 'z'>\n"
+        "<!ATTLIST b x CDATA 'b1'>\n"
+        "<!ENTITY e 'entity'>\n"
+        "<!ENTITY f '&e;&e;'>\n"
+        "]>\n"
+        "<doc>&f;<a/><b/></doc>";
+    unsigned long before = 0;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        CharData storage;
+
+        if (i > 0) {
+            XML_ParserReset(parser, NULL);
+            before = counted_mallocs;
+        }
+        CharData_Init(&storage);
+        XML_SetUserData(parser, &storage);
+        XML_SetCharacterDataHandler(parser, accumulate_characters);
+        XML_SetStartElementHandler(parser, record_attribute_values);
+        XML_SetElementDeclHandler(parser, dummy_element_decl_handler);
+        if (XML_Parse(parser, text, (int)strlen(text),
+                      XML_TRUE) == XML_STATUS_ERROR)
+            xml_failure(parser);
+        CharData_CheckXMLChars(&storage, XCS("entityentitydefyzb1"));
+    }
+    return counted_mallocs - before;
+}
+
+START_TEST(test_arena_parser)
+{
+    XML_Memory_Handling_Suite memsuite = {
+        counting_malloc, counting_realloc, free
+    };
+    unsigned long plain, arena;
+
+    XML_ParserFree(parser);
+    parser = XML_ParserCreate_MM(NULL, &memsuite, NULL);
+    if (parser == NULL)
+        fail("Parser not created");
+    plain = count_reparse_allocations();
+
+    XML_ParserFree(parser);
+    /* small chunks to exercise chunk chaining */
+    parser = XML_ParserCreate_Arena(NULL, &memsuite, NULL, 64);
+    if (parser == NULL)
+        fail("Arena parser not created");
+    arena = count_reparse_allocations();
+    if (arena >= plain)
+        fail("Arena parser did not save allocations");
+
+    XML_ParserFree(parser);
+    parser = XML_ParserCreate_Arena(NULL, &memsuite, XCS("!"), 0);
+    if (parser == NULL)
+        fail("Arena parser not created");
+    count_reparse_allocations();
+}
+END_TEST
+
+START_TEST(test_reset_keep_capacity)
+{
+    XML_Memory_Handling_Suite memsuite = {
+        counting_malloc, counting_realloc, free
+    };
+    unsigned long plain, kept;
+
+    XML_ParserFree(parser);
+    parser = XML_ParserCreate_MM(NULL, &memsuite, NULL);
+    if (parser == NULL)
+        fail("Parser not created");
+    plain = count_reparse_allocations();
+    XML_SetResetMode(parser, XML_RESET_KEEP_CAPACITY);
+    /* the first reset in this mode fills the spare lists */
+    XML_ParserReset(parser, NULL);
+    count_reparse_allocations();
+    XML_ParserReset(parser, NULL);
+    kept = count_reparse_allocations();
+    if (kept >= plain)
+        fail("Keeping capacity did not save allocations");
+
+    XML_ParserFree(parser);
+    parser = XML_ParserCreate_MM(NULL, &memsuite, XCS("!"));
+    if (parser == NULL)
+        fail("Parser not created");
+    XML_SetResetMode(parser, XML_RESET_KEEP_CAPACITY);
+    count_reparse_allocations();
+    XML_ParserReset(parser, NULL);
+    count_reparse_allocations();
+}
+END_TEST
+
+/* After warming up on a document, reset with XML_RESET_KEEP_CAPACITY
+ * must make parsing the same document again allocation-free.
+ */
+START_TEST(test_reset_zero_allocations)
+{
+    const char *text =
+        "<!DOCTYPE n:doc [\n"
+        "<!ELEMENT n:doc (a|(b,c?))*>\n"
+        "<!ATTLIST a a1 CDATA '1' a2 CDATA '2' a3 CDATA '3' a4 CDATA '4'\n"
+        "            a5 CDATA '5' a6 CDATA '6' a7 CDATA '7' a8 CDATA '8'\n"
+        "            a9 CDATA '9' a10 NMTOKENS ' x  y '>\n"
+        "<!ATTLIST b xmlns:m CDATA 'urn:m' m:id ID #IMPLIED>\n"
+        "<!ENTITY e 'some entity text that is fairly long, to grow pools'>\n"
+        "<!ENTITY f '&e;&e;&e;&e;&e;&e;&e;&e;'>\n"
+        "]>\n"
+        "<n:doc xmlns:n='urn:n' xmlns='urn:default'>"
+        "&f;<a/><b m:id='b1'><c xmlns:p='urn:p' p:x='&f;'>&f;</c></b>"
+        "<a a1='one'>text<![CDATA[<cdata>]]><?pi data?><!-- c --></a>"
+        "</n:doc>";
+    XML_Memory_Handling_Suite memsuite = {
+        tracking_malloc,
+        tracking_realloc,
+        tracking_free
+    };
+    unsigned long before = 0;
+    int i;
+
+    XML_ParserFree(parser);
+    parser = XML_ParserCreate_MM(XCS("UTF-8"), &memsuite, XCS("!"));
+    if (parser == NULL)
+        fail("Parser not created");
+    XML_SetResetMode(parser, XML_RESET_KEEP_CAPACITY);
+    for (i = 0; i < 4; i++) {
+        CharData storage;
+
+        if (i > 0)
+            XML_ParserReset(parser, XCS("UTF-8"));
+        if (i == 3)
+            before = tracking_allocation_count();
+        CharData_Init(&storage);
+        XML_SetUserData(parser, &storage);
+        XML_SetCharacterDataHandler(parser, accumulate_characters);
+        if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                    XML_TRUE) == XML_STATUS_ERROR)
+            xml_failure(parser);
+    }
+    if (tracking_allocation_count() != before)
+        fail("Allocations after warm-up");
+    XML_ParserFree(parser);
+    parser = NULL;
+    if (!tracking_report())
+        fail("Memory leak found");
+}
+END_TEST
+
+/* A sized allocator that checks the sizes passed back to it. */
+typedef struct {
+    unsigned long outstanding;
+    unsigned long mismatches;
+    unsigned long aligned;
+    size_t bytes;
+} SizedStats;
+
+typedef struct {
+    void *raw;          /* start of the underlying malloc() block */
+    size_t size;        /* size requested by the parser */
+} SizedBlock;
+
+static void *
+sized_malloc(void *ctx, size_t size)
+{
+    SizedBlock *block = (SizedBlock *)malloc(sizeof(SizedBlock) + size);
+    if (block == NULL)
+        return NULL;
+    block->raw = block;
+    block->size = size;
+    ((SizedStats *)ctx)->outstanding++;
+    ((SizedStats *)ctx)->bytes += size;
+    return block + 1;
+}
+
+static void *
+sized_realloc(void *ctx, void *ptr, size_t oldSize, size_t size)
+{
+    SizedStats *stats = (SizedStats *)ctx;
+    SizedBlock *block = (SizedBlock *)ptr - 1;
+    if (block->size != oldSize || block->raw != block)
+        stats->mismatches++;
+    block = (SizedBlock *)realloc(block, sizeof(SizedBlock) + size);
+    if (block == NULL)
+        return NULL;
+    stats->bytes += size - block->size;
+    block->raw = block;
+    block->size = size;
+    return block + 1;
+}
+
+static void
+sized_free(void *ctx, void *ptr, size_t size)
+{
+    SizedStats *stats = (SizedStats *)ctx;
+    SizedBlock *block = (SizedBlock *)ptr - 1;
+    if (block->size != size)
+        stats->mismatches++;
+    stats->outstanding--;
+    stats->bytes -= block->size;
+    free(block->raw);
+}
+
+static void *
+sized_aligned_alloc(void *ctx, size_t alignment, size_t size)
+{
+    char *raw = (char *)malloc(sizeof(SizedBlock) + alignment + size);
+    char *p;
+    SizedBlock *block;
+    if (raw == NULL)
+        return NULL;
+    p = raw + sizeof(SizedBlock) + alignment - 1;
+    p -= (size_t)p % alignment;
+    block = (SizedBlock *)p - 1;
+    block->raw = raw;
+    block->size = size;
+    ((SizedStats *)ctx)->outstanding++;
+    ((SizedStats *)ctx)->aligned++;
+    ((SizedStats *)ctx)->bytes += size;
+    return p;
+}
+
+START_TEST(test_sized_memory_suite)
+{
+    const char *text =
+        "<!DOCTYPE doc [\n"
+        "<!ELEMENT doc (a|(b,c))*>\n"
+        "<!ELEMENT e EMPTY>\n"
+        "<!ATTLIST a x CDATA 'def' y CDATA 'y'>\n"
+        "<!ENTITY ent 'entity text'>\n"
+        "]>\n"
+        "<doc xmlns='urn:default' xmlns:p='urn:p'>&ent;"
+        "<a p:z='1'/><b xmlns:q='urn:a-rather-long-namespace-name'><q:c/></b>"
+        "</doc>";
+    SizedStats stats = { 0, 0, 0, 0 };
+    XML_Memory_Handling_Suite2 memsuite = {
+        sized_malloc, sized_realloc, sized_free, sized_aligned_alloc, NULL
+    };
+    void *ptr;
+    int i;
+
+    memsuite.ctx = &stats;
+    if (XML_ParserCreate_MM2(NULL, NULL, NULL) != NULL)
+        fail("Parser created without a memory suite");
+    XML_ParserFree(parser);
+    parser = XML_ParserCreate_MM2(XCS("UTF-8"), &memsuite, XCS("!"));
+    if (parser == NULL)
+        fail("Parser not created");
+    if (stats.aligned == 0)
+        fail("Parser not allocated with aligned_alloc_fcn");
+    for (i = 0; i < 2; i++) {
+        if (i > 0)
+            XML_ParserReset(parser, NULL);
+        XML_SetElementDeclHandler(parser, dummy_element_decl_handler);
+        if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                    XML_TRUE) == XML_STATUS_ERROR)
+            xml_failure(parser);
+    }
+    ptr = XML_MemMalloc(parser, 10);
+    if (ptr == NULL)
+        fail("XML_MemMalloc failed");
+    ptr = XML_MemRealloc(parser, ptr, 1000);
+    if (ptr == NULL)
+        fail("XML_MemRealloc failed");
+    XML_MemFree(parser, ptr);
+    XML_ParserFree(parser);
+    parser = NULL;
+    if (stats.mismatches != 0)
+        fail("Wrong size passed to the memory suite");
+    if (stats.outstanding != 0)
+        fail("Memory leak found");
+}
+END_TEST
+
+/* Test that the memory statistics agree with what the memory suite
+   sees, and that the limit stops the parse */
+START_TEST(test_memory_stats)
+{
+    const char *text =
+        "<!DOCTYPE doc [\n"
+        "<!ATTLIST a x CDATA 'def'>\n"
+        "<!ENTITY ent 'entity text'>\n"
+        "]>\n"
+        "<doc xmlns='urn:default' xmlns:p='urn:p'>&ent;"
+        "<a p:z='1'/><b><c/></b></doc>";
+    char longText[2000];
+    SizedStats sizedStats = { 0, 0, 0, 0 };
+    XML_Memory_Handling_Suite2 memsuite = {
+        sized_malloc, sized_realloc, sized_free, sized_aligned_alloc, NULL
+    };
+    XML_MemoryStats stats;
+    size_t sum = 0;
+    size_t limit;
+    void *buffer;
+    int i;
+
+    memsuite.ctx = &sizedStats;
+    XML_ParserFree(parser);
+    parser = XML_ParserCreate_MM2(NULL, &memsuite, XCS("!"));
+    if (parser == NULL)
+        fail("Parser not created");
+    buffer = XML_GetBuffer(parser, (int)strlen(text));
+    if (buffer == NULL)
+        fail("Buffer not allocated");
+    memcpy(buffer, text, strlen(text));
+    if (XML_ParseBuffer(parser, (int)strlen(text),
+                        XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    XML_GetMemoryStats(parser, &stats);
+    if (stats.current != sizedStats.bytes)
+        fail("Memory held does not match the memory suite");
+    if (stats.peak < stats.current)
+        fail("Peak below memory held");
+    for (i = 0; i < XML_MEMORY_CATEGORIES; i++) {
+        if (stats.currentBy[i] == 0)
+            fail("Category without memory");
+        if (stats.peakBy[i] < stats.currentBy[i])
+            fail("Category peak below memory held");
+        sum += stats.currentBy[i];
+    }
+    if (sum != stats.current)
+        fail("Categories do not add up");
+
+    if (XML_SetMemoryLimit(parser, 1))
+        fail("Limit below memory held accepted");
+    XML_ParserReset(parser, NULL);
+    XML_GetMemoryStats(parser, &stats);
+    if (stats.peak != stats.current)
+        fail("Peak not restarted by reset");
+    limit = stats.current + 256;
+    if (!XML_SetMemoryLimit(parser, limit))
+        fail("Limit refused");
+    sprintf(longText, "<doc a='%01900d'/>", 0);
+    if (XML_Parse(parser, longText, (int)strlen(longText),
+                  XML_TRUE) != XML_STATUS_ERROR)
+        fail("Parse succeeded despite the memory limit");
+    if (XML_GetErrorCode(parser) != XML_ERROR_MEMORY_LIMIT)
+        xml_failure(parser);
+    XML_GetMemoryStats(parser, &stats);
+    if (stats.peak > limit)
+        fail("Memory limit exceeded");
+
+    /* without the limit, the same document parses */
+    XML_ParserReset(parser, NULL);
+    XML_SetMemoryLimit(parser, 0);
+    if (XML_Parse(parser, longText, (int)strlen(longText),
+                  XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    XML_ParserFree(parser);
+    parser = NULL;
+    if (sizedStats.mismatches != 0 || sizedStats.outstanding != 0)
+        fail("Memory suite misused");
+}
+END_TEST
+
+/* An external entity parser may be freed after its parent; the memory
+   account they share lives as long as either */
+START_TEST(test_entity_parser_outlives_parent)
+{
+    const char *text = "<e>entity text<f/></e>";
+    SizedStats sizedStats = { 0, 0, 0, 0 };
+    XML_Memory_Handling_Suite2 memsuite = {
+        sized_malloc, sized_realloc, sized_free, sized_aligned_alloc, NULL
+    };
+    XML_Parser extparser;
+    XML_MemoryStats stats;
+
+    memsuite.ctx = &sizedStats;
+    XML_ParserFree(parser);
+    parser = XML_ParserCreate_MM2(NULL, &memsuite, NULL);
+    if (parser == NULL)
+        fail("Parser not created");
+    if (XML_Parse(parser, "<doc>", 5, XML_FALSE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    extparser = XML_ExternalEntityParserCreate(parser, XCS(""), NULL);
+    if (extparser == NULL)
+        fail("Could not create external entity parser");
+    if (_XML_Parse_SINGLE_BYTES(extparser, text, (int)strlen(text),
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(extparser);
+    XML_ParserFree(parser);
+    parser = NULL;
+
+    XML_GetMemoryStats(extparser, &stats);
+    if (stats.current != sizedStats.bytes)
+        fail("Memory held does not match the memory suite");
+    XML_ParserFree(extparser);
+    if (sizedStats.mismatches != 0 || sizedStats.outstanding != 0)
+        fail("Memory suite misused");
+}
+END_TEST
+
+/* Test that XML_TrimMemory gives back what a spike left behind without
+   disturbing a parse in progress */
+START_TEST(test_trim_memory)
+{
+    char spike[30000];
+    char *p = spike;
+    SizedStats sizedStats = { 0, 0, 0, 0 };
+    XML_Memory_Handling_Suite2 memsuite = {
+        sized_malloc, sized_realloc, sized_free, sized_aligned_alloc, NULL
+    };
+    XML_MemoryStats before, after;
+    CharData storage;
+    int i;
+
+    memsuite.ctx = &sizedStats;
+    XML_ParserFree(parser);
+    parser = XML_ParserCreate_MM2(NULL, &memsuite, XCS("!"));
+    if (parser == NULL)
+        fail("Parser not created");
+    CharData_Init(&storage);
+    XML_SetUserData(parser, &storage);
+    XML_SetStartElementHandler(parser, record_attribute_values);
+
+    /* deep nesting, many attributes and a large token */
+    p += sprintf(p, "<doc><s");
+    for (i = 0; i < 40; i++)
+        p += sprintf(p, " a%d=''", i);
+    p += sprintf(p, ">");
+    for (i = 0; i < 200; i++)
+        p += sprintf(p, "<p:d xmlns:p='urn:%d'>", i);
+    p += sprintf(p, "<!--");
+    memset(p, 'x', 20000);
+    p += 20000;
+    p += sprintf(p, "-->");
+    for (i = 0; i < 200; i++)
+        p += sprintf(p, "</p:d>");
+    sprintf(p, "</s><c attr='abc");
+    if (XML_Parse(parser, spike, 15000, XML_FALSE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    if (XML_Parse(parser, spike + 15000, (int)strlen(spike + 15000),
+                  XML_FALSE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+
+    XML_GetMemoryStats(parser, &before);
+    if (!XML_TrimMemory(parser, before.current))
+        fail("Trimming to the memory held failed");
+    if (XML_TrimMemory(parser, 0))
+        fail("Trimmed to nothing");
+    XML_GetMemoryStats(parser, &after);
+    if (after.current != sizedStats.bytes)
+        fail("Memory held does not match the memory suite");
+    if (after.currentBy[XML_MEMORY_BUFFER]
+            >= before.currentBy[XML_MEMORY_BUFFER]
+        || after.currentBy[XML_MEMORY_TAGS]
+            >= before.currentBy[XML_MEMORY_TAGS]
+        || after.currentBy[XML_MEMORY_BINDINGS]
+            >= before.currentBy[XML_MEMORY_BINDINGS])
+        fail("Memory not trimmed");
+
+    /* the partial start tag survived in the trimmed buffer */
+    if (XML_Parse(parser, "def'/></doc>", 12, XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, XCS("abcdef"));
+    XML_ParserFree(parser);
+    parser = NULL;
+    if (sizedStats.mismatches != 0 || sizedStats.outstanding != 0)
+        fail("Memory suite misused");
+}
+END_TEST
+
+/* XML_TrimMemory releases nothing when called from a handler, where
+   the parse still uses its buffers */
+static void XMLCALL
+start_element_trimmer(void *userData, const XML_Char *UNUSED_P(name),
+                      const XML_Char **UNUSED_P(atts))
+{
+    XML_MemoryStats before, after;
+
+    XML_GetMemoryStats(parser, &before);
+    if (XML_TrimMemory(parser, 0))
+        fail("Trimmed to nothing");
+    XML_GetMemoryStats(parser, &after);
+    if (after.current != before.current)
+        *(int *)userData = 1;
+}
+
+START_TEST(test_trim_memory_in_handler)
+{
+    const char *text =
+        "<doc><a x='1'>text</a><!-- comment --><b y='2'/></doc>";
+    int trimmed = 0;
+    void *buffer;
+
+    XML_SetUserData(parser, &trimmed);
+    XML_SetStartElementHandler(parser, start_element_trimmer);
+    buffer = XML_GetBuffer(parser, (int)strlen(text));
+    if (buffer == NULL)
+        fail("Buffer not allocated");
+    memcpy(buffer, text, strlen(text));
+    if (XML_ParseBuffer(parser, (int)strlen(text),
+                        XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    if (trimmed)
+        fail("Memory trimmed from a handler");
+}
+END_TEST
+
+/* A parser holds only itself, its memory account and its DTD until it
+   starts parsing, and XML_TrimMemory() takes a reset parser back to
+   that footprint. */
+START_TEST(test_idle_footprint)
+{
+    const char *text =
+        "<?xml version='1.0' encoding='iso-8859-1'?>\n"
+        "<!DOCTYPE d [\n"
+        "<!ELEMENT d (e|p:f)*>\n"
+        "<!ATTLIST e a CDATA 'x'>\n"
+        "<!ENTITY g 'ggg'>\n"
+        "]>\n"
+        "<d xmlns='urn:a' xmlns:p='urn:p'>"
+        "<e p:b='1' c='2'>&g;\xe9</e><p:f/></d>";
+    SizedStats sizedStats = { 0, 0, 0, 0 };
+    XML_Memory_Handling_Suite2 memsuite = {
+        sized_malloc, sized_realloc, sized_free, sized_aligned_alloc, NULL
+    };
+    XML_MemoryStats idle, stats;
+    int i;
+
+    memsuite.ctx = &sizedStats;
+    XML_ParserFree(parser);
+    parser = XML_ParserCreate_MM2(NULL, &memsuite, XCS("!"));
+    if (parser == NULL)
+        fail("Parser not created");
+    XML_GetMemoryStats(parser, &idle);
+    if (sizedStats.outstanding != 3)
+        fail("Idle parser holds more than itself, its account and its DTD");
+    for (i = 0; i < XML_MEMORY_CATEGORIES; i++) {
+        if (i != XML_MEMORY_DTD && i != XML_MEMORY_OTHER
+            && idle.currentBy[i] != 0)
+            fail("Idle parser holds memory it has not used yet");
+    }
+
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    if (!XML_ParserReset(parser, NULL))
+        fail("Parser not reset");
+    if (!XML_TrimMemory(parser, idle.current))
+        fail("Reset parser not trimmed to its idle footprint");
+    XML_GetMemoryStats(parser, &stats);
+    if (stats.current != idle.current || sizedStats.outstanding != 3)
+        fail("Reset parser does not return to its idle footprint");
+
+    /* everything released comes back on demand */
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    XML_ParserFree(parser);
+    parser = NULL;
+    if (sizedStats.mismatches != 0 || sizedStats.outstanding != 0)
+        fail("Memory suite misused");
+}
+END_TEST
+
+/* Records elements, attributes and text; an element named "stop"
+   suspends the parser. */
+static void XMLCALL
+hibernate_start(void *userData, const XML_Char *name, const XML_Char **atts)
+{
+    CharData *storage = (CharData *)userData;
+    CharData_AppendXMLChars(storage, XCS("<"), 1);
+    CharData_AppendXMLChars(storage, name, -1);
+    for (; *atts != NULL; atts += 2) {
+        CharData_AppendXMLChars(storage, XCS(" "), 1);
+        CharData_AppendXMLChars(storage, atts[0], -1);
+        CharData_AppendXMLChars(storage, XCS("="), 1);
+        CharData_AppendXMLChars(storage, atts[1], -1);
+    }
+    CharData_AppendXMLChars(storage, XCS(">"), 1);
+    if (xcstrcmp(name, XCS("urn:a!stop")) == 0)
+        XML_StopParser(parser, XML_TRUE);
+}
+
+static void XMLCALL
+hibernate_end(void *userData, const XML_Char *name)
+{
+    CharData *storage = (CharData *)userData;
+    CharData_AppendXMLChars(storage, XCS("</"), 2);
+    CharData_AppendXMLChars(storage, name, -1);
+    CharData_AppendXMLChars(storage, XCS(">"), 1);
+}
+
+/* Parses text a few bytes at a time, hibernating and waking the
+   parser after every call if hibernate is set; returns the number of
+   times the parser was hibernated while suspended in *suspended. */
+static int
+hibernate_parse(const char *text, XML_Memory_Handling_Suite2 *memsuite,
+                CharData *storage, XML_Bool hibernate, int *suspended)
+{
+    const int chunk = 7;
+    int len = (int)strlen(text);
+    int offset;
+    int hibernated = 0;
+
+    parser = XML_ParserCreate_MM2(NULL, memsuite, XCS("!"));
+    if (parser == NULL)
+        fail("Parser not created");
+    XML_SetReturnNSTriplet(parser, XML_TRUE);
+    XML_SetUserData(parser, storage);
+    XML_SetElementHandler(parser, hibernate_start, hibernate_end);
+    XML_SetCharacterDataHandler(parser, accumulate_characters);
+    for (offset = 0; offset < len; offset += chunk) {
+        int n = len - offset < chunk ? len - offset : chunk;
+        enum XML_Status status = XML_Parse(parser, text + offset, n,
+                                           offset + n == len);
+        for (;;) {
+            if (status == XML_STATUS_ERROR)
+                xml_failure(parser);
+            if (hibernate) {
+                void *blob;
+                size_t size;
+                if (XML_Hibernate(parser, &blob, &size) == XML_STATUS_OK) {
+                    parser = XML_Wake(blob, size, NULL);
+                    if (parser == NULL)
+                        fail("Parser not woken");
+                    hibernated++;
+                    if (status == XML_STATUS_SUSPENDED)
+                        ++*suspended;
+                }
+            }
+            if (status != XML_STATUS_SUSPENDED)
+                break;
+            status = XML_ResumeParser(parser);
+        }
+    }
+    return hibernated;
+}
+
+static void XMLCALL
+count_end_elements(void *userData, const XML_Char *UNUSED_P(name))
+{
+    ++*(int *)userData;
+}
+
+/* Open elements outgrowing their initial room while each of their
+   names is split across parsing calls still match their end tags */
+START_TEST(test_deep_nesting_chunked)
+{
+    const char *pad = "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwx";
+    char text[70000];
+    char *p = text;
+    int ended = 0;
+    int i;
+
+    for (i = 0; i < 500; i++)
+        p += sprintf(p, "<e%d_%.*s>", i, i % 50, pad);
+    for (i = 499; i >= 0; i--)
+        p += sprintf(p, "</e%d_%.*s>", i, i % 50, pad);
+    XML_SetUserData(parser, &ended);
+    XML_SetEndElementHandler(parser, count_end_elements);
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text), XML_TRUE)
+            == XML_STATUS_ERROR)
+        xml_failure(parser);
+    if (ended != 500)
+        fail("Not all elements ended");
+
+    /* a mismatch deep down is still caught */
+    XML_ParserReset(parser, NULL);
+    p = text;
+    for (i = 0; i < 500; i++)
+        p += sprintf(p, "<e%d>", i);
+    sprintf(p, "</e498>");
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text), XML_FALSE)
+            != XML_STATUS_ERROR)
+        fail("Mismatched end tag not reported");
+    if (XML_GetErrorCode(parser) != XML_ERROR_TAG_MISMATCH)
+        xml_failure(parser);
+}
+END_TEST
+
+/* End tags in an encoding that must be converted are matched against
+   the converted name of the open element, however long */
+START_TEST(test_end_tag_converted_name)
+{
+    char name[201];
+    char text[1000];
+    int ended = 0;
+
+    memset(name, '\xe9', 200);
+    name[200] = '\0';
+    sprintf(text, "<?xml version='1.0' encoding='iso-8859-1'?>"
+            "<d><%s></%s></d>", name, name);
+    XML_SetUserData(parser, &ended);
+    XML_SetEndElementHandler(parser, count_end_elements);
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text), XML_TRUE)
+            == XML_STATUS_ERROR)
+        xml_failure(parser);
+    if (ended != 2)
+        fail("Not all elements ended");
+
+    XML_ParserReset(parser, NULL);
+    name[199] = 'x';
+    sprintf(text, "<?xml version='1.0' encoding='iso-8859-1'?>"
+            "<d><%s></%.199s\xe9>", name, name);
+    if (XML_Parse(parser, text, (int)strlen(text), XML_FALSE)
+            != XML_STATUS_ERROR)
+        fail("Mismatched end tag not reported");
+    if (XML_GetErrorCode(parser) != XML_ERROR_TAG_MISMATCH)
+        xml_failure(parser);
+}
+END_TEST
+
+typedef struct InPlaceData {
+    int items;
+    int chars;
+    XML_Bool suspend;
+} InPlaceData;
+
+static void XMLCALL
+in_place_start(void *userData, const XML_Char *UNUSED_P(name),
+               const XML_Char **UNUSED_P(atts))
+{
+    InPlaceData *data = (InPlaceData *)userData;
+#ifdef XML_CONTEXT_BYTES
+    int offset, size;
+    const char *buffer = XML_GetInputContext(parser, &offset, &size);
+    if (buffer == NULL || offset >= size || buffer[offset] != '<')
+        fail("Context not at the start tag");
+#endif
+    if (data->suspend && ++data->items % 1000 == 0)
+        XML_StopParser(parser, XML_TRUE);
+    else if (!data->suspend)
+        data->items++;
+}
+
+static void XMLCALL
+in_place_characters(void *userData, const XML_Char *UNUSED_P(s), int len)
+{
+    ((InPlaceData *)userData)->chars += len;
+}
+
+/* After a suspension in the start handler of "<suspend/>", at bytes 6
+   to 16 of the document, the parser still reports the position just
+   past that tag */
+static void
+check_suspended_at_tag(void)
+{
+#ifdef XML_CONTEXT_BYTES
+    int offset, size;
+    const char *buffer = XML_GetInputContext(parser, &offset, &size);
+    if (buffer == NULL || offset < 10 || offset > size
+            || memcmp(buffer + offset - 10, "<suspend/>", 10) != 0)
+        fail("Context not after the suspending tag");
+#endif
+    if (XML_GetCurrentByteIndex(parser) != 16)
+        fail("Position after the suspending tag not reported");
+}
+
+/* Input handed to XML_Parse() is parsed where it is, only what is left
+   over being copied, whether it comes in one piece or in chunks that
+   split tokens, with or without suspending */
+START_TEST(test_parse_in_place)
+{
+    char *text = (char *)malloc(200000);
+    char *p = text;
+    InPlaceData data;
+    XML_MemoryStats stats;
+    int len, i, round;
+
+    if (text == NULL)
+        fail("Out of memory");
+    p += sprintf(p, "<doc>");
+    for (i = 0; i < 5000; i++)
+        p += sprintf(p, "<item n='%d'>text %d</item>", i, i);
+    sprintf(p, "</doc>");
+    len = (int)strlen(text);
+
+    for (round = 0; round < 3; round++) {
+        const int chunk = round == 0 ? len : 49999;
+        int off;
+        XML_ParserReset(parser, NULL);
+        data.items = 0;
+        data.chars = 0;
+        data.suspend = (XML_Bool)(round == 2);
+        XML_SetUserData(parser, &data);
+        XML_SetStartElementHandler(parser, in_place_start);
+        XML_SetCharacterDataHandler(parser, in_place_characters);
+        for (off = 0; off < len; off += chunk) {
+            const int n = len - off < chunk ? len - off : chunk;
+            enum XML_Status status
+                = XML_Parse(parser, text + off, n, off + n == len);
+            while (status == XML_STATUS_SUSPENDED)
+                status = XML_ResumeParser(parser);
+            if (status == XML_STATUS_ERROR)
+                xml_failure(parser);
+        }
+        if (data.items != 5001 || data.chars != 5000 * 5 + 18890)
+            fail("Document not parsed in full");
+        XML_GetMemoryStats(parser, &stats);
+        if (!data.suspend && stats.peakBy[XML_MEMORY_BUFFER] > 8192)
+            fail("Input copied to the buffer");
+    }
+    free(text);
+}
+END_TEST
+
+/* A parser suspended while completing a token left over from the
+   previous call still reports the event once the rest of the input has
+   been added to its buffer */
+START_TEST(test_parse_suspended_keeps_event)
+{
+    char *text = (char *)malloc(30000);
+    enum XML_Status status;
+
+    if (text == NULL)
+        fail("Out of memory");
+    sprintf(text, "pend/>");
+    memset(text + 6, 'x', 20000);
+    sprintf(text + 20006, "</doc>");
+    XML_SetStartElementHandler(parser, start_element_suspender);
+    if (XML_Parse(parser, "<doc>\n<sus", 10, XML_FALSE) != XML_STATUS_OK)
+        xml_failure(parser);
+    status = XML_Parse(parser, text, (int)strlen(text), XML_TRUE);
+    if (status != XML_STATUS_SUSPENDED)
+        fail("Parser not suspended");
+    check_suspended_at_tag();
+    if (XML_ResumeParser(parser) != XML_STATUS_OK)
+        xml_failure(parser);
+    free(text);
+}
+END_TEST
+
+/* Input in segments, some empty and most splitting tokens, is parsed
+   in a single XML_ParseV() call with only the split tokens copied, and
+   is kept for XML_ResumeParser() when parsing is suspended */
+START_TEST(test_parse_v)
+{
+    char *text = (char *)malloc(200000);
+    char *p = text;
+    struct iovec iov[64];
+    InPlaceData data;
+    XML_MemoryStats stats;
+    int len, i, round;
+
+    if (text == NULL)
+        fail("Out of memory");
+    p += sprintf(p, "<doc>");
+    for (i = 0; i < 5000; i++)
+        p += sprintf(p, "<item n='%d'>text %d</item>", i, i);
+    sprintf(p, "</doc>");
+    len = (int)strlen(text);
+
+    for (round = 0; round < 2; round++) {
+        enum XML_Status status;
+        int off = 0;
+        XML_ParserReset(parser, NULL);
+        data.items = 0;
+        data.chars = 0;
+        data.suspend = (XML_Bool)(round == 1);
+        XML_SetUserData(parser, &data);
+        XML_SetStartElementHandler(parser, in_place_start);
+        XML_SetCharacterDataHandler(parser, in_place_characters);
+        for (i = 0; i < 64; i++) {
+            const int n = i % 5 == 4 ? 0 : len / 64;
+            iov[i].iov_base = text + off;
+            iov[i].iov_len = (size_t)(i == 63 ? len - off : n);
+            off += (int)iov[i].iov_len;
+        }
+        status = XML_ParseV(parser, iov, 64, XML_TRUE);
+        while (status == XML_STATUS_SUSPENDED)
+            status = XML_ResumeParser(parser);
+        if (status == XML_STATUS_ERROR)
+            xml_failure(parser);
+        if (data.items != 5001 || data.chars != 5000 * 5 + 18890)
+            fail("Document not parsed in full");
+        XML_GetMemoryStats(parser, &stats);
+        if (!data.suspend && stats.peakBy[XML_MEMORY_BUFFER] > 8192)
+            fail("Input copied to the buffer");
+    }
+
+    /* suspended in the first segment, with a large one to keep in a
+       buffer that has to grow */
+    XML_ParserFree(parser);
+    parser = XML_ParserCreate(NULL);
+    if (parser == NULL)
+        fail("Parser not created");
+    XML_SetStartElementHandler(parser, start_element_suspender);
+    iov[0].iov_base = (void *)"<doc>\n<suspend/>";
+    iov[0].iov_len = 16;
+    memset(text, 'x', 20000);
+    iov[1].iov_base = text;
+    iov[1].iov_len = 20000;
+    iov[2].iov_base = (void *)"</doc>";
+    iov[2].iov_len = 6;
+    if (XML_ParseV(parser, iov, 3, XML_TRUE) != XML_STATUS_SUSPENDED)
+        fail("Parser not suspended");
+    check_suspended_at_tag();
+    if (XML_ResumeParser(parser) != XML_STATUS_OK)
+        xml_failure(parser);
+
+    XML_ParserReset(parser, NULL);
+    if (XML_ParseV(parser, NULL, 1, XML_TRUE) != XML_STATUS_ERROR
+            || XML_GetErrorCode(parser) != XML_ERROR_INVALID_ARGUMENT)
+        fail("NULL segments not refused");
+    free(text);
+}
+END_TEST
+
+typedef struct ReaderData {
+    const char *text;
+    int len;
+    int pos;
+    int reads;
+    int maxAsked;
+    int failAt;  /* read returning an error, or 0 */
+} ReaderData;
+
+static int XMLCALL
+memory_reader(void *readerArg, char *buf, int len)
+{
+    ReaderData *data = (ReaderData *)readerArg;
+    int n = data->len - data->pos;
+    if (++data->reads == data->failAt)
+        return -1;
+    if (len > data->maxAsked)
+        data->maxAsked = len;
+    if (n > len)
+        n = len;
+    memcpy(buf, data->text + data->pos, n);
+    data->pos += n;
+    return n;
+}
+
+static void XMLCALL
+reader_suspend_start(void *userData, const XML_Char *UNUSED_P(name),
+                     const XML_Char **UNUSED_P(atts))
+{
+    InPlaceData *data = (InPlaceData *)userData;
+    if (++data->items % 1000 == 0)
+        XML_StopParser(parser, XML_TRUE);
+}
+
+/* XML_ParseFromReader() pulls the whole input with reads that grow,
+   goes on after a suspension when called again, and fails the parse
+   when the reader fails */
+START_TEST(test_parse_from_reader)
+{
+    char *text = (char *)malloc(400000);
+    char *p = text;
+    ReaderData reader;
+    InPlaceData data;
+    enum XML_Status status;
+    int suspensions = 0;
+    int i;
+
+    if (text == NULL)
+        fail("Out of memory");
+    p += sprintf(p, "<doc>");
+    for (i = 0; i < 5000; i++)
+        p += sprintf(p, "<item n='%d'>text %d</item>", i, i);
+    /* a token much longer than the first read */
+    p += sprintf(p, "<!--");
+    memset(p, 'c', 200000);
+    p += 200000;
+    sprintf(p, "--></doc>");
+
+    memset(&reader, 0, sizeof(reader));
+    reader.text = text;
+    reader.len = (int)strlen(text);
+    data.items = 0;
+    data.chars = 0;
+    XML_SetUserData(parser, &data);
+    XML_SetStartElementHandler(parser, reader_suspend_start);
+    XML_SetCharacterDataHandler(parser, in_place_characters);
+    while ((status = XML_ParseFromReader(parser, memory_reader, &reader))
+           == XML_STATUS_SUSPENDED)
+        suspensions++;
+    if (status == XML_STATUS_ERROR)
+        xml_failure(parser);
+    if (suspensions != 5 || data.items != 5001
+            || data.chars != 5000 * 5 + 18890)
+        fail("Document not parsed in full");
+    if (reader.maxAsked <= 16 * 1024)
+        fail("Reads did not grow");
+    if (reader.reads > 40)
+        fail("Too many reads");
+
+    XML_ParserReset(parser, NULL);
+    memset(&reader, 0, sizeof(reader));
+    reader.text = text;
+    reader.len = (int)strlen(text);
+    reader.failAt = 3;
+    if (XML_ParseFromReader(parser, memory_reader, &reader)
+            != XML_STATUS_ERROR
+            || XML_GetErrorCode(parser) != XML_ERROR_READ_FAILED)
+        fail("Failed read not reported");
+    free(text);
+}
+END_TEST
+
+/* XML_ParseFile() parses a file mapped or read, with a token spanning
+   two mapped windows, and goes on after a suspension when called
+   again */
+START_TEST(test_parse_file)
+{
+    const char *path = "runtests_parse_file.xml";
+    const size_t commentLen = 9 * 1024 * 1024;
+    const int flags[3] = {
+        0, XML_FILE_NO_MAP, XML_FILE_POPULATE | XML_FILE_DROP_PAGES
+    };
+    char *comment = (char *)malloc(commentLen);
+    FILE *file = fopen(path, "wb");
+    InPlaceData data;
+    int i, round;
+
+    if (comment == NULL || file == NULL)
+        fail("Cannot set up the input");
+    fprintf(file, "<doc>");
+    for (i = 0; i < 5000; i++)
+        fprintf(file, "<item n='%d'>text %d</item>", i, i);
+    memset(comment, 'c', commentLen);
+    fprintf(file, "<!--");
+    if (fwrite(comment, 1, commentLen, file) != commentLen)
+        fail("Cannot write the input");
+    fprintf(file, "--></doc>");
+    if (fclose(file) != 0)
+        fail("Cannot write the input");
+    free(comment);
+
+    for (round = 0; round < 4; round++) {
+        enum XML_Status status;
+        int suspensions = 0;
+        XML_ParserReset(parser, NULL);
+        data.items = 0;
+        data.chars = 0;
+        data.suspend = (XML_Bool)(round == 3);
+        XML_SetUserData(parser, &data);
+        XML_SetStartElementHandler(parser, data.suspend ? reader_suspend_start
+                                                        : in_place_start);
+        XML_SetCharacterDataHandler(parser, in_place_characters);
+        while ((status = XML_ParseFile(parser, path, flags[round % 3]))
+               == XML_STATUS_SUSPENDED)
+            suspensions++;
+        if (status == XML_STATUS_ERROR)
+            xml_failure(parser);
+        if (data.items != 5001 || data.chars != 5000 * 5 + 18890
+                || suspensions != (data.suspend ? 5 : 0))
+            fail("File not parsed in full");
+    }
+    remove(path);
+
+    XML_ParserReset(parser, NULL);
+    if (XML_ParseFile(parser, path, 0) != XML_STATUS_ERROR
+            || XML_GetErrorCode(parser) != XML_ERROR_READ_FAILED)
+        fail("Missing file not reported");
+}
+END_TEST
+
+/* The prefetch handler is told about the external entities that may be
+   read, including those declared in the external subset */
+static void XMLCALL
+record_prefetch(XML_Parser parser, const XML_Char *UNUSED_P(base),
+                const XML_Char *systemId, const XML_Char *publicId)
+{
+    CharData *storage = (CharData *)XML_GetUserData(parser);
+    CharData_AppendXMLChars(storage, systemId, -1);
+    if (publicId != NULL) {
+        CharData_AppendXMLChars(storage, XCS("|"), 1);
+        CharData_AppendXMLChars(storage, publicId, -1);
+    }
+    CharData_AppendXMLChars(storage, XCS(";"), 1);
+}
+
+static int XMLCALL
+prefetch_loader(XML_Parser parser, const XML_Char *context,
+                const XML_Char *UNUSED_P(base), const XML_Char *systemId,
+                const XML_Char *UNUSED_P(publicId))
+{
+    const char *text = "<!ENTITY % m SYSTEM 'm.ent'>";
+    XML_Parser extparser;
+
+    CharData_AppendXMLChars((CharData *)XML_GetUserData(parser),
+                            XCS("read "), 5);
+    CharData_AppendXMLChars((CharData *)XML_GetUserData(parser),
+                            systemId, -1);
+    CharData_AppendXMLChars((CharData *)XML_GetUserData(parser),
+                            XCS(";"), 1);
+    if (xcstrcmp(systemId, XCS("subset.dtd")) != 0)
+        return XML_STATUS_OK;
+    extparser = XML_ExternalEntityParserCreate(parser, context, NULL);
+    if (extparser == NULL)
+        fail("Could not create external entity parser");
+    if (_XML_Parse_SINGLE_BYTES(extparser, text, (int)strlen(text),
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(extparser);
+    XML_ParserFree(extparser);
+    return XML_STATUS_OK;
+}
+
+START_TEST(test_external_entity_prefetch)
+{
+    const char *text =
+        "<!DOCTYPE doc SYSTEM 'subset.dtd' [\n"
+        "  <!ENTITY e1 SYSTEM 'e1.ent'>\n"
+        "  <!ENTITY e2 PUBLIC 'pub' 'e2.ent'>\n"
+        "  <!NOTATION n SYSTEM 'n'>\n"
+        "  <!ENTITY u SYSTEM 'u.bin' NDATA n>\n"
+        "  <!ENTITY i 'internal'>\n"
+        "  <!ENTITY % p SYSTEM 'p.ent'>\n"
+        "  <!ENTITY e1 SYSTEM 'again.ent'>\n"
+        "]>\n"
+        "<doc>&e1;</doc>";
+    const XML_Char *expected[3] = {
+        XCS("subset.dtd;e1.ent;e2.ent|pub;p.ent;read subset.dtd;m.ent;")
+        XCS("read e1.ent;"),
+        XCS("e1.ent;e2.ent|pub;read e1.ent;"),
+        XCS("")
+    };
+    int round;
+
+    for (round = 0; round < 3; round++) {
+        CharData storage;
+        CharData_Init(&storage);
+        XML_ParserReset(parser, NULL);
+        XML_SetUserData(parser, &storage);
+        XML_SetExternalEntityPrefetchHandler(parser, record_prefetch);
+        if (round < 2)
+            XML_SetExternalEntityRefHandler(parser, prefetch_loader);
+        XML_SetParamEntityParsing(parser,
+                                  round == 0 ? XML_PARAM_ENTITY_PARSING_ALWAYS
+                                             : XML_PARAM_ENTITY_PARSING_NEVER);
+        if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                    XML_TRUE) == XML_STATUS_ERROR)
+            xml_failure(parser);
+        CharData_CheckXMLChars(&storage, expected[round]);
+    }
+}
+END_TEST
+
+/* Text from an internal entity is reported in the same pieces on every
+   reference, including when a parse is suspended in the middle of it */
+static void XMLCALL
+accumulate_pieces(void *userData, const XML_Char *s, int len)
+{
+    CharData_AppendXMLChars((CharData *)userData, s, len);
+    CharData_AppendXMLChars((CharData *)userData, XCS("|"), 1);
+}
+
+static void XMLCALL
+suspend_after_newline(void *userData, const XML_Char *s, int len)
+{
+    accumulate_pieces(userData, s, len);
+    if (len == 1 && s[0] == XCS('\n'))
+        XML_StopParser(parser, XML_TRUE);
+}
+
+static void XMLCALL
+start_default_pieces(void *UNUSED_P(userData),
+                     const XML_Char *UNUSED_P(name),
+                     const XML_Char **UNUSED_P(atts))
+{
+    XML_SetDefaultHandlerExpand(parser, accumulate_pieces);
+}
+
+START_TEST(test_entity_text_replay)
+{
+    const char *text =
+        "<!DOCTYPE doc [\n"
+        "<!ENTITY e 'a&amp;b&#38;#65;\nc'>\n"
+        "<!ENTITY m '<x>t</x>'>\n"
+        "]>\n"
+        "<doc>&e;&e;&m;</doc>";
+    const XML_Char *expected =
+        XCS("a|&|b|A|\n|c|a|&|b|A|\n|c|t|");
+    const XML_Char *expectedDefault =
+        XCS("a|&amp;|b|&#65;|\n|c|a|&amp;|b|&#65;|\n|c|t|</x>|</doc>|");
+    CharData storage;
+
+    CharData_Init(&storage);
+    XML_SetUserData(parser, &storage);
+    XML_SetCharacterDataHandler(parser, accumulate_pieces);
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, expected);
+
+    XML_ParserReset(parser, NULL);
+    CharData_Init(&storage);
+    XML_SetUserData(parser, &storage);
+    XML_SetStartElementHandler(parser, start_default_pieces);
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, expectedDefault);
+
+    XML_ParserReset(parser, NULL);
+    CharData_Init(&storage);
+    XML_SetUserData(parser, &storage);
+    XML_SetCharacterDataHandler(parser, suspend_after_newline);
+    if (XML_Parse(parser, text, (int)strlen(text),
+                  XML_TRUE) != XML_STATUS_SUSPENDED)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, XCS("a|&|b|A|\n|"));
+    if (XML_ResumeParser(parser) != XML_STATUS_SUSPENDED)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, XCS("a|&|b|A|\n|c|a|&|b|A|\n|"));
+    if (XML_ResumeParser(parser) != XML_STATUS_OK)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, expected);
+}
+END_TEST
+
+/* The input buffer is sized as set by XML_SetBufferPolicy, and a
+   buffer grown for a huge token is given back once it is passed */
+START_TEST(test_buffer_policy)
+{
+    const char *head = "<doc><!--";
+    const char *tail = "--><e/>";
+    XML_MemoryStats stats;
+    char *buffer;
+    int i;
+
+    if (XML_SetBufferPolicy(parser, 0, 5, 0)
+            || XML_SetBufferPolicy(parser, -1, 0, 0)
+            || XML_SetBufferPolicy(parser, 0, 0, -1))
+        fail("Invalid buffer policy accepted");
+    if (!XML_SetBufferPolicy(parser, 256, 50, 8192))
+        fail("Buffer policy refused");
+
+    buffer = (char *)XML_GetBuffer(parser, (int)strlen(head));
+    if (buffer == NULL)
+        fail("Buffer not allocated");
+    XML_GetMemoryStats(parser, &stats);
+    if (stats.currentBy[XML_MEMORY_BUFFER] != 256)
+        fail("Buffer not of the initial size");
+    memcpy(buffer, head, strlen(head));
+    if (XML_ParseBuffer(parser, (int)strlen(head), XML_FALSE)
+            == XML_STATUS_ERROR)
+        xml_failure(parser);
+
+    /* a 100000 byte comment in pieces of 100 */
+    for (i = 0; i < 1000; i++) {
+        buffer = (char *)XML_GetBuffer(parser, 100);
+        if (buffer == NULL)
+            fail("Buffer not grown");
+        memset(buffer, 'x', 100);
+        if (XML_ParseBuffer(parser, 100, XML_FALSE) == XML_STATUS_ERROR)
+            xml_failure(parser);
+    }
+    XML_GetMemoryStats(parser, &stats);
+    if (stats.currentBy[XML_MEMORY_BUFFER] < 100000)
+        fail("Buffer not grown for the token");
+
+    for (i = 0; i < 3; i++) {
+        buffer = (char *)XML_GetBuffer(parser, (int)strlen(tail));
+        if (buffer == NULL)
+            fail("Buffer not allocated");
+        memcpy(buffer, tail, strlen(tail));
+        if (XML_ParseBuffer(parser, (int)strlen(tail), XML_FALSE)
+                == XML_STATUS_ERROR)
+            xml_failure(parser);
+        tail = "<e/>";
+    }
+    XML_GetMemoryStats(parser, &stats);
+    if (stats.currentBy[XML_MEMORY_BUFFER] > 8192)
+        fail("Buffer not shrunk");
+    if (XML_Parse(parser, "</doc>", 6, XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+}
+END_TEST
+
+/* The size_t entry points parse like the int ones and reject what
+   they cannot take */
+START_TEST(test_parse64)
+{
+    const char *text = "<doc>64-bit clean</doc>";
+    const char *more = "<doc>in the buffer</doc>";
+    CharData storage;
+    char *buffer;
+
+    CharData_Init(&storage);
+    XML_SetUserData(parser, &storage);
+    XML_SetCharacterDataHandler(parser, accumulate_characters);
+    if (XML_Parse64(parser, text, strlen(text), XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, XCS("64-bit clean"));
+
+    XML_ParserReset(parser, NULL);
+    CharData_Init(&storage);
+    XML_SetUserData(parser, &storage);
+    XML_SetCharacterDataHandler(parser, accumulate_characters);
+    buffer = (char *)XML_GetBuffer64(parser, strlen(more));
+    if (buffer == NULL)
+        fail("Buffer not allocated");
+    memcpy(buffer, more, strlen(more));
+    if (XML_ParseBuffer64(parser, strlen(more), XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, XCS("in the buffer"));
+
+    XML_ParserReset(parser, NULL);
+    if (XML_GetBuffer64(parser, (size_t)-1) != NULL
+            || XML_GetErrorCode(parser) != XML_ERROR_NO_MEMORY)
+        fail("Impossible buffer not refused");
+    XML_ParserReset(parser, NULL);
+    if (XML_Parse64(parser, NULL, 1, XML_TRUE) != XML_STATUS_ERROR
+            || XML_GetErrorCode(parser) != XML_ERROR_INVALID_ARGUMENT)
+        fail("NULL input not refused");
+    XML_ParserReset(parser, NULL);
+    if (XML_ParseBuffer(parser, -1, XML_TRUE) != XML_STATUS_ERROR
+            || XML_GetErrorCode(parser) != XML_ERROR_INVALID_ARGUMENT)
+        fail("Negative length not refused");
+}
+END_TEST
+
+#ifdef LARGE_INPUT_TESTS
+typedef struct {
+    size_t chars;
+    int calls;
+    XML_Bool split;
+} LargeTextData;
+
+static void XMLCALL
+large_text_characters(void *userData, const XML_Char *s, int len)
+{
+    LargeTextData *data = (LargeTextData *)userData;
+    data->chars += (size_t)len;
+    data->calls++;
+#ifndef XML_UNICODE
+    if (len > 0 && ((s[0] & 0xC0) == 0x80
+                    || (s[len - 1] & 0xC0) == 0xC0))
+        data->split = XML_TRUE;
+#else
+    (void)s;
+#endif
+}
+#endif /* LARGE_INPUT_TESTS */
+
+/* A text node of more than INT_MAX bytes, handed to XML_Parse64() in
+   one piece, is reported in pieces that do not split characters.  The
+   input is 1 MB of file mapped over and over; parsing it takes a few
+   seconds, so this only runs with EXPAT_LARGE_TESTS set. */
+START_TEST(test_parse64_over_int_max)
+{
+#ifdef LARGE_INPUT_TESTS
+    const size_t unit = 1024 * 1024;
+    const size_t units = 2200;
+    const size_t len = unit * units;
+    LargeTextData data = { 0, 0, XML_FALSE };
+    FILE *file;
+    char *text;
+    char *input;
+    size_t i;
+
+    if (sizeof(size_t) < 8 || getenv("EXPAT_LARGE_TESTS") == NULL)
+        return;
+    /* the first, middle and last mapping; the middle one begins with
+       an e acute so that a piece of INT_MAX bytes would split it */
+    text = (char *)malloc(3 * unit);
+    file = tmpfile();
+    if (text == NULL || file == NULL)
+        fail("Cannot set up the input");
+    memset(text, 'a', 3 * unit);
+    memcpy(text, "<d>", 3);
+    text[unit] = (char)0xC3;
+    text[unit + 1] = (char)0xA9;
+    memcpy(text + 3 * unit - 4, "</d>", 4);
+    if (fwrite(text, 1, 3 * unit, file) != 3 * unit || fflush(file) != 0)
+        fail("Cannot write the input");
+    free(text);
+
+    input = (char *)mmap(NULL, len, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (input == (char *)MAP_FAILED)
+        fail("Cannot reserve the input");
+    for (i = 0; i < units; i++) {
+        const off_t offset = (off_t)(i == 0 ? 0
+                                     : i == units - 1 ? 2 * unit : unit);
+        if (mmap(input + i * unit, unit, PROT_READ, MAP_SHARED | MAP_FIXED,
+                 fileno(file), offset) == MAP_FAILED)
+            fail("Cannot map the input");
+    }
+
+    XML_SetUserData(parser, &data);
+    XML_SetCharacterDataHandler(parser, large_text_characters);
+    if (XML_Parse64(parser, input, len, XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+#ifndef XML_UNICODE
+    if (data.chars != len - 7)
+#else
+    if (data.chars != len - 7 - (units - 2))
+#endif
+        fail("Text not reported in full");
+    if (data.calls < 2)
+        fail("Text over INT_MAX not split");
+    if (data.split)
+        fail("Character split between pieces");
+    munmap(input, len);
+    fclose(file);
+#endif /* LARGE_INPUT_TESTS */
+}
+END_TEST
+
+/* A parser hibernated between any two parsing calls, or while
+   suspended, goes on as if it had never stopped. */
+START_TEST(test_hibernate)
+{
+    const char *text =
+        "<?xml version='1.0' encoding='us-ascii'?>\n"
+        "<!DOCTYPE d [\n"
+        "<!ATTLIST e xmlns:q CDATA 'urn:q' q:c CDATA 'v'>\n"
+        "<!ENTITY g 'ggg'>\n"
+        "]>\n"
+        "<d xmlns='urn:a' xmlns:p='urn:p'>"
+        "<e p:b='1'>&g;<![CDATA[x<y]]></e><stop/>"
+        "<p:f>text<e/></p:f><q:h xmlns:q='urn:q2'/>"
+        "<longer-element-name>more text</longer-element-name></d>\n"
+        "<!-- epilog -->\n";
+    SizedStats sizedStats = { 0, 0, 0, 0 };
+    XML_Memory_Handling_Suite2 memsuite = {
+        sized_malloc, sized_realloc, sized_free, sized_aligned_alloc, NULL
+    };
+    CharData expected, storage;
+    XML_Size line, column;
+    int hibernated;
+    int suspended = 0;
+
+    memsuite.ctx = &sizedStats;
+    XML_ParserFree(parser);
+    CharData_Init(&expected);
+    hibernate_parse(text, &memsuite, &expected, XML_FALSE, &suspended);
+    line = XML_GetCurrentLineNumber(parser);
+    column = XML_GetCurrentColumnNumber(parser);
+    XML_ParserFree(parser);
+
+    CharData_Init(&storage);
+    hibernated = hibernate_parse(text, &memsuite, &storage, XML_TRUE,
+                                 &suspended);
+    /* after each call from the document element on, but not in the
+       prolog */
+    if (hibernated != 28 || suspended != 1)
+        fail("Parser not hibernated");
+    if (storage.count != expected.count
+        || memcmp(storage.data, expected.data,
+                  expected.count * sizeof(XML_Char)) != 0)
+        fail("Woken parser reports a different document");
+    if (XML_GetCurrentLineNumber(parser) != line
+        || XML_GetCurrentColumnNumber(parser) != column)
+        fail("Woken parser reports a different position");
+    XML_ParserFree(parser);
+    parser = NULL;
+    if (sizedStats.mismatches != 0 || sizedStats.outstanding != 0)
+        fail("Memory suite misused");
+}
+END_TEST
+
+/*
+ * Namespaces tests.
+ */
+
+static void
+namespace_setup(void)
+{
+    parser = XML_ParserCreateNS(NULL, XCS(' '));
+    if (parser == NULL)
+        fail("Parser not created.");
+}
+
+static void
+namespace_teardown(void)
+{
+    basic_teardown();
+}
+
+/* Check that an element name and attribute name match the expected values.
+   The expected values are passed as an array reference of string pointers
+   provided as the userData argument; the first is the expected
+   element name, and the second is the expected attribute name.
+*/
+static int triplet_start_flag = XML_FALSE;
+static int triplet_end_flag = XML_FALSE;
+
+static void XMLCALL
+triplet_start_checker(void *userData, const XML_Char *name,
+                      const XML_Char **atts)
+{
+    XML_Char **elemstr = (XML_Char **)userData;
+    char buffer[1024];
+    if (xcstrcmp(elemstr[0], name) != 0) {
+        sprintf(buffer, "unexpected start string: '%" XML_FMT_STR "'", name);
+        fail(buffer);
+    }
+    if (xcstrcmp(elemstr[1], atts[0]) != 0) {
+        sprintf(buffer, "unexpected attribute string: '%" XML_FMT_STR "'",
+                atts[0]);
+        fail(buffer);
+    }
+    triplet_start_flag = XML_TRUE;
+}
+
+/* Check that the element name passed to the end-element handler matches
+   the expected value.  The expected value is passed as the first element
+   in an array of strings passed as the userData argument.
+*/
+static void XMLCALL
+triplet_end_checker(void *userData, const XML_Char *name)
+{
+    XML_Char **elemstr = (XML_Char **)userData;
+    if (xcstrcmp(elemstr[0], name) != 0) {
+        char buffer[1024];
+        sprintf(buffer, "unexpected end string: '%" XML_FMT_STR "'", name);
+        fail(buffer);
+    }
+    triplet_end_flag = XML_TRUE;
+}
+
+START_TEST(test_return_ns_triplet)
+{
+    const char *text =
+        "<foo:e xmlns:foo='http://example.org/' bar:a='12'\n"
+        "       xmlns:bar='http://example.org/'>";
+    const char *epilog = "</foo:e>";
+    const XML_Char *elemstr[] = {
+        XCS("http://example.org/ e foo"),
+        XCS("http://example.org/ a bar")
+    };
+    XML_SetReturnNSTriplet(parser, XML_TRUE);
+    XML_SetUserData(parser, (void *)elemstr);
+    XML_SetElementHandler(parser, triplet_start_checker,
+                          triplet_end_checker);
+    XML_SetNamespaceDeclHandler(parser,
+                                dummy_start_namespace_decl_handler,
+                                dummy_end_namespace_decl_handler);
+    triplet_start_flag = XML_FALSE;
+    triplet_end_flag = XML_FALSE;
+    dummy_handler_flags = 0;
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                XML_FALSE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    if (!triplet_start_flag)
+        fail("triplet_start_checker not invoked");
+    /* Check that unsetting "return triplets" fails while still parsing */
+    XML_SetReturnNSTriplet(parser, XML_FALSE);
+    if (_XML_Parse_SINGLE_BYTES(parser, epilog, (int)strlen(epilog),
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    if (!triplet_end_flag)
+        fail("triplet_end_checker not invoked");
+    if (dummy_handler_flags != (DUMMY_START_NS_DECL_HANDLER_FLAG |
+                                DUMMY_END_NS_DECL_HANDLER_FLAG))
+        fail("Namespace handlers not called");
+}
+END_TEST
+
+static void XMLCALL
+overwrite_start_checker(void *userData, const XML_Char *name,
+                        const XML_Char **atts)
+{
+    CharData *storage = (CharData *) userData;
+    CharData_AppendXMLChars(storage, XCS("start "), 6);
+    CharData_AppendXMLChars(storage, name, -1);
+    while (*atts != NULL) {
+        CharData_AppendXMLChars(storage, XCS("\nattribute "), 11);
+        CharData_AppendXMLChars(storage, *atts, -1);
+        atts += 2;
+    }
+    CharData_AppendXMLChars(storage, XCS("\n"), 1);
+}
+
+static void XMLCALL
+overwrite_end_checker(void *userData, const XML_Char *name)
+{
+    CharData *storage = (CharData *) userData;
+    CharData_AppendXMLChars(storage, XCS("end "), 4);
+    CharData_AppendXMLChars(storage, name, -1);
+    CharData_AppendXMLChars(storage, XCS("\n"), 1);
+}
+
+static void
+run_ns_tagname_overwrite_test(const char *text, const XML_Char *result)
+{
+    CharData storage;
+    CharData_Init(&storage);
+    XML_SetUserData(parser, &storage);
+    XML_SetElementHandler(parser,
+                          overwrite_start_checker, overwrite_end_checker);
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text), XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, result);
+}
+
+/* Regression test for SF bug #566334. */
+START_TEST(test_ns_tagname_overwrite)
+{
+    const char *text =
+        "<n:e xmlns:n='http://example.org/'>\n"
+        "  <n:f n:attr='foo'/>\n"
+        "  <n:g n:attr2='bar'/>\n"
+        "</n:e>";
+    const XML_Char *result =
+        XCS("start http://example.org/ e\n")
+        XCS("start http://example.org/ f\n")
+        XCS("attribute http://example.org/ attr\n")
+        XCS("end http://example.org/ f\n")
+        XCS("start http://example.org/ g\n")
+        XCS("attribute http://example.org/ attr2\n")
+        XCS("end http://example.org/ g\n")
+        XCS("end http://example.org/ e\n");
+    run_ns_tagname_overwrite_test(text, result);
+}
+END_TEST
+
+/* Regression test for SF bug #566334. */
+START_TEST(test_ns_tagname_overwrite_triplet)
+{
+    const char *text =
+        "<n:e xmlns:n='http://example.org/'>\n"
+        "  <n:f n:attr='foo'/>\n"
+        "  <n:g n:attr2='bar'/>\n"
+        "</n:e>";
+    const XML_Char *result =
+        XCS("start http://example.org/ e n\n")
+        XCS("start http://example.org/ f n\n")
+        XCS("attribute http://example.org/ attr n\n")
+        XCS("end http://example.org/ f n\n")
+        XCS("start http://example.org/ g n\n")
+        XCS("attribute http://example.org/ attr2 n\n")
+        XCS("end http://example.org/ g n\n")
+        XCS("end http://example.org/ e n\n");
+    XML_SetReturnNSTriplet(parser, XML_TRUE);
+    run_ns_tagname_overwrite_test(text, result);
+}
+END_TEST
+
+
+/* Regression test for SF bug #620343. */
 static void XMLCALL
 start_element_fail(void *UNUSED_P(userData),
                    const XML_Char *UNUSED_P(name), const XML_Char **UNUSED_P(atts))
@@ -7874,6 +9930,90 @@ START_TEST(test_ns_double_colon_doctype)
 }
 END_TEST
 
+/* Test path patterns with expanded names */
+START_TEST(test_ns_path_subscriptions)
+{
+    const char *text =
+        "<doc xmlns='http://example.org/' xmlns:p='http://example.org/p'>"
+        "<item p:id='1' id='x'>t</item><p:item>u</p:item></doc>";
+    const XML_Char *expected = XCS("[0@1=10:t]0[22:u]2");
+    CharData storage;
+
+    if (XML_AddPathPattern(parser,
+                           XCS("/{http://example.org/}doc")
+                           XCS("/{http://example.org/}item")) != 0
+        || XML_AddPathPattern(parser,
+                              XCS("/{http://example.org/}doc/*")
+                              XCS("/@{http://example.org/p}id")) != 1
+        || XML_AddPathPattern(parser,
+                              XCS("//{http://example.org/p}item")) != 2
+        || XML_AddPathPattern(parser, XCS("//item")) != 3)
+        fail("Valid path pattern rejected");
+    CharData_Init(&storage);
+    set_path_handlers(&storage);
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, expected);
+}
+END_TEST
+
+/* Test skipped tags are checked for bound prefixes, and that their
+   namespace declarations are in scope for their content only.
+ */
+START_TEST(test_ns_skip_current_element)
+{
+    const char *text =
+        "<doc xmlns:a='http://example.org/'><skip>"
+        "<b xmlns:p='http://example.org/p'><p:c p:x='1' a:x='2'/></b>"
+        "</skip><e/></doc>";
+    struct {
+        const char *text;
+        enum XML_Error error;
+    } cases[] = {
+        { "<doc><skip><p:c/></skip></doc>",
+          XML_ERROR_UNBOUND_PREFIX },
+        { "<doc><skip><c p:x='1'/></skip></doc>",
+          XML_ERROR_UNBOUND_PREFIX },
+        { "<doc><skip><b xmlns:p='http://example.org/'></b><p:c/></skip></doc>",
+          XML_ERROR_UNBOUND_PREFIX },
+        { "<doc xmlns:a='http://example.org/' xmlns:b='http://example.org/'>"
+          "<skip><c a:x='1' b:x='2'/></skip></doc>",
+          XML_ERROR_DUPLICATE_ATTRIBUTE },
+        { "<doc><skip><c xmlns:p=''/></skip></doc>",
+          XML_ERROR_UNDECLARING_PREFIX }
+    };
+    const XML_Char *expected = XCS("<doc><skip></skip><e></e></doc>");
+    CharData storage;
+    size_t i;
+
+    CharData_Init(&storage);
+    XML_SetUserData(parser, &storage);
+    XML_SetElementHandler(parser, skipping_start_handler,
+                          skipping_end_handler);
+    XML_SetNamespaceDeclHandler(parser, dummy_start_namespace_decl_handler,
+                                dummy_end_namespace_decl_handler);
+    dummy_handler_flags = 0;
+    if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                XML_TRUE) == XML_STATUS_ERROR)
+        xml_failure(parser);
+    CharData_CheckXMLChars(&storage, expected);
+    /* only the declaration on doc is reported */
+    if (dummy_handler_flags != (DUMMY_START_NS_DECL_HANDLER_FLAG
+                                | DUMMY_END_NS_DECL_HANDLER_FLAG))
+        fail("Namespace declaration handlers not called as expected");
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        XML_ParserReset(parser, NULL);
+        CharData_Init(&storage);
+        XML_SetUserData(parser, &storage);
+        XML_SetStartElementHandler(parser, skipping_start_handler);
+        expect_failure(cases[i].text, cases[i].error,
+                       "Bad namespace use in skipped content not detected");
+    }
+}
+END_TEST
+
 /* Control variable; the number of times duff_allocator() will successfully allocate */
 #define ALLOC_ALWAYS_SUCCEED (-1)
 #define REALLOC_ALWAYS_SUCCEED (-1)
@@ -10456,6 +12596,53 @@ START_TEST(test_alloc_long_notation)
 END_TEST
 
 
+/* Test allocation failures in a parser using an arena, including its
+ * external entity parsers.
+ */
+START_TEST(test_alloc_arena)
+{
+    const char *text =
+        "<!DOCTYPE doc [\n"
+        "<!ELEMENT doc (#PCDATA|a)*>\n"
+        "<!ATTLIST a x CDATA 'default' y CDATA 'why'>\n"
+        "<!ENTITY i 'internal'>\n"
+        "<!ENTITY e SYSTEM 'foo'>\n"
+        "]>\n"
+        "<doc>&i;<a/>&e;</doc>";
+    ExtOption options[] = {
+        { XCS("foo"), "<a x='1'/>" },
+        { NULL, NULL }
+    };
+    XML_Memory_Handling_Suite memsuite = {
+        duff_allocator,
+        duff_reallocator,
+        free
+    };
+    int i;
+    const int max_alloc_count = 40;
+
+    for (i = 0; i < max_alloc_count; i++) {
+        XML_ParserFree(parser);
+        allocation_count = ALLOC_ALWAYS_SUCCEED;
+        parser = XML_ParserCreate_Arena(NULL, &memsuite, NULL, 64);
+        if (parser == NULL)
+            fail("Parser not created");
+        allocation_count = i;
+        XML_SetUserData(parser, options);
+        XML_SetElementDeclHandler(parser, dummy_element_decl_handler);
+        XML_SetExternalEntityRefHandler(parser, external_entity_optioner);
+        if (_XML_Parse_SINGLE_BYTES(parser, text, (int)strlen(text),
+                                    XML_TRUE) != XML_STATUS_ERROR)
+            break;
+    }
+    if (i == 0)
+        fail("Parsing worked despite failing allocations");
+    else if (i == max_alloc_count)
+        fail("Parsing failed even at max allocation count");
+}
+END_TEST
+
+
 static void
 nsalloc_setup(void)
 {
@@ -12038,6 +14225,7 @@ make_suite(void)
     tcase_add_test(tc_basic, test_suspend_parser_between_cdata_calls);
     tcase_add_test(tc_basic, test_memory_allocation);
     tcase_add_test(tc_basic, test_default_current);
+    tcase_add_test(tc_basic, test_default_current_utf16_text_decl);
     tcase_add_test(tc_basic, test_dtd_elements);
     tcase_add_test(tc_basic, test_set_foreign_dtd);
     tcase_add_test(tc_basic, test_foreign_dtd_not_standalone);
@@ -12175,6 +14363,44 @@ make_suite(void)
     tcase_add_test(tc_basic, test_bad_notation);
     tcase_add_test(tc_basic, test_default_doctype_handler);
     tcase_add_test(tc_basic, test_empty_element_abort);
+    tcase_add_test(tc_basic, test_lazy_attributes);
+    tcase_add_test(tc_basic, test_lazy_attributes_utf16);
+    tcase_add_test(tc_basic, test_lazy_attributes_duplicate);
+    tcase_add_test(tc_basic, test_lazy_attributes_unknown_encoding);
+    tcase_add_test(tc_basic, test_lazy_attributes_declared);
+    tcase_add_test(tc_basic, test_get_attribute_value_eager);
+    tcase_add_test(tc_basic, test_skip_current_element);
+    tcase_add_test(tc_basic, test_skip_empty_root_element);
+    tcase_add_test(tc_basic, test_skip_rest_of_element);
+    tcase_add_test(tc_basic, test_skip_current_element_errors);
+    tcase_add_test(tc_basic, test_skip_current_element_attributes);
+    tcase_add_test(tc_basic, test_skip_current_element_not_parsing);
+    tcase_add_test(tc_basic, test_path_subscriptions);
+    tcase_add_test(tc_basic, test_path_skips_unmatched_subtrees);
+    tcase_add_test(tc_basic, test_path_invalid_patterns);
+    tcase_add_test(tc_basic, test_path_text_and_nesting);
+    tcase_add_test(tc_basic, test_arena_parser);
+    tcase_add_test(tc_basic, test_reset_keep_capacity);
+    tcase_add_test(tc_basic, test_reset_zero_allocations);
+    tcase_add_test(tc_basic, test_sized_memory_suite);
+    tcase_add_test(tc_basic, test_memory_stats);
+    tcase_add_test(tc_basic, test_entity_parser_outlives_parent);
+    tcase_add_test(tc_basic, test_trim_memory);
+    tcase_add_test(tc_basic, test_trim_memory_in_handler);
+    tcase_add_test(tc_basic, test_idle_footprint);
+    tcase_add_test(tc_basic, test_deep_nesting_chunked);
+    tcase_add_test(tc_basic, test_end_tag_converted_name);
+    tcase_add_test(tc_basic, test_parse_in_place);
+    tcase_add_test(tc_basic, test_parse_suspended_keeps_event);
+    tcase_add_test(tc_basic, test_parse_v);
+    tcase_add_test(tc_basic, test_parse_from_reader);
+    tcase_add_test(tc_basic, test_parse_file);
+    tcase_add_test(tc_basic, test_external_entity_prefetch);
+    tcase_add_test(tc_basic, test_entity_text_replay);
+    tcase_add_test(tc_basic, test_buffer_policy);
+    tcase_add_test(tc_basic, test_parse64);
+    tcase_add_test(tc_basic, test_parse64_over_int_max);
+    tcase_add_test(tc_basic, test_hibernate);
 
     suite_add_tcase(s, tc_namespace);
     tcase_add_checked_fixture(tc_namespace,
@@ -12211,6 +14437,8 @@ make_suite(void)
     tcase_add_test(tc_namespace, test_ns_utf16_doctype);
     tcase_add_test(tc_namespace, test_ns_invalid_doctype);
     tcase_add_test(tc_namespace, test_ns_double_colon_doctype);
+    tcase_add_test(tc_namespace, test_ns_path_subscriptions);
+    tcase_add_test(tc_namespace, test_ns_skip_current_element);
 
     suite_add_tcase(s, tc_misc);
     tcase_add_checked_fixture(tc_misc, NULL, basic_teardown);
@@ -12276,6 +14504,7 @@ make_suite(void)
     tcase_add_test(tc_alloc, test_alloc_long_public_id);
     tcase_add_test(tc_alloc, test_alloc_long_entity_value);
     tcase_add_test(tc_alloc, test_alloc_long_notation);
+    tcase_add_test(tc_alloc, test_alloc_arena);
 
     suite_add_tcase(s, tc_nsalloc);
     tcase_add_checked_fixture(tc_nsalloc, nsalloc_setup, nsalloc_teardown);
@@ -64,10 +64,20 @@
 #endif
 #endif
 
+#include <errno.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #ifdef _DEBUG
+/* reads smaller than the parser asks for, to exercise split tokens */
 #define READ_SIZE 16
-#else
-#define READ_SIZE (1024*8)
 #endif
 
 
@@ -98,6 +108,8 @@ reportError(XML_Parser parser, const XML_Char *filename)
     ftprintf(stderr, T("%s: (unknown message %d)\n"), filename, code);
 }
  
+#ifdef XML_UNICODE
+
 /* This implementation will give problems on files larger than INT_MAX. */
 static void
 processFile(const void *data, size_t size,
@@ -113,6 +125,42 @@ processFile(const void *data, size_t size,
     *retPtr = 1;
 }
 
+#else /* not XML_UNICODE */
+
+/* XML_ParseFile() maps the file a window at a time, or reads it where
+   it cannot be mapped */
+static int
+parseFile(const XML_Char *filename, XML_Parser parser)
+{
+  if (XML_ParseFile(parser, filename, 0) == XML_STATUS_ERROR) {
+    if (XML_GetErrorCode(parser) == XML_ERROR_READ_FAILED)
+      tperror(filename);
+    else
+      reportError(parser, filename);
+    return 0;
+  }
+  return 1;
+}
+
+#endif /* not XML_UNICODE */
+
+/* Tells whether the file starts with the magic bytes of gzip or zstd;
+   such a file is decompressed as it is streamed, not mapped. */
+static int
+isCompressed(const XML_Char *filename)
+{
+  unsigned char magic[4];
+  int n;
+  int fd = topen(filename, O_BINARY|O_RDONLY);
+  if (fd < 0)
+    return 0;
+  n = (int)read(fd, magic, sizeof(magic));
+  close(fd);
+  return (n >= 2 && magic[0] == 0x1F && magic[1] == 0x8B)
+         || (n == 4 && magic[0] == 0x28 && magic[1] == 0xB5
+             && magic[2] == 0x2F && magic[3] == 0xFD);
+}
+
 #if defined(_WIN32)
 
 static int
@@ -153,6 +201,215 @@ resolveSystemId(const XML_Char *base, const XML_Char *systemId,
   return *toFree;
 }
 
+#ifdef HAVE_PTHREAD
+
+/* The external entities the parser announces as declared are read in
+   the background, each by a thread of its own, so that the files of a
+   DTD made of many modules are read at the same time rather than one
+   after another as they are referenced; a prefetched entity is parsed
+   from memory.  Only regular files are prefetched, as reading anything
+   else could block or have effects, and a prefetch the document did
+   not use is abandoned to its thread rather than waited for. */
+#define PREFETCH_MAX 64                     /* entities per document */
+#define PREFETCH_MAX_SIZE (16*1024*1024)    /* larger ones are streamed */
+
+typedef struct {
+  XML_Char *filename;
+  int fd;
+  pthread_t thread;
+  XML_Bool joined;
+  XML_Bool finished;   /* guarded by prefetchLock, as is abandoned */
+  XML_Bool abandoned;  /* the thread frees the prefetch when finished */
+  char *data;   /* NULL if not read */
+  size_t size;
+} PREFETCH;
+
+static PREFETCH *prefetches[PREFETCH_MAX];
+static int prefetchCount = 0;
+static pthread_mutex_t prefetchLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+prefetchFree(PREFETCH *prefetch)
+{
+  free(prefetch->data);
+  free(prefetch->filename);
+  free(prefetch);
+}
+
+static void *
+prefetchFile(void *arg)
+{
+  PREFETCH *prefetch = (PREFETCH *)arg;
+  size_t capacity = prefetch->size + 1;  /* the size when opened */
+  char *data = (char *)malloc(capacity);
+  size_t size = 0;
+  XML_Bool abandoned;
+
+  while (data != NULL) {
+    int n;
+    if (size == capacity) {
+      char *bigger = NULL;
+      if (capacity < PREFETCH_MAX_SIZE)
+        bigger = (char *)realloc(data, capacity *= 2);
+      if (bigger == NULL) {
+        free(data);
+        data = NULL;
+        break;
+      }
+      data = bigger;
+    }
+    n = (int)read(prefetch->fd, data + size, capacity - size);
+    if (n < 0) {
+      free(data);
+      data = NULL;
+      break;
+    }
+    if (n == 0)
+      break;
+    size += n;
+  }
+  close(prefetch->fd);
+  prefetch->data = data;
+  prefetch->size = size;
+  pthread_mutex_lock(&prefetchLock);
+  prefetch->finished = XML_TRUE;
+  abandoned = prefetch->abandoned;
+  pthread_mutex_unlock(&prefetchLock);
+  if (abandoned)
+    prefetchFree(prefetch);
+  return NULL;
+}
+
+static void XMLCALL
+prefetchEntity(XML_Parser UNUSED_P(parser),
+               const XML_Char *base,
+               const XML_Char *systemId,
+               const XML_Char *UNUSED_P(publicId))
+{
+  XML_Char *s;
+  const XML_Char *filename = resolveSystemId(base, systemId, &s);
+  PREFETCH *prefetch;
+  struct stat sb;
+  int fd;
+  int i;
+
+  for (i = 0; i < prefetchCount; i++)
+    if (tcscmp(prefetches[i]->filename, filename) == 0)
+      break;
+  if (i < prefetchCount || prefetchCount == PREFETCH_MAX) {
+    free(s);
+    return;
+  }
+  /* opening a FIFO for reading would wait for a writer */
+  fd = topen(filename, O_BINARY|O_RDONLY|O_NONBLOCK);
+  if (fd < 0) {
+    free(s);
+    return;
+  }
+  if (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode)
+      || sb.st_size > PREFETCH_MAX_SIZE
+      || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) < 0) {
+    close(fd);
+    free(s);
+    return;
+  }
+  prefetch = (PREFETCH *)malloc(sizeof(PREFETCH));
+  if (prefetch != NULL) {
+    prefetch->filename = (XML_Char *)malloc((tcslen(filename) + 1)
+                                            * sizeof(XML_Char));
+    if (prefetch->filename == NULL) {
+      free(prefetch);
+      prefetch = NULL;
+    }
+  }
+  if (prefetch != NULL) {
+    tcscpy(prefetch->filename, filename);
+    prefetch->fd = fd;
+    prefetch->joined = XML_FALSE;
+    prefetch->finished = XML_FALSE;
+    prefetch->abandoned = XML_FALSE;
+    prefetch->data = NULL;
+    prefetch->size = (size_t)sb.st_size;
+    if (pthread_create(&prefetch->thread, NULL, prefetchFile, prefetch)) {
+      free(prefetch->filename);
+      free(prefetch);
+      prefetch = NULL;
+    }
+    else
+      prefetches[prefetchCount++] = prefetch;
+  }
+  if (prefetch == NULL)
+    close(fd);
+  free(s);
+}
+
+/* Parses the entity from memory if it was prefetched; returns 1 if it
+   was parsed, 0 on error and -1 if it was not prefetched. */
+static int
+parsePrefetched(const XML_Char *filename, XML_Parser parser)
+{
+  int i;
+  for (i = 0; i < prefetchCount; i++) {
+    PREFETCH *prefetch = prefetches[i];
+    if (tcscmp(prefetch->filename, filename) != 0)
+      continue;
+    if (!prefetch->joined) {
+      pthread_join(prefetch->thread, NULL);
+      prefetch->joined = XML_TRUE;
+    }
+    /* compressed files are streamed */
+    if (prefetch->data == NULL
+        || (prefetch->size >= 2
+            && (unsigned char)prefetch->data[0] == 0x1F
+            && (unsigned char)prefetch->data[1] == 0x8B)
+        || (prefetch->size >= 4
+            && memcmp(prefetch->data, "\x28\xB5\x2F\xFD", 4) == 0))
+      return -1;
+    if (XML_Parse64(parser, prefetch->data, prefetch->size, 1)
+        == XML_STATUS_ERROR) {
+      reportError(parser, filename);
+      return 0;
+    }
+    return 1;
+  }
+  return -1;
+}
+
+static void
+prefetchClear(void)
+{
+  int i;
+  for (i = 0; i < prefetchCount; i++) {
+    PREFETCH *prefetch = prefetches[i];
+    if (!prefetch->joined) {
+      XML_Bool finished;
+      pthread_mutex_lock(&prefetchLock);
+      finished = prefetch->finished;
+      if (!finished)
+        prefetch->abandoned = XML_TRUE;
+      pthread_mutex_unlock(&prefetchLock);
+      if (!finished) {
+        pthread_detach(prefetch->thread);
+        continue;
+      }
+      pthread_join(prefetch->thread, NULL);
+    }
+    prefetchFree(prefetch);
+  }
+  prefetchCount = 0;
+}
+
+#else /* not HAVE_PTHREAD */
+
+static int
+parsePrefetched(const XML_Char *UNUSED_P(filename),
+                XML_Parser UNUSED_P(parser))
+{
+  return -1;
+}
+
+#endif /* not HAVE_PTHREAD */
+
 static int
 externalEntityRefFilemap(XML_Parser parser,
                          const XML_Char *context,
@@ -164,33 +421,364 @@ externalEntityRefFilemap(XML_Parser parser,
   XML_Char *s;
   const XML_Char *filename;
   XML_Parser entParser = XML_ExternalEntityParserCreate(parser, context, 0);
+#ifdef XML_UNICODE
   int filemapRes;
   PROCESS_ARGS args;
   args.retPtr = &result;
   args.parser = entParser;
+#endif
   filename = resolveSystemId(base, systemId, &s);
   XML_SetBase(entParser, filename);
-  filemapRes = filemap(filename, processFile, &args);
-  switch (filemapRes) {
-  case 0:
-    result = 0;
-    break;
-  case 2:
-    ftprintf(stderr, T("%s: file too large for memory-mapping")
-        T(", switching to streaming\n"), filename);
+  result = parsePrefetched(filename, entParser);
+  if (result < 0 && isCompressed(filename))
     result = processStream(filename, entParser);
-    break;
+  else if (result < 0) {
+#ifdef XML_UNICODE
+    filemapRes = filemap(filename, processFile, &args);
+    switch (filemapRes) {
+    case 0:
+      result = 0;
+      break;
+    case 2:
+      ftprintf(stderr, T("%s: file too large for memory-mapping")
+          T(", switching to streaming\n"), filename);
+      result = processStream(filename, entParser);
+      break;
+    }
+#else
+    result = parseFile(filename, entParser);
+#endif
   }
   free(s);
   XML_ParserFree(entParser);
   return result;
 }
 
+/* Input read from a file descriptor and, if it starts with the magic
+   bytes of gzip, decompressed on the way. */
+typedef struct {
+  int fd;
+  int error;                /* errno of a failed read, or 0 */
+  const XML_Char *message;  /* why the input is unusable, or NULL */
+  XML_Bool started;         /* the magic bytes have been looked at */
+  char magic[4];            /* the first bytes read, still to deliver */
+  int magicLen;
+#ifdef HAVE_ZLIB
+  XML_Bool gzip;
+  XML_Bool inMember;        /* inside a gzip member */
+  z_stream zs;
+  unsigned char *in;        /* compressed input */
+#endif
+} INPUT;
+
+#define GZIP_INPUT_SIZE (256*1024)
+
+static void
+inputInit(INPUT *input, int fd)
+{
+  input->fd = fd;
+  input->error = 0;
+  input->message = NULL;
+  input->started = XML_FALSE;
+  input->magicLen = 0;
+#ifdef HAVE_ZLIB
+  input->gzip = XML_FALSE;
+  input->in = NULL;
+#endif
+}
+
+static void
+inputClose(INPUT *input)
+{
+#ifdef HAVE_ZLIB
+  if (input->gzip)
+    inflateEnd(&input->zs);
+  free(input->in);
+#endif
+  (void)input;
+}
+
+/* Reads the first bytes to tell compressed from plain input. */
+static int
+inputStart(INPUT *input)
+{
+  input->started = XML_TRUE;
+  while (input->magicLen < (int)sizeof(input->magic)) {
+    const int n = (int)read(input->fd, input->magic + input->magicLen,
+                            sizeof(input->magic) - input->magicLen);
+    if (n < 0) {
+      input->error = errno;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    input->magicLen += n;
+  }
+  if (input->magicLen >= 4 && memcmp(input->magic, "\x28\xB5\x2F\xFD", 4) == 0) {
+    input->message = T("zstd-compressed input is not supported");
+    return -1;
+  }
+  if (input->magicLen >= 2 && memcmp(input->magic, "\x1F\x8B", 2) == 0) {
+#ifdef HAVE_ZLIB
+    input->in = (unsigned char *)malloc(GZIP_INPUT_SIZE);
+    if (input->in == NULL) {
+      input->message = T("out of memory");
+      return -1;
+    }
+    memset(&input->zs, 0, sizeof(input->zs));
+    /* 32 + 15: a gzip header, and the largest window */
+    if (inflateInit2(&input->zs, 32 + 15) != Z_OK) {
+      input->message = T("out of memory");
+      return -1;
+    }
+    input->gzip = XML_TRUE;
+    input->inMember = XML_FALSE;
+    memcpy(input->in, input->magic, input->magicLen);
+    input->zs.next_in = input->in;
+    input->zs.avail_in = (uInt)input->magicLen;
+    input->magicLen = 0;
+#else
+    input->message = T("gzip-compressed input is not supported");
+    return -1;
+#endif
+  }
+  return 0;
+}
+
+#ifdef HAVE_ZLIB
+/* Decompresses into buf until it is full or the input ends; gzip
+   members following each other are decompressed in turn. */
+static int
+inputInflate(INPUT *input, char *buf, int len)
+{
+  z_stream *zs = &input->zs;
+  zs->next_out = (Bytef *)buf;
+  zs->avail_out = (uInt)len;
+  while (zs->avail_out > 0) {
+    int rc;
+    if (zs->avail_in == 0) {
+      const int n = (int)read(input->fd, input->in, GZIP_INPUT_SIZE);
+      if (n < 0) {
+        input->error = errno;
+        return -1;
+      }
+      if (n == 0) {
+        if (input->inMember) {
+          input->message = T("unexpected end of compressed input");
+          return -1;
+        }
+        break;
+      }
+      zs->next_in = input->in;
+      zs->avail_in = (uInt)n;
+    }
+    if (!input->inMember) {
+      inflateReset(zs);
+      input->inMember = XML_TRUE;
+    }
+    rc = inflate(zs, Z_NO_FLUSH);
+    if (rc == Z_STREAM_END)
+      input->inMember = XML_FALSE;
+    else if (rc != Z_OK) {
+      input->message = T("invalid compressed input");
+      return -1;
+    }
+  }
+  return len - (int)zs->avail_out;
+}
+#endif /* HAVE_ZLIB */
+
+/* Reads up to len bytes of the input, decompressed if need be, into
+   buf; returns how many, 0 at the end of the input, or -1 on error. */
+static int
+inputRead(INPUT *input, char *buf, int len)
+{
+  int nread;
+  if (!input->started && inputStart(input) < 0)
+    return -1;
+#ifdef HAVE_ZLIB
+  if (input->gzip)
+    return inputInflate(input, buf, len);
+#endif
+  if (input->magicLen > 0) {
+    nread = input->magicLen < len ? input->magicLen : len;
+    memcpy(buf, input->magic, nread);
+    memmove(input->magic, input->magic + nread, input->magicLen - nread);
+    input->magicLen -= nread;
+    return nread;
+  }
+  nread = (int)read(input->fd, buf, len);
+  if (nread < 0)
+    input->error = errno;
+  return nread < 0 ? -1 : nread;
+}
+
+static void
+reportInputError(const INPUT *input, const XML_Char *name)
+{
+  if (input->message != NULL)
+    ftprintf(stderr, T("%s: %s\n"), name, input->message);
+  else {
+    errno = input->error;
+    tperror(name);
+  }
+}
+
+static int XMLCALL
+readStream(void *args, char *buf, int len)
+{
+#ifdef READ_SIZE
+  if (len > READ_SIZE)
+    len = READ_SIZE;
+#endif
+  return inputRead((INPUT *)args, buf, len);
+}
+
+#ifdef HAVE_PTHREAD
+
+/* A thread reads, and decompresses, the input ahead into a ring of
+   buffers that the parser takes in turn, so that waiting for input,
+   decompressing and parsing overlap.  XML_Parse64() parses each buffer
+   where it is, copying only a token left unfinished at its end, so a
+   buffer can be refilled as soon as it returns. */
+#define READ_AHEAD_BUFFERS 4
+#define READ_AHEAD_SIZE (1024*1024)
+
+typedef struct {
+  char *data;
+  int len;    /* bytes read, 0 at the end of the input, -1 on error */
+} READ_AHEAD_BUFFER;
+
+typedef struct {
+  INPUT *input;
+  pthread_mutex_t lock;
+  pthread_cond_t filled;
+  pthread_cond_t emptied;
+  READ_AHEAD_BUFFER buffers[READ_AHEAD_BUFFERS];
+  int next;   /* the buffer to parse next */
+  int count;  /* buffers read and not yet parsed */
+} READ_AHEAD;
+
+static void
+unlockMutex(void *mutex)
+{
+  pthread_mutex_unlock((pthread_mutex_t *)mutex);
+}
+
+/* Waits until the parser has emptied a buffer.  The wait is a
+   cancellation point, so it lives in a function of its own: the
+   cleanup handler setup may use setjmp(), which would clobber the
+   locals of a loop around it. */
+static void
+waitForEmptied(READ_AHEAD *ra)
+{
+  pthread_mutex_lock(&ra->lock);
+  pthread_cleanup_push(unlockMutex, &ra->lock);
+  while (ra->count == READ_AHEAD_BUFFERS)
+    pthread_cond_wait(&ra->emptied, &ra->lock);
+  pthread_cleanup_pop(1);
+}
+
+static void *
+readAhead(void *arg)
+{
+  READ_AHEAD *ra = (READ_AHEAD *)arg;
+  int i = 0;
+  for (;;) {
+    READ_AHEAD_BUFFER *buffer = &ra->buffers[i];
+    int len;
+    waitForEmptied(ra);
+#ifdef READ_SIZE
+    len = inputRead(ra->input, buffer->data, READ_SIZE);
+#else
+    len = inputRead(ra->input, buffer->data, READ_AHEAD_SIZE);
+#endif
+    buffer->len = len;
+    pthread_mutex_lock(&ra->lock);
+    ra->count++;
+    pthread_cond_signal(&ra->filled);
+    pthread_mutex_unlock(&ra->lock);
+    if (len <= 0)
+      return NULL;
+    i = (i + 1) % READ_AHEAD_BUFFERS;
+  }
+}
+
+/* Returns 1 if the input was parsed, 0 on error, and -1 if the
+   reader thread could not be started. */
+static int
+processStreamReadAhead(const XML_Char *name, INPUT *input, XML_Parser parser)
+{
+  READ_AHEAD ra;
+  pthread_t thread;
+  int ok = 1;
+  int i;
+
+  for (i = 0; i < READ_AHEAD_BUFFERS; i++) {
+    ra.buffers[i].data = (char *)malloc(READ_AHEAD_SIZE);
+    if (ra.buffers[i].data == NULL) {
+      while (i-- > 0)
+        free(ra.buffers[i].data);
+      return -1;
+    }
+  }
+  ra.input = input;
+  ra.next = 0;
+  ra.count = 0;
+  pthread_mutex_init(&ra.lock, NULL);
+  pthread_cond_init(&ra.filled, NULL);
+  pthread_cond_init(&ra.emptied, NULL);
+  if (pthread_create(&thread, NULL, readAhead, &ra) != 0)
+    ok = -1;
+  else {
+    for (;;) {
+      READ_AHEAD_BUFFER *buffer = &ra.buffers[ra.next];
+      pthread_mutex_lock(&ra.lock);
+      while (ra.count == 0)
+        pthread_cond_wait(&ra.filled, &ra.lock);
+      pthread_mutex_unlock(&ra.lock);
+      if (buffer->len < 0) {
+        reportInputError(input, name);
+        ok = 0;
+        break;
+      }
+      if (XML_Parse64(parser, buffer->data, (size_t)buffer->len,
+                      buffer->len == 0) == XML_STATUS_ERROR) {
+        reportError(parser, name);
+        ok = 0;
+        break;
+      }
+      if (buffer->len == 0)
+        break;
+      pthread_mutex_lock(&ra.lock);
+      ra.next = (ra.next + 1) % READ_AHEAD_BUFFERS;
+      ra.count--;
+      pthread_cond_signal(&ra.emptied);
+      pthread_mutex_unlock(&ra.lock);
+    }
+    /* the reader may be waiting for input that is no longer needed */
+    if (!ok)
+      pthread_cancel(thread);
+    pthread_join(thread, NULL);
+  }
+  pthread_cond_destroy(&ra.emptied);
+  pthread_cond_destroy(&ra.filled);
+  pthread_mutex_destroy(&ra.lock);
+  for (i = 0; i < READ_AHEAD_BUFFERS; i++)
+    free(ra.buffers[i].data);
+  return ok;
+}
+
+#endif /* HAVE_PTHREAD */
+
 static int
 processStream(const XML_Char *filename, XML_Parser parser)
 {
   /* passing NULL for filename means read intput from stdin */
+  const XML_Char *name = filename != NULL ? filename : T("STDIN");
+  INPUT input;
   int fd = 0;   /* 0 is the fileno for stdin */
+  int ok = -1;
 
   if (filename != NULL) {
     fd = topen(filename, O_BINARY|O_RDONLY);
@@ -199,36 +787,26 @@ processStream(const XML_Char *filename, XML_Parser parser)
       return 0;
     }
   }
-  for (;;) {
-    int nread;
-    char *buf = (char *)XML_GetBuffer(parser, READ_SIZE);
-    if (!buf) {
-      if (filename != NULL)
-        close(fd);
-      ftprintf(stderr, T("%s: out of memory\n"),
-               filename != NULL ? filename : T("xmlwf"));
-      return 0;
-    }
-    nread = read(fd, buf, READ_SIZE);
-    if (nread < 0) {
-      tperror(filename != NULL ? filename : T("STDIN"));
-      if (filename != NULL)
-        close(fd);
-      return 0;
-    }
-    if (XML_ParseBuffer(parser, nread, nread == 0) == XML_STATUS_ERROR) {
-        reportError(parser, filename != NULL ? filename : T("STDIN"));
-      if (filename != NULL)
-        close(fd);
-      return 0;
-    }
-    if (nread == 0) {
-      if (filename != NULL)
-        close(fd);
-      break;;
+  inputInit(&input, fd);
+#ifdef HAVE_PTHREAD
+  ok = processStreamReadAhead(name, &input, parser);
+#endif
+  if (ok < 0) {
+    /* the parser sizes the reads itself */
+    ok = 1;
+    if (XML_ParseFromReader(parser, readStream, &input)
+        == XML_STATUS_ERROR) {
+      if (XML_GetErrorCode(parser) == XML_ERROR_READ_FAILED)
+        reportInputError(&input, name);
+      else
+        reportError(parser, name);
+      ok = 0;
     }
   }
-  return 1;
+  inputClose(&input);
+  if (filename != NULL)
+    close(fd);
+  return ok;
 }
 
 static int
@@ -244,7 +822,9 @@ externalEntityRefStream(XML_Parser parser,
   XML_Parser entParser = XML_ExternalEntityParserCreate(parser, context, 0);
   filename = resolveSystemId(base, systemId, &s);
   XML_SetBase(entParser, filename);
-  ret = processStream(filename, entParser);
+  ret = parsePrefetched(filename, entParser);
+  if (ret < 0)
+    ret = processStream(filename, entParser);
   free(s);
   XML_ParserFree(entParser);
   return ret;
@@ -262,12 +842,18 @@ XML_ProcessFile(XML_Parser parser,
     exit(1);
   }
 
-  if (flags & XML_EXTERNAL_ENTITIES)
+  if (flags & XML_EXTERNAL_ENTITIES) {
       XML_SetExternalEntityRefHandler(parser,
                                       (flags & XML_MAP_FILE)
                                       ? externalEntityRefFilemap
                                       : externalEntityRefStream);
-  if (flags & XML_MAP_FILE) {
+#ifdef HAVE_PTHREAD
+      XML_SetExternalEntityPrefetchHandler(parser, prefetchEntity);
+#endif
+  }
+  /* compressed input can only be streamed */
+  if ((flags & XML_MAP_FILE) && !isCompressed(filename)) {
+#ifdef XML_UNICODE
     int filemapRes;
     PROCESS_ARGS args;
     args.retPtr = &result;
@@ -283,8 +869,14 @@ XML_ProcessFile(XML_Parser parser,
       result = processStream(filename, parser);
       break;
     }
+#else
+    result = parseFile(filename, parser);
+#endif
   }
   else
     result = processStream(filename, parser);
+#ifdef HAVE_PTHREAD
+  prefetchClear();
+#endif
   return result;
 }
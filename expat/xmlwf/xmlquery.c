@@ -0,0 +1,365 @@
+/*
+                            __  __            _
+                         ___\ \/ /_ __   __ _| |_
+                        / _ \\  /| '_ \ / _` | __|
+                       |  __//  \| |_) | (_| | |_
+                        \___/_/\_\ .__/ \__,_|\__|
+                                 |_| XML parser
+
+   Copyright (c) 1997-2000 Thai Open Source Software Center Ltd
+   Copyright (c) 2000-2017 Expat development team
+   Licensed under the MIT license:
+
+   Permission is  hereby granted,  free of charge,  to any  person obtaining
+   a  copy  of  this  software   and  associated  documentation  files  (the
+   "Software"),  to  deal in  the  Software  without restriction,  including
+   without  limitation the  rights  to use,  copy,  modify, merge,  publish,
+   distribute, sublicense, and/or sell copies of the Software, and to permit
+   persons  to whom  the Software  is  furnished to  do so,  subject to  the
+   following conditions:
+
+   The above copyright  notice and this permission notice  shall be included
+   in all copies or substantial portions of the Software.
+
+   THE  SOFTWARE  IS  PROVIDED  "AS  IS",  WITHOUT  WARRANTY  OF  ANY  KIND,
+   EXPRESS  OR IMPLIED,  INCLUDING  BUT  NOT LIMITED  TO  THE WARRANTIES  OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+   NO EVENT SHALL THE AUTHORS OR  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+   DAMAGES OR  OTHER LIABILITY, WHETHER  IN AN  ACTION OF CONTRACT,  TORT OR
+   OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+   USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "expat.h"
+#include "internal.h"  /* for UNUSED_P only */
+#include "xmlfile.h"
+#include "xmltchar.h"
+
+#ifdef _MSC_VER
+# include <crtdbg.h>
+#endif
+
+#ifdef XML_UNICODE
+# include <wchar.h>
+#endif
+
+/* Streaming query tool: evaluates a set of path patterns (see
+   XML_AddPathPattern) in one pass and prints one line per match,
+   "query<TAB>value" or with -r "query<TAB>start<TAB>end" giving the
+   byte range of the match in the document entity.  Matches are
+   printed when they complete, so nested matches come out innermost
+   first.
+*/
+
+#define NSSEP T('\001')
+
+typedef struct {
+  XML_Char *buf;
+  int len;
+  int size;
+  int open;             /* number of open matches of the query */
+} QueryText;
+
+typedef struct {
+  int id;
+  XML_Index start;      /* byte index of the start-tag */
+  int textStart;        /* length of the query text at the start-tag */
+} OpenMatch;
+
+typedef struct {
+  FILE *out;            /* NULL while benchmarking */
+  int ranges;
+  QueryText *texts;
+  OpenMatch *stack;
+  int depth;
+  int stackSize;
+} QueryState;
+
+static void
+outOfMemory(void)
+{
+  ftprintf(stderr, T("out of memory\n"));
+  exit(1);
+}
+
+static void
+printText(FILE *fp, const XML_Char *s, int len)
+{
+  for (; len > 0; --len, ++s)
+    puttc(*s, fp);
+}
+
+static void
+printRange(FILE *fp, int id, XML_Index start, XML_Index end)
+{
+  ftprintf(fp, T("%d\t%") T(XML_FMT_INT_MOD) T("d\t%")
+               T(XML_FMT_INT_MOD) T("d\n"), id, start, end);
+}
+
+static void XMLCALL
+queryStart(void *userData, int pathId, const XML_Char *UNUSED_P(name),
+           const XML_Char **UNUSED_P(atts))
+{
+  XML_Parser parser = (XML_Parser)userData;
+  QueryState *state = (QueryState *)XML_GetUserData(parser);
+  OpenMatch *match;
+
+  if (state->depth == state->stackSize) {
+    int newSize = state->stackSize ? state->stackSize * 2 : 16;
+    match = (OpenMatch *)realloc(state->stack, newSize * sizeof(OpenMatch));
+    if (!match)
+      outOfMemory();
+    state->stack = match;
+    state->stackSize = newSize;
+  }
+  match = &state->stack[state->depth++];
+  match->id = pathId;
+  match->start = XML_GetCurrentByteIndex(parser);
+  match->textStart = state->texts[pathId].len;
+  state->texts[pathId].open++;
+}
+
+static void XMLCALL
+queryEnd(void *userData, int pathId, const XML_Char *UNUSED_P(name))
+{
+  XML_Parser parser = (XML_Parser)userData;
+  QueryState *state = (QueryState *)XML_GetUserData(parser);
+  QueryText *text = &state->texts[pathId];
+  const OpenMatch *match = &state->stack[--state->depth];
+
+  if (state->out) {
+    if (state->ranges)
+      printRange(state->out, pathId, match->start,
+                 XML_GetCurrentByteIndex(parser)
+                 + XML_GetCurrentByteCount(parser));
+    else {
+      ftprintf(state->out, T("%d\t"), pathId);
+      printText(state->out, text->buf + match->textStart,
+                text->len - match->textStart);
+      puttc(T('\n'), state->out);
+    }
+  }
+  /* the text is shared with the enclosing matches of the query */
+  if (--text->open == 0)
+    text->len = 0;
+}
+
+static void XMLCALL
+queryCharacters(void *userData, int pathId, const XML_Char *s, int len)
+{
+  XML_Parser parser = (XML_Parser)userData;
+  QueryState *state = (QueryState *)XML_GetUserData(parser);
+  QueryText *text = &state->texts[pathId];
+
+  if (text->len + len > text->size) {
+    int newSize = text->size ? text->size : 64;
+    XML_Char *buf;
+    while (newSize < text->len + len)
+      newSize *= 2;
+    buf = (XML_Char *)realloc(text->buf, newSize * sizeof(XML_Char));
+    if (!buf)
+      outOfMemory();
+    text->buf = buf;
+    text->size = newSize;
+  }
+  memcpy(text->buf + text->len, s, len * sizeof(XML_Char));
+  text->len += len;
+}
+
+static void XMLCALL
+queryAttribute(void *userData, int pathId, const XML_Char *UNUSED_P(name),
+               const XML_Char *value)
+{
+  XML_Parser parser = (XML_Parser)userData;
+  QueryState *state = (QueryState *)XML_GetUserData(parser);
+
+  if (!state->out)
+    return;
+  if (state->ranges) {
+    XML_Index start = XML_GetCurrentByteIndex(parser);
+    printRange(state->out, pathId, start,
+               start + XML_GetCurrentByteCount(parser));
+  }
+  else {
+    ftprintf(state->out, T("%d\t"), pathId);
+    fputts(value, state->out);
+    puttc(T('\n'), state->out);
+  }
+}
+
+static void
+setHandlers(XML_Parser parser, QueryState *state)
+{
+  XML_SetUserData(parser, state);
+  XML_UseParserAsHandlerArg(parser);
+  XML_SetPathElementHandler(parser, queryStart, queryEnd);
+  if (!state->ranges)
+    XML_SetPathCharacterDataHandler(parser, queryCharacters);
+  XML_SetPathAttributeHandler(parser, queryAttribute);
+}
+
+static void
+usage(const XML_Char *prog, int rc)
+{
+  ftprintf(stderr,
+           T("usage: %s [-n] [-r] [-m] [-b loops] -q query [-q query ...] [file ...]\n"), prog);
+  exit(rc);
+}
+
+#if defined(__MINGW32__) && defined(XML_UNICODE)
+/* Silence warning about missing prototype */
+int wmain(int argc, XML_Char **argv);
+#endif
+
+int
+tmain(int argc, XML_Char **argv)
+{
+  int i, j, k;
+  const XML_Char **queries;
+  int nQueries = 0;
+  int useNamespaces = 0;
+  int loops = 0;
+  unsigned processFlags = 0;
+  int useStdin = 0;
+  int status = 0;
+  QueryState state;
+
+#ifdef _MSC_VER
+  _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF|_CRTDBG_LEAK_CHECK_DF);
+#endif
+
+  memset(&state, 0, sizeof(state));
+  queries = (const XML_Char **)malloc(argc * sizeof(XML_Char *));
+  if (!queries)
+    outOfMemory();
+  i = 1;
+  j = 0;
+  while (i < argc) {
+    if (j == 0) {
+      if (argv[i][0] != T('-'))
+        break;
+      if (argv[i][1] == T('-') && argv[i][2] == T('\0')) {
+        i++;
+        break;
+      }
+      j++;
+    }
+    switch (argv[i][j]) {
+    case T('n'):
+      useNamespaces = 1;
+      j++;
+      break;
+    case T('r'):
+      state.ranges = 1;
+      j++;
+      break;
+    case T('m'):
+      processFlags |= XML_MAP_FILE;
+      j++;
+      break;
+    case T('q'):
+    case T('b'):
+      {
+        const XML_Char option = argv[i][j];
+        const XML_Char *arg;
+        if (argv[i][j + 1] == T('\0')) {
+          if (++i == argc)
+            usage(argv[0], 2);
+          arg = argv[i];
+        }
+        else
+          arg = argv[i] + j + 1;
+        if (option == T('q'))
+          queries[nQueries++] = arg;
+        else {
+          for (loops = 0; *arg >= T('0') && *arg <= T('9'); arg++)
+            loops = loops * 10 + (*arg - T('0'));
+          if (*arg != T('\0') || loops <= 0)
+            usage(argv[0], 2);
+        }
+        i++;
+        j = 0;
+      }
+      break;
+    case T('h'):
+      usage(argv[0], 0);
+      return 0;
+    case T('\0'):
+      if (j > 1) {
+        i++;
+        j = 0;
+        break;
+      }
+      /* fall through */
+    default:
+      usage(argv[0], 2);
+    }
+  }
+  if (nQueries == 0)
+    usage(argv[0], 2);
+  if (i == argc) {
+    if (loops)
+      usage(argv[0], 2);
+    useStdin = 1;
+    processFlags &= ~XML_MAP_FILE;
+    i--;
+  }
+
+  state.texts = (QueryText *)calloc(nQueries, sizeof(QueryText));
+  if (!state.texts)
+    outOfMemory();
+  for (; i < argc; i++) {
+    const XML_Char *filename = useStdin ? NULL : argv[i];
+    XML_Parser parser;
+    clock_t start = 0;
+    int loop;
+
+    if (useNamespaces)
+      parser = XML_ParserCreateNS(NULL, NSSEP);
+    else
+      parser = XML_ParserCreate(NULL);
+    if (!parser) {
+      tperror(T("Could not instantiate parser"));
+      exit(1);
+    }
+    for (k = 0; k < nQueries; k++) {
+      if (XML_AddPathPattern(parser, queries[k]) != k) {
+        ftprintf(stderr, T("%s: invalid query\n"), queries[k]);
+        exit(2);
+      }
+    }
+    if (loops)
+      start = clock();
+    for (loop = 0; loop < (loops ? loops : 1); loop++) {
+      if (loop > 0)
+        XML_ParserReset(parser, NULL);
+      state.out = loops ? NULL : stdout;
+      state.depth = 0;
+      for (k = 0; k < nQueries; k++) {
+        state.texts[k].len = 0;
+        state.texts[k].open = 0;
+      }
+      setHandlers(parser, &state);
+      if (!XML_ProcessFile(parser, filename, processFlags)) {
+        status = 2;
+        break;
+      }
+    }
+    if (loops && loop == loops)
+      ftprintf(stderr, T("%s: %d loops, average time per loop: %f\n"),
+               filename, loops,
+               ((double)(clock() - start)) / CLOCKS_PER_SEC / loops);
+    XML_ParserFree(parser);
+  }
+  for (k = 0; k < nQueries; k++)
+    free(state.texts[k].buf);
+  free(state.texts);
+  free(state.stack);
+  free((void *)queries);
+  return status;
+}
@@ -42,6 +42,7 @@
 # define ftprintf fwprintf
 # define tfopen _wfopen
 # define fputts fputws
+# define fgetts fgetws
 # define puttc putwc
 # define tcscmp wcscmp
 # define tcscpy wcscpy
@@ -53,12 +54,14 @@
 # define topen _wopen
 # define tmain wmain
 # define tremove _wremove
+# define trename _wrename
 # define tchar wchar_t
 #else /* not XML_UNICODE */
 # define T(x) x
 # define ftprintf fprintf
 # define tfopen fopen
 # define fputts fputs
+# define fgetts fgets
 # define puttc putc
 # define tcscmp strcmp
 # define tcscpy strcpy
@@ -70,5 +73,6 @@
 # define topen open
 # define tmain main
 # define tremove remove
+# define trename rename
 # define tchar char
 #endif /* not XML_UNICODE */
@@ -30,6 +30,12 @@
    USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#ifdef _WIN32
+#include "winconfig.h"
+#elif defined(HAVE_EXPAT_CONFIG_H)
+#include <expat_config.h>
+#endif /* ndef _WIN32 */
+
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,6 +52,16 @@
 # include <crtdbg.h>
 #endif
 
+#ifdef HAVE_FORK
+# include <errno.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <signal.h>
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
 #ifdef XML_UNICODE
 # include <wchar.h>
 #endif
@@ -892,10 +908,739 @@ static void
 usage(const XML_Char *prog, int rc)
 {
   ftprintf(stderr,
-           T("usage: %s [-s] [-n] [-p] [-x] [-e encoding] [-w] [-d output-dir] [-c] [-m] [-r] [-t] [-N] [file ...]\n"), prog);
+           T("usage: %s [-s] [-n] [-p] [-x] [-e encoding] [-w] [-d output-dir] [-c] [-m] [-r] [-t] [-N] [-j jobs] [-l] [file ...]\n"), prog);
   exit(rc);
 }
 
+/* Options applying to every file */
+typedef struct {
+  const XML_Char *outputDir;
+  const XML_Char *encoding;
+  unsigned processFlags;
+  int windowsCodePages;
+  int outputType;
+  int useNamespaces;
+  int requireStandalone;
+  int requiresNotations;
+  enum XML_ParamEntityParsing paramEntityParsing;
+  int useStdin;
+} XmlwfOptions;
+
+/* The names of the files to process: those on the command line, then
+   with -l those read from standard input, one per line. */
+typedef struct {
+  XML_Char **argv;
+  int argc;
+  int i;
+  int readList;
+  XML_Char *line;
+  size_t lineSize;
+} FileList;
+
+static const XML_Char *
+nextFile(FileList *files)
+{
+  if (files->i < files->argc)
+    return files->argv[files->i++];
+  while (files->readList) {
+    size_t len = 0;
+    for (;;) {
+      if (files->lineSize - len < 2) {
+        size_t size = files->lineSize ? 2 * files->lineSize : 256;
+        XML_Char *line = (XML_Char *)realloc(files->line,
+                                             size * sizeof(XML_Char));
+        if (!line) {
+          ftprintf(stderr, T("out of memory\n"));
+          exit(1);
+        }
+        files->line = line;
+        files->lineSize = size;
+      }
+      if (!fgetts(files->line + len, (int)(files->lineSize - len), stdin)) {
+        files->readList = 0;
+        break;
+      }
+      len += tcslen(files->line + len);
+      if (files->line[len - 1] == T('\n'))
+        break;
+    }
+    while (len > 0 && (files->line[len - 1] == T('\n')
+                       || files->line[len - 1] == T('\r')))
+      len--;
+    if (len > 0) {
+      files->line[len] = T('\0');
+      return files->line;
+    }
+  }
+  return NULL;
+}
+
+/* Returns the name of the file the output for file goes to. */
+static XML_Char *
+outputName(const XmlwfOptions *options, const XML_Char *file)
+{
+  XML_Char *outName;
+  const XML_Char * delim = T("/");
+  if (!options->useStdin) {
+    /* Jump after last (back)slash */
+    const XML_Char * lastDelim = tcsrchr(file, delim[0]);
+    if (lastDelim)
+      file = lastDelim + 1;
+#if defined(_WIN32)
+    else {
+      const XML_Char * winDelim = T("\\");
+      lastDelim = tcsrchr(file, winDelim[0]);
+      if (lastDelim) {
+        file = lastDelim + 1;
+        delim = winDelim;
+      }
+    }
+#endif
+  }
+  else
+    file = T("STDIN");
+  outName = (XML_Char *)malloc((tcslen(options->outputDir) + tcslen(file) + 2)
+                   * sizeof(XML_Char));
+  tcscpy(outName, options->outputDir);
+  tcscat(outName, delim);
+  tcscat(outName, file);
+  return outName;
+}
+
+static XML_Parser
+createParser(const XmlwfOptions *options)
+{
+  XML_Parser parser;
+  if (options->useNamespaces)
+    parser = XML_ParserCreateNS(options->encoding, NSSEP);
+  else
+    parser = XML_ParserCreate(options->encoding);
+
+  if (! parser) {
+    tperror(T("Could not instantiate parser"));
+    exit(1);
+  }
+  return parser;
+}
+
+/* Checks one file with a new or reset parser, writing its output if
+   asked to, to tempName instead if that is not NULL; exits with status
+   2 if the file is not well-formed and output is written. */
+static void
+processFile(XML_Parser parser, const XmlwfOptions *options,
+            XmlwfUserData *userData, const XML_Char *file,
+            const XML_Char *tempName)
+{
+  XML_Char *outName = 0;
+  int result;
+
+  if (options->requireStandalone)
+    XML_SetNotStandaloneHandler(parser, notStandalone);
+  XML_SetParamEntityParsing(parser, options->paramEntityParsing);
+  if (options->outputType == 't') {
+    /* This is for doing timings; this gives a more realistic estimate of
+       the parsing time. */
+    XML_SetElementHandler(parser, nopStartElement, nopEndElement);
+    XML_SetCharacterDataHandler(parser, nopCharacterData);
+    XML_SetProcessingInstructionHandler(parser, nopProcessingInstruction);
+  }
+  else if (options->outputDir) {
+    outName = outputName(options, file);
+    userData->fp = tfopen(tempName ? tempName : outName, T("wb"));
+    if (!userData->fp) {
+      tperror(outName);
+      exit(1);
+    }
+    setvbuf(userData->fp, NULL, _IOFBF, 16384);
+#ifdef XML_UNICODE
+    puttc(0xFEFF, userData->fp);
+#endif
+    XML_SetUserData(parser, userData);
+    switch (options->outputType) {
+    case 'm':
+      XML_UseParserAsHandlerArg(parser);
+      XML_SetElementHandler(parser, metaStartElement, metaEndElement);
+      XML_SetProcessingInstructionHandler(parser, metaProcessingInstruction);
+      XML_SetCommentHandler(parser, metaComment);
+      XML_SetCdataSectionHandler(parser, metaStartCdataSection,
+                                 metaEndCdataSection);
+      XML_SetCharacterDataHandler(parser, metaCharacterData);
+      XML_SetDoctypeDeclHandler(parser, metaStartDoctypeDecl,
+                                metaEndDoctypeDecl);
+      XML_SetEntityDeclHandler(parser, metaEntityDecl);
+      XML_SetNotationDeclHandler(parser, metaNotationDecl);
+      XML_SetNamespaceDeclHandler(parser, metaStartNamespaceDecl,
+                                  metaEndNamespaceDecl);
+      metaStartDocument(parser);
+      break;
+    case 'c':
+      XML_UseParserAsHandlerArg(parser);
+      XML_SetDefaultHandler(parser, markup);
+      XML_SetElementHandler(parser, defaultStartElement, defaultEndElement);
+      XML_SetCharacterDataHandler(parser, defaultCharacterData);
+      XML_SetProcessingInstructionHandler(parser,
+                                          defaultProcessingInstruction);
+      break;
+    default:
+      if (options->useNamespaces)
+        XML_SetElementHandler(parser, startElementNS, endElementNS);
+      else
+        XML_SetElementHandler(parser, startElement, endElement);
+      XML_SetCharacterDataHandler(parser, characterData);
+#ifndef W3C14N
+      XML_SetProcessingInstructionHandler(parser, processingInstruction);
+      if (options->requiresNotations) {
+        XML_SetDoctypeDeclHandler(parser, startDoctypeDecl, endDoctypeDecl);
+        XML_SetNotationDeclHandler(parser, notationDecl);
+      }
+#endif /* not W3C14N */
+      break;
+    }
+  }
+  if (options->windowsCodePages)
+    XML_SetUnknownEncodingHandler(parser, unknownEncoding, 0);
+  result = XML_ProcessFile(parser, options->useStdin ? NULL : file,
+                           options->processFlags);
+  if (options->outputDir) {
+    if (options->outputType == 'm')
+      metaEndDocument(parser);
+    fclose(userData->fp);
+    if (!result) {
+      tremove(tempName ? tempName : outName);
+      exit(2);
+    }
+    free(outName);
+  }
+}
+
+/* Processes the files one after another with one parser, reset in
+   between. */
+static void
+processFiles(const XmlwfOptions *options, FileList *files)
+{
+  XmlwfUserData userData = { NULL, NULL, NULL };
+  XML_Parser parser = createParser(options);
+  const XML_Char *file;
+  int n;
+
+  for (n = 0; (file = nextFile(files)) != NULL; n++) {
+    if (n > 0 && !XML_ParserReset(parser, options->encoding)) {
+      tperror(T("Could not reset parser"));
+      exit(1);
+    }
+    processFile(parser, options, &userData, file, NULL);
+  }
+  XML_ParserFree(parser);
+}
+
+#ifdef HAVE_FORK
+
+/* With -j, worker processes check the files, each reusing one parser.
+   A worker captures what it writes to stdout and stderr for a file in
+   temporary files and passes it on with the result, and the output is
+   written in the order of the files, as if they had been processed one
+   after another; processes rather than threads, as the handlers and
+   error reporting write to the standard streams directly.  Output
+   files are written under temporary names and renamed in the same
+   order, so that files with the same output name cannot get in each
+   other's way.  When a file fails with output written, the files after
+   it are dropped, their output removed, and xmlwf exits as it would
+   have at that file. */
+
+/* Jobs handed out but not yet written out, per worker */
+#define JOBS_PER_WORKER 8
+
+typedef struct {
+  size_t index;
+  int exited;     /* the worker exited while processing the file */
+  size_t outLen;  /* followed by what the worker wrote to stdout */
+  size_t errLen;  /* and to stderr */
+} WORKER_RESULT;
+
+typedef struct {
+  XML_Char *name;
+  XML_Char *tempName;  /* of its output file, or NULL */
+  int state;      /* JOB_FREE, JOB_RUNNING or JOB_DONE */
+  int exitCode;   /* -1 unless the worker exited */
+  char *out;
+  size_t outLen;
+  char *err;
+  size_t errLen;
+} JOB;
+
+enum { JOB_FREE, JOB_RUNNING, JOB_DONE };
+
+typedef struct {
+  pid_t pid;
+  int jobFd;      /* job indices and file names are written here */
+  int resultFd;   /* WORKER_RESULTs are read from here */
+  int job;        /* the slot of the job it works on, or -1 */
+} WORKER;
+
+/* The job a worker process is working on, for reporting an exit() */
+static int workerResultFd = -1;
+static size_t workerJob;
+static int workerBusy = 0;
+
+/* Set before the workers are started */
+static unsigned long parentPid;
+
+/* Returns the temporary name of the output for the file with the
+   given index, the output name with the process and index appended,
+   or NULL if no output files are written. */
+static XML_Char *
+tempOutputName(const XmlwfOptions *options, const XML_Char *file,
+               size_t index)
+{
+  XML_Char *outName;
+  XML_Char *tempName;
+  XML_Char digits[2 * 3 * sizeof(unsigned long) + 4];
+  XML_Char *p = digits + sizeof(digits) / sizeof(XML_Char);
+  unsigned long n = (unsigned long)index;
+  size_t len;
+  if (!options->outputDir || options->outputType == 't')
+    return NULL;
+  /* ".pid.index", written backwards */
+  *--p = T('\0');
+  do
+    *--p = (XML_Char)(T('0') + n % 10);
+  while ((n /= 10) != 0);
+  *--p = T('.');
+  n = parentPid;
+  do
+    *--p = (XML_Char)(T('0') + n % 10);
+  while ((n /= 10) != 0);
+  *--p = T('.');
+  outName = outputName(options, file);
+  len = tcslen(outName);
+  tempName = (XML_Char *)realloc(outName,
+                                 (len + tcslen(p) + 1) * sizeof(XML_Char));
+  if (!tempName) {
+    ftprintf(stderr, T("out of memory\n"));
+    exit(1);
+  }
+  tcscpy(tempName + len, p);
+  return tempName;
+}
+
+static int
+writeAll(int fd, const void *buf, size_t len)
+{
+  const char *p = (const char *)buf;
+  while (len > 0) {
+    const ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return 0;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 1;
+}
+
+/* Returns 1 if all of buf was read, 0 at the end of input */
+static int
+readAll(int fd, void *buf, size_t len)
+{
+  char *p = (char *)buf;
+  while (len > 0) {
+    const ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return 0;
+    p += n;
+    len -= (size_t)n;
+  }
+  return 1;
+}
+
+static char *
+readCapture(int fd, size_t len)
+{
+  char *buf = (char *)malloc(len ? len : 1);
+  if (buf && len && pread(fd, buf, len, 0) != (ssize_t)len) {
+    free(buf);
+    buf = NULL;
+  }
+  return buf;
+}
+
+static void
+sendResult(int exited)
+{
+  WORKER_RESULT result;
+  off_t outLen, errLen;
+  char *out, *err;
+  fflush(stdout);
+  fflush(stderr);
+  outLen = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+  errLen = lseek(STDERR_FILENO, 0, SEEK_CUR);
+  out = readCapture(STDOUT_FILENO, (size_t)outLen);
+  err = readCapture(STDERR_FILENO, (size_t)errLen);
+  if (outLen < 0 || errLen < 0 || !out || !err)
+    _exit(1);
+  result.index = workerJob;
+  result.exited = exited;
+  result.outLen = (size_t)outLen;
+  result.errLen = (size_t)errLen;
+  if (!writeAll(workerResultFd, &result, sizeof(result))
+      || !writeAll(workerResultFd, out, result.outLen)
+      || !writeAll(workerResultFd, err, result.errLen))
+    _exit(1);
+  free(out);
+  free(err);
+}
+
+static void
+workerExit(void)
+{
+  if (workerBusy) {
+    workerBusy = 0;
+    sendResult(1);
+  }
+}
+
+static void
+runWorker(const XmlwfOptions *options, int jobFd, int resultFd)
+{
+  XmlwfUserData userData = { NULL, NULL, NULL };
+  XML_Parser parser = NULL;
+  XML_Char *tempName;
+  FILE *out = tmpfile();
+  FILE *err = tmpfile();
+  XML_Char *name = NULL;
+  size_t nameSize = 0;
+
+  /* Standard input may hold the list of files, buffered by the parent;
+     exiting with it open could move the parent's position in it. */
+  const int devNull = open("/dev/null", O_RDONLY);
+
+  if (!out || !err || devNull < 0
+      || dup2(devNull, STDIN_FILENO) < 0
+      || dup2(fileno(out), STDOUT_FILENO) < 0
+      || dup2(fileno(err), STDERR_FILENO) < 0)
+    _exit(1);
+  close(devNull);
+  workerResultFd = resultFd;
+  atexit(workerExit);
+  for (;;) {
+    size_t header[2];  /* index, length of the name */
+    if (!readAll(jobFd, header, sizeof(header)))
+      break;
+    if (header[1] >= nameSize) {
+      nameSize = header[1] + 1;
+      free(name);
+      name = (XML_Char *)malloc(nameSize * sizeof(XML_Char));
+      if (!name)
+        _exit(1);
+    }
+    if (!readAll(jobFd, name, header[1] * sizeof(XML_Char)))
+      _exit(1);
+    name[header[1]] = T('\0');
+    if (ftruncate(STDOUT_FILENO, 0) || ftruncate(STDERR_FILENO, 0)
+        || lseek(STDOUT_FILENO, 0, SEEK_SET)
+        || lseek(STDERR_FILENO, 0, SEEK_SET))
+      _exit(1);
+    workerJob = header[0];
+    workerBusy = 1;
+    if (!parser)
+      parser = createParser(options);
+    else if (!XML_ParserReset(parser, options->encoding)) {
+      tperror(T("Could not reset parser"));
+      exit(1);
+    }
+    tempName = tempOutputName(options, name, workerJob);
+    processFile(parser, options, &userData, name, tempName);
+    free(tempName);
+    workerBusy = 0;
+    sendResult(0);
+  }
+  if (parser)
+    XML_ParserFree(parser);
+  free(name);
+  exit(0);
+}
+
+static int
+startWorker(WORKER *worker, const XmlwfOptions *options,
+            WORKER *workers, int nWorkers)
+{
+  int jobPipe[2], resultPipe[2];
+  if (pipe(jobPipe))
+    return 0;
+  if (pipe(resultPipe)) {
+    close(jobPipe[0]);
+    close(jobPipe[1]);
+    return 0;
+  }
+  fflush(stdout);
+  fflush(stderr);
+  worker->pid = fork();
+  if (worker->pid == 0) {
+    int i;
+    /* the other workers' pipes would keep them from seeing the end */
+    for (i = 0; i < nWorkers; i++) {
+      close(workers[i].jobFd);
+      close(workers[i].resultFd);
+    }
+    close(jobPipe[1]);
+    close(resultPipe[0]);
+    runWorker(options, jobPipe[0], resultPipe[1]);
+  }
+  close(jobPipe[0]);
+  close(resultPipe[1]);
+  if (worker->pid < 0) {
+    close(jobPipe[1]);
+    close(resultPipe[0]);
+    return 0;
+  }
+  worker->jobFd = jobPipe[1];
+  worker->resultFd = resultPipe[0];
+  worker->job = -1;
+  return 1;
+}
+
+/* Stops the workers, and removes the output of the files from the
+   one at which processing stops, which has not been renamed yet. */
+static void
+stopWorkers(WORKER *workers, int nWorkers, JOB *jobs, int nJobs,
+            int failed)
+{
+  int i;
+  for (i = 0; i < nWorkers; i++) {
+    if (failed >= 0 && workers[i].job >= 0)
+      kill(workers[i].pid, SIGKILL);
+    close(workers[i].jobFd);
+    close(workers[i].resultFd);
+  }
+  for (i = 0; i < nWorkers; i++)
+    waitpid(workers[i].pid, NULL, 0);
+  if (failed < 0)
+    return;
+  for (i = 0; i < nJobs; i++) {
+    if ((i == failed || jobs[i].state != JOB_FREE) && jobs[i].tempName)
+      tremove(jobs[i].tempName);
+  }
+}
+
+/* Gives the output of a finished file its name; returns 0 if that
+   fails. */
+static int
+renameOutput(const XmlwfOptions *options, JOB *job)
+{
+  XML_Char *outName;
+  int ok = 1;
+  if (!job->tempName)
+    return 1;
+  outName = outputName(options, job->name);
+  if (trename(job->tempName, outName)) {
+    tperror(outName);
+    ok = 0;
+  }
+  free(outName);
+  return ok;
+}
+
+/* Reads a result from a worker; returns 0 if the worker has gone. */
+static int
+readResult(WORKER *worker, JOB *jobs)
+{
+  WORKER_RESULT result;
+  JOB *job = &jobs[worker->job];
+  if (!readAll(worker->resultFd, &result, sizeof(result)))
+    result.exited = -1;
+  else {
+    job->outLen = result.outLen;
+    job->errLen = result.errLen;
+    job->out = (char *)malloc(result.outLen ? result.outLen : 1);
+    job->err = (char *)malloc(result.errLen ? result.errLen : 1);
+    if (!job->out || !job->err) {
+      ftprintf(stderr, T("out of memory\n"));
+      exit(1);
+    }
+    if (!readAll(worker->resultFd, job->out, result.outLen)
+        || !readAll(worker->resultFd, job->err, result.errLen))
+      result.exited = -1;
+  }
+  job->state = JOB_DONE;
+  job->exitCode = -1;
+  worker->job = -1;
+  if (result.exited) {
+    int status;
+    waitpid(worker->pid, &status, 0);
+    if (WIFEXITED(status))
+      job->exitCode = WEXITSTATUS(status);
+    else {
+      ftprintf(stderr, T("%s: worker terminated by signal %d\n"),
+               job->name, WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+      job->exitCode = 1;
+    }
+    return 0;
+  }
+  return 1;
+}
+
+/* Processes the files in nWorkers worker processes; returns 0 if no
+   worker could be started. */
+static int
+processFilesInParallel(const XmlwfOptions *options, FileList *files,
+                       int nWorkers)
+{
+  WORKER *workers;
+  JOB *jobs;
+  struct pollfd *fds;
+  int nJobs;
+  size_t nextIndex = 0;  /* of the next file to hand out */
+  size_t writeIndex = 0; /* of the next file to write the output of */
+  int more = 1;
+  int i;
+
+  workers = (WORKER *)malloc(nWorkers * sizeof(WORKER));
+  fds = (struct pollfd *)malloc(nWorkers * sizeof(struct pollfd));
+  nJobs = nWorkers * JOBS_PER_WORKER;
+  jobs = (JOB *)calloc(nJobs, sizeof(JOB));
+  if (!workers || !fds || !jobs) {
+    free(workers);
+    free(fds);
+    free(jobs);
+    return 0;
+  }
+  parentPid = (unsigned long)getpid();
+  for (i = 0; i < nWorkers; i++)
+    if (!startWorker(&workers[i], options, workers, i))
+      break;
+  nWorkers = i;
+  if (nWorkers == 0) {
+    free(workers);
+    free(fds);
+    free(jobs);
+    return 0;
+  }
+
+  for (;;) {
+    int busy = 0;
+    /* hand out files to idle workers */
+    for (i = 0; i < nWorkers; i++) {
+      JOB *job = &jobs[nextIndex % nJobs];
+      const XML_Char *file;
+      size_t header[2];
+      if (workers[i].job >= 0)
+        continue;
+      if (!more || job->state != JOB_FREE)
+        break;
+      file = nextFile(files);
+      if (!file) {
+        more = 0;
+        break;
+      }
+      header[0] = nextIndex;
+      header[1] = tcslen(file);
+      job->name = (XML_Char *)malloc((header[1] + 1) * sizeof(XML_Char));
+      if (!job->name) {
+        ftprintf(stderr, T("out of memory\n"));
+        exit(1);
+      }
+      tcscpy(job->name, file);
+      job->tempName = tempOutputName(options, file, nextIndex);
+      job->state = JOB_RUNNING;
+      workers[i].job = (int)(nextIndex % nJobs);
+      nextIndex++;
+      if (!writeAll(workers[i].jobFd, header, sizeof(header))
+          || !writeAll(workers[i].jobFd, file,
+                       header[1] * sizeof(XML_Char))) {
+        /* the worker has gone; its result tells how */
+        continue;
+      }
+    }
+    for (i = 0; i < nWorkers; i++) {
+      if (workers[i].job >= 0) {
+        fds[busy].fd = workers[i].resultFd;
+        fds[busy].events = POLLIN;
+        busy++;
+      }
+    }
+    if (busy == 0)
+      break;
+    if (poll(fds, busy, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      tperror(T("poll"));
+      exit(1);
+    }
+    for (i = 0; i < nWorkers; i++) {
+      int j;
+      if (workers[i].job < 0)
+        continue;
+      for (j = 0; j < busy && fds[j].fd != workers[i].resultFd; j++)
+        ;
+      if (j == busy || !fds[j].revents)
+        continue;
+      if (!readResult(&workers[i], jobs)) {
+        /* the worker exited; what the file it worked on does to xmlwf
+           happens once its output is written */
+        workers[i].pid = -1;
+      }
+    }
+    /* write out the output of finished files in order */
+    for (;;) {
+      JOB *job = &jobs[writeIndex % nJobs];
+      if (job->state != JOB_DONE)
+        break;
+      fflush(stdout);
+      fwrite(job->out, 1, job->outLen, stdout);
+      fflush(stdout);
+      fwrite(job->err, 1, job->errLen, stderr);
+      fflush(stderr);
+      free(job->out);
+      free(job->err);
+      job->state = JOB_FREE;
+      if (job->exitCode < 0 && !renameOutput(options, job))
+        job->exitCode = 1;
+      if (job->exitCode >= 0) {
+        int exitCode = job->exitCode;
+        int k = 0;
+        /* as one after another, the output of a file that is not
+           well-formed also replaces that of an earlier one */
+        if (exitCode == 2 && job->tempName) {
+          XML_Char *outName = outputName(options, job->name);
+          tremove(outName);
+          free(outName);
+        }
+        for (i = 0; i < nWorkers; i++)
+          if (workers[i].pid > 0)
+            workers[k++] = workers[i];
+        stopWorkers(workers, k, jobs, nJobs, (int)(writeIndex % nJobs));
+        exit(exitCode);
+      }
+      free(job->name);
+      free(job->tempName);
+      writeIndex++;
+    }
+    /* replace workers that have exited */
+    for (i = 0; i < nWorkers; i++) {
+      if (workers[i].pid < 0) {
+        close(workers[i].jobFd);
+        close(workers[i].resultFd);
+        workers[i].jobFd = workers[i].resultFd = -1;
+        if (!startWorker(&workers[i], options, workers, nWorkers)) {
+          tperror(T("Could not start worker"));
+          exit(1);
+        }
+      }
+    }
+  }
+  stopWorkers(workers, nWorkers, jobs, nJobs, -1);
+  free(workers);
+  free(fds);
+  free(jobs);
+  return 1;
+}
+
+#endif /* HAVE_FORK */
+
 #if defined(__MINGW32__) && defined(XML_UNICODE)
 /* Silence warning about missing prototype */
 int wmain(int argc, XML_Char **argv);
@@ -905,23 +1650,28 @@ int
 tmain(int argc, XML_Char **argv)
 {
   int i, j;
-  const XML_Char *outputDir = NULL;
-  const XML_Char *encoding = NULL;
-  unsigned processFlags = XML_MAP_FILE;
-  int windowsCodePages = 0;
-  int outputType = 0;
-  int useNamespaces = 0;
-  int requireStandalone = 0;
-  int requiresNotations = 0;
-  enum XML_ParamEntityParsing paramEntityParsing = 
-    XML_PARAM_ENTITY_PARSING_NEVER;
-  int useStdin = 0;
-  XmlwfUserData userData = { NULL, NULL, NULL };
+  XmlwfOptions options;
+  FileList files;
+  int nWorkers = 1;
 
 #ifdef _MSC_VER
   _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF|_CRTDBG_LEAK_CHECK_DF);
 #endif
 
+  options.outputDir = NULL;
+  options.encoding = NULL;
+  options.processFlags = XML_MAP_FILE;
+  options.windowsCodePages = 0;
+  options.outputType = 0;
+  options.useNamespaces = 0;
+  options.requireStandalone = 0;
+  options.requiresNotations = 0;
+  options.paramEntityParsing = XML_PARAM_ENTITY_PARSING_NEVER;
+  options.useStdin = 0;
+  files.readList = 0;
+  files.line = NULL;
+  files.lineSize = 0;
+
   i = 1;
   j = 0;
   while (i < argc) {
@@ -936,53 +1686,57 @@ tmain(int argc, XML_Char **argv)
     }
     switch (argv[i][j]) {
     case T('r'):
-      processFlags &= ~XML_MAP_FILE;
+      options.processFlags &= ~XML_MAP_FILE;
       j++;
       break;
     case T('s'):
-      requireStandalone = 1;
+      options.requireStandalone = 1;
       j++;
       break;
     case T('n'):
-      useNamespaces = 1;
+      options.useNamespaces = 1;
       j++;
       break;
     case T('p'):
-      paramEntityParsing = XML_PARAM_ENTITY_PARSING_ALWAYS;
+      options.paramEntityParsing = XML_PARAM_ENTITY_PARSING_ALWAYS;
       /* fall through */
     case T('x'):
-      processFlags |= XML_EXTERNAL_ENTITIES;
+      options.processFlags |= XML_EXTERNAL_ENTITIES;
       j++;
       break;
     case T('w'):
-      windowsCodePages = 1;
+      options.windowsCodePages = 1;
       j++;
       break;
     case T('m'):
-      outputType = 'm';
+      options.outputType = 'm';
       j++;
       break;
     case T('c'):
-      outputType = 'c';
-      useNamespaces = 0;
+      options.outputType = 'c';
+      options.useNamespaces = 0;
       j++;
       break;
     case T('t'):
-      outputType = 't';
+      options.outputType = 't';
       j++;
       break;
     case T('N'):
-      requiresNotations = 1;
+      options.requiresNotations = 1;
+      j++;
+      break;
+    case T('l'):
+      files.readList = 1;
       j++;
       break;
     case T('d'):
       if (argv[i][j + 1] == T('\0')) {
         if (++i == argc)
           usage(argv[0], 2);
-        outputDir = argv[i];
+        options.outputDir = argv[i];
       }
       else
-        outputDir = argv[i] + j + 1;
+        options.outputDir = argv[i] + j + 1;
       i++;
       j = 0;
       break;
@@ -990,10 +1744,32 @@ tmain(int argc, XML_Char **argv)
       if (argv[i][j + 1] == T('\0')) {
         if (++i == argc)
           usage(argv[0], 2);
-        encoding = argv[i];
+        options.encoding = argv[i];
       }
       else
-        encoding = argv[i] + j + 1;
+        options.encoding = argv[i] + j + 1;
+      i++;
+      j = 0;
+      break;
+    case T('j'):
+      {
+        const XML_Char *s;
+        if (argv[i][j + 1] == T('\0')) {
+          if (++i == argc)
+            usage(argv[0], 2);
+          s = argv[i];
+        }
+        else
+          s = argv[i] + j + 1;
+        nWorkers = 0;
+        for (; *s; s++) {
+          if (*s < T('0') || *s > T('9') || nWorkers > 9999)
+            usage(argv[0], 2);
+          nWorkers = 10 * nWorkers + (*s - T('0'));
+        }
+        if (nWorkers < 1)
+          usage(argv[0], 2);
+      }
       i++;
       j = 0;
       break;
@@ -1014,125 +1790,25 @@ tmain(int argc, XML_Char **argv)
       usage(argv[0], 2);
     }
   }
-  if (i == argc) {
-    useStdin = 1;
-    processFlags &= ~XML_MAP_FILE;
-    i--;
+  if (options.outputType == 't')
+    options.outputDir = 0;
+  files.argv = argv;
+  files.argc = argc;
+  files.i = i;
+  if (i == argc && !files.readList) {
+    /* the document is read from standard input */
+    options.useStdin = 1;
+    options.processFlags &= ~XML_MAP_FILE;
+    files.i--;
+    nWorkers = 1;
   }
-  for (; i < argc; i++) {
-    XML_Char *outName = 0;
-    int result;
-    XML_Parser parser;
-    if (useNamespaces)
-      parser = XML_ParserCreateNS(encoding, NSSEP);
-    else
-      parser = XML_ParserCreate(encoding);
-
-    if (! parser) {
-      tperror(T("Could not instantiate parser"));
-      exit(1);
-    }
-
-    if (requireStandalone)
-      XML_SetNotStandaloneHandler(parser, notStandalone);
-    XML_SetParamEntityParsing(parser, paramEntityParsing);
-    if (outputType == 't') {
-      /* This is for doing timings; this gives a more realistic estimate of
-         the parsing time. */
-      outputDir = 0;
-      XML_SetElementHandler(parser, nopStartElement, nopEndElement);
-      XML_SetCharacterDataHandler(parser, nopCharacterData);
-      XML_SetProcessingInstructionHandler(parser, nopProcessingInstruction);
-    }
-    else if (outputDir) {
-      const XML_Char * delim = T("/");
-      const XML_Char *file = useStdin ? T("STDIN") : argv[i];
-      if (!useStdin) {
-        /* Jump after last (back)slash */
-        const XML_Char * lastDelim = tcsrchr(file, delim[0]);
-        if (lastDelim)
-          file = lastDelim + 1;
-#if defined(_WIN32)
-        else {
-          const XML_Char * winDelim = T("\\");
-          lastDelim = tcsrchr(file, winDelim[0]);
-          if (lastDelim) {
-            file = lastDelim + 1;
-            delim = winDelim;
-          }
-        }
-#endif
-      }
-      outName = (XML_Char *)malloc((tcslen(outputDir) + tcslen(file) + 2)
-                       * sizeof(XML_Char));
-      tcscpy(outName, outputDir);
-      tcscat(outName, delim);
-      tcscat(outName, file);
-      userData.fp = tfopen(outName, T("wb"));
-      if (!userData.fp) {
-        tperror(outName);
-        exit(1);
-      }
-      setvbuf(userData.fp, NULL, _IOFBF, 16384);
-#ifdef XML_UNICODE
-      puttc(0xFEFF, userData.fp);
-#endif
-      XML_SetUserData(parser, &userData);
-      switch (outputType) {
-      case 'm':
-        XML_UseParserAsHandlerArg(parser);
-        XML_SetElementHandler(parser, metaStartElement, metaEndElement);
-        XML_SetProcessingInstructionHandler(parser, metaProcessingInstruction);
-        XML_SetCommentHandler(parser, metaComment);
-        XML_SetCdataSectionHandler(parser, metaStartCdataSection,
-                                   metaEndCdataSection);
-        XML_SetCharacterDataHandler(parser, metaCharacterData);
-        XML_SetDoctypeDeclHandler(parser, metaStartDoctypeDecl,
-                                  metaEndDoctypeDecl);
-        XML_SetEntityDeclHandler(parser, metaEntityDecl);
-        XML_SetNotationDeclHandler(parser, metaNotationDecl);
-        XML_SetNamespaceDeclHandler(parser, metaStartNamespaceDecl,
-                                    metaEndNamespaceDecl);
-        metaStartDocument(parser);
-        break;
-      case 'c':
-        XML_UseParserAsHandlerArg(parser);
-        XML_SetDefaultHandler(parser, markup);
-        XML_SetElementHandler(parser, defaultStartElement, defaultEndElement);
-        XML_SetCharacterDataHandler(parser, defaultCharacterData);
-        XML_SetProcessingInstructionHandler(parser,
-                                            defaultProcessingInstruction);
-        break;
-      default:
-        if (useNamespaces)
-          XML_SetElementHandler(parser, startElementNS, endElementNS);
-        else
-          XML_SetElementHandler(parser, startElement, endElement);
-        XML_SetCharacterDataHandler(parser, characterData);
-#ifndef W3C14N
-        XML_SetProcessingInstructionHandler(parser, processingInstruction);
-        if (requiresNotations) {
-          XML_SetDoctypeDeclHandler(parser, startDoctypeDecl, endDoctypeDecl);
-          XML_SetNotationDeclHandler(parser, notationDecl);
-        }
-#endif /* not W3C14N */
-        break;
-      }
-    }
-    if (windowsCodePages)
-      XML_SetUnknownEncodingHandler(parser, unknownEncoding, 0);
-    result = XML_ProcessFile(parser, useStdin ? NULL : argv[i], processFlags);
-    if (outputDir) {
-      if (outputType == 'm')
-        metaEndDocument(parser);
-      fclose(userData.fp);
-      if (!result) {
-        tremove(outName);
-        exit(2);
-      }
-      free(outName);
-    }
-    XML_ParserFree(parser);
+#ifdef HAVE_FORK
+  if (nWorkers > 1 && processFilesInParallel(&options, &files, nWorkers)) {
+    free(files.line);
+    return 0;
   }
+#endif
+  processFiles(&options, &files);
+  free(files.line);
   return 0;
 }